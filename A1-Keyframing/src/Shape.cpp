@@ -1,9 +1,12 @@
 #include "Shape.h"
 #include <algorithm>
 #include <iostream>
+#include <unordered_map>
+#include <cstdint>
 
 #include "GLSL.h"
 #include "Program.h"
+#include "MeshOptimizer.h"
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -16,7 +19,9 @@ using namespace std;
 Shape::Shape() :
 	posBufID(0),
 	norBufID(0),
-	texBufID(0)
+	texBufID(0),
+	eleBufID(0),
+	eleType(GL_UNSIGNED_INT)
 {
 }
 
@@ -24,6 +29,25 @@ Shape::~Shape()
 {
 }
 
+// One vertex per distinct (position, normal, texcoord) index triple. Keys
+// are compared whole, so no index range is too large to weld.
+struct WeldKey
+{
+	int v, n, t;
+	bool operator==(const WeldKey &o) const { return v == o.v && n == o.n && t == o.t; }
+};
+
+struct WeldKeyHash
+{
+	size_t operator()(const WeldKey &k) const
+	{
+		uint64_t h = (uint32_t)k.v * 0x9E3779B97F4A7C15ull;
+		h ^= (uint32_t)k.n + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+		h ^= (uint32_t)k.t + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+		return (size_t)h;
+	}
+};
+
 void Shape::loadMesh(const string &meshName)
 {
 	// Load geometry
@@ -37,36 +61,53 @@ void Shape::loadMesh(const string &meshName)
 	} else {
 		// Some OBJ files have different indices for vertex positions, normals,
 		// and texture coordinates. For example, a cube corner vertex may have
-		// three different normals. Here, we are going to duplicate all such
-		// vertices.
+		// three different normals. Each distinct (position, normal, texcoord)
+		// index triple becomes one vertex, so corners shared by several faces
+		// are stored once.
+		unordered_map<WeldKey, unsigned int, WeldKeyHash> welded;
+		size_t corners = 0;
+		for(const auto &shape : shapes) {
+			corners += shape.mesh.indices.size();
+		}
+		welded.reserve(corners);
+		eleBuf.reserve(corners);
 		// Loop over shapes
 		for(size_t s = 0; s < shapes.size(); s++) {
-			// Loop over faces (polygons)
-			size_t index_offset = 0;
-			for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-				size_t fv = shapes[s].mesh.num_face_vertices[f];
-				// Loop over vertices in the face.
-				for(size_t v = 0; v < fv; v++) {
-					// access to vertex
-					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
-					posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
-					if(!attrib.normals.empty()) {
-						norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
-						norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
-						norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
-					}
-					if(!attrib.texcoords.empty()) {
-						texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
-						texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+1]);
-					}
+			// Faces are triangulated by the loader, so every 3 corners are a
+			// triangle
+			for(const tinyobj::index_t &idx : shapes[s].mesh.indices) {
+				WeldKey key = {idx.vertex_index, idx.normal_index, idx.texcoord_index};
+				auto it = welded.find(key);
+				if(it != welded.end()) {
+					eleBuf.push_back(it->second);
+					continue;
+				}
+				unsigned int v = (unsigned int)(posBuf.size() / 3);
+				welded[key] = v;
+				eleBuf.push_back(v);
+				posBuf.push_back(attrib.vertices[3*idx.vertex_index+0]);
+				posBuf.push_back(attrib.vertices[3*idx.vertex_index+1]);
+				posBuf.push_back(attrib.vertices[3*idx.vertex_index+2]);
+				if(!attrib.normals.empty()) {
+					norBuf.push_back(attrib.normals[3*idx.normal_index+0]);
+					norBuf.push_back(attrib.normals[3*idx.normal_index+1]);
+					norBuf.push_back(attrib.normals[3*idx.normal_index+2]);
+				}
+				if(!attrib.texcoords.empty()) {
+					texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
+					texBuf.push_back(attrib.texcoords[2*idx.texcoord_index+1]);
 				}
-				index_offset += fv;
-				// per-face material (IGNORE)
-				//shapes[s].mesh.material_ids[f];
 			}
 		}
+		cout << meshName << ": " << corners << " corners welded to " << posBuf.size() / 3 << " vertices" << endl;
+
+		// Triangles in vertex cache order, vertices in the order they are
+		// first drawn
+		vector<unsigned int> remap;
+		optimizeMesh(meshName, eleBuf, posBuf, remap);
+		remapVertices(posBuf, remap, 3);
+		remapVertices(norBuf, remap, 3);
+		remapVertices(texBuf, remap, 2);
 	}
 }
 
@@ -118,8 +159,21 @@ void Shape::init()
 		glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
 	}
 	
+	// Send the index array to the GPU, in 16 bits if every index fits
+	glGenBuffers(1, &eleBufID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	if(posBuf.size() / 3 <= 0xFFFF) {
+		vector<unsigned short> ele16(eleBuf.begin(), eleBuf.end());
+		eleType = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ele16.size()*sizeof(unsigned short), ele16.data(), GL_STATIC_DRAW);
+	} else {
+		eleType = GL_UNSIGNED_INT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, eleBuf.size()*sizeof(unsigned int), eleBuf.data(), GL_STATIC_DRAW);
+	}
+	
 	// Unbind the arrays
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
@@ -149,8 +203,9 @@ void Shape::draw(const shared_ptr<Program> prog) const
 	}
 	
 	// Draw
-	int count = (int)posBuf.size()/3; // number of indices to be rendered
-	glDrawArrays(GL_TRIANGLES, 0, count);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	glDrawElements(GL_TRIANGLES, (GLsizei)eleBuf.size(), eleType, (const void *)0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 	
 	// Disable and unbind
 	if(h_tex != -1) {
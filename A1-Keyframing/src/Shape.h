@@ -9,11 +9,15 @@
 class Program;
 
 /**
- * A shape defined by a list of triangles
- * - posBuf should be of length 3*ntris
- * - norBuf should be of length 3*ntris (if normals are available)
- * - texBuf should be of length 2*ntris (if texture coords are available)
- * posBufID, norBufID, and texBufID are OpenGL buffer identifiers.
+ * An indexed triangle mesh
+ * - posBuf is of length 3*nverts
+ * - norBuf is of length 3*nverts (if normals are available)
+ * - texBuf is of length 2*nverts (if texture coords are available)
+ * - eleBuf holds 3 vertex indices per triangle
+ * Face corners with the same position, normal and texcoord are welded into
+ * one vertex when loading. The indices go to the GPU as 16-bit values when
+ * there are few enough vertices, 32-bit otherwise.
+ * posBufID, norBufID, texBufID, and eleBufID are OpenGL buffer identifiers.
  */
 class Shape
 {
@@ -29,9 +33,12 @@ private:
 	std::vector<float> posBuf;
 	std::vector<float> norBuf;
 	std::vector<float> texBuf;
+	std::vector<unsigned int> eleBuf;
 	unsigned posBufID;
 	unsigned norBufID;
 	unsigned texBufID;
+	unsigned eleBufID;
+	unsigned eleType; // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
 };
 
 #endif
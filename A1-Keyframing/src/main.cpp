@@ -16,6 +16,7 @@
 #include "Program.h"
 #include "MatrixStack.h"
 #include "Shape.h"
+#include "Profiler.h"
 
 #include "HelicopterKeyframe.h"
 #include "SplineMatrix.h"
@@ -60,6 +61,10 @@ vector<pair<float,float> > usTable;
 float smax;
 float tmax = 5.0f;
 
+// Stage timings ('t'), written to profile.csv while on
+shared_ptr<Profiler> profiler;
+int stageSpline, stageDraw, stageCurves;
+
 void initControlPoints(){
 	// First control point must be (0,0,0)
 	cps.push_back(glm::vec3(0,0,0));
@@ -171,6 +176,17 @@ static void key_callback(GLFWwindow *window, int key, int scancode, int action,
 static void char_callback(GLFWwindow *window, unsigned int key)
 {
 	keyPresses[key]++;
+	if(key == 't') {
+		// Unthrottled while timing
+		bool on = keyPresses[key] % 2;
+		glfwSwapInterval(on ? 0 : 1);
+		profiler->setEnabled(on);
+		if(on) {
+			profiler->openCSV("profile.csv");
+		} else {
+			profiler->closeCSV();
+		}
+	}
 }
 
 static void cursor_position_callback(GLFWwindow* window, double xmouse, double ymouse)
@@ -225,6 +241,12 @@ static void init()
 	
 	camera = make_shared<Camera>();
 
+	profiler = make_shared<Profiler>();
+	stageSpline = profiler->addStage("spline");
+	stageDraw = profiler->addStage("draw", true);
+	stageCurves = profiler->addStage("curves", true);
+	profiler->setGPUTiming(true);
+
 	// Load and initialize the necessary helicopter meshes
 	std::shared_ptr<Shape> body0;
 	std::shared_ptr<Shape> body1;
@@ -281,45 +303,9 @@ static void init()
 
 float maxValForT = 0.0f;
 
-void render()
+// Position and orientation of the interpolated helicopter at time t
+static glm::mat4 interpolateHelicopter(double t)
 {
-	// Update time.
-	double t = glfwGetTime();
-	
-	// Get current frame buffer size.
-	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
-	glViewport(0, 0, width, height);
-	
-	// Use the window size for camera.
-	glfwGetWindowSize(window, &width, &height);
-	camera->setAspect((float)width/(float)height);
-	
-	// Clear buffers
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	if(keyPresses[(unsigned)'c'] % 2) {
-		glEnable(GL_CULL_FACE);
-	} else {
-		glDisable(GL_CULL_FACE);
-	}
-	if(keyPresses[(unsigned)'z'] % 2) {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-	} else {
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}
-	
-	auto P = make_shared<MatrixStack>();
-	auto MV = make_shared<MatrixStack>();
-	
-	// Apply camera transforms
-	P->pushMatrix();
-	camera->applyProjectionMatrix(P);
-	MV->pushMatrix();
-
-	camera->applyViewMatrix(MV);
-
-	prog->bind();
-
 	float u = 0.0f;
 	float k = 0.0f;
 
@@ -401,27 +387,79 @@ void render()
 
 	E[3] = glm::vec4(pos, 1.0f); // Puts the position into the last column
 
+	return E;
+}
+
+void render()
+{
+	// Update time.
+	double t = glfwGetTime();
+	
+	// Get current frame buffer size.
+	int width, height;
+	glfwGetFramebufferSize(window, &width, &height);
+	glViewport(0, 0, width, height);
+	
+	// Use the window size for camera.
+	glfwGetWindowSize(window, &width, &height);
+	camera->setAspect((float)width/(float)height);
+	
+	// Clear buffers
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	if(keyPresses[(unsigned)'c'] % 2) {
+		glEnable(GL_CULL_FACE);
+	} else {
+		glDisable(GL_CULL_FACE);
+	}
+	if(keyPresses[(unsigned)'z'] % 2) {
+		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	} else {
+		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	}
+	
+	auto P = make_shared<MatrixStack>();
+	auto MV = make_shared<MatrixStack>();
+	
+	// Apply camera transforms
+	P->pushMatrix();
+	camera->applyProjectionMatrix(P);
+	MV->pushMatrix();
+
+	camera->applyViewMatrix(MV);
+
+	prog->bind();
+
+	glm::mat4 E;
+	{
+		ProfileScope scope(profiler.get(), stageSpline);
+		E = interpolateHelicopter(t);
+	}
+	glm::mat4 B = getSplineMatrix(splineMatrices, type);
+
 	if (helicopterCam){
 		MV->rotate(-M_PI/2.0f, 0, 1, 0);
 		MV->multMatrix(glm ::inverse(E));
 	}
 
-	// Draw the keyframed helicopters
-	if (showKeyframes){
-		for (int i = 0; i < helicopterVec.size(); i++){
-			helicopterVec.at(i)->drawHelicopter(prog, P, MV, helicopterMeshes, t);
+	{
+		ProfileScope scope(profiler.get(), stageDraw);
+		// Draw the keyframed helicopters
+		if (showKeyframes){
+			for (int i = 0; i < helicopterVec.size(); i++){
+				helicopterVec.at(i)->drawHelicopter(prog, P, MV, helicopterMeshes, t);
+			}
 		}
-	}
 
-	// Draw the interpolated helicopter
-	MV->pushMatrix();
+		// Draw the interpolated helicopter
+		MV->pushMatrix();
 
-		MV->multMatrix(E);
+			MV->multMatrix(E);
 
-		glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		interpolatedHelicopter->drawHelicopter(prog, P, MV, helicopterMeshes, t);
-	MV->popMatrix();
+			glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+			glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+			interpolatedHelicopter->drawHelicopter(prog, P, MV, helicopterMeshes, t);
+		MV->popMatrix();
+	}
 
 	glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
 	glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
@@ -476,56 +514,59 @@ void render()
 	}
 	glEnd();
 
-	// Draw the spline curves
-	if (showKeyframes){
-
-		for (int i = 0; i < cps.size(); i++){
-
-			glm::mat4 G(0);
-			G[0] = glm::vec4(cps[(0 + i) % cps.size()], 1.0f);
-			G[1] = glm::vec4(cps[(1 + i) % cps.size()], 1.0f);
-			G[2] = glm::vec4(cps[(2 + i) % cps.size()], 1.0f);
-			G[3] = glm::vec4(cps[(3 + i) % cps.size()], 1.0f);
-
-			glLineWidth(1.0f);
-			glBegin(GL_LINE_STRIP);
-			for (float u = 0; u < 1; u = u + 0.005){
-				glm::vec4 uVec(1, u, u * u, u * u * u);
-				// Compute position at u
-				glm::vec4 pos = G * B * uVec;
-				glColor3f(0.3f, 0.8f, 0.3f);
-				glVertex3f(pos.x, pos.y, pos.z);
-			}
+	{
+		ProfileScope scope(profiler.get(), stageCurves);
+		// Draw the spline curves
+		if (showKeyframes){
+
+			for (int i = 0; i < cps.size(); i++){
+
+				glm::mat4 G(0);
+				G[0] = glm::vec4(cps[(0 + i) % cps.size()], 1.0f);
+				G[1] = glm::vec4(cps[(1 + i) % cps.size()], 1.0f);
+				G[2] = glm::vec4(cps[(2 + i) % cps.size()], 1.0f);
+				G[3] = glm::vec4(cps[(3 + i) % cps.size()], 1.0f);
+
+				glLineWidth(1.0f);
+				glBegin(GL_LINE_STRIP);
+				for (float u = 0; u < 1; u = u + 0.005){
+					glm::vec4 uVec(1, u, u * u, u * u * u);
+					// Compute position at u
+					glm::vec4 pos = G * B * uVec;
+					glColor3f(0.3f, 0.8f, 0.3f);
+					glVertex3f(pos.x, pos.y, pos.z);
+				}
 
-			glEnd();
-		}
+				glEnd();
+			}
 
-		// Draw the equidistant points along the spline curve
-		if(!usTable.empty()) {
-			float ds = 1.5f;
-			glPointSize(5.0f);
-			glBegin(GL_POINTS);
-			float smax = usTable.back().second; // spline length
-			for(float s = 0.0f; s < smax; s += ds) {
-				// Convert from s to (concatenated) u
-				float uu = s2u(s);
-				// Convert from concatenated u to the usual u between 0 and 1.
-				float kfloat;
-				float u = std::modf(uu, &kfloat);
-				// k is the index of the starting control point
-				int k = (int)std::floor(kfloat);
-				// Compute spline point at u
-				glm::mat4 Gk;
-				for(int i = 0; i < 4; ++i) {
-					Gk[i] = glm::vec4(cps[(k+i) % cps.size()], 0.0f);
+			// Draw the equidistant points along the spline curve
+			if(!usTable.empty()) {
+				float ds = 1.5f;
+				glPointSize(5.0f);
+				glBegin(GL_POINTS);
+				float smax = usTable.back().second; // spline length
+				for(float s = 0.0f; s < smax; s += ds) {
+					// Convert from s to (concatenated) u
+					float uu = s2u(s);
+					// Convert from concatenated u to the usual u between 0 and 1.
+					float kfloat;
+					float u = std::modf(uu, &kfloat);
+					// k is the index of the starting control point
+					int k = (int)std::floor(kfloat);
+					// Compute spline point at u
+					glm::mat4 Gk;
+					for(int i = 0; i < 4; ++i) {
+						Gk[i] = glm::vec4(cps[(k+i) % cps.size()], 0.0f);
+					}
+					glm::vec4 uVec(1.0f, u, u*u, u*u*u);
+					glm::vec3 P(Gk * (B * uVec));
+
+					glColor3f(1.0f, 0.0f, 0.0f);
+					glVertex3fv(&P[0]);
 				}
-				glm::vec4 uVec(1.0f, u, u*u, u*u*u);
-				glm::vec3 P(Gk * (B * uVec));
-
-				glColor3f(1.0f, 0.0f, 0.0f);
-				glVertex3fv(&P[0]);
+				glEnd();
 			}
-			glEnd();
 		}
 	}
 	
@@ -539,6 +580,8 @@ void render()
 	// Pop stacks
 	MV->popMatrix();
 	P->popMatrix();
+
+	profiler->draw(width, height);
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
@@ -593,6 +636,10 @@ int main(int argc, char **argv)
 			render();
 			// Swap front and back buffers.
 			glfwSwapBuffers(window);
+			profiler->endFrame();
+			if(profiler->isEnabled() && profiler->getFrameCount() > 0 && profiler->getFrameCount() % Profiler::HISTORY == 0) {
+				profiler->print(cout);
+			}
 		}
 		// Poll for and process events.
 		glfwPollEvents();
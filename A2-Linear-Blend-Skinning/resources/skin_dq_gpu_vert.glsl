@@ -0,0 +1,53 @@
+#version 120
+
+// Dual quaternion skinning on the GPU. Up to 4 influences per vertex; each
+// palette entry holds the bone's real part in column 0 and its dual part in
+// column 1 (column 2 is unused padding shared with the CPU layout).
+const int MAX_BONES = 64;
+
+attribute vec4 aPos;
+attribute vec3 aNor;
+attribute vec2 aTex;
+attribute vec4 aBoneInd;
+attribute vec4 aWeight;
+
+uniform mat4 P;
+uniform mat4 MV;
+uniform mat3 T;
+uniform mat3x4 bonesDQ[MAX_BONES];
+
+varying vec3 vPos;
+varying vec3 vNor;
+varying vec2 vTex;
+
+// Adds one influence, flipped onto the first influence's hemisphere
+void blend(float w, float ind, vec4 first, inout vec4 r, inout vec4 d)
+{
+	mat3x4 b = bonesDQ[int(ind)];
+	w = dot(b[0], first) < 0.0 ? -w : w;
+	r += w * b[0];
+	d += w * b[1];
+}
+
+void main()
+{
+	vec4 first = bonesDQ[int(aBoneInd.x)][0];
+	vec4 r = vec4(0.0);
+	vec4 d = vec4(0.0);
+	blend(aWeight.x, aBoneInd.x, first, r, d);
+	blend(aWeight.y, aBoneInd.y, first, r, d);
+	blend(aWeight.z, aBoneInd.z, first, r, d);
+	blend(aWeight.w, aBoneInd.w, first, r, d);
+	float len = length(r);
+	r /= len;
+	d /= len;
+	vec3 t = 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
+	vec3 pos = aPos.xyz + 2.0 * cross(r.xyz, cross(r.xyz, aPos.xyz) + r.w * aPos.xyz) + t;
+	vec3 nor = aNor + 2.0 * cross(r.xyz, cross(r.xyz, aNor) + r.w * aNor);
+	vec4 posCam = MV * vec4(pos, 1.0);
+	vec3 norCam = (MV * vec4(nor, 0.0)).xyz;
+	gl_Position = P * posCam;
+	vPos = posCam.xyz;
+	vNor = norCam;
+	vTex = vec2(T * vec3(aTex, 1.0));
+}
@@ -0,0 +1,34 @@
+#version 120
+
+// Linear blend skinning on the GPU. Up to 4 influences per vertex; the
+// palette holds bones[j] = M_j(k) * inverse(M_j(0)) for the current frame.
+const int MAX_BONES = 64;
+
+attribute vec4 aPos;
+attribute vec3 aNor;
+attribute vec2 aTex;
+attribute vec4 aBoneInd;
+attribute vec4 aWeight;
+
+uniform mat4 P;
+uniform mat4 MV;
+uniform mat3 T;
+uniform mat4 bones[MAX_BONES];
+
+varying vec3 vPos;
+varying vec3 vNor;
+varying vec2 vTex;
+
+void main()
+{
+	mat4 M = aWeight.x * bones[int(aBoneInd.x)]
+	       + aWeight.y * bones[int(aBoneInd.y)]
+	       + aWeight.z * bones[int(aBoneInd.z)]
+	       + aWeight.w * bones[int(aBoneInd.w)];
+	vec4 posCam = MV * (M * aPos);
+	vec3 norCam = (MV * (M * vec4(aNor, 0.0))).xyz;
+	gl_Position = P * posCam;
+	vPos = posCam.xyz;
+	vNor = norCam;
+	vTex = vec2(T * vec3(aTex, 1.0));
+}
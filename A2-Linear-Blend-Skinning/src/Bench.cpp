@@ -0,0 +1,990 @@
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include <memory>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <thread>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Bench.h"
+#include "ShapeSkin.h"
+#include "JobPool.h"
+#include "Parsers.hpp"
+#include "CompressedClip.h"
+#include "PoseSampler.h"
+#include "Skeleton.h"
+#include "BlendTree.h"
+#include "Profiler.h"
+#include "MeshOptimizer.h"
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double elapsedMs(Clock::time_point t0)
+{
+	return chrono::duration<double, milli>(Clock::now() - t0).count();
+}
+
+static shared_ptr<ShapeSkin> loadBenchShape(const vector< vector<string> > &meshData, bool optimizeOrder = true)
+{
+	if(meshData.empty()) {
+		cerr << "No MESH in input.txt" << endl;
+		return nullptr;
+	}
+	auto shape = make_shared<ShapeSkin>();
+	shape->setOptimizeOrder(optimizeOrder);
+	shape->loadMesh(DATA_DIR + meshData[0][0]);
+	shape->loadAttachment(DATA_DIR + meshData[0][1]);
+	// Throughput benchmarks time the whole mesh; benchDirty turns this back on
+	shape->setIncremental(false);
+	return shape;
+}
+
+// The skinning loop as it was before the palette: a lazily-filled cache of
+// maxInfluences * vertCount matrices per frame, each holding its own
+// inverse(bindPose), with a mat4 compare against zero to detect a hit.
+class LegacySkinner
+{
+public:
+	LegacySkinner(ShapeSkin &shape) : shape(shape) {}
+
+	void skin(int k)
+	{
+		size_t maxInf = shape.getMaxInfluences();
+		size_t vertCount = shape.getVertCount();
+		if(cache.empty()) {
+			cache.resize(allFrames.size());
+			for(auto &c : cache) {
+				c = vector<glm::mat4>(maxInf * vertCount, glm::mat4(0));
+			}
+		}
+		for(int i = 0; i < (int)vertCount; i++) {
+			glm::vec3 initialPos = shape.getInitialPos(i);
+			glm::vec3 initialNor = shape.getInitialNor(i);
+			vector<pair<unsigned int, float> > inf = shape.getBoneInfluences(i);
+			glm::vec3 newPos(0.0f);
+			glm::vec3 newNor(0.0f);
+			for(int j = 0; j < (int)inf.size(); j++) {
+				int boneID = inf.at(j).first;
+				float w = inf.at(j).second;
+				if(w == 0) {
+					continue;
+				}
+				glm::mat4 M;
+				if(cache.at(k).at(maxInf * i + j) != glm::mat4(0)) {
+					M = cache.at(k).at(maxInf * i + j);
+				} else {
+					M = allFrames.at(k).bonePlacements.at(boneID).quatMat * glm::inverse(bindPose.bonePlacements.at(boneID).quatMat);
+					cache.at(k).at(maxInf * i + j) = M;
+				}
+				newPos = newPos + w * glm::vec3(M * glm::vec4(initialPos, 1.0f));
+				newNor = newNor + w * glm::vec3(M * glm::vec4(initialNor, 0.0f));
+			}
+			shape.updatePos(i, newPos);
+			shape.updateNor(i, newNor);
+		}
+	}
+
+private:
+	ShapeSkin &shape;
+	vector< vector<glm::mat4> > cache;
+};
+
+// Per-frame CPU skinning time, legacy per-vertex matrix cache vs. palette.
+static void benchSkin(const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return;
+	}
+	int frameCount = (int)allFrames.size();
+	const int passes = 10;
+
+	LegacySkinner legacy(*shape);
+	// The first pass fills the legacy cache, which is how the app behaved too.
+	auto t0 = Clock::now();
+	for(int k = 0; k < frameCount; k++) {
+		legacy.skin(k);
+	}
+	double legacyColdMs = elapsedMs(t0) / frameCount;
+	t0 = Clock::now();
+	for(int p = 0; p < passes; p++) {
+		for(int k = 0; k < frameCount; k++) {
+			legacy.skin(k);
+		}
+	}
+	double legacyMs = elapsedMs(t0) / (passes * frameCount);
+
+	t0 = Clock::now();
+	for(int p = 0; p < passes; p++) {
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(allFrames[k]);
+			shape->skinReference();
+		}
+	}
+	double paletteMs = elapsedMs(t0) / (passes * frameCount);
+
+	t0 = Clock::now();
+	for(int p = 0; p < passes; p++) {
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(allFrames[k]);
+			shape->skin();
+		}
+	}
+	double kernelMs = elapsedMs(t0) / (passes * frameCount);
+
+	size_t legacyBytes = shape->getMaxInfluences() * shape->getVertCount() * sizeof(glm::mat4);
+	size_t paletteBytes = shape->getPalette().size() * sizeof(glm::mat4);
+	cout << "verts " << shape->getVertCount() << ", bones " << shape->getBoneCount() << ", frames " << frameCount << endl;
+	cout << "legacy cache : " << legacyColdMs << " ms/frame (first pass), " << legacyMs << " ms/frame, " << legacyBytes / 1024.0 << " KB/frame" << endl;
+	cout << "palette      : " << paletteMs << " ms/frame, " << paletteBytes / 1024.0 << " KB/frame" << endl;
+	cout << "palette SoA  : " << kernelMs << " ms/frame (" << SkinKernel::getISAName(shape->getSkinISA()) << ")" << endl;
+}
+
+// SoA kernel at each instruction set the CPU supports, checked against the
+// per-vertex glm loop. The optional argument is the allowed max abs error.
+static bool benchSimd(const vector<string> &args, const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return false;
+	}
+	float tolerance = args.empty() ? 1e-3f : stof(args[0]);
+	int frameCount = (int)allFrames.size();
+	const int passes = 20;
+
+	// Reference results for every frame
+	vector< vector<float> > refPos(frameCount), refNor(frameCount);
+	auto t0 = Clock::now();
+	for(int k = 0; k < frameCount; k++) {
+		shape->buildPalette(allFrames[k]);
+		shape->skinReference();
+		refPos[k] = shape->getPosBuf();
+		refNor[k] = shape->getNorBuf();
+	}
+	double refMs = elapsedMs(t0) / frameCount;
+	cout << "reference : " << refMs << " ms/frame" << endl;
+
+	bool ok = true;
+	SkinKernel::ISA best = SkinKernel::detectISA();
+	for(int i = SkinKernel::SCALAR; i <= best; i++) {
+		SkinKernel::ISA isa = (SkinKernel::ISA)i;
+		shape->setSkinISA(isa);
+		float maxErr = 0.0f;
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(allFrames[k]);
+			shape->skin();
+			const vector<float> &pos = shape->getPosBuf();
+			const vector<float> &nor = shape->getNorBuf();
+			for(size_t v = 0; v < pos.size(); v++) {
+				maxErr = max(maxErr, fabs(pos[v] - refPos[k][v]));
+				maxErr = max(maxErr, fabs(nor[v] - refNor[k][v]));
+			}
+		}
+		t0 = Clock::now();
+		for(int p = 0; p < passes; p++) {
+			for(int k = 0; k < frameCount; k++) {
+				shape->buildPalette(allFrames[k]);
+				shape->skin();
+			}
+		}
+		double ms = elapsedMs(t0) / (passes * frameCount);
+		bool pass = maxErr <= tolerance;
+		ok = ok && pass;
+		cout << SkinKernel::getISAName(isa) << " : " << ms << " ms/frame, " << refMs / ms << "x, max error " << maxErr << (pass ? " (ok)" : " (FAILED)") << endl;
+	}
+	shape->setSkinISA(best);
+	return ok;
+}
+
+// Influence storage and skinning time, every vertex padded to the mesh's
+// max influence count (one bucket) vs. the shape's own CSR buckets.
+static bool benchSparse(const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return false;
+	}
+	size_t vertCount = shape->getVertCount();
+	size_t maxInf = shape->getMaxInfluences();
+	int frameCount = (int)allFrames.size();
+	const int passes = 20;
+
+	// The padded layout as a CSR with a fixed stride; zero weights on bone 0
+	vector<float> pos(3 * vertCount), nor(3 * vertCount);
+	vector<unsigned int> start(vertCount + 1), bones(vertCount * maxInf, 0);
+	vector<float> weights(vertCount * maxInf, 0.0f);
+	vector<size_t> histogram(maxInf + 1, 0);
+	for(size_t i = 0; i < vertCount; i++) {
+		glm::vec3 p = shape->getInitialPos((int)i);
+		glm::vec3 n = shape->getInitialNor((int)i);
+		for(int c = 0; c < 3; c++) {
+			pos[3 * i + c] = p[c];
+			nor[3 * i + c] = n[c];
+		}
+		vector<pair<unsigned int, float> > inf = shape->getBoneInfluences((int)i);
+		histogram[min(inf.size(), maxInf)]++;
+		start[i] = (unsigned int)(i * maxInf);
+		for(size_t j = 0; j < inf.size() && j < maxInf; j++) {
+			bones[i * maxInf + j] = inf[j].first;
+			weights[i * maxInf + j] = inf[j].second;
+		}
+	}
+	start[vertCount] = (unsigned int)(vertCount * maxInf);
+	SkinKernel padded;
+	padded.setup(&pos[0], &nor[0], &start[0], &bones[0], &weights[0], vertCount);
+	const SkinKernel &sparse = shape->getKernel();
+
+	cout << "verts " << vertCount << ", max influences " << maxInf << ", influences per vertex:";
+	for(size_t n = 1; n <= maxInf; n++) {
+		cout << " " << n << "x" << histogram[n];
+	}
+	cout << endl;
+	// The shape's CPU copy (was vertCount * maxInf pairs) plus the kernel's
+	size_t paddedBytes = vertCount * maxInf * (sizeof(unsigned int) + sizeof(float)) + padded.getInfluenceBytes();
+	size_t sparseBytes = (vertCount + 1) * sizeof(unsigned int) + shape->getInfluenceCount() * (sizeof(unsigned int) + sizeof(float)) + sparse.getInfluenceBytes();
+	cout << "padded : " << paddedBytes / 1024.0 << " KB influences, 1 bucket, " << padded.getSlotCount() << " slots" << endl;
+	cout << "sparse : " << sparseBytes / 1024.0 << " KB influences, " << sparse.getBucketCount() << " buckets, " << sparse.getSlotCount() << " slots, "
+		<< 100.0 * (1.0 - (double)sparseBytes / paddedBytes) << "% saved" << endl;
+
+	bool ok = true;
+	vector<float> palette(12 * shape->getBoneCount());
+	vector<float> paddedPos(3 * vertCount), paddedNor(3 * vertCount), sparsePos(3 * vertCount), sparseNor(3 * vertCount);
+	SkinKernel::ISA best = SkinKernel::detectISA();
+	for(int i = SkinKernel::SCALAR; i <= best; i++) {
+		SkinKernel::ISA isa = (SkinKernel::ISA)i;
+		padded.setISA(isa);
+		shape->setSkinISA(isa);
+		double ms[2] = {0.0, 0.0};
+		float maxErr = 0.0f;
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(allFrames[k]);
+			const vector<glm::mat4> &M = shape->getPalette();
+			for(size_t b = 0; b < M.size(); b++) {
+				for(int r = 0; r < 3; r++) {
+					for(int c = 0; c < 4; c++) {
+						palette[12 * b + 4 * r + c] = M[b][c][r];
+					}
+				}
+			}
+			auto t0 = Clock::now();
+			for(int p = 0; p < passes; p++) {
+				padded.skin(&palette[0], &paddedPos[0], &paddedNor[0]);
+			}
+			ms[0] += elapsedMs(t0);
+			t0 = Clock::now();
+			for(int p = 0; p < passes; p++) {
+				sparse.skin(&palette[0], &sparsePos[0], &sparseNor[0]);
+			}
+			ms[1] += elapsedMs(t0);
+			for(size_t v = 0; v < sparsePos.size(); v++) {
+				maxErr = max(maxErr, fabs(sparsePos[v] - paddedPos[v]));
+				maxErr = max(maxErr, fabs(sparseNor[v] - paddedNor[v]));
+			}
+		}
+		ms[0] /= passes * frameCount;
+		ms[1] /= passes * frameCount;
+		bool pass = maxErr <= 1e-4f;
+		ok = ok && pass;
+		cout << SkinKernel::getISAName(isa) << " : padded " << ms[0] << " ms/frame, sparse " << ms[1] << " ms/frame, " << ms[0] / ms[1]
+			<< "x, max difference " << maxErr << (pass ? " (ok)" : " (FAILED)") << endl;
+	}
+	shape->setSkinISA(best);
+	return ok;
+}
+
+// Dirty-bone tracking on three versions of the clip: everything moving,
+// only one joint's subtree moving (the rest held at the first frame), and
+// nothing moving. Reports vertices skinned and bytes upload() would send
+// per frame, and the time against full re-skinning. The optional argument
+// is the moving joint.
+static bool benchDirty(const vector<string> &args, const vector< vector<string> > &meshData, const string &skeletonData)
+{
+	auto shape = loadBenchShape(meshData);
+	auto full = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return false;
+	}
+	string prefix = skeletonData.substr(0, skeletonData.rfind("_skel"));
+	string joint = args.empty() ? "mixamorig:RightForeArm" : args[0];
+	Skeleton skeleton;
+	vector<Pose> local;
+	Pose bind;
+	if(!skeleton.load(DATA_DIR + prefix, local, bind) || local.empty()) {
+		return false;
+	}
+	int moving = skeleton.findJoint(joint);
+	if(moving < 0) {
+		cout << "No joint " << joint << endl;
+		return false;
+	}
+	vector<float> mask;
+	skeleton.getSubtreeMask(moving, mask);
+
+	int frameCount = (int)local.size();
+	const int passes = 10;
+	const char *names[] = {"all moving", "subtree", "static"};
+	vector<Frame> clips[3];
+	for(int c = 0; c < 3; c++) {
+		clips[c].assign(frameCount, Frame(0));
+		Pose pose = local[0];
+		for(int k = 0; k < frameCount; k++) {
+			for(size_t i = 0; i < pose.size(); i++) {
+				bool moves = (c == 0) || (c == 1 && mask[i] > 0.0f);
+				pose.rot[i] = local[moves ? k : 0].rot[i];
+				pose.pos[i] = local[moves ? k : 0].pos[i];
+			}
+			skeleton.computeWorld(pose, clips[c][k]);
+		}
+	}
+
+	size_t vertCount = shape->getVertCount();
+	cout << "verts " << vertCount << ", frames " << frameCount << ", moving joint " << joint << endl;
+	bool ok = true;
+	for(int c = 0; c < 3; c++) {
+		// Vertices and bytes per frame, and the result after every frame
+		// against a full re-skin. The first frame is always a full one.
+		shape->setIncremental(true);
+		size_t skinned = 0, bytes = 0, ranges = 0;
+		float maxErr = 0.0f;
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(clips[c][k]);
+			shape->skin();
+			full->buildPalette(clips[c][k]);
+			full->skin();
+			size_t b = shape->collectUploadRanges();
+			if(k > 0) {
+				skinned += shape->getSkinnedVertCount();
+				bytes += b;
+				ranges += shape->getUploadRanges().size();
+			}
+			const vector<float> &pos = shape->getPosBuf();
+			const vector<float> &nor = shape->getNorBuf();
+			for(size_t v = 0; v < pos.size(); v++) {
+				maxErr = max(maxErr, fabs(pos[v] - full->getPosBuf()[v]));
+				maxErr = max(maxErr, fabs(nor[v] - full->getNorBuf()[v]));
+			}
+		}
+
+		double ms[2];
+		for(int inc = 1; inc >= 0; inc--) {
+			shape->setIncremental(inc != 0);
+			auto t0 = Clock::now();
+			for(int p = 0; p < passes; p++) {
+				for(int k = 0; k < frameCount; k++) {
+					shape->buildPalette(clips[c][k]);
+					shape->skin();
+					shape->collectUploadRanges();
+				}
+			}
+			ms[inc] = elapsedMs(t0) / (passes * frameCount);
+		}
+		bool pass = maxErr <= 1e-4f;
+		ok = ok && pass;
+		double measured = frameCount - 1;
+		cout << names[c] << " : " << skinned / measured << " verts/frame, " << bytes / measured / 1024.0 << " KB/frame in "
+			<< ranges / measured << " ranges (full " << 2 * vertCount * 3 * sizeof(float) / 1024.0 << " KB), "
+			<< ms[1] << " ms/frame vs " << ms[0] << " full, max error " << maxErr << (pass ? " (ok)" : " (FAILED)") << endl;
+	}
+	return ok;
+}
+
+// The first mesh in the exporter's order and after the load-time reorder:
+// post-transform cache stats for a few cache sizes, and the CPU skinning
+// time, which walks the vertices in index order
+static bool benchVertexCache(const vector< vector<string> > &meshData)
+{
+	auto original = loadBenchShape(meshData, false);
+	auto optimized = loadBenchShape(meshData, true);
+	if(!original || !optimized || allFrames.empty()) {
+		return false;
+	}
+	int frameCount = (int)allFrames.size();
+	const int passes = 20;
+	const int cacheSizes[] = {8, 16, 32};
+	const char *names[] = {"original ", "optimized"};
+	shared_ptr<ShapeSkin> shapes[] = {original, optimized};
+	cout << "verts " << original->getVertCount() << ", triangles " << original->getElemBuf().size() / 3 << endl;
+	double ms[2];
+	float maxErr = 0.0f;
+	for(int i = 0; i < 2; i++) {
+		ShapeSkin &shape = *shapes[i];
+		cout << names[i] << " :";
+		vector<unsigned int> elems(shape.getElemBuf().begin(), shape.getElemBuf().end());
+		for(int size : cacheSizes) {
+			VertexCacheStats stats = analyzeVertexCache(elems, shape.getVertCount(), size);
+			cout << " cache " << size << " ACMR " << stats.acmr << " ATVR " << stats.atvr << ",";
+		}
+		auto t0 = Clock::now();
+		for(int p = 0; p < passes; p++) {
+			for(int k = 0; k < frameCount; k++) {
+				shape.buildPalette(allFrames[k]);
+				shape.skin();
+			}
+		}
+		ms[i] = elapsedMs(t0) / (passes * frameCount);
+		cout << " skin " << ms[i] << " ms/frame" << endl;
+	}
+	// Same triangles, same skinned corners: compare them through the indices
+	const SectionArray<unsigned int> &a = original->getElemBuf();
+	const SectionArray<unsigned int> &b = optimized->getElemBuf();
+	vector< vector<float> > cornersA, cornersB;
+	for(size_t t = 0; t < a.size() / 3; t++) {
+		vector<float> ta, tb;
+		for(int k = 0; k < 3; k++) {
+			for(int c = 0; c < 3; c++) {
+				ta.push_back(original->getPosBuf()[3 * a[3 * t + k] + c]);
+				tb.push_back(optimized->getPosBuf()[3 * b[3 * t + k] + c]);
+			}
+		}
+		cornersA.push_back(ta);
+		cornersB.push_back(tb);
+	}
+	sort(cornersA.begin(), cornersA.end());
+	sort(cornersB.begin(), cornersB.end());
+	for(size_t t = 0; t < cornersA.size() && t < cornersB.size(); t++) {
+		for(size_t c = 0; c < cornersA[t].size(); c++) {
+			maxErr = max(maxErr, fabs(cornersA[t][c] - cornersB[t][c]));
+		}
+	}
+	bool ok = a.size() == b.size() && maxErr <= 1e-4f;
+	cout << "skinning " << ms[0] / ms[1] << "x, max difference " << maxErr << (ok ? " (ok)" : " (FAILED)") << endl;
+	return ok;
+}
+
+// Crowd skinning: 1, 10 and 100 copies of the first mesh, each on its own
+// frame, skinned on 1 to N threads. The optional argument is N.
+static void benchCrowd(const vector<string> &args, const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return;
+	}
+	int maxThreads = args.empty() ? max(1, (int)thread::hardware_concurrency()) : stoi(args[0]);
+	int frameCount = (int)allFrames.size();
+	const int frames = 60;
+
+	vector<int> threadCounts;
+	for(int t = 1; t < maxThreads; t *= 2) {
+		threadCounts.push_back(t);
+	}
+	threadCounts.push_back(maxThreads);
+
+	cout << "instances threads ms/frame speedup" << endl;
+	for(int instances : {1, 10, 100}) {
+		vector< shared_ptr<ShapeSkin> > crowd;
+		for(int c = 0; c < instances; c++) {
+			crowd.push_back(make_shared<ShapeSkin>(*shape));
+		}
+		double serialMs = 0.0;
+		for(int threads : threadCounts) {
+			JobPool pool(threads);
+			auto t0 = Clock::now();
+			for(int f = 0; f < frames; f++) {
+				for(int c = 0; c < instances; c++) {
+					crowd[c]->buildPalette(allFrames[(f + c) % frameCount]);
+				}
+				ShapeSkin::skinAll(crowd, &pool);
+			}
+			double ms = elapsedMs(t0) / frames;
+			if(threads == 1) {
+				serialMs = ms;
+			}
+			cout << instances << " " << threads << " " << ms << " " << serialMs / ms << endl;
+		}
+	}
+}
+
+// Startup cost of the skeleton and every mesh: text parsing vs. the mapped
+// binary bundles. The optional argument is the number of repetitions.
+static void benchLoad(const vector<string> &args, const vector< vector<string> > &meshData, const string &skeletonData)
+{
+	int reps = args.empty() ? 5 : stoi(args[0]);
+
+	// Make sure fresh bundles exist
+	allFrames.clear();
+	loadBoneAnimationCached(skeletonData);
+	for(const auto &mesh : meshData) {
+		ShapeSkin().load(DATA_DIR + mesh[0], DATA_DIR + mesh[1]);
+	}
+
+	auto t0 = Clock::now();
+	for(int r = 0; r < reps; r++) {
+		allFrames.clear();
+		loadBoneAnimation(skeletonData);
+		for(const auto &mesh : meshData) {
+			ShapeSkin shape;
+			shape.loadMesh(DATA_DIR + mesh[0]);
+			shape.loadAttachment(DATA_DIR + mesh[1]);
+		}
+	}
+	double textMs = elapsedMs(t0) / reps;
+
+	// The meshes are read in place from their bundles; the frames are still
+	// copied out of the skeleton's, so time the two apart
+	double skeletonMs = 0.0, meshMs = 0.0;
+	for(int r = 0; r < reps; r++) {
+		t0 = Clock::now();
+		allFrames.clear();
+		loadBoneAnimationCached(skeletonData);
+		skeletonMs += elapsedMs(t0);
+		t0 = Clock::now();
+		for(const auto &mesh : meshData) {
+			ShapeSkin().load(DATA_DIR + mesh[0], DATA_DIR + mesh[1]);
+		}
+		meshMs += elapsedMs(t0);
+	}
+	skeletonMs /= reps;
+	meshMs /= reps;
+	double binaryMs = skeletonMs + meshMs;
+
+	cout << "text   : " << textMs << " ms" << endl;
+	cout << "binary : " << binaryMs << " ms (" << textMs / binaryMs << "x): skeleton " << skeletonMs << " ms (" << allFrames.size() << " frames), meshes " << meshMs << " ms" << endl;
+}
+
+// Compressed clip: size against the raw matrices, decode cost, and error
+// against the raw data, both per bone and on the skinned mesh. Optional
+// arguments are the rotation tolerance in degrees and the translation
+// tolerance in model units.
+static void benchCompress(const vector<string> &args, const vector< vector<string> > &meshData)
+{
+	if(allFrames.empty()) {
+		return;
+	}
+	float rotTolDeg = args.size() > 0 ? stof(args[0]) : 0.5f;
+	float posTol = args.size() > 1 ? stof(args[1]) : 0.05f;
+	size_t frameCount = allFrames.size();
+	size_t boneCount = allFrames[0].bonePlacements.size();
+
+	CompressedClip clip;
+	auto t0 = Clock::now();
+	clip.compress(allFrames, glm::radians(rotTolDeg), posTol);
+	double compressMs = elapsedMs(t0);
+
+	size_t rawBytes = frameCount * boneCount * sizeof(Bone);
+	size_t sourceBytes = frameCount * boneCount * 7 * sizeof(float); // quaternion + translation
+	size_t packedBytes = clip.getByteSize();
+	cout << frameCount << " frames, " << boneCount << " bones, tolerance " << rotTolDeg << " deg / " << posTol << endl;
+	cout << "compress     : " << compressMs << " ms" << endl;
+	cout << "raw mat4     : " << rawBytes / 1024.0 << " KB" << endl;
+	cout << "raw quat+pos : " << sourceBytes / 1024.0 << " KB" << endl;
+	cout << "compressed   : " << packedBytes / 1024.0 << " KB, " << clip.getKeyCount() << " keys, "
+		<< clip.getConstantTrackCount() << "/" << boneCount << " constant translation tracks" << endl;
+	cout << "ratio        : " << rawBytes / (double)packedBytes << "x vs mat4, " << sourceBytes / (double)packedBytes << "x vs quat+pos" << endl;
+
+	// Playing at 4x the clip's rate, as a 120 Hz display would, with and
+	// without a key cursor. Both must decode the same poses.
+	Pose pose, cursorPose;
+	CompressedClip::Cursor cursor;
+	const int passes = 50;
+	const int steps = 4;
+	float maxCursorDiff = 0.0f;
+	for(size_t k = 0; k < frameCount * steps; k++) {
+		clip.decode(k / (float)steps, pose);
+		clip.decode(k / (float)steps, cursorPose, cursor);
+		for(size_t j = 0; j < boneCount; j++) {
+			for(int c = 0; c < 4; c++) {
+				maxCursorDiff = max(maxCursorDiff, fabs(pose.rot[j][c] - cursorPose.rot[j][c]));
+			}
+			for(int c = 0; c < 3; c++) {
+				maxCursorDiff = max(maxCursorDiff, fabs(pose.pos[j][c] - cursorPose.pos[j][c]));
+			}
+		}
+	}
+	double decodeMs[2];
+	for(int c = 0; c < 2; c++) {
+		t0 = Clock::now();
+		for(int p = 0; p < passes; p++) {
+			for(size_t k = 0; k < frameCount * steps; k++) {
+				if(c == 0) {
+					clip.decode(k / (float)steps, pose);
+				} else {
+					clip.decode(k / (float)steps, pose, cursor);
+				}
+			}
+		}
+		decodeMs[c] = elapsedMs(t0);
+	}
+	double decodes = (double)passes * frameCount * steps * boneCount;
+	cout << "decode       : search " << decodeMs[0] * 1e6 / decodes << " ns/bone, cursor " << decodeMs[1] * 1e6 / decodes
+		<< " ns/bone, max difference " << maxCursorDiff << (maxCursorDiff == 0.0f ? " (ok)" : " (MISMATCH)") << endl;
+
+	// Error against the raw samples
+	double maxAngle = 0.0, sumAngle = 0.0, maxDist = 0.0, sumDist = 0.0;
+	for(size_t k = 0; k < frameCount; k++) {
+		clip.decode((float)k, pose);
+		for(size_t j = 0; j < boneCount; j++) {
+			const glm::mat4 &M = allFrames[k].bonePlacements[j].quatMat;
+			glm::quat q = glm::normalize(glm::quat_cast(glm::mat3(M)));
+			double angle = 2.0 * acos(min(1.0f, fabs(glm::dot(q, pose.rot[j]))));
+			double dist = glm::length(glm::vec3(M[3]) - pose.pos[j]);
+			maxAngle = max(maxAngle, angle);
+			maxDist = max(maxDist, dist);
+			sumAngle += angle;
+			sumDist += dist;
+		}
+	}
+	size_t samples = frameCount * boneCount;
+	cout << "rotation err : max " << glm::degrees((float)maxAngle) << " deg, mean " << glm::degrees((float)(sumAngle / samples)) << " deg" << endl;
+	cout << "position err : max " << maxDist << ", mean " << sumDist / samples << endl;
+
+	// What that does to the skin
+	auto shape = loadBenchShape(meshData);
+	if(!shape) {
+		return;
+	}
+	double maxVertErr = 0.0;
+	for(size_t k = 0; k < frameCount; k++) {
+		shape->buildPalette(allFrames[k]);
+		shape->skin();
+		vector<float> ref = shape->getPosBuf();
+		clip.decode((float)k, pose);
+		shape->buildPalette(pose);
+		shape->skin();
+		const vector<float> &pos = shape->getPosBuf();
+		for(size_t v = 0; v < pos.size(); v += 3) {
+			glm::vec3 d(pos[v] - ref[v], pos[v+1] - ref[v+1], pos[v+2] - ref[v+2]);
+			maxVertErr = max(maxVertErr, (double)glm::length(d));
+		}
+	}
+	cout << "vertex err   : max " << maxVertErr << endl;
+}
+
+// Dual quaternion against linear blend skinning at each instruction set.
+// The SIMD DQ results are checked against the scalar DQ loop, and vertices
+// bound to a single bone (where both methods must agree) against LBS.
+static bool benchDQS(const vector<string> &args, const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return false;
+	}
+	float tolerance = args.empty() ? 1e-3f : stof(args[0]);
+	int frameCount = (int)allFrames.size();
+	const int passes = 20;
+
+	vector<size_t> rigid;
+	for(size_t v = 0; v < shape->getVertCount(); v++) {
+		int n = 0;
+		for(const auto &inf : shape->getBoneInfluences((int)v)) {
+			n += inf.second > 0.0f;
+		}
+		if(n == 1) {
+			rigid.push_back(v);
+		}
+	}
+
+	// Scalar results for every frame, both methods
+	vector< vector<float> > lbsPos(frameCount), dqPos(frameCount), dqNor(frameCount);
+	shape->setSkinISA(SkinKernel::SCALAR);
+	for(int k = 0; k < frameCount; k++) {
+		shape->setSkinMethod(ShapeSkin::LINEAR_BLEND);
+		shape->buildPalette(allFrames[k]);
+		shape->skin();
+		lbsPos[k] = shape->getPosBuf();
+		shape->setSkinMethod(ShapeSkin::DUAL_QUATERNION);
+		shape->buildPalette(allFrames[k]);
+		shape->skin();
+		dqPos[k] = shape->getPosBuf();
+		dqNor[k] = shape->getNorBuf();
+	}
+	float rigidErr = 0.0f, maxDiff = 0.0f;
+	for(int k = 0; k < frameCount; k++) {
+		for(size_t v : rigid) {
+			for(int c = 0; c < 3; c++) {
+				rigidErr = max(rigidErr, fabs(dqPos[k][3*v + c] - lbsPos[k][3*v + c]));
+			}
+		}
+		for(size_t v = 0; v < lbsPos[k].size(); v++) {
+			maxDiff = max(maxDiff, fabs(dqPos[k][v] - lbsPos[k][v]));
+		}
+	}
+	bool ok = rigidErr <= tolerance;
+	cout << rigid.size() << " of " << shape->getVertCount() << " vertices on one bone: DQ vs LBS max error " << rigidErr << (ok ? " (ok)" : " (FAILED)") << endl;
+	cout << "largest DQ vs LBS difference elsewhere: " << maxDiff << endl;
+
+	SkinKernel::ISA best = SkinKernel::detectISA();
+	for(int i = SkinKernel::SCALAR; i <= best; i++) {
+		SkinKernel::ISA isa = (SkinKernel::ISA)i;
+		shape->setSkinISA(isa);
+		double ms[2];
+		for(int m = 0; m < 2; m++) {
+			shape->setSkinMethod(m ? ShapeSkin::DUAL_QUATERNION : ShapeSkin::LINEAR_BLEND);
+			auto t0 = Clock::now();
+			for(int p = 0; p < passes; p++) {
+				for(int k = 0; k < frameCount; k++) {
+					shape->buildPalette(allFrames[k]);
+					shape->skin();
+				}
+			}
+			ms[m] = elapsedMs(t0) / (passes * frameCount);
+		}
+		float maxErr = 0.0f;
+		for(int k = 0; k < frameCount; k++) {
+			shape->buildPalette(allFrames[k]);
+			shape->skin();
+			const vector<float> &pos = shape->getPosBuf();
+			const vector<float> &nor = shape->getNorBuf();
+			for(size_t v = 0; v < pos.size(); v++) {
+				maxErr = max(maxErr, fabs(pos[v] - dqPos[k][v]));
+				maxErr = max(maxErr, fabs(nor[v] - dqNor[k][v]));
+			}
+		}
+		bool pass = maxErr <= tolerance;
+		ok = ok && pass;
+		double mverts = shape->getVertCount() / 1e3;
+		cout << SkinKernel::getISAName(isa) << " : LBS " << ms[0] << " ms/frame (" << mverts / ms[0] << " Mverts/s), DQ " << ms[1] << " ms/frame (" << mverts / ms[1] << " Mverts/s), DQ max error " << maxErr << (pass ? " (ok)" : " (FAILED)") << endl;
+	}
+	shape->setSkinISA(best);
+	return ok;
+}
+
+// Sub-frame sampling cost per bone for each blend mode, into a Pose and
+// straight into a skinning palette.
+static void benchSample(const vector< vector<string> > &meshData)
+{
+	auto shape = loadBenchShape(meshData);
+	if(!shape || allFrames.empty()) {
+		return;
+	}
+	PoseSampler sampler;
+	sampler.setClip(allFrames);
+	size_t boneCount = sampler.getBoneCount();
+	const int samples = 200000;
+	// Step through the clip at a 144 Hz display rate
+	const float step = 30.0f / 144.0f;
+
+	Pose pose;
+	pose.resize(boneCount);
+	cout << "mode  pose ns/bone  palette ns/bone" << endl;
+	for(PoseSampler::Mode mode : {PoseSampler::STEP, PoseSampler::NLERP, PoseSampler::SLERP}) {
+		auto t0 = Clock::now();
+		for(int i = 0; i < samples; i++) {
+			sampler.sample(i * step, mode, pose);
+		}
+		double poseNs = elapsedMs(t0) * 1e6 / ((double)samples * boneCount);
+		t0 = Clock::now();
+		for(int i = 0; i < samples; i++) {
+			sampler.sample(i * step, mode, *shape);
+		}
+		double paletteNs = elapsedMs(t0) * 1e6 / ((double)samples * boneCount);
+		cout << PoseSampler::getModeName(mode) << " " << poseNs << " " << paletteNs << endl;
+	}
+}
+
+// A joint as a separately allocated tree node, evaluated by recursion
+// from the root: the pointer-chasing layout the flat Skeleton replaces.
+struct TreeJoint
+{
+	int bone;
+	glm::mat4 pre, post;
+	vector< unique_ptr<TreeJoint> > children;
+
+	void eval(const glm::mat4 &parentWorld, const Pose &local, glm::mat4 *world) const
+	{
+		glm::mat4 M = pre * glm::mat4_cast(local.rot[bone]) * post;
+		M[3] += glm::vec4(local.pos[bone], 0.0f);
+		world[bone] = parentWorld * M;
+		for(const auto &c : children) {
+			c->eval(world[bone], local, world);
+		}
+	}
+};
+
+// Local clip -> world matrices: the linear pass against a recursive tree
+// walk, plus the error against the world-space _skel.txt frames. (In the
+// Silly_Dancing data the unanimated *_Toe_End joints keep binding pose
+// values, in degrees, in _skel_local.txt, so they alone are off.)
+static void benchHierarchy(const vector<string> &args, const string &skeletonData)
+{
+	string prefix = args.size() > 0 ? args[0] : skeletonData.substr(0, skeletonData.rfind("_skel"));
+	Skeleton skeleton;
+	vector<Pose> frames;
+	Pose bind;
+	if(!skeleton.load(DATA_DIR + prefix, frames, bind) || frames.empty()) {
+		return;
+	}
+	size_t boneCount = skeleton.getBoneCount();
+
+	if(frames.size() == allFrames.size()) {
+		Frame world(0);
+		float maxErr = 0.0f;
+		size_t maxBone = 0;
+		for(size_t k = 0; k < frames.size(); k++) {
+			skeleton.computeWorld(frames[k], world);
+			for(size_t i = 0; i < boneCount; i++) {
+				int j = skeleton.getJointIndex(i);
+				const glm::mat4 &A = world.bonePlacements[j].quatMat;
+				const glm::mat4 &B = allFrames[k].bonePlacements[j].quatMat;
+				for(int c = 0; c < 4; c++) {
+					for(int r = 0; r < 3; r++) {
+						float e = fabs(A[c][r] - B[c][r]);
+						if(e > maxErr) {
+							maxErr = e;
+							maxBone = i;
+						}
+					}
+				}
+			}
+		}
+		cout << "max error vs world clip: " << maxErr << " (" << skeleton.getName(maxBone) << ")" << endl;
+	}
+
+	vector< unique_ptr<TreeJoint> > nodes(boneCount);
+	for(size_t i = 0; i < boneCount; i++) {
+		nodes[i].reset(new TreeJoint());
+		nodes[i]->bone = (int)i;
+		nodes[i]->pre = skeleton.getPre(i);
+		nodes[i]->post = skeleton.getPost(i);
+	}
+	vector< unique_ptr<TreeJoint> > roots;
+	for(int i = (int)boneCount - 1; i >= 0; i--) {
+		int p = skeleton.getParent(i);
+		auto &list = p < 0 ? roots : nodes[p]->children;
+		list.insert(list.begin(), move(nodes[i]));
+	}
+
+	const int reps = 20000;
+	vector<glm::mat4> world(boneCount);
+	auto t0 = Clock::now();
+	for(int i = 0; i < reps; i++) {
+		skeleton.computeWorld(frames[i % frames.size()], world.data());
+	}
+	double linearUs = elapsedMs(t0) * 1e3 / reps;
+	t0 = Clock::now();
+	for(int i = 0; i < reps; i++) {
+		for(const auto &r : roots) {
+			r->eval(glm::mat4(1.0f), frames[i % frames.size()], world.data());
+		}
+	}
+	double treeUs = elapsedMs(t0) * 1e3 / reps;
+	cout << boneCount << " joints" << endl;
+	cout << "linear pass : " << linearUs << " us/frame" << endl;
+	cout << "tree walk   : " << treeUs << " us/frame" << endl;
+}
+
+// Blend tree evaluation for 1 to 8 layers on the local clip: the base
+// layer mid-crossfade, then alternating additive and masked override layers.
+static void benchBlend(const vector<string> &args, const string &skeletonData)
+{
+	string prefix = args.size() > 0 ? args[0] : skeletonData.substr(0, skeletonData.rfind("_skel"));
+	Skeleton skeleton;
+	vector<Pose> frames;
+	Pose bind;
+	if(!skeleton.load(DATA_DIR + prefix, frames, bind) || frames.empty()) {
+		return;
+	}
+	size_t boneCount = skeleton.getBoneCount();
+	vector<float> mask;
+	skeleton.getSubtreeMask(min((int)boneCount - 1, 9), mask);
+	const int evals = 100000;
+	const float dt = 1.0f / 144.0f;
+
+	Pose pose;
+	Frame world(0);
+	cout << boneCount << " joints" << endl;
+	cout << "layers  us/eval  ns/bone/layer  (+ world pass us)" << endl;
+	for(int layerCount = 1; layerCount <= 8; layerCount++) {
+		BlendTree tree;
+		int clip = tree.addClip(frames);
+		int other = tree.addClip(frames);
+		int additive = tree.addClip(frames, true);
+		int m = tree.addMask(mask);
+		tree.addLayer(clip, BlendTree::OVERRIDE);
+		for(int i = 1; i < layerCount; i++) {
+			if(i % 2) {
+				tree.addLayer(additive, BlendTree::ADDITIVE, 0.5f);
+			} else {
+				tree.addLayer(other, BlendTree::OVERRIDE, 0.5f, m);
+			}
+			tree.setTime(i, i * 0.37f);
+		}
+		tree.crossfade(0, other, 1e6f);
+		tree.evaluate(PoseSampler::NLERP, pose);
+
+		auto t0 = Clock::now();
+		for(int i = 0; i < evals; i++) {
+			tree.update(dt);
+			tree.evaluate(PoseSampler::NLERP, pose);
+		}
+		double evalUs = elapsedMs(t0) * 1e3 / evals;
+		t0 = Clock::now();
+		for(int i = 0; i < evals; i++) {
+			skeleton.computeWorld(pose, world);
+		}
+		double worldUs = elapsedMs(t0) * 1e3 / evals;
+		cout << layerCount << " " << evalUs << " " << evalUs * 1e3 / (boneCount * layerCount) << " " << worldUs << endl;
+	}
+}
+
+// Cost of a ProfileScope with no profiler, a disabled one and an enabled
+// one (CPU timing only, no context here)
+static bool benchProfiler()
+{
+	const int scopes = 10000000;
+	Profiler profiler;
+	int stage = profiler.addStage("bench");
+	volatile int sink = 0;
+	const char *labels[] = {"no profiler", "disabled", "enabled"};
+	double disabledNs = 0.0;
+	for(int mode = 0; mode < 3; mode++) {
+		profiler.setEnabled(mode == 2);
+		Profiler *p = (mode == 0) ? nullptr : &profiler;
+		auto t0 = Clock::now();
+		for(int i = 0; i < scopes; i++) {
+			ProfileScope scope(p, stage);
+			sink = sink + 1;
+		}
+		double ns = elapsedMs(t0) * 1e6 / scopes;
+		if(mode == 1) {
+			disabledNs = ns;
+		}
+		cout << labels[mode] << ": " << ns << " ns/scope" << endl;
+	}
+	profiler.endFrame();
+	bool ok = disabledNs < 100.0;
+	cout << "disabled scope " << (ok ? "under" : "OVER") << " 100 ns" << endl;
+	return ok;
+}
+
+bool runBenchmark(const string &name, const vector<string> &args, const vector< vector<string> > &meshData, const string &skeletonData)
+{
+	if(name == "skin") {
+		benchSkin(meshData);
+	} else if(name == "simd") {
+		return benchSimd(args, meshData);
+	} else if(name == "crowd") {
+		benchCrowd(args, meshData);
+	} else if(name == "load") {
+		benchLoad(args, meshData, skeletonData);
+	} else if(name == "compress") {
+		benchCompress(args, meshData);
+	} else if(name == "sample") {
+		benchSample(meshData);
+	} else if(name == "hierarchy") {
+		benchHierarchy(args, skeletonData);
+	} else if(name == "dirty") {
+		return benchDirty(args, meshData, skeletonData);
+	} else if(name == "sparse") {
+		return benchSparse(meshData);
+	} else if(name == "dqs") {
+		return benchDQS(args, meshData);
+	} else if(name == "blend") {
+		benchBlend(args, skeletonData);
+	} else if(name == "profiler") {
+		return benchProfiler();
+	} else if(name == "vcache") {
+		return benchVertexCache(meshData);
+	} else {
+		cout << "Unknown benchmark: " << name << endl;
+		cout << "Available: skin, simd [tolerance], sparse, dirty [joint], dqs [tolerance], crowd [max threads], load [reps], compress [deg] [units], sample, hierarchy [prefix], blend [prefix], profiler, vcache" << endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+
+// Headless micro-benchmarks. These only touch CPU-side data, so they run
+// without a window or GL context:
+//   A2 <SHADER DIR> <DATA DIR> --bench <name> [args...]
+// meshData and skeletonData are the MESH and SKELETON lines from input.txt.
+// Returns false if the benchmark name is unknown or a check failed.
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args, const std::vector< std::vector<std::string> > &meshData, const std::string &skeletonData);
+
+#endif
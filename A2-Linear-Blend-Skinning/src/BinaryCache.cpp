@@ -0,0 +1,175 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "BinaryCache.h"
+
+using namespace std;
+
+static const char MAGIC[8] = {'A', '2', 'C', 'A', 'C', 'H', 'E', '\0'};
+static const uint64_t ALIGNMENT = 64;
+
+BinaryCache::BinaryCache() :
+	data(NULL),
+	size(0),
+	mapped(false)
+{
+	memset(&pending, 0, sizeof(pending));
+}
+
+BinaryCache::~BinaryCache()
+{
+	close();
+}
+
+bool BinaryCache::stampSources(const vector<string> &sources, uint64_t *stamp)
+{
+	memset(stamp, 0, 2 * MAX_SOURCES * sizeof(uint64_t));
+	for(size_t i = 0; i < sources.size() && i < (size_t)MAX_SOURCES; i++) {
+		struct stat st;
+		if(stat(sources[i].c_str(), &st) != 0) {
+			return false;
+		}
+		stamp[2*i] = (uint64_t)st.st_size;
+		stamp[2*i + 1] = (uint64_t)st.st_mtime;
+	}
+	return true;
+}
+
+bool BinaryCache::open(const string &path, const vector<string> &sources)
+{
+	close();
+#ifndef _WIN32
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(Header)) {
+		::close(fd);
+		return false;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if(p == MAP_FAILED) {
+		return false;
+	}
+	data = (const char *)p;
+	size = st.st_size;
+	mapped = true;
+#else
+	ifstream in(path, ios::binary);
+	if(!in.good()) {
+		return false;
+	}
+	in.seekg(0, ios::end);
+	fallbackData.resize((size_t)in.tellg());
+	in.seekg(0, ios::beg);
+	in.read(fallbackData.data(), fallbackData.size());
+	if(fallbackData.size() < sizeof(Header)) {
+		fallbackData.clear();
+		return false;
+	}
+	data = fallbackData.data();
+	size = fallbackData.size();
+#endif
+
+	// Reject bundles from another version or older than their sources
+	const Header *h = (const Header *)data;
+	uint64_t stamp[2 * MAX_SOURCES];
+	bool fresh = memcmp(h->magic, MAGIC, sizeof(MAGIC)) == 0 &&
+		h->version == VERSION &&
+		h->sectionCount <= (uint32_t)MAX_SECTIONS &&
+		stampSources(sources, stamp) &&
+		memcmp(h->sourceStamp, stamp, sizeof(stamp)) == 0;
+	for(uint32_t i = 0; fresh && i < h->sectionCount; i++) {
+		fresh = h->sections[i].offset + h->sections[i].size <= size;
+	}
+	if(!fresh) {
+		close();
+	}
+	return fresh;
+}
+
+void BinaryCache::close()
+{
+#ifndef _WIN32
+	if(mapped) {
+		munmap((void *)data, size);
+	}
+#endif
+	fallbackData.clear();
+	data = NULL;
+	size = 0;
+	mapped = false;
+}
+
+uint64_t BinaryCache::getCount(int i) const
+{
+	return ((const Header *)data)->counts[i];
+}
+
+const void *BinaryCache::getSection(int i, size_t &bytes) const
+{
+	const Header *h = (const Header *)data;
+	if(i >= (int)h->sectionCount) {
+		bytes = 0;
+		return NULL;
+	}
+	bytes = h->sections[i].size;
+	return data + h->sections[i].offset;
+}
+
+void BinaryCache::setCount(int i, uint64_t c)
+{
+	pending.counts[i] = c;
+}
+
+void BinaryCache::addSection(const void *data, size_t bytes)
+{
+	pendingData.push_back(make_pair(data, bytes));
+}
+
+bool BinaryCache::write(const string &path, const vector<string> &sources)
+{
+	if(pendingData.size() > (size_t)MAX_SECTIONS || !stampSources(sources, pending.sourceStamp)) {
+		return false;
+	}
+	memcpy(pending.magic, MAGIC, sizeof(MAGIC));
+	pending.version = VERSION;
+	pending.sectionCount = (uint32_t)pendingData.size();
+	uint64_t offset = (sizeof(Header) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	for(size_t i = 0; i < pendingData.size(); i++) {
+		pending.sections[i].offset = offset;
+		pending.sections[i].size = pendingData[i].second;
+		offset = (offset + pendingData[i].second + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+	}
+
+	// Write to a temporary file and rename, so a reader never sees half a bundle
+	string tmp = path + ".tmp";
+	ofstream out(tmp, ios::binary);
+	if(!out.good()) {
+		cout << "Cannot write " << tmp << endl;
+		return false;
+	}
+	out.write((const char *)&pending, sizeof(pending));
+	const char zeros[ALIGNMENT] = {0};
+	uint64_t pos = sizeof(pending);
+	for(size_t i = 0; i < pendingData.size(); i++) {
+		out.write(zeros, pending.sections[i].offset - pos);
+		out.write((const char *)pendingData[i].first, pendingData[i].second);
+		pos = pending.sections[i].offset + pendingData[i].second;
+	}
+	out.close();
+	pendingData.clear();
+	remove(path.c_str());
+	return out.good() && rename(tmp.c_str(), path.c_str()) == 0;
+}
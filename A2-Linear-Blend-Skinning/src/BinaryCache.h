@@ -0,0 +1,126 @@
+#pragma once
+#ifndef BINARYCACHE_H
+#define BINARYCACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * Read-only array that is either owned or borrowed from a section of a
+ * mapped BinaryCache. Loaders that parse text fill 'owned' and call own();
+ * BinaryCache::borrowSection points it straight into the mapping, which the
+ * holder keeps open for as long as the array is read. Copying an owned array
+ * copies its elements; copying a borrowed one borrows the same section.
+ */
+template <typename T>
+class SectionArray
+{
+public:
+	std::vector<T> owned;
+
+	SectionArray() : ptr(NULL), count(0) {}
+	SectionArray(const SectionArray &other) : owned(other.owned) { copyView(other); }
+	SectionArray &operator=(const SectionArray &other) { owned = other.owned; copyView(other); return *this; }
+
+	void own() { ptr = owned.data(); count = owned.size(); }
+	void borrow(const T *p, size_t n) { std::vector<T>().swap(owned); ptr = p; count = n; }
+	bool isBorrowed() const { return owned.empty() && ptr != NULL; }
+
+	const T *data() const { return ptr; }
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	const T &operator[](size_t i) const { return ptr[i]; }
+	const T *begin() const { return ptr; }
+	const T *end() const { return ptr + count; }
+
+private:
+	void copyView(const SectionArray &other)
+	{
+		if(other.isBorrowed()) {
+			ptr = other.ptr;
+			count = other.count;
+		} else {
+			own();
+		}
+	}
+
+	const T *ptr;
+	size_t count;
+};
+
+/**
+ * Versioned binary bundle of preprocessed data, written next to the text
+ * files it was cooked from. The file is a fixed header followed by up to
+ * MAX_SECTIONS raw arrays, each starting on a 64-byte boundary, so readers
+ * can use them straight out of the memory map without any parsing.
+ *
+ * The header records the size and modification time of each source file.
+ * open() refuses a bundle whose sources have changed since it was cooked,
+ * or that was written by a different VERSION; callers then fall back to the
+ * text path and cook a new one.
+ */
+class BinaryCache
+{
+public:
+	static const uint32_t VERSION = 3;
+	static const int MAX_SECTIONS = 8;
+	static const int MAX_SOURCES = 2;
+
+	BinaryCache();
+	virtual ~BinaryCache();
+
+	// Reading
+	bool open(const std::string &path, const std::vector<std::string> &sources);
+	void close();
+	uint64_t getCount(int i) const;
+	// Raw section data and its size in bytes
+	const void *getSection(int i, size_t &bytes) const;
+	// Points a at section i, valid until close()
+	template <typename T>
+	void borrowSection(int i, SectionArray<T> &a) const
+	{
+		size_t bytes;
+		const T *p = (const T *)getSection(i, bytes);
+		a.borrow(p, bytes / sizeof(T));
+	}
+
+	// Writing
+	void setCount(int i, uint64_t c);
+	void addSection(const void *data, size_t bytes);
+	bool write(const std::string &path, const std::vector<std::string> &sources);
+
+	// Where the bundle for the given text file lives
+	static std::string getPath(const std::string &source) { return source + ".a2cache"; }
+
+private:
+	struct Section
+	{
+		uint64_t offset;
+		uint64_t size;
+	};
+	struct Header
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t sectionCount;
+		uint64_t sourceStamp[2 * MAX_SOURCES]; // size, mtime per source
+		uint64_t counts[MAX_SECTIONS];
+		Section sections[MAX_SECTIONS];
+	};
+
+	static bool stampSources(const std::vector<std::string> &sources, uint64_t *stamp);
+
+	// Mapped (or, without mmap, loaded) file
+	const char *data;
+	size_t size;
+	bool mapped;
+	std::vector<char> fallbackData;
+
+	// Pending sections for write()
+	Header pending;
+	std::vector< std::pair<const void *, size_t> > pendingData;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include <algorithm>
+
+#include "BlendTree.h"
+
+using namespace std;
+
+BlendTree::BlendTree(float fps) :
+	fps(fps),
+	boneCount(0),
+	maskCount(0)
+{
+}
+
+BlendTree::~BlendTree()
+{
+}
+
+int BlendTree::addClip(const vector<Pose> &frames, bool additive)
+{
+	if(!frames.empty()) {
+		// Masks and scratch poses are laid out for one bone count
+		if(boneCount > 0 && frames[0].size() != boneCount) {
+			return -1;
+		}
+		boneCount = frames[0].size();
+	}
+	clips.push_back(PoseSampler());
+	if(!additive || frames.empty()) {
+		clips.back().setClip(frames);
+	} else {
+		// Offsets from the first frame: rotation applied after the base
+		// rotation, translation added
+		const Pose &ref = frames[0];
+		vector<Pose> deltas(frames);
+		for(auto &d : deltas) {
+			for(size_t j = 0; j < d.size(); j++) {
+				d.rot[j] = glm::normalize(glm::inverse(ref.rot[j]) * d.rot[j]);
+				d.pos[j] -= ref.pos[j];
+			}
+		}
+		clips.back().setClip(deltas);
+	}
+	return (int)clips.size() - 1;
+}
+
+int BlendTree::addMask(const vector<float> &boneWeights)
+{
+	if(boneCount == 0 || boneWeights.size() != boneCount) {
+		return -1;
+	}
+	masks.insert(masks.end(), boneWeights.begin(), boneWeights.end());
+	maskCount++;
+	return (int)maskCount - 1;
+}
+
+int BlendTree::addLayer(int clip, Blend blend, float weight, int mask)
+{
+	if(clip < 0 || clip >= (int)clips.size() || mask < -1 || mask >= (int)maskCount) {
+		return -1;
+	}
+	Layer layer;
+	layer.clip = clip;
+	layer.blend = blend;
+	layer.weight = weight;
+	layer.mask = mask;
+	layer.time = 0.0f;
+	layer.fromClip = -1;
+	layer.fromTime = 0.0f;
+	layer.fade = 1.0f;
+	layer.fadeRate = 0.0f;
+	layers.push_back(layer);
+	layerPose.resize(boneCount);
+	fromPose.resize(boneCount);
+	return (int)layers.size() - 1;
+}
+
+void BlendTree::crossfade(int layer, int clip, float duration)
+{
+	Layer &l = layers[layer];
+	if(clip == l.clip) {
+		return;
+	}
+	if(duration <= 0.0f) {
+		l.clip = clip;
+		l.time = 0.0f;
+		l.fromClip = -1;
+		l.fade = 1.0f;
+		return;
+	}
+	l.fromClip = l.clip;
+	l.fromTime = l.time;
+	l.clip = clip;
+	l.time = 0.0f;
+	l.fade = 0.0f;
+	l.fadeRate = 1.0f / duration;
+}
+
+void BlendTree::update(float dt)
+{
+	for(auto &l : layers) {
+		l.time += dt;
+		if(l.fromClip >= 0) {
+			l.fromTime += dt;
+			l.fade += dt * l.fadeRate;
+			if(l.fade >= 1.0f) {
+				l.fade = 1.0f;
+				l.fromClip = -1;
+			}
+		}
+	}
+}
+
+void BlendTree::sampleLayer(const Layer &l, PoseSampler::Mode mode)
+{
+	clips[l.clip].sample(l.time * fps, mode, layerPose);
+	if(l.fromClip < 0) {
+		return;
+	}
+	clips[l.fromClip].sample(l.fromTime * fps, mode, fromPose);
+	// Smoothstep so the fade has no velocity jump at either end
+	float a = l.fade * l.fade * (3.0f - 2.0f * l.fade);
+	for(size_t j = 0; j < boneCount; j++) {
+		layerPose.rot[j] = nlerp(fromPose.rot[j], layerPose.rot[j], a);
+		layerPose.pos[j] = glm::mix(fromPose.pos[j], layerPose.pos[j], a);
+	}
+}
+
+void BlendTree::evaluate(PoseSampler::Mode mode, Pose &pose)
+{
+	pose.resize(boneCount);
+	const glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+	for(size_t i = 0; i < layers.size(); i++) {
+		const Layer &l = layers[i];
+		if(i > 0 && l.weight <= 0.0f) {
+			continue;
+		}
+		sampleLayer(l, mode);
+		const float *mask = l.mask >= 0 ? &masks[l.mask * boneCount] : nullptr;
+		if(i == 0) {
+			// The base layer sets the pose outright
+			copy(layerPose.rot.begin(), layerPose.rot.end(), pose.rot.begin());
+			copy(layerPose.pos.begin(), layerPose.pos.end(), pose.pos.begin());
+		} else if(l.blend == OVERRIDE) {
+			for(size_t j = 0; j < boneCount; j++) {
+				float w = mask ? l.weight * mask[j] : l.weight;
+				pose.rot[j] = nlerp(pose.rot[j], layerPose.rot[j], w);
+				pose.pos[j] = glm::mix(pose.pos[j], layerPose.pos[j], w);
+			}
+		} else {
+			for(size_t j = 0; j < boneCount; j++) {
+				float w = mask ? l.weight * mask[j] : l.weight;
+				pose.rot[j] = glm::normalize(pose.rot[j] * nlerp(identity, layerPose.rot[j], w));
+				pose.pos[j] += layerPose.pos[j] * w;
+			}
+		}
+	}
+}
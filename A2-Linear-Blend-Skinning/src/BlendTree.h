@@ -0,0 +1,85 @@
+#pragma once
+#ifndef BLENDTREE_H
+#define BLENDTREE_H
+
+#include <vector>
+
+#include "Pose.h"
+#include "PoseSampler.h"
+
+/**
+ * Layered blending of several clips into one pose per character.
+ *
+ * Layers are applied in order on top of the first one. An OVERRIDE layer
+ * blends towards its clip's pose by its weight; an ADDITIVE layer applies
+ * its clip's offsets from that clip's first frame. Either can be limited to
+ * some joints by a mask (a weight per bone). crossfade() switches a
+ * layer's clip over a duration, blending the outgoing and incoming clips.
+ *
+ * Poses are blended per bone on the flat rot/pos arrays, so this is meant
+ * for local-space clips (Skeleton); evaluate once per character per frame,
+ * then build world matrices. All scratch poses are sized when layers are
+ * added, so update() and evaluate() do not allocate.
+ */
+class BlendTree
+{
+public:
+	enum Blend
+	{
+		OVERRIDE,
+		ADDITIVE
+	};
+
+	BlendTree(float fps = 30.0f);
+	virtual ~BlendTree();
+
+	// Clips and masks are shared by all layers. Additive clips are stored as
+	// offsets from their first frame. Returns the index to refer to them by,
+	// or -1 if the clip or mask does not have the first clip's bone count
+	// (or the clip or mask given to addLayer does not exist).
+	int addClip(const std::vector<Pose> &frames, bool additive = false);
+	int addMask(const std::vector<float> &boneWeights);
+	int addLayer(int clip, Blend blend, float weight = 1.0f, int mask = -1);
+
+	void setWeight(int layer, float weight) { layers[layer].weight = weight; }
+	void setTime(int layer, float seconds) { layers[layer].time = seconds; }
+	// Fades from the layer's current clip to 'clip'. The new clip starts
+	// from its beginning; the old one keeps playing until the fade is done.
+	void crossfade(int layer, int clip, float duration);
+
+	void update(float dt);
+	void evaluate(PoseSampler::Mode mode, Pose &pose);
+
+	size_t getClipCount() const { return clips.size(); }
+	size_t getLayerCount() const { return layers.size(); }
+	size_t getBoneCount() const { return boneCount; }
+	int getClip(int layer) const { return layers[layer].clip; }
+
+private:
+	struct Layer
+	{
+		int clip;
+		Blend blend;
+		float weight;
+		int mask;
+		float time;
+		// Outgoing clip during a crossfade, -1 otherwise
+		int fromClip;
+		float fromTime;
+		float fade; // 0 = all fromClip, 1 = all clip
+		float fadeRate;
+	};
+
+	void sampleLayer(const Layer &layer, PoseSampler::Mode mode);
+
+	float fps;
+	size_t boneCount;
+	std::vector<PoseSampler> clips;
+	std::vector<float> masks; // [mask * boneCount + bone]
+	size_t maskCount;
+	std::vector<Layer> layers;
+	Pose layerPose;
+	Pose fromPose;
+};
+
+#endif
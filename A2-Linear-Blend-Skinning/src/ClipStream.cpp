@@ -0,0 +1,205 @@
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ClipStream.h"
+
+using namespace std;
+
+ClipStream::ClipStream(size_t capacity) :
+	capacity(max((size_t)2, capacity)),
+	boneCount(0),
+	bindPose(0),
+	playhead(0),
+	quit(false),
+	hits(0),
+	misses(0)
+{
+}
+
+ClipStream::~ClipStream()
+{
+	close();
+}
+
+bool ClipStream::open(const string &filename)
+{
+	close();
+	this->filename = filename;
+	ifstream in(filename);
+	if(!in.good()) {
+		cout << "Cannot read " << filename << endl;
+		return false;
+	}
+	cout << "Streaming quaternions from " << filename << endl;
+
+	// Index the data lines without parsing them
+	string line;
+	size_t numFrames = 0;
+	streamoff bindOffset = -1;
+	while(true) {
+		streamoff offset = in.tellg();
+		getline(in, line);
+		if(in.eof()) {
+			break;
+		}
+		if(line.empty() || line.at(0) == '#') {
+			continue;
+		}
+		if(numFrames == 0 && boneCount == 0) {
+			stringstream ss(line);
+			ss >> numFrames;
+			ss >> boneCount;
+		} else if(bindOffset < 0) {
+			bindOffset = offset;
+		} else {
+			lineOffsets.push_back(offset);
+		}
+	}
+	in.close();
+
+	mainIn.open(filename);
+	prefetchIn.open(filename);
+	bindPose = Frame((int)boneCount);
+	if(bindOffset < 0 || !mainIn.good() || !prefetchIn.good()) {
+		lineOffsets.clear();
+		return false;
+	}
+	if(!decode(mainIn, bindOffset, bindPose) || lineOffsets.empty()) {
+		return false;
+	}
+
+	slots.assign(capacity, Slot());
+	for(auto &s : slots) {
+		s.pose = Frame((int)boneCount);
+	}
+	playhead = 0;
+	quit = false;
+	prefetcher = thread(&ClipStream::prefetchLoop, this);
+	return true;
+}
+
+void ClipStream::close()
+{
+	if(prefetcher.joinable()) {
+		{
+			lock_guard<mutex> lock(slotMutex);
+			quit = true;
+		}
+		moved.notify_all();
+		prefetcher.join();
+	}
+	mainIn.close();
+	prefetchIn.close();
+	slots.clear();
+	lineOffsets.clear();
+	boneCount = 0;
+}
+
+bool ClipStream::decode(ifstream &in, streamoff offset, Frame &pose) const
+{
+	in.clear();
+	in.seekg(offset);
+	string line;
+	getline(in, line);
+	const char *p = line.c_str();
+	char *end;
+	for(size_t i = 0; i < boneCount; i++) {
+		float v[7];
+		for(int c = 0; c < 7; c++) {
+			v[c] = strtof(p, &end);
+			if(end == p) {
+				return false;
+			}
+			p = end;
+		}
+		// File order is x y z w, then the position
+		pose.bonePlacements[i] = Bone(glm::quat(v[3], v[0], v[1], v[2]), glm::vec3(v[4], v[5], v[6]));
+	}
+	return true;
+}
+
+bool ClipStream::inWindow(long frame) const
+{
+	size_t n = lineOffsets.size();
+	size_t d = (frame + n - playhead) % n;
+	return d < capacity;
+}
+
+int ClipStream::findSlot(long frame) const
+{
+	for(size_t s = 0; s < slots.size(); s++) {
+		if(slots[s].frame == frame) {
+			return (int)s;
+		}
+	}
+	return -1;
+}
+
+int ClipStream::findVictim() const
+{
+	// Any slot holding a frame behind the playhead or too far ahead
+	for(size_t s = 0; s < slots.size(); s++) {
+		if(slots[s].frame < 0 || !inWindow(slots[s].frame)) {
+			return (int)s;
+		}
+	}
+	return -1;
+}
+
+const Frame &ClipStream::getFrame(size_t k)
+{
+	lock_guard<mutex> lock(slotMutex);
+	playhead = k % lineOffsets.size();
+	int s = findSlot(playhead);
+	if(s >= 0) {
+		hits++;
+	} else {
+		// Seek past the prefetched window: decode just this frame
+		misses++;
+		s = findVictim();
+		decode(mainIn, lineOffsets[playhead], slots[s].pose);
+		slots[s].frame = playhead;
+	}
+	moved.notify_one();
+	return slots[s].pose;
+}
+
+void ClipStream::prefetchLoop()
+{
+	Frame scratch((int)boneCount);
+	unique_lock<mutex> lock(slotMutex);
+	while(!quit) {
+		// Next frame after the playhead that is not decoded yet
+		size_t n = lineOffsets.size();
+		long want = -1;
+		for(size_t d = 0; d < min(capacity, n); d++) {
+			long f = (long)((playhead + d) % n);
+			if(findSlot(f) < 0) {
+				want = f;
+				break;
+			}
+		}
+		if(want < 0) {
+			moved.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		bool ok = decode(prefetchIn, lineOffsets[want], scratch);
+		lock.lock();
+
+		// The playhead may have moved while decoding
+		if(ok && inWindow(want) && findSlot(want) < 0) {
+			int s = findVictim();
+			if(s >= 0) {
+				swap(slots[s].pose, scratch);
+				slots[s].frame = want;
+			}
+		}
+	}
+}
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef CLIPSTREAM_H
+#define CLIPSTREAM_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "ShapeSkin.h"
+
+/**
+ * Plays a _skel.txt clip without loading it. open() only records where each
+ * frame's line starts; frames are decoded on demand into a small ring of
+ * slots. A background thread keeps the slots filled with the frames just
+ * after the playhead, wrapping around the end of the clip, so memory stays
+ * at capacity * boneCount bones however long the clip is.
+ *
+ * As in loadBoneAnimation, the first data line is the bind pose and frame k
+ * is the (k + 1)th data line.
+ */
+class ClipStream
+{
+public:
+	ClipStream(size_t capacity = 32);
+	virtual ~ClipStream();
+
+	bool open(const std::string &filename);
+	void close();
+
+	size_t getFrameCount() const { return lineOffsets.size(); }
+	size_t getBoneCount() const { return boneCount; }
+	const Frame &getBindPose() const { return bindPose; }
+
+	// Frame k, valid until the next call. Moves the playhead to k. If the
+	// prefetcher has not reached k yet (a seek), only that one frame is
+	// decoded here; this never waits on the background thread.
+	const Frame &getFrame(size_t k);
+
+	size_t getHits() const { return hits; }
+	size_t getMisses() const { return misses; }
+
+private:
+	struct Slot
+	{
+		long frame;
+		Frame pose;
+		Slot() : frame(-1), pose(0) {}
+	};
+
+	bool decode(std::ifstream &in, std::streamoff offset, Frame &pose) const;
+	bool inWindow(long frame) const;
+	int findSlot(long frame) const;
+	int findVictim() const;
+	void prefetchLoop();
+
+	std::string filename;
+	size_t capacity;
+	size_t boneCount;
+	Frame bindPose;
+	std::vector<std::streamoff> lineOffsets;
+
+	std::vector<Slot> slots;
+	size_t playhead;
+	std::ifstream mainIn; // Used by getFrame() on a miss
+	std::ifstream prefetchIn; // Used by the background thread
+
+	std::thread prefetcher;
+	std::mutex slotMutex;
+	std::condition_variable moved;
+	bool quit;
+	size_t hits;
+	size_t misses;
+};
+
+#endif
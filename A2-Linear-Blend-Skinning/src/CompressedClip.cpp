@@ -0,0 +1,333 @@
+#include <cmath>
+#include <algorithm>
+
+#include "CompressedClip.h"
+
+using namespace std;
+
+static const float SQRT1_2 = 0.70710678f;
+static const float ROT_STEPS = 32767.0f;
+static const float POS_STEPS = 65535.0f;
+
+// Smallest-three: the three smaller components in 15 bits each, the index of
+// the largest in the top bit of the first two words.
+static void packQuat(glm::quat q, uint16_t *out)
+{
+	float c[4] = {q.x, q.y, q.z, q.w};
+	int largest = 0;
+	for(int i = 1; i < 4; i++) {
+		if(fabs(c[i]) > fabs(c[largest])) {
+			largest = i;
+		}
+	}
+	// q and -q are the same rotation; make the dropped component positive
+	float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+	int k = 0;
+	for(int i = 0; i < 4; i++) {
+		if(i == largest) {
+			continue;
+		}
+		float v = (sign * c[i] / SQRT1_2) * 0.5f + 0.5f;
+		out[k++] = (uint16_t)(glm::clamp(v, 0.0f, 1.0f) * ROT_STEPS + 0.5f);
+	}
+	out[0] |= (largest & 1) << 15;
+	out[1] |= (largest >> 1) << 15;
+}
+
+static glm::quat unpackQuat(const uint16_t *in)
+{
+	int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+	float c[4];
+	float sum = 0.0f;
+	int k = 0;
+	for(int i = 0; i < 4; i++) {
+		if(i == largest) {
+			continue;
+		}
+		float v = (in[k++] & 0x7FFF) / ROT_STEPS;
+		c[i] = (v * 2.0f - 1.0f) * SQRT1_2;
+		sum += c[i] * c[i];
+	}
+	c[largest] = sqrt(max(0.0f, 1.0f - sum));
+	return glm::quat(c[3], c[0], c[1], c[2]);
+}
+
+static float angleBetween(const glm::quat &a, const glm::quat &b)
+{
+	float d = fabs(glm::dot(a, b));
+	return 2.0f * acos(min(1.0f, d));
+}
+
+// Douglas-Peucker style key reduction. err(a, b, f) is the error at frame f
+// when it is interpolated from kept keys a and b. Returns the kept frames.
+template <typename ErrorFn>
+static vector<uint32_t> reduceKeys(uint32_t n, float tolerance, ErrorFn err)
+{
+	vector<bool> keep(n, false);
+	keep[0] = true;
+	keep[n - 1] = true;
+	vector< pair<uint32_t, uint32_t> > stack;
+	if(n > 2) {
+		stack.push_back(make_pair(0u, n - 1));
+	}
+	while(!stack.empty()) {
+		uint32_t a = stack.back().first;
+		uint32_t b = stack.back().second;
+		stack.pop_back();
+		float worst = 0.0f;
+		uint32_t worstFrame = a;
+		for(uint32_t f = a + 1; f < b; f++) {
+			float e = err(a, b, f);
+			if(e > worst) {
+				worst = e;
+				worstFrame = f;
+			}
+		}
+		if(worst > tolerance) {
+			keep[worstFrame] = true;
+			if(worstFrame - a > 1) {
+				stack.push_back(make_pair(a, worstFrame));
+			}
+			if(b - worstFrame > 1) {
+				stack.push_back(make_pair(worstFrame, b));
+			}
+		}
+	}
+	vector<uint32_t> keys;
+	for(uint32_t f = 0; f < n; f++) {
+		if(keep[f]) {
+			keys.push_back(f);
+		}
+	}
+	return keys;
+}
+
+CompressedClip::CompressedClip() :
+	frameCount(0)
+{
+}
+
+CompressedClip::~CompressedClip()
+{
+}
+
+void CompressedClip::compress(const vector<Frame> &frames, float rotTolerance, float posTolerance)
+{
+	rotTracks.clear();
+	rotKeyFrames.clear();
+	rotKeyData.clear();
+	posTracks.clear();
+	posKeyFrames.clear();
+	posKeyData.clear();
+	frameCount = frames.size();
+	if(frameCount == 0) {
+		return;
+	}
+	uint32_t n = (uint32_t)frameCount;
+	size_t boneCount = frames[0].bonePlacements.size();
+
+	vector<glm::quat> raw(n), quantized(n);
+	vector<glm::vec3> rawPos(n), quantizedPos(n);
+	vector<uint16_t> packed(3 * n);
+	for(size_t j = 0; j < boneCount; j++) {
+		// Rotation track
+		for(uint32_t f = 0; f < n; f++) {
+			const glm::mat4 &M = frames[f].bonePlacements[j].quatMat;
+			raw[f] = glm::normalize(glm::quat_cast(glm::mat3(M)));
+			rawPos[f] = glm::vec3(M[3]);
+			packQuat(raw[f], &packed[3*f]);
+			quantized[f] = unpackQuat(&packed[3*f]);
+		}
+		vector<uint32_t> keys = reduceKeys(n, rotTolerance, [&](uint32_t a, uint32_t b, uint32_t f) {
+			float alpha = (f - a) / (float)(b - a);
+			return angleBetween(nlerp(quantized[a], quantized[b], alpha), raw[f]);
+		});
+		RotTrack rt;
+		rt.firstKey = (uint32_t)rotKeyFrames.size();
+		rt.keyCount = (uint32_t)keys.size();
+		rotTracks.push_back(rt);
+		for(uint32_t f : keys) {
+			rotKeyFrames.push_back(f);
+			rotKeyData.insert(rotKeyData.end(), &packed[3*f], &packed[3*f] + 3);
+		}
+
+		// Translation track
+		glm::vec3 lo = rawPos[0];
+		glm::vec3 hi = rawPos[0];
+		for(uint32_t f = 1; f < n; f++) {
+			lo = glm::min(lo, rawPos[f]);
+			hi = glm::max(hi, rawPos[f]);
+		}
+		PosTrack pt;
+		pt.firstKey = (uint32_t)posKeyFrames.size();
+		glm::vec3 extent = hi - lo;
+		if(max(extent.x, max(extent.y, extent.z)) <= 2.0f * posTolerance) {
+			// Constant: the midpoint is within tolerance of every sample
+			pt.keyCount = 0;
+			pt.offset = 0.5f * (lo + hi);
+			pt.scale = glm::vec3(0.0f);
+			posTracks.push_back(pt);
+			continue;
+		}
+		pt.offset = lo;
+		pt.scale = extent / POS_STEPS;
+		for(uint32_t f = 0; f < n; f++) {
+			for(int c = 0; c < 3; c++) {
+				float v = pt.scale[c] > 0.0f ? (rawPos[f][c] - lo[c]) / pt.scale[c] : 0.0f;
+				packed[3*f + c] = (uint16_t)(glm::clamp(v, 0.0f, POS_STEPS) + 0.5f);
+				quantizedPos[f][c] = lo[c] + packed[3*f + c] * pt.scale[c];
+			}
+		}
+		keys = reduceKeys(n, posTolerance, [&](uint32_t a, uint32_t b, uint32_t f) {
+			float alpha = (f - a) / (float)(b - a);
+			return glm::length(glm::mix(quantizedPos[a], quantizedPos[b], alpha) - rawPos[f]);
+		});
+		pt.keyCount = (uint32_t)keys.size();
+		posTracks.push_back(pt);
+		for(uint32_t f : keys) {
+			posKeyFrames.push_back(f);
+			posKeyData.insert(posKeyData.end(), &packed[3*f], &packed[3*f] + 3);
+		}
+	}
+}
+
+glm::quat CompressedClip::decodeRot(uint32_t key) const
+{
+	return unpackQuat(&rotKeyData[3 * key]);
+}
+
+glm::vec3 CompressedClip::decodePos(const PosTrack &t, uint32_t key) const
+{
+	const uint16_t *p = &posKeyData[3 * key];
+	return t.offset + t.scale * glm::vec3(p[0], p[1], p[2]);
+}
+
+// Index of the last key at or before 'frame' within [first, first + count)
+static uint32_t findKey(const vector<uint32_t> &keyFrames, uint32_t first, uint32_t count, float frame)
+{
+	auto begin = keyFrames.begin() + first;
+	auto it = upper_bound(begin, begin + count, frame, [](float f, uint32_t k) { return f < (float)k; });
+	return first + (uint32_t)max((ptrdiff_t)0, (it - begin) - 1);
+}
+
+void CompressedClip::decode(float frame, Pose &pose) const
+{
+	size_t boneCount = rotTracks.size();
+	pose.resize(boneCount);
+	frame = glm::clamp(frame, 0.0f, (float)(frameCount - 1));
+	for(size_t j = 0; j < boneCount; j++) {
+		const RotTrack &rt = rotTracks[j];
+		uint32_t a = findKey(rotKeyFrames, rt.firstKey, rt.keyCount, frame);
+		if(a + 1 < rt.firstKey + rt.keyCount) {
+			float fa = (float)rotKeyFrames[a];
+			float alpha = (frame - fa) / (rotKeyFrames[a + 1] - fa);
+			pose.rot[j] = nlerp(decodeRot(a), decodeRot(a + 1), alpha);
+		} else {
+			pose.rot[j] = decodeRot(a);
+		}
+
+		const PosTrack &pt = posTracks[j];
+		if(pt.keyCount == 0) {
+			pose.pos[j] = pt.offset;
+			continue;
+		}
+		a = findKey(posKeyFrames, pt.firstKey, pt.keyCount, frame);
+		if(a + 1 < pt.firstKey + pt.keyCount) {
+			float fa = (float)posKeyFrames[a];
+			float alpha = (frame - fa) / (posKeyFrames[a + 1] - fa);
+			pose.pos[j] = glm::mix(decodePos(pt, a), decodePos(pt, a + 1), alpha);
+		} else {
+			pose.pos[j] = decodePos(pt, a);
+		}
+	}
+}
+
+// Same, from the key k it was at last time: a few steps forward, otherwise
+// the binary search
+static uint32_t advanceKey(const vector<uint32_t> &keyFrames, uint32_t first, uint32_t count, float frame, uint32_t k)
+{
+	const int MAX_STEPS = 4;
+	uint32_t end = first + count;
+	if(k >= first && k < end && (float)keyFrames[k] <= frame) {
+		for(int s = 0; s < MAX_STEPS; s++) {
+			if(k + 1 == end || (float)keyFrames[k + 1] > frame) {
+				return k;
+			}
+			k++;
+		}
+	}
+	return findKey(keyFrames, first, count, frame);
+}
+
+void CompressedClip::decode(float frame, Pose &pose, Cursor &cursor) const
+{
+	size_t boneCount = rotTracks.size();
+	if(cursor.rot.size() != boneCount) {
+		// No key is cached yet
+		cursor.rot.assign(boneCount, ~0u);
+		cursor.pos.assign(boneCount, ~0u);
+		cursor.rotA.resize(boneCount);
+		cursor.rotB.resize(boneCount);
+		cursor.posA.resize(boneCount);
+		cursor.posB.resize(boneCount);
+	}
+	pose.resize(boneCount);
+	frame = glm::clamp(frame, 0.0f, (float)(frameCount - 1));
+	for(size_t j = 0; j < boneCount; j++) {
+		const RotTrack &rt = rotTracks[j];
+		uint32_t a = advanceKey(rotKeyFrames, rt.firstKey, rt.keyCount, frame, cursor.rot[j]);
+		bool next = a + 1 < rt.firstKey + rt.keyCount;
+		if(a != cursor.rot[j]) {
+			cursor.rot[j] = a;
+			cursor.rotA[j] = decodeRot(a);
+			cursor.rotB[j] = next ? decodeRot(a + 1) : cursor.rotA[j];
+		}
+		if(next) {
+			float fa = (float)rotKeyFrames[a];
+			float alpha = (frame - fa) / (rotKeyFrames[a + 1] - fa);
+			pose.rot[j] = nlerp(cursor.rotA[j], cursor.rotB[j], alpha);
+		} else {
+			pose.rot[j] = cursor.rotA[j];
+		}
+
+		const PosTrack &pt = posTracks[j];
+		if(pt.keyCount == 0) {
+			pose.pos[j] = pt.offset;
+			continue;
+		}
+		a = advanceKey(posKeyFrames, pt.firstKey, pt.keyCount, frame, cursor.pos[j]);
+		next = a + 1 < pt.firstKey + pt.keyCount;
+		if(a != cursor.pos[j]) {
+			cursor.pos[j] = a;
+			cursor.posA[j] = decodePos(pt, a);
+			cursor.posB[j] = next ? decodePos(pt, a + 1) : cursor.posA[j];
+		}
+		if(next) {
+			float fa = (float)posKeyFrames[a];
+			float alpha = (frame - fa) / (posKeyFrames[a + 1] - fa);
+			pose.pos[j] = glm::mix(cursor.posA[j], cursor.posB[j], alpha);
+		} else {
+			pose.pos[j] = cursor.posA[j];
+		}
+	}
+}
+
+size_t CompressedClip::getConstantTrackCount() const
+{
+	size_t n = 0;
+	for(const auto &t : posTracks) {
+		n += (t.keyCount == 0);
+	}
+	return n;
+}
+
+size_t CompressedClip::getByteSize() const
+{
+	return sizeof(*this) +
+		rotTracks.size() * sizeof(RotTrack) +
+		rotKeyFrames.size() * sizeof(uint32_t) +
+		rotKeyData.size() * sizeof(uint16_t) +
+		posTracks.size() * sizeof(PosTrack) +
+		posKeyFrames.size() * sizeof(uint32_t) +
+		posKeyData.size() * sizeof(uint16_t);
+}
@@ -0,0 +1,91 @@
+#pragma once
+#ifndef COMPRESSEDCLIP_H
+#define COMPRESSEDCLIP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Pose.h"
+#include "ShapeSkin.h"
+
+/**
+ * Compressed storage for a clip of world-space bone transforms.
+ *
+ * Rotations are stored smallest-three: the largest quaternion component is
+ * dropped (and rebuilt from unit length), the other three are quantized to
+ * 15 bits, and the 2-bit index of the dropped one goes in the spare bits.
+ * That is 6 bytes per key instead of a 64-byte matrix.
+ *
+ * Translations that stay within the tolerance for the whole clip are stored
+ * once. The rest are quantized to 16 bits per component over the track's
+ * range.
+ *
+ * Each track then drops every key that linear interpolation of its
+ * neighbours reproduces within the tolerance. The frames between two kept
+ * keys are measured against the raw data, interpolating the quantized keys,
+ * so the bound covers both steps there. The kept keys themselves are not
+ * checked: their only error is quantization, at most half a step.
+ */
+class CompressedClip
+{
+public:
+	CompressedClip();
+	virtual ~CompressedClip();
+
+	// rotTolerance in radians, posTolerance in model units
+	void compress(const std::vector<Frame> &frames, float rotTolerance, float posTolerance);
+
+	// Where a character's last decode() was in each track, with the keys
+	// around it already unpacked. Each character playing the clip keeps its
+	// own; the clip stays shared.
+	struct Cursor
+	{
+		std::vector<uint32_t> rot; // key at or before the frame, per bone
+		std::vector<uint32_t> pos;
+		std::vector<glm::quat> rotA, rotB; // that key and the next
+		std::vector<glm::vec3> posA, posB;
+	};
+
+	// Pose at a (possibly fractional) frame. Keys are found by binary search,
+	// so this is stateless and can be called for many characters at once.
+	void decode(float frame, Pose &pose) const;
+	// Same, starting each track from the cursor's key, so playing forward
+	// finds the next keys in a step or two and only unpacks keys it has not
+	// reached before. Falls back to the search when the frame goes back (a
+	// loop or a seek) or jumps several keys ahead.
+	void decode(float frame, Pose &pose, Cursor &cursor) const;
+
+	size_t getFrameCount() const { return frameCount; }
+	size_t getBoneCount() const { return rotTracks.size(); }
+	size_t getKeyCount() const { return rotKeyFrames.size() + posKeyFrames.size(); }
+	size_t getConstantTrackCount() const;
+	size_t getByteSize() const;
+
+private:
+	struct RotTrack
+	{
+		uint32_t firstKey;
+		uint32_t keyCount;
+	};
+	struct PosTrack
+	{
+		uint32_t firstKey;
+		uint32_t keyCount; // 0: constant, value is 'offset'
+		glm::vec3 offset;
+		glm::vec3 scale;
+	};
+
+	glm::quat decodeRot(uint32_t key) const;
+	glm::vec3 decodePos(const PosTrack &t, uint32_t key) const;
+
+	size_t frameCount;
+	std::vector<RotTrack> rotTracks;
+	std::vector<uint32_t> rotKeyFrames;
+	std::vector<uint16_t> rotKeyData; // 3 per key
+	std::vector<PosTrack> posTracks;
+	std::vector<uint32_t> posKeyFrames;
+	std::vector<uint16_t> posKeyData; // 3 per key
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <fstream>
+
+#ifdef A2_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+#include <GLFW/glfw3.h>
+
+#include "Headless.h"
+#include "GLSL.h"
+
+using namespace std;
+
+Headless::Headless() :
+	width(0),
+	height(0),
+	fboID(0),
+	colorBufID(0),
+	depthBufID(0),
+	display(NULL),
+	context(NULL),
+	window(NULL)
+{
+}
+
+Headless::~Headless()
+{
+	if(fboID) {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &fboID);
+		glDeleteRenderbuffers(1, &colorBufID);
+		glDeleteRenderbuffers(1, &depthBufID);
+	}
+#ifdef A2_EGL
+	if(display) {
+		eglMakeCurrent((EGLDisplay)display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if(context) {
+			eglDestroyContext((EGLDisplay)display, (EGLContext)context);
+		}
+		eglTerminate((EGLDisplay)display);
+	}
+#endif
+	if(window) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
+}
+
+bool Headless::isEGL() const
+{
+	return context != NULL;
+}
+
+bool Headless::createContext()
+{
+#ifdef A2_EGL
+	// Surfaceless Mesa first, then whatever the default display is
+	EGLDisplay d = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if(getPlatformDisplay) {
+		d = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	if(d == EGL_NO_DISPLAY) {
+		d = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if(d != EGL_NO_DISPLAY && eglInitialize(d, &major, &minor)) {
+		display = d;
+		eglBindAPI(EGL_OPENGL_API);
+		const EGLint attribs[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT, EGL_NONE};
+		EGLConfig config;
+		EGLint count = 0;
+		eglChooseConfig(d, attribs, &config, 1, &count);
+		// Needs EGL_KHR_no_config_context when no config matches
+		EGLContext c = eglCreateContext(d, count > 0 ? config : (EGLConfig)0, EGL_NO_CONTEXT, NULL);
+		if(c != EGL_NO_CONTEXT && eglMakeCurrent(d, EGL_NO_SURFACE, EGL_NO_SURFACE, c)) {
+			context = c;
+			return true;
+		}
+		cerr << "EGL: no surfaceless OpenGL context (error " << hex << eglGetError() << dec << "), trying GLFW" << endl;
+	}
+#endif
+	if(!glfwInit()) {
+		return false;
+	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	window = glfwCreateWindow(64, 64, "A2", NULL, NULL);
+	if(!window) {
+		glfwTerminate();
+		return false;
+	}
+	glfwMakeContextCurrent(window);
+	return true;
+}
+
+bool Headless::createFramebuffer(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	glGenRenderbuffers(1, &colorBufID);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBufID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glGenRenderbuffers(1, &depthBufID);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBufID);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &fboID);
+	glBindFramebuffer(GL_FRAMEBUFFER, fboID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBufID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBufID);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if(status != GL_FRAMEBUFFER_COMPLETE) {
+		cerr << "Offscreen framebuffer incomplete: " << hex << status << dec << endl;
+		return false;
+	}
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void Headless::readPixels(vector<unsigned char> &rgba) const
+{
+	rgba.resize(4 * width * height);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+}
+
+bool Headless::writeFrame(const string &path, Format format, const vector<unsigned char> &rgba) const
+{
+	ofstream out(path, ios::binary);
+	if(!out.good()) {
+		cerr << "Cannot write " << path << endl;
+		return false;
+	}
+	if(format == RAW) {
+		out.write((const char *)&rgba[0], rgba.size());
+		return out.good();
+	}
+	// GL rows start at the bottom, PPM rows at the top
+	out << "P6\n" << width << " " << height << "\n255\n";
+	vector<unsigned char> row(3 * width);
+	for(int y = height - 1; y >= 0; y--) {
+		const unsigned char *src = &rgba[4 * width * y];
+		for(int x = 0; x < width; x++) {
+			row[3*x] = src[4*x];
+			row[3*x + 1] = src[4*x + 1];
+			row[3*x + 2] = src[4*x + 2];
+		}
+		out.write((const char *)&row[0], row.size());
+	}
+	return out.good();
+}
@@ -0,0 +1,59 @@
+#pragma once
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <string>
+#include <vector>
+
+struct GLFWwindow;
+
+/**
+ * Offscreen rendering for batch runs: a GL context with no visible window
+ * and a framebuffer object of a fixed size to draw into and read back.
+ *
+ * With A2_EGL (defined by CMake when libEGL is found) the context comes
+ * from EGL with no surface, so no display server is needed; under Mesa,
+ * LIBGL_ALWAYS_SOFTWARE=1 forces the llvmpipe software rasterizer.
+ * Otherwise a hidden GLFW window provides the context. Either way nothing
+ * is presented, so there is no vsync.
+ */
+class Headless
+{
+public:
+	enum Format
+	{
+		PPM, // binary RGB, top row first
+		RAW  // RGBA bytes as read back, bottom row first
+	};
+
+	Headless();
+	virtual ~Headless();
+
+	// Creates the context and makes it current. Call before glewInit().
+	bool createContext();
+	// GLEW must be initialized by now. Leaves the framebuffer bound.
+	bool createFramebuffer(int width, int height);
+	int getWidth() const { return width; }
+	int getHeight() const { return height; }
+	bool isEGL() const;
+
+	void readPixels(std::vector<unsigned char> &rgba) const;
+	bool writeFrame(const std::string &path, Format format, const std::vector<unsigned char> &rgba) const;
+	static const char *getExtension(Format format) { return format == PPM ? ".ppm" : ".raw"; }
+
+private:
+	int width;
+	int height;
+	GLuint fboID;
+	GLuint colorBufID;
+	GLuint depthBufID;
+	// EGL display and context (as void * so EGL stays out of this header)
+	void *display;
+	void *context;
+	GLFWwindow *window;
+};
+
+#endif
@@ -0,0 +1,114 @@
+#include "JobPool.h"
+
+using namespace std;
+
+JobPool::JobPool(int threadCount) :
+	pending(0),
+	queued(0),
+	nextQueue(0),
+	quit(false)
+{
+	if(threadCount <= 0) {
+		threadCount = max(1, (int)thread::hardware_concurrency());
+	}
+	for(int i = 0; i < threadCount; i++) {
+		queues.push_back(unique_ptr<Queue>(new Queue()));
+	}
+	for(int i = 1; i < threadCount; i++) {
+		workers.push_back(thread(&JobPool::workerLoop, this, i));
+	}
+}
+
+JobPool::~JobPool()
+{
+	{
+		lock_guard<mutex> lock(sleepMutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(auto &w : workers) {
+		w.join();
+	}
+}
+
+void JobPool::submit(const Job &job)
+{
+	int q = (int)(nextQueue++ % queues.size());
+	pending++;
+	{
+		lock_guard<mutex> lock(queues[q]->mutex);
+		queues[q]->jobs.push_back(job);
+	}
+	queued++;
+	{
+		// Taking the lock orders this with a worker about to sleep
+		lock_guard<mutex> lock(sleepMutex);
+	}
+	wake.notify_one();
+}
+
+bool JobPool::popOrSteal(int self, Job &job)
+{
+	// Own queue first, newest job (still warm in cache)
+	{
+		Queue &q = *queues[self];
+		lock_guard<mutex> lock(q.mutex);
+		if(!q.jobs.empty()) {
+			job = move(q.jobs.back());
+			q.jobs.pop_back();
+			queued--;
+			return true;
+		}
+	}
+	// Then steal the oldest job from someone else
+	int n = (int)queues.size();
+	for(int i = 1; i < n; i++) {
+		Queue &q = *queues[(self + i) % n];
+		lock_guard<mutex> lock(q.mutex);
+		if(!q.jobs.empty()) {
+			job = move(q.jobs.front());
+			q.jobs.pop_front();
+			queued--;
+			return true;
+		}
+	}
+	return false;
+}
+
+void JobPool::workerLoop(int self)
+{
+	Job job;
+	while(true) {
+		if(popOrSteal(self, job)) {
+			job();
+			if(--pending == 0) {
+				lock_guard<mutex> lock(sleepMutex);
+				done.notify_all();
+			}
+			continue;
+		}
+		unique_lock<mutex> lock(sleepMutex);
+		wake.wait(lock, [this] { return quit || queued > 0; });
+		if(quit) {
+			return;
+		}
+	}
+}
+
+void JobPool::wait()
+{
+	Job job;
+	while(pending > 0) {
+		if(popOrSteal(0, job)) {
+			job();
+			if(--pending == 0) {
+				lock_guard<mutex> lock(sleepMutex);
+				done.notify_all();
+			}
+		} else {
+			// Nothing left to take; wait for the running jobs to finish
+			unique_lock<mutex> lock(sleepMutex);
+			done.wait(lock, [this] { return pending == 0; });
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef JOBPOOL_H
+#define JOBPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+/**
+ * Fixed set of worker threads with one job deque each. submit() deals jobs
+ * out round-robin; a worker pops from the back of its own deque and, when
+ * that is empty, steals from the front of the others. The thread calling
+ * wait() works on the queues too, so a pool of N threads has N-1 workers.
+ */
+class JobPool
+{
+public:
+	typedef std::function<void()> Job;
+
+	// threadCount <= 0 uses every hardware thread
+	JobPool(int threadCount = 0);
+	virtual ~JobPool();
+
+	void submit(const Job &job);
+	// Blocks until every submitted job has finished
+	void wait();
+	int getThreadCount() const { return (int)queues.size(); }
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<Job> jobs;
+	};
+
+	bool popOrSteal(int self, Job &job);
+	void workerLoop(int self);
+
+	std::vector< std::unique_ptr<Queue> > queues; // queues[0] belongs to the waiting thread
+	std::vector<std::thread> workers;
+	std::atomic<int> pending; // submitted but not finished
+	std::atomic<int> queued;  // submitted but not yet taken by a thread
+	std::atomic<unsigned int> nextQueue;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	bool quit;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include <iostream>
+#include <algorithm>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "MeshOptimizer.h"
+
+using namespace std;
+
+VertexCacheStats analyzeVertexCache(const vector<unsigned int> &indices, size_t vertCount, int cacheSize)
+{
+	VertexCacheStats stats = {0.0f, 0.0f};
+	// stamp[v] is the miss count right after v entered the cache, 0 if it
+	// never did; v is still in a FIFO cache while fewer than cacheSize
+	// vertices came in after it
+	vector<unsigned int> stamp(vertCount, 0);
+	unsigned int misses = 0;
+	size_t used = 0;
+	for(unsigned int v : indices) {
+		if(stamp[v] == 0) {
+			used++;
+		}
+		if(stamp[v] == 0 || misses - stamp[v] >= (unsigned int)cacheSize) {
+			stamp[v] = ++misses;
+		}
+	}
+	if(!indices.empty()) {
+		stats.acmr = (float)misses / (indices.size() / 3);
+		stats.atvr = (float)misses / used;
+	}
+	return stats;
+}
+
+void optimizeVertexCache(vector<unsigned int> &indices, size_t vertCount, int cacheSize, vector<unsigned int> *clusters)
+{
+	size_t triCount = indices.size() / 3;
+	if(clusters) {
+		clusters->clear();
+	}
+	if(triCount == 0) {
+		return;
+	}
+	// Triangles around each vertex, in CSR form
+	vector<unsigned int> adjStart(vertCount + 1, 0);
+	for(unsigned int v : indices) {
+		adjStart[v + 1]++;
+	}
+	for(size_t v = 0; v < vertCount; v++) {
+		adjStart[v + 1] += adjStart[v];
+	}
+	vector<unsigned int> adj(indices.size());
+	vector<unsigned int> fill(adjStart.begin(), adjStart.end() - 1);
+	for(size_t i = 0; i < indices.size(); i++) {
+		adj[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+	// Triangles not emitted yet around each vertex
+	vector<unsigned int> live(vertCount);
+	for(size_t v = 0; v < vertCount; v++) {
+		live[v] = adjStart[v + 1] - adjStart[v];
+	}
+
+	vector<unsigned int> cacheTime(vertCount, 0);
+	vector<unsigned char> emitted(triCount, 0);
+	vector<unsigned int> deadEnd; // recently emitted vertices, to restart from
+	vector<unsigned int> candidates;
+	vector<unsigned int> out;
+	out.reserve(indices.size());
+	unsigned int time = cacheSize + 1;
+	size_t cursor = 0;
+	long fan = indices[0];
+	bool jumped = true;
+	while(fan >= 0) {
+		if(jumped && clusters) {
+			clusters->push_back((unsigned int)(out.size() / 3));
+		}
+		// Emit the fan's remaining triangles
+		candidates.clear();
+		for(unsigned int i = adjStart[fan]; i < adjStart[fan + 1]; i++) {
+			unsigned int t = adj[i];
+			if(emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			for(int k = 0; k < 3; k++) {
+				unsigned int v = indices[3 * t + k];
+				out.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				if(time - cacheTime[v] > (unsigned int)cacheSize) {
+					cacheTime[v] = time++;
+				}
+			}
+		}
+		// Next fan: the oldest candidate whose remaining triangles still
+		// fit before it leaves the cache, else any candidate with some left
+		fan = -1;
+		long best = -1;
+		for(unsigned int v : candidates) {
+			if(live[v] == 0) {
+				continue;
+			}
+			long priority = 0;
+			if(time - cacheTime[v] + 2 * live[v] <= (unsigned int)cacheSize) {
+				priority = time - cacheTime[v];
+			}
+			if(priority > best) {
+				best = priority;
+				fan = v;
+			}
+		}
+		jumped = (fan < 0);
+		// Dead end: back up to a recent vertex, then scan for any left
+		while(fan < 0 && !deadEnd.empty()) {
+			unsigned int v = deadEnd.back();
+			deadEnd.pop_back();
+			if(live[v] > 0) {
+				fan = v;
+			}
+		}
+		while(fan < 0 && cursor < vertCount) {
+			if(live[cursor] > 0) {
+				fan = (long)cursor;
+			} else {
+				cursor++;
+			}
+		}
+	}
+	indices.swap(out);
+}
+
+void optimizeOverdraw(vector<unsigned int> &indices, const vector<float> &pos, const vector<unsigned int> &clusters)
+{
+	size_t triCount = indices.size() / 3;
+	if(clusters.size() < 2 || pos.empty()) {
+		return;
+	}
+	// Area-weighted center and normal of each cluster and of the mesh
+	size_t clusterCount = clusters.size();
+	vector<glm::vec3> center(clusterCount, glm::vec3(0.0f));
+	vector<glm::vec3> normal(clusterCount, glm::vec3(0.0f));
+	vector<float> area(clusterCount, 0.0f);
+	glm::vec3 meshCenter(0.0f);
+	float meshArea = 0.0f;
+	for(size_t c = 0; c < clusterCount; c++) {
+		size_t end = (c + 1 < clusterCount) ? clusters[c + 1] : triCount;
+		for(size_t t = clusters[c]; t < end; t++) {
+			glm::vec3 p[3];
+			for(int k = 0; k < 3; k++) {
+				const float *v = &pos[3 * indices[3 * t + k]];
+				p[k] = glm::vec3(v[0], v[1], v[2]);
+			}
+			glm::vec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+			float a = glm::length(n);
+			center[c] += a * (p[0] + p[1] + p[2]) / 3.0f;
+			normal[c] += n;
+			area[c] += a;
+		}
+		meshCenter += center[c];
+		meshArea += area[c];
+		if(area[c] > 0.0f) {
+			center[c] /= area[c];
+		}
+	}
+	if(meshArea > 0.0f) {
+		meshCenter /= meshArea;
+	}
+	// Clusters facing out from the center first
+	vector<float> key(clusterCount, 0.0f);
+	for(size_t c = 0; c < clusterCount; c++) {
+		float len = glm::length(normal[c]);
+		if(len > 0.0f) {
+			key[c] = glm::dot(center[c] - meshCenter, normal[c] / len);
+		}
+	}
+	vector<unsigned int> order(clusterCount);
+	for(size_t c = 0; c < clusterCount; c++) {
+		order[c] = (unsigned int)c;
+	}
+	stable_sort(order.begin(), order.end(), [&key](unsigned int a, unsigned int b) { return key[a] > key[b]; });
+
+	vector<unsigned int> out;
+	out.reserve(indices.size());
+	for(unsigned int c : order) {
+		size_t end = (c + 1 < clusterCount) ? clusters[c + 1] : triCount;
+		out.insert(out.end(), indices.begin() + 3 * clusters[c], indices.begin() + 3 * end);
+	}
+	indices.swap(out);
+}
+
+void optimizeVertexFetch(vector<unsigned int> &indices, size_t vertCount, vector<unsigned int> &remap)
+{
+	remap.assign(vertCount, ~0u);
+	unsigned int next = 0;
+	for(unsigned int &v : indices) {
+		if(remap[v] == ~0u) {
+			remap[v] = next++;
+		}
+		v = remap[v];
+	}
+	for(size_t v = 0; v < vertCount; v++) {
+		if(remap[v] == ~0u) {
+			remap[v] = next++;
+		}
+	}
+}
+
+void optimizeMesh(const string &name, vector<unsigned int> &indices, const vector<float> &pos, vector<unsigned int> &remap, bool overdraw)
+{
+	size_t vertCount = pos.size() / 3;
+	VertexCacheStats before = analyzeVertexCache(indices, vertCount);
+	vector<unsigned int> clusters;
+	optimizeVertexCache(indices, vertCount, 16, &clusters);
+	if(overdraw) {
+		optimizeOverdraw(indices, pos, clusters);
+	}
+	VertexCacheStats after = analyzeVertexCache(indices, vertCount);
+	optimizeVertexFetch(indices, vertCount, remap);
+	cout << name << ": ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+		<< " (" << clusters.size() << " clusters)" << endl;
+}
@@ -14,10 +14,11 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "ShapeSkin.h"
+#include "BinaryCache.h"
 
 extern std::string DATA_DIR;
 
-void loadBoneAnimation(std::string skeletonData){
+inline void loadBoneAnimation(std::string skeletonData){
 	//std::string filename = DATA_DIR + "bigvegas_Capoeira_skel.txt";
 	std::string filename = DATA_DIR + skeletonData;
 	std::ifstream in;
@@ -89,4 +90,53 @@ void loadBoneAnimation(std::string skeletonData){
 	in.close();
 }
 
+// Skeleton bundle layout: the bind pose, then every frame, as raw Bones
+enum SkelCacheSection { CACHE_BIND_POSE, CACHE_FRAMES };
+enum SkelCacheCount { CACHE_FRAME_COUNT, CACHE_SKEL_BONE_COUNT };
+
+// Same result as loadBoneAnimation, through the binary cache. Maps the
+// bundle if it is fresh; otherwise parses the text file and cooks one.
+inline void loadBoneAnimationCached(std::string skeletonData){
+	std::string filename = DATA_DIR + skeletonData;
+	std::string path = BinaryCache::getPath(filename);
+	std::vector<std::string> sources = {filename};
+
+	BinaryCache cache;
+	if(cache.open(path, sources)) {
+		size_t numFrames = cache.getCount(CACHE_FRAME_COUNT);
+		size_t numBones = cache.getCount(CACHE_SKEL_BONE_COUNT);
+		size_t bindBytes, frameBytes;
+		const Bone *bind = (const Bone *)cache.getSection(CACHE_BIND_POSE, bindBytes);
+		const Bone *frames = (const Bone *)cache.getSection(CACHE_FRAMES, frameBytes);
+		if(bindBytes == numBones * sizeof(Bone) && frameBytes == numFrames * numBones * sizeof(Bone)) {
+			bindPose.bonePlacements.assign(bind, bind + numBones);
+			allFrames.assign(numFrames, Frame(0));
+			for(size_t k = 0; k < numFrames; k++) {
+				allFrames[k].bonePlacements.assign(frames + k * numBones, frames + (k + 1) * numBones);
+			}
+			std::cout << "Loaded " << path << std::endl;
+			return;
+		}
+	}
+
+	loadBoneAnimation(skeletonData);
+	if(allFrames.empty()) {
+		return;
+	}
+	size_t numBones = bindPose.bonePlacements.size();
+	std::vector<Bone> frames;
+	frames.reserve(allFrames.size() * numBones);
+	for(const auto &f : allFrames) {
+		frames.insert(frames.end(), f.bonePlacements.begin(), f.bonePlacements.end());
+	}
+	BinaryCache out;
+	out.setCount(CACHE_FRAME_COUNT, allFrames.size());
+	out.setCount(CACHE_SKEL_BONE_COUNT, numBones);
+	out.addSection(bindPose.bonePlacements.data(), numBones * sizeof(Bone));
+	out.addSection(frames.data(), frames.size() * sizeof(Bone));
+	if(out.write(path, sources)) {
+		std::cout << "Cooked " << path << std::endl;
+	}
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#ifndef POSE_H
+#define POSE_H
+
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+// Bone transforms as a rotation and a translation per bone. Either in the
+// same (world) space as the _skel.txt data, or local to the parent joint
+// (see Skeleton). Flat arrays indexed by bone.
+struct Pose
+{
+	std::vector<glm::quat> rot;
+	std::vector<glm::vec3> pos;
+
+	void resize(size_t boneCount)
+	{
+		rot.resize(boneCount);
+		pos.resize(boneCount);
+	}
+	size_t size() const { return rot.size(); }
+};
+
+// Normalized lerp along the shorter arc
+inline glm::quat nlerp(const glm::quat &a, const glm::quat &b, float alpha)
+{
+	float s = glm::dot(a, b) < 0.0f ? -alpha : alpha;
+	glm::quat q((1.0f - alpha) * a.w + s * b.w,
+		(1.0f - alpha) * a.x + s * b.x,
+		(1.0f - alpha) * a.y + s * b.y,
+		(1.0f - alpha) * a.z + s * b.z);
+	return glm::normalize(q);
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include <cmath>
+#include <algorithm>
+
+#include "PoseSampler.h"
+
+using namespace std;
+
+PoseSampler::PoseSampler() :
+	frameCount(0),
+	boneCount(0)
+{
+}
+
+PoseSampler::~PoseSampler()
+{
+}
+
+void PoseSampler::setClip(const vector<Frame> &frames)
+{
+	frameCount = frames.size();
+	boneCount = frameCount > 0 ? frames[0].bonePlacements.size() : 0;
+	rot.resize(frameCount * boneCount);
+	pos.resize(frameCount * boneCount);
+	for(size_t k = 0; k < frameCount; k++) {
+		for(size_t j = 0; j < boneCount; j++) {
+			const glm::mat4 &M = frames[k].bonePlacements[j].quatMat;
+			rot[k * boneCount + j] = glm::normalize(glm::quat_cast(glm::mat3(M)));
+			pos[k * boneCount + j] = glm::vec3(M[3]);
+		}
+	}
+}
+
+void PoseSampler::setClip(const vector<Pose> &frames)
+{
+	frameCount = frames.size();
+	boneCount = frameCount > 0 ? frames[0].size() : 0;
+	rot.resize(frameCount * boneCount);
+	pos.resize(frameCount * boneCount);
+	for(size_t k = 0; k < frameCount; k++) {
+		copy(frames[k].rot.begin(), frames[k].rot.end(), rot.begin() + k * boneCount);
+		copy(frames[k].pos.begin(), frames[k].pos.end(), pos.begin() + k * boneCount);
+	}
+}
+
+const char *PoseSampler::getModeName(Mode mode)
+{
+	switch(mode) {
+		case NLERP: return "nlerp";
+		case SLERP: return "slerp";
+		default: return "step";
+	}
+}
+
+template <typename Out>
+void PoseSampler::sampleInto(float frame, Mode mode, Out out) const
+{
+	if(frameCount == 0) {
+		return;
+	}
+	float f = fmod(frame, (float)frameCount);
+	if(f < 0.0f) {
+		f += frameCount;
+	}
+	size_t a = min((size_t)f, frameCount - 1);
+	size_t b = (a + 1) % frameCount;
+	float alpha = f - a;
+	const glm::quat *ra = &rot[a * boneCount];
+	const glm::quat *rb = &rot[b * boneCount];
+	const glm::vec3 *pa = &pos[a * boneCount];
+	const glm::vec3 *pb = &pos[b * boneCount];
+
+	switch(mode) {
+		case STEP:
+			for(size_t j = 0; j < boneCount; j++) {
+				out(j, ra[j], pa[j]);
+			}
+			break;
+		case NLERP:
+			for(size_t j = 0; j < boneCount; j++) {
+				out(j, nlerp(ra[j], rb[j], alpha), glm::mix(pa[j], pb[j], alpha));
+			}
+			break;
+		case SLERP:
+			for(size_t j = 0; j < boneCount; j++) {
+				out(j, glm::slerp(ra[j], rb[j], alpha), glm::mix(pa[j], pb[j], alpha));
+			}
+			break;
+	}
+}
+
+void PoseSampler::sample(float frame, Mode mode, Pose &pose) const
+{
+	pose.resize(boneCount);
+	sampleInto(frame, mode, [&pose](size_t j, const glm::quat &q, const glm::vec3 &p) {
+		pose.rot[j] = q;
+		pose.pos[j] = p;
+	});
+}
+
+void PoseSampler::sample(float frame, Mode mode, ShapeSkin &shape) const
+{
+	sampleInto(frame, mode, [&shape](size_t j, const glm::quat &q, const glm::vec3 &p) {
+		shape.setPaletteEntry(j, q, p);
+	});
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef POSESAMPLER_H
+#define POSESAMPLER_H
+
+#include <string>
+#include <vector>
+
+#include "Pose.h"
+#include "ShapeSkin.h"
+
+/**
+ * Samples a clip between its stored frames. The clip is converted once to
+ * a rotation and a translation per bone per frame (28 bytes instead of a
+ * 64-byte matrix). sample() blends the two frames around a fractional
+ * frame number: rotations with nlerp or slerp, translations with lerp.
+ * Sampling wraps, so the last frame blends into the first.
+ */
+class PoseSampler
+{
+public:
+	enum Mode
+	{
+		STEP,  // Nearest earlier frame, as before
+		NLERP,
+		SLERP
+	};
+
+	PoseSampler();
+	virtual ~PoseSampler();
+
+	void setClip(const std::vector<Frame> &frames);
+	// Poses are used as they are, so local-space clips blend in local space
+	void setClip(const std::vector<Pose> &frames);
+	size_t getFrameCount() const { return frameCount; }
+	size_t getBoneCount() const { return boneCount; }
+
+	// Into a preallocated pose, or straight into a shape's skinning palette.
+	// Neither allocates once pose has been sized.
+	void sample(float frame, Mode mode, Pose &pose) const;
+	void sample(float frame, Mode mode, ShapeSkin &shape) const;
+
+	static const char *getModeName(Mode mode);
+
+private:
+	template <typename Out>
+	void sampleInto(float frame, Mode mode, Out out) const;
+
+	size_t frameCount;
+	size_t boneCount;
+	std::vector<glm::quat> rot; // [frame * boneCount + bone]
+	std::vector<glm::vec3> pos;
+};
+
+#endif
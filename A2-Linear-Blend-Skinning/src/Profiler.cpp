@@ -0,0 +1,332 @@
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "Profiler.h"
+
+using namespace std;
+
+static double toMs(chrono::steady_clock::duration d)
+{
+	return chrono::duration<double, milli>(d).count();
+}
+
+// Bar colors, repeated past six stages; print() names them for the legend
+static const float colors[][3] = {
+	{0.9f, 0.2f, 0.2f}, {0.2f, 0.7f, 0.2f}, {0.2f, 0.4f, 0.9f},
+	{0.9f, 0.6f, 0.1f}, {0.7f, 0.2f, 0.8f}, {0.1f, 0.7f, 0.7f}
+};
+static const char *colorNames[] = {"red", "green", "blue", "orange", "purple", "cyan"};
+static const int COLOR_COUNT = 6;
+
+Profiler::Profiler() :
+	enabled(false),
+	gpuTiming(false),
+	queryOpen(false),
+	frame(0),
+	resolved(0),
+	frameSum(0.0)
+{
+	reset();
+}
+
+Profiler::~Profiler()
+{
+	closeCSV();
+	for(auto &slot : slots) {
+		for(auto &q : slot.queries) {
+			queryPool.push_back(q.second);
+		}
+	}
+	if(!queryPool.empty()) {
+		glDeleteQueries((GLsizei)queryPool.size(), queryPool.data());
+	}
+}
+
+int Profiler::addStage(const string &name, bool gpu)
+{
+	Stage stage;
+	stage.name = name;
+	stage.gpu = gpu;
+	stages.push_back(stage);
+	reset();
+	return (int)stages.size() - 1;
+}
+
+bool Profiler::setGPUTiming(bool on)
+{
+	if(on && !(GLEW_VERSION_3_3 || GLEW_ARB_timer_query)) {
+		cout << "Profiler: no timer queries, CPU timing only" << endl;
+		on = false;
+	}
+	gpuTiming = on;
+	reset();
+	return gpuTiming;
+}
+
+void Profiler::setEnabled(bool on)
+{
+	if(on != enabled) {
+		enabled = on;
+		reset();
+	}
+}
+
+void Profiler::reset()
+{
+	// Drops the frames in flight; their queries go back to the pool
+	for(auto &slot : slots) {
+		for(auto &q : slot.queries) {
+			queryPool.push_back(q.second);
+		}
+		slot.frame = -1;
+		slot.frameMs = 0.0;
+		slot.cpuMs.assign(stages.size(), 0.0);
+		slot.queries.clear();
+	}
+	if(queryOpen) {
+		glEndQuery(GL_TIME_ELAPSED);
+		queryOpen = false;
+	}
+	for(auto &stage : stages) {
+		stage.sum[0] = stage.sum[1] = 0.0;
+	}
+	history.assign(HISTORY * stages.size() * 2, 0.0);
+	frameHistory.assign(HISTORY, 0.0);
+	frameSum = 0.0;
+	frame = 0;
+	resolved = 0;
+	frameStart = Clock::now();
+}
+
+void Profiler::begin(int stage)
+{
+	Stage &s = stages[stage];
+	if(gpuTiming && s.gpu && !queryOpen) {
+		GLuint query;
+		if(queryPool.empty()) {
+			glGenQueries(1, &query);
+		} else {
+			query = queryPool.back();
+			queryPool.pop_back();
+		}
+		slots[frame % (LATENCY + 1)].queries.push_back(make_pair(stage, query));
+		glBeginQuery(GL_TIME_ELAPSED, query);
+		queryOpen = true;
+	}
+	// Last, so the query calls are not counted
+	s.start = Clock::now();
+}
+
+void Profiler::end(int stage)
+{
+	Clock::time_point now = Clock::now();
+	if(!enabled) {
+		// Disabled while the scope was open
+		return;
+	}
+	Slot &slot = slots[frame % (LATENCY + 1)];
+	slot.cpuMs[stage] += toMs(now - stages[stage].start);
+	if(queryOpen && !slot.queries.empty() && slot.queries.back().first == stage) {
+		glEndQuery(GL_TIME_ELAPSED);
+		queryOpen = false;
+	}
+}
+
+void Profiler::endFrame()
+{
+	if(!enabled) {
+		return;
+	}
+	Clock::time_point now = Clock::now();
+	Slot &slot = slots[frame % (LATENCY + 1)];
+	slot.frame = frame;
+	slot.frameMs = toMs(now - frameStart);
+	frameStart = now;
+	frame++;
+	// The slot to reuse next holds the frame from LATENCY frames ago
+	Slot &next = slots[frame % (LATENCY + 1)];
+	if(next.frame >= 0) {
+		resolve(next);
+	}
+	next.frame = -1;
+	next.cpuMs.assign(stages.size(), 0.0);
+	next.queries.clear();
+}
+
+void Profiler::resolve(Slot &slot)
+{
+	// The row being overwritten leaves the window (rows start out zero)
+	size_t stride = stages.size() * 2;
+	double *row = &history[(resolved % HISTORY) * stride];
+	for(size_t i = 0; i < stages.size(); i++) {
+		stages[i].sum[0] -= row[i * 2];
+		stages[i].sum[1] -= row[i * 2 + 1];
+		row[i * 2] = slot.cpuMs[i];
+		row[i * 2 + 1] = 0.0;
+	}
+	for(auto &q : slot.queries) {
+		// Blocks only if the GPU is more than LATENCY frames behind
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(q.second, GL_QUERY_RESULT, &ns);
+		row[q.first * 2 + 1] += ns * 1e-6;
+		queryPool.push_back(q.second);
+	}
+	slot.queries.clear();
+	for(size_t i = 0; i < stages.size(); i++) {
+		stages[i].sum[0] += row[i * 2];
+		stages[i].sum[1] += row[i * 2 + 1];
+	}
+	double &f = frameHistory[resolved % HISTORY];
+	frameSum += slot.frameMs - f;
+	f = slot.frameMs;
+	if(csv.is_open()) {
+		csv << slot.frame << "," << slot.frameMs;
+		for(size_t i = 0; i < stages.size(); i++) {
+			csv << "," << row[i * 2];
+			if(stages[i].gpu) {
+				csv << "," << row[i * 2 + 1];
+			}
+		}
+		csv << "\n";
+	}
+	resolved++;
+}
+
+bool Profiler::openCSV(const string &filename)
+{
+	closeCSV();
+	csv.open(filename);
+	if(!csv.good()) {
+		cout << "Cannot write to " << filename << endl;
+		return false;
+	}
+	csv << "frame,frame_ms";
+	for(const auto &stage : stages) {
+		csv << "," << stage.name << "_cpu_ms";
+		if(stage.gpu) {
+			csv << "," << stage.name << "_gpu_ms";
+		}
+	}
+	csv << "\n";
+	return true;
+}
+
+void Profiler::closeCSV()
+{
+	if(!csv.is_open()) {
+		return;
+	}
+	// Finish the frames still in flight, oldest first, so none are missing
+	for(int f = max(0, frame - LATENCY); f < frame; f++) {
+		Slot &slot = slots[f % (LATENCY + 1)];
+		if(slot.frame == f) {
+			resolve(slot);
+			slot.frame = -1;
+		}
+	}
+	csv.close();
+}
+
+double Profiler::getCPUMs(int stage) const
+{
+	return resolved ? stages[stage].sum[0] / min(resolved, HISTORY) : 0.0;
+}
+
+double Profiler::getGPUMs(int stage) const
+{
+	return resolved ? stages[stage].sum[1] / min(resolved, HISTORY) : 0.0;
+}
+
+double Profiler::getFrameMs() const
+{
+	return resolved ? frameSum / min(resolved, HISTORY) : 0.0;
+}
+
+void Profiler::print(ostream &out) const
+{
+	out << fixed << setprecision(3) << "frame " << getFrameMs() << " ms";
+	for(size_t i = 0; i < stages.size(); i++) {
+		out << " | " << stages[i].name << " (" << colorNames[i % COLOR_COUNT] << ") " << getCPUMs((int)i);
+		if(stages[i].gpu && gpuTiming) {
+			out << ", gpu " << getGPUMs((int)i);
+		}
+	}
+	out << defaultfloat << endl;
+}
+
+void Profiler::draw(int width, int height, double budgetMs) const
+{
+	if(!enabled) {
+		return;
+	}
+	glPushAttrib(GL_ENABLE_BIT | GL_POLYGON_BIT | GL_LINE_BIT | GL_CURRENT_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_TEXTURE_2D);
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+	glLineWidth(1.0f);
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glOrtho(0.0, width, 0.0, height, -1.0, 1.0);
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	// One bar per stage, the GPU time under it, bottom up; the budget spans
+	// 40% of the width
+	const float margin = 10.0f, barHeight = 8.0f;
+	float msToPx = 0.4f * width / (float)budgetMs;
+	float y = margin;
+	glBegin(GL_QUADS);
+	for(size_t i = 0; i < stages.size(); i++) {
+		const float *c = colors[i % COLOR_COUNT];
+		float w = (float)getCPUMs((int)i) * msToPx;
+		glColor3f(c[0], c[1], c[2]);
+		glVertex2f(margin, y);
+		glVertex2f(margin + w, y);
+		glVertex2f(margin + w, y + barHeight);
+		glVertex2f(margin, y + barHeight);
+		if(stages[i].gpu && gpuTiming) {
+			w = (float)getGPUMs((int)i) * msToPx;
+			glColor3f(0.5f + 0.5f * c[0], 0.5f + 0.5f * c[1], 0.5f + 0.5f * c[2]);
+			glVertex2f(margin, y - 0.5f * barHeight);
+			glVertex2f(margin + w, y - 0.5f * barHeight);
+			glVertex2f(margin + w, y);
+			glVertex2f(margin, y);
+		}
+		y += barHeight * 2.0f;
+	}
+	glEnd();
+
+	// Recent frame times, newest on the right; the chart height is twice
+	// the budget
+	const float chartHeight = 60.0f;
+	float chartY = y + margin;
+	float msToChart = chartHeight / (2.0f * (float)budgetMs);
+	int count = min(resolved, HISTORY);
+	glColor3f(0.3f, 0.3f, 0.3f);
+	glBegin(GL_LINE_STRIP);
+	for(int k = 0; k < count; k++) {
+		int f = resolved - count + k;
+		float ms = min((float)frameHistory[f % HISTORY], 2.0f * (float)budgetMs);
+		glVertex2f(margin + 2.0f * k, chartY + ms * msToChart);
+	}
+	glEnd();
+
+	// Budget markers: the bars' limit and the chart's midline
+	glColor3f(0.0f, 0.0f, 0.0f);
+	glBegin(GL_LINES);
+	glVertex2f(margin + (float)budgetMs * msToPx, margin - barHeight);
+	glVertex2f(margin + (float)budgetMs * msToPx, y);
+	glVertex2f(margin, chartY + 0.5f * chartHeight);
+	glVertex2f(margin + 2.0f * HISTORY, chartY + 0.5f * chartHeight);
+	glEnd();
+
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopAttrib();
+}
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <functional>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
@@ -14,16 +16,27 @@
 #include "GLSL.h"
 #include "Program.h"
 #include "TextureMatrix.h"
+#include "JobPool.h"
+#include "BinaryCache.h"
+#include "Pose.h"
+#include "StreamBuffer.h"
+#include "MeshOptimizer.h"
 
 using namespace std;
 using namespace glm;
 
 ShapeSkin::ShapeSkin() :
 	prog(NULL),
+	skinMode(CPU_SKINNING),
+	skinMethod(LINEAR_BLEND),
 	elemBufID(0),
 	posBufID(0),
 	norBufID(0),
-	texBufID(0)
+	texBufID(0),
+	restPosBufID(0),
+	restNorBufID(0),
+	boneIndBufID(0),
+	boneWeightBufID(0)
 {
 	T = make_shared<TextureMatrix>();
 }
@@ -54,11 +67,11 @@ void ShapeSkin::loadMesh(const string &meshName)
 		posBuf = attrib.vertices;
 
 		// ADDED THIS:
-		initialPosBuf = attrib.vertices;
-		initialNorBuf = attrib.normals;
+		initialPosBuf.owned = attrib.vertices;
+		initialNorBuf.owned = attrib.normals;
 
 		norBuf = attrib.normals;
-		texBuf = attrib.texcoords;
+		texBuf.owned = attrib.texcoords;
 		assert(posBuf.size() == norBuf.size());
 		// Loop over shapes
 		for(size_t s = 0; s < shapes.size(); s++) {
@@ -71,7 +84,7 @@ void ShapeSkin::loadMesh(const string &meshName)
 				for(size_t v = 0; v < fv; v++) {
 					// access to vertex
 					tinyobj::index_t idx = mesh.indices[index_offset + v];
-					elemBuf.push_back(idx.vertex_index);
+					elemBuf.owned.push_back(idx.vertex_index);
 				}
 				index_offset += fv;
 				// per-face material (IGNORE)
@@ -79,6 +92,7 @@ void ShapeSkin::loadMesh(const string &meshName)
 			}
 		}
 	}
+	ownArrays();
 }
 
 void ShapeSkin::loadAttachment(const std::string &filename)
@@ -95,6 +109,9 @@ void ShapeSkin::loadAttachment(const std::string &filename)
 	std::string line;
 
 	int currMaxInf;
+	influenceStart.owned.assign(1, 0);
+	influenceBone.owned.clear();
+	influenceWeight.owned.clear();
 	while(1){
 		getline(in, line);
 		if (in.eof()){
@@ -120,19 +137,181 @@ void ShapeSkin::loadAttachment(const std::string &filename)
 
 		ss >> currMaxInf;
 
-		for (int i = 0; i < maxInfluences; i++){
-			int boneInd = 0.0f;
+		// Only the influences the vertex has: no padding to maxInfluences
+		for (int i = 0; i < currMaxInf; i++){
+			int boneInd = 0;
 			float weight = 0.0f;
-			if (i < currMaxInf){
-				ss >> boneInd;
-				ss >> weight;
+			ss >> boneInd;
+			ss >> weight;
+			if (weight != 0.0f){
+				this->influenceBone.owned.push_back(boneInd);
+				this->influenceWeight.owned.push_back(weight);
 			}
+		}
+		influenceStart.owned.push_back((unsigned int)influenceBone.owned.size());
+	}
+
+	if (optimizeOrder){
+		optimizeVertexOrder(filename);
+	}
+	ownArrays();
+	finishAttachment();
+}
+
+void ShapeSkin::optimizeVertexOrder(const std::string &name)
+{
+	// Needs the influences too, since they are renumbered with the vertices
+	if (elemBuf.owned.empty() || initialPosBuf.owned.size() != 3 * vertCount || influenceStart.owned.size() != vertCount + 1){
+		return;
+	}
+	// No overdraw pass: the mesh deforms, and keeping neighbouring vertices
+	// together keeps the dirty ranges of a moving bone short
+	vector<unsigned int> remap;
+	optimizeMesh(name, elemBuf.owned, initialPosBuf.owned, remap, false);
+	remapVertices(initialPosBuf.owned, remap, 3);
+	remapVertices(initialNorBuf.owned, remap, 3);
+	remapVertices(texBuf.owned, remap, 2);
+	posBuf = initialPosBuf.owned;
+	norBuf = initialNorBuf.owned;
+
+	vector<unsigned int> order(vertCount);
+	for (size_t v = 0; v < vertCount; v++){
+		order[remap[v]] = (unsigned int)v;
+	}
+	vector<unsigned int> start(1, 0), bones;
+	vector<float> weights;
+	bones.reserve(influenceBone.owned.size());
+	weights.reserve(influenceWeight.owned.size());
+	for (unsigned int v : order){
+		bones.insert(bones.end(), influenceBone.owned.begin() + influenceStart.owned[v], influenceBone.owned.begin() + influenceStart.owned[v + 1]);
+		weights.insert(weights.end(), influenceWeight.owned.begin() + influenceStart.owned[v], influenceWeight.owned.begin() + influenceStart.owned[v + 1]);
+		start.push_back((unsigned int)bones.size());
+	}
+	influenceStart.owned.swap(start);
+	influenceBone.owned.swap(bones);
+	influenceWeight.owned.swap(weights);
+}
 
-			this->boneIndBuf.push_back(boneInd);
-			this->weightBuf.push_back(weight);
+void ShapeSkin::ownArrays()
+{
+	bundle.reset();
+	initialPosBuf.own();
+	initialNorBuf.own();
+	texBuf.own();
+	elemBuf.own();
+	influenceStart.own();
+	influenceBone.own();
+	influenceWeight.own();
+}
+
+void ShapeSkin::finishAttachment()
+{
+	// The skeleton is loaded before the attachments, so the bind pose is known here.
+	// Invert it once instead of once per vertex influence per frame.
+	inverseBindPose.resize(bindPose.bonePlacements.size());
+	for (size_t j = 0; j < inverseBindPose.size(); j++){
+		inverseBindPose[j] = glm::inverse(bindPose.bonePlacements[j].quatMat);
+	}
+	palette.assign(inverseBindPose.size(), glm::mat4(1.0f));
+	paletteRows.assign(12 * palette.size(), 0.0f);
+	paletteDQ.assign(12 * palette.size(), 0.0f);
+
+	// Copy everything the skinning loop reads into aligned SoA arrays
+	assert(initialPosBuf.size() == 3 * vertCount);
+	assert(influenceStart.size() == vertCount + 1);
+	kernel.setup(&initialPosBuf[0], &initialNorBuf[0], &influenceStart[0], influenceBone.data(), influenceWeight.data(), vertCount);
+
+	// Which blocks of 8 slots each bone reaches. Slots are visited in order,
+	// so a bone's last block is enough to skip repeats.
+	size_t blockCount = (kernel.getSlotCount() + 7) / 8;
+	vector<unsigned int> lastBlock(palette.size(), ~0u);
+	vector< vector<unsigned int> > blocks(palette.size());
+	for (size_t slot = 0; slot < kernel.getSlotCount(); slot++){
+		unsigned int v = kernel.getSlotVertex(slot);
+		unsigned int block = (unsigned int)(slot / 8);
+		for (unsigned int i = v < vertCount ? influenceStart[v] : 0; v < vertCount && i < influenceStart[v + 1]; i++){
+			unsigned int j = influenceBone[i];
+			if (j < palette.size() && lastBlock[j] != block){
+				lastBlock[j] = block;
+				blocks[j].push_back(block);
+			}
 		}
+	}
+	boneBlockStart.assign(1, 0);
+	boneBlocks.clear();
+	for (const auto &b : blocks){
+		boneBlocks.insert(boneBlocks.end(), b.begin(), b.end());
+		boneBlockStart.push_back((unsigned int)boneBlocks.size());
+	}
+	boneDirty.assign(palette.size(), 0);
+	blockDirty.assign(blockCount, 0);
+	vertDirty.assign(vertCount, 0);
+	allDirty = true;
+}
+
+// Bundle layout
+enum MeshCacheSection { CACHE_POS, CACHE_NOR, CACHE_TEX, CACHE_ELEM, CACHE_INF_START, CACHE_BONE_IND, CACHE_WEIGHT };
+enum MeshCacheCount { CACHE_VERT_COUNT, CACHE_BONE_COUNT, CACHE_MAX_INFLUENCES };
+
+void ShapeSkin::load(const std::string &meshName, const std::string &attachmentName)
+{
+	std::vector<std::string> sources = {meshName, attachmentName};
+	std::string path = BinaryCache::getPath(meshName);
+	auto cache = std::make_shared<BinaryCache>();
+	if (cache->open(path, sources) && loadBinary(cache)){
+		std::cout << "Loaded " << path << std::endl;
+		return;
+	}
+	loadMesh(meshName);
+	loadAttachment(attachmentName);
+	if (writeBinary(path, sources)){
+		std::cout << "Cooked " << path << std::endl;
+	}
+}
 
+bool ShapeSkin::loadBinary(std::shared_ptr<BinaryCache> cache)
+{
+	vertCount = cache->getCount(CACHE_VERT_COUNT);
+	boneCount = cache->getCount(CACHE_BONE_COUNT);
+	maxInfluences = cache->getCount(CACHE_MAX_INFLUENCES);
+	if (boneCount != bindPose.bonePlacements.size()){
+		// Cooked against a different skeleton
+		vertCount = boneCount = maxInfluences = 0;
+		return false;
 	}
+	// Read in place, no parsing and no copies. Only the skinned positions
+	// and normals, which are rewritten every frame, get their own memory.
+	bundle = cache;
+	cache->borrowSection(CACHE_POS, initialPosBuf);
+	cache->borrowSection(CACHE_NOR, initialNorBuf);
+	cache->borrowSection(CACHE_TEX, texBuf);
+	cache->borrowSection(CACHE_ELEM, elemBuf);
+	cache->borrowSection(CACHE_INF_START, influenceStart);
+	cache->borrowSection(CACHE_BONE_IND, influenceBone);
+	cache->borrowSection(CACHE_WEIGHT, influenceWeight);
+	posBuf.assign(initialPosBuf.begin(), initialPosBuf.end());
+	norBuf.assign(initialNorBuf.begin(), initialNorBuf.end());
+	finishAttachment();
+	return true;
+}
+
+bool ShapeSkin::writeBinary(const std::string &path, const std::vector<std::string> &sources) const
+{
+	if (vertCount == 0){
+		return false;
+	}
+	BinaryCache cache;
+	cache.setCount(CACHE_VERT_COUNT, vertCount);
+	cache.setCount(CACHE_BONE_COUNT, boneCount);
+	cache.setCount(CACHE_MAX_INFLUENCES, maxInfluences);
+	cache.addSection(initialPosBuf.data(), initialPosBuf.size() * sizeof(float));
+	cache.addSection(initialNorBuf.data(), initialNorBuf.size() * sizeof(float));
+	cache.addSection(texBuf.data(), texBuf.size() * sizeof(float));
+	cache.addSection(elemBuf.data(), elemBuf.size() * sizeof(unsigned int));
+	cache.addSection(influenceStart.data(), influenceStart.size() * sizeof(unsigned int));
+	cache.addSection(influenceBone.data(), influenceBone.size() * sizeof(unsigned int));
+	cache.addSection(influenceWeight.data(), influenceWeight.size() * sizeof(float));
+	return cache.write(path, sources);
 }
 
 glm::vec3 ShapeSkin::getInitialPos(int vertInd){
@@ -155,11 +334,10 @@ glm::vec3 ShapeSkin::getInitialNor(int vertInd){
 
 
 std::vector<std::pair<unsigned int, float> > ShapeSkin::getBoneInfluences(int vertInd){
-	std::vector<std::pair<unsigned int, float> > influences(this->maxInfluences);
+	std::vector<std::pair<unsigned int, float> > influences;
 
-	for (int i = 0; i < this->maxInfluences; i++){
-		influences.at(i).first = this->boneIndBuf.at((vertInd * maxInfluences) + i);
-		influences.at(i).second = this->weightBuf.at((vertInd * maxInfluences) + i);
+	for (unsigned int i = influenceStart[vertInd]; i < influenceStart[vertInd + 1]; i++){
+		influences.push_back(std::make_pair(this->influenceBone[i], this->influenceWeight[i]));
 	}
 
 	return influences;
@@ -186,6 +364,43 @@ void ShapeSkin::init()
 	glGenBuffers(1, &elemBufID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elemBufID);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elemBuf.size()*sizeof(unsigned int), &elemBuf[0], GL_STATIC_DRAW);
+
+	// For GPU skinning: the bind pose never changes, and neither do the influences.
+	// Keep the largest MAX_GPU_INFLUENCES of each vertex, renormalized.
+	std::vector<float> gpuBoneInd(MAX_GPU_INFLUENCES * vertCount, 0.0f);
+	std::vector<float> gpuWeight(MAX_GPU_INFLUENCES * vertCount, 0.0f);
+	for (size_t i = 0; i < vertCount; i++){
+		std::vector<std::pair<float, unsigned int> > inf;
+		for (unsigned int j = influenceStart[i]; j < influenceStart[i + 1]; j++){
+			inf.push_back(std::make_pair(influenceWeight[j], influenceBone[j]));
+		}
+		std::sort(inf.begin(), inf.end(), std::greater<std::pair<float, unsigned int> >());
+		size_t n = std::min(inf.size(), (size_t)MAX_GPU_INFLUENCES);
+		float sum = 0.0f;
+		for (size_t j = 0; j < n; j++){
+			sum += inf[j].first;
+		}
+		for (size_t j = 0; j < n && sum > 0.0f; j++){
+			gpuBoneInd[i * MAX_GPU_INFLUENCES + j] = (float)inf[j].second;
+			gpuWeight[i * MAX_GPU_INFLUENCES + j] = inf[j].first / sum;
+		}
+	}
+
+	glGenBuffers(1, &restPosBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, restPosBufID);
+	glBufferData(GL_ARRAY_BUFFER, initialPosBuf.size()*sizeof(float), &initialPosBuf[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &restNorBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, restNorBufID);
+	glBufferData(GL_ARRAY_BUFFER, initialNorBuf.size()*sizeof(float), &initialNorBuf[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &boneIndBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, boneIndBufID);
+	glBufferData(GL_ARRAY_BUFFER, gpuBoneInd.size()*sizeof(float), &gpuBoneInd[0], GL_STATIC_DRAW);
+
+	glGenBuffers(1, &boneWeightBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, boneWeightBufID);
+	glBufferData(GL_ARRAY_BUFFER, gpuWeight.size()*sizeof(float), &gpuWeight[0], GL_STATIC_DRAW);
 	
 	// Unbind the arrays
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
@@ -206,31 +421,201 @@ void ShapeSkin::updateNor(int vertInd, glm::vec3 newNor){
 	this->norBuf.at((vertInd * 3) + 2) = newNor.z;
 }
 
-// Pass in the current frame, k
-void ShapeSkin::update(int k)
+void ShapeSkin::buildPalette(const Frame &pose)
+{
+	// One matrix per bone, shared by every vertex that bone influences
+	for (size_t j = 0; j < palette.size(); j++){
+		setPaletteEntry(j, pose.bonePlacements[j].quatMat);
+	}
+}
+
+void ShapeSkin::buildPalette(const Pose &pose)
+{
+	for (size_t j = 0; j < palette.size(); j++){
+		setPaletteEntry(j, pose.rot[j], pose.pos[j]);
+	}
+}
+
+void ShapeSkin::setPaletteEntry(size_t j, const glm::mat4 &boneMatrix)
 {
-	// TODO: CPU skinning calculations.
-	// After computing the new positions and normals, send the new data
-	// to the GPU by copying and pasting the relevant code from the
-	// init() function.
-
-	if (boneMatrices == nullptr){
-		boneMatrices = make_shared<std::vector<std::vector<glm::mat4> >>(allFrames.size());
-		for (int frameNo = 0; frameNo < allFrames.size(); frameNo++){
-			boneMatrices->at(frameNo) = std::vector<glm::mat4>(this->maxInfluences * this->vertCount);
+	palette[j] = boneMatrix * inverseBindPose[j];
+	float entry[12];
+	float *dst;
+	int n;
+	if (skinMethod == DUAL_QUATERNION){
+		// Rigid bones only: rotation q, translation t -> (q, 0.5 * t * q)
+		glm::quat q = glm::normalize(glm::quat_cast(glm::mat3(palette[j])));
+		glm::quat d = glm::quat(0.0f, glm::vec3(palette[j][3])) * q * 0.5f;
+		entry[0] = q.x; entry[1] = q.y; entry[2] = q.z; entry[3] = q.w;
+		entry[4] = d.x; entry[5] = d.y; entry[6] = d.z; entry[7] = d.w;
+		dst = &paletteDQ[12 * j];
+		n = 8;
+	} else {
+		for (int r = 0; r < 3; r++){
+			for (int c = 0; c < 4; c++){
+				entry[4 * r + c] = palette[j][c][r];
+			}
 		}
+		dst = &paletteRows[12 * j];
+		n = 12;
+	}
+	// A bone that did not move leaves its vertices alone
+	if (!std::equal(entry, entry + n, dst)){
+		std::copy(entry, entry + n, dst);
+		boneDirty[j] = 1;
+	}
+}
+
+void ShapeSkin::setPaletteEntry(size_t j, const glm::quat &rot, const glm::vec3 &pos)
+{
+	glm::mat4 M = glm::mat4_cast(rot);
+	M[3] = glm::vec4(pos, 1.0f);
+	setPaletteEntry(j, M);
+}
+
+void ShapeSkin::setSkinMode(SkinMode m)
+{
+	// posBuf is not kept up to date while the GPU skins
+	if (m != skinMode){
+		markAllDirty();
 	}
+	skinMode = m;
+}
 
+void ShapeSkin::collectDirty()
+{
+	// A streamed block has to be redone in every region of the ring, since
+	// each one still holds the results from REGIONS frames back
+	unsigned char frames = stream ? StreamBuffer::REGIONS : 1;
+	if (allDirty || !incremental){
+		std::fill(blockDirty.begin(), blockDirty.end(), frames);
+	} else {
+		for (size_t j = 0; j < boneDirty.size(); j++){
+			if (!boneDirty[j]){
+				continue;
+			}
+			for (unsigned int i = boneBlockStart[j]; i < boneBlockStart[j + 1]; i++){
+				blockDirty[boneBlocks[i]] = frames;
+			}
+		}
+	}
+	std::fill(boneDirty.begin(), boneDirty.end(), 0);
+	allDirty = false;
+
+	// Merge consecutive dirty blocks into slot ranges
+	skinRanges.clear();
+	skinnedVerts = 0;
+	size_t slotCount = kernel.getSlotCount();
+	for (size_t b = 0; b < blockDirty.size(); b++){
+		if (!blockDirty[b]){
+			continue;
+		}
+		blockDirty[b]--;
+		size_t begin = 8 * b;
+		size_t end = std::min(begin + 8, slotCount);
+		if (!skinRanges.empty() && skinRanges.back().second == begin){
+			skinRanges.back().second = end;
+		} else {
+			skinRanges.push_back(std::make_pair(begin, end));
+		}
+		for (size_t slot = begin; slot < end; slot++){
+			unsigned int v = kernel.getSlotVertex(slot);
+			if (v < vertCount){
+				vertDirty[v] = 1;
+				skinnedVerts++;
+			}
+		}
+	}
+}
+
+void ShapeSkin::skin()
+{
+	collectDirty();
+	for (const auto &r : skinRanges){
+		skinRange(r.first, r.second);
+	}
+}
+
+void ShapeSkin::skinRange(size_t begin, size_t end)
+{
+	float *pos = streamPos ? streamPos : &posBuf[0];
+	float *nor = streamPos ? streamNor : &norBuf[0];
+	if (skinMethod == DUAL_QUATERNION){
+		kernel.skinRangeDQ(&paletteDQ[0], pos, nor, begin, end);
+	} else {
+		kernel.skinRange(&paletteRows[0], pos, nor, begin, end);
+	}
+}
+
+bool ShapeSkin::setStreaming(bool on)
+{
+	stream.reset();
+	streamPos = streamNor = NULL;
+	if (on && StreamBuffer::isSupported()){
+		stream = std::make_shared<StreamBuffer>();
+		if (!stream->init(posBuf.size()*sizeof(float) + norBuf.size()*sizeof(float))){
+			stream.reset();
+		}
+	}
+	markAllDirty();
+	return stream != NULL;
+}
+
+void ShapeSkin::map()
+{
+	streamPos = streamNor = NULL;
+	if (!stream || skinMode == GPU_SKINNING){
+		return;
+	}
+	streamPos = (float *)stream->acquire();
+	streamNor = streamPos + posBuf.size();
+}
+
+double ShapeSkin::getStreamWaitMs() const
+{
+	return streamPos ? stream->getWaitMs() : 0.0;
+}
+
+void ShapeSkin::skinAll(const std::vector< std::shared_ptr<ShapeSkin> > &shapes, JobPool *pool)
+{
+	// Small enough to balance a handful of characters across the threads,
+	// large enough that the job overhead stays negligible. Multiple of 8.
+	const size_t chunk = 1024;
+	for(const auto &shape : shapes) {
+		if(shape->skinMode == GPU_SKINNING) {
+			shape->skinnedVerts = 0;
+			continue;
+		}
+		if(!pool) {
+			shape->skin();
+			continue;
+		}
+		ShapeSkin *s = shape.get();
+		s->collectDirty();
+		for(const auto &r : s->skinRanges) {
+			for(size_t begin = r.first; begin < r.second; begin += chunk) {
+				size_t end = std::min(begin + chunk, r.second);
+				pool->submit([s, begin, end] { s->skinRange(begin, end); });
+			}
+		}
+	}
+	if(pool) {
+		pool->wait();
+	}
+}
+
+void ShapeSkin::skinReference()
+{
 	// Compute the equation and update posBuf!
-	for (int i = 0; i < this->vertCount; i++){
-		glm::vec3 initialPos = getInitialPos(i);
-		glm::vec3 initialNor = getInitialNor(i);
+	for (size_t i = 0; i < this->vertCount; i++){
+		glm::vec3 initialPos = getInitialPos((int)i);
+		glm::vec3 initialNor = getInitialNor((int)i);
 
-		std::vector<std::pair<unsigned int, float> > boneInfluences = getBoneInfluences(i);
+		std::vector<std::pair<unsigned int, float> > boneInfluences = getBoneInfluences((int)i);
 		glm::vec3 newPos(0.0f,0.0f,0.0f);
 		glm::vec3 newNor(0.0f,0.0f,0.0f);
 
-		for (int j = 0; j < boneInfluences.size(); j++){
+		for (size_t j = 0; j < boneInfluences.size(); j++){
 			int boneID = boneInfluences.at(j).first;
 			float boneWeight = boneInfluences.at(j).second;
 
@@ -238,34 +623,71 @@ void ShapeSkin::update(int k)
 				continue;
 			}
 
-			glm::mat4 matKthFrameJthBone;
-
-			if (boneMatrices->at(k).at((this->maxInfluences * i) + j) != glm::mat4(0)){
-				matKthFrameJthBone = boneMatrices->at(k).at((this->maxInfluences * i) + j);
-			}
-			else{
-				glm::mat4 j_kthMat = allFrames.at(k).bonePlacements.at(boneID).quatMat;
-				matKthFrameJthBone = j_kthMat * glm::inverse(bindPose.bonePlacements.at(boneID).quatMat);
-				boneMatrices->at(k).at((this->maxInfluences * i) + j) = matKthFrameJthBone;
-			}
-
-			newPos = newPos + boneWeight * glm::vec3(matKthFrameJthBone * glm::vec4(initialPos,1.0f));
-			newNor = newNor + boneWeight * glm::vec3(matKthFrameJthBone * glm::vec4(initialNor,0.0f));
+			const glm::mat4 &M = palette[boneID];
+			newPos = newPos + boneWeight * glm::vec3(M * glm::vec4(initialPos,1.0f));
+			newNor = newNor + boneWeight * glm::vec3(M * glm::vec4(initialNor,0.0f));
+		}
 
-			// Pre-optimizations:
-			// newPos = newPos + boneWeight * glm::vec3(j_kthMat * glm::inverse(bindPose.bonePlacements.at(boneID).quatMat) * glm::vec4(initialPos,1.0f));
-			// newNor = newNor + boneWeight * glm::vec3(j_kthMat * glm::inverse(bindPose.bonePlacements.at(boneID).quatMat) * glm::vec4(initialNor,0.0f));
+		updatePos((int)i, newPos);
+		updateNor((int)i, newNor);
+	}
+	std::fill(vertDirty.begin(), vertDirty.end(), 1);
+}
 
+size_t ShapeSkin::collectUploadRanges()
+{
+	// Runs of re-skinned vertices. A gap shorter than this is sent along
+	// with its neighbours rather than costing another call.
+	const size_t maxGap = 64;
+	uploadRanges.clear();
+	uploadedBytes = 0;
+	for (size_t v = 0; v < vertCount; v++){
+		if (!vertDirty[v]){
+			continue;
+		}
+		vertDirty[v] = 0;
+		if (!uploadRanges.empty() && v - uploadRanges.back().second < maxGap){
+			uploadRanges.back().second = v + 1;
+		} else {
+			uploadRanges.push_back(std::make_pair(v, v + 1));
 		}
+	}
+	// Positions and normals
+	for (const auto &r : uploadRanges){
+		uploadedBytes += 2 * (r.second - r.first) * 3 * sizeof(float);
+	}
+	return uploadedBytes;
+}
 
-		updatePos(i, newPos);
-		updateNor(i, newNor);
+void ShapeSkin::upload()
+{
+	if (skinMode == GPU_SKINNING){
+		// Only the palette changes, and draw() sends it
+		uploadedBytes = 0;
+		return;
+	}
+	if (collectUploadRanges() == 0 || streamPos){
+		// Streamed vertices were written straight into the mapped buffer
+		return;
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_DYNAMIC_DRAW);
+	const size_t vertBytes = 3 * sizeof(float);
+	if (uploadRanges.size() == 1 && uploadRanges[0].second - uploadRanges[0].first == vertCount){
+		// Everything moved: replace the whole store as before
+		glBindBuffer(GL_ARRAY_BUFFER, posBufID);
+		glBufferData(GL_ARRAY_BUFFER, posBuf.size()*sizeof(float), &posBuf[0], GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
+		glBufferData(GL_ARRAY_BUFFER, norBuf.size()*sizeof(float), &norBuf[0], GL_DYNAMIC_DRAW);
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, posBufID);
+		for (const auto &r : uploadRanges){
+			glBufferSubData(GL_ARRAY_BUFFER, r.first * vertBytes, (r.second - r.first) * vertBytes, &posBuf[3 * r.first]);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, norBufID);
+		for (const auto &r : uploadRanges){
+			glBufferSubData(GL_ARRAY_BUFFER, r.first * vertBytes, (r.second - r.first) * vertBytes, &norBuf[3 * r.first]);
+		}
+	}
 
 	glUniformMatrix3fv(prog->getUniform("T"), 1, GL_FALSE, glm::value_ptr(T->getMatrix()));
 	
@@ -278,16 +700,43 @@ void ShapeSkin::draw(int k) const
 
 	// Send texture matrix
 	glUniformMatrix3fv(prog->getUniform("T"), 1, GL_FALSE, glm::value_ptr(T->getMatrix()));
+
+	bool gpu = (skinMode == GPU_SKINNING);
+	int h_ind = -1;
+	int h_wgt = -1;
+	if (gpu){
+		// The whole per-frame transfer: one mat4 (or one dual quaternion) per bone
+		if (skinMethod == DUAL_QUATERNION){
+			glUniformMatrix3x4fv(prog->getUniform("bonesDQ"), (int)palette.size(), GL_FALSE, &paletteDQ[0]);
+		} else {
+			glUniformMatrix4fv(prog->getUniform("bones"), (int)palette.size(), GL_FALSE, glm::value_ptr(palette[0]));
+		}
+
+		h_ind = prog->getAttribute("aBoneInd");
+		glEnableVertexAttribArray(h_ind);
+		glBindBuffer(GL_ARRAY_BUFFER, boneIndBufID);
+		glVertexAttribPointer(h_ind, MAX_GPU_INFLUENCES, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+
+		h_wgt = prog->getAttribute("aWeight");
+		glEnableVertexAttribArray(h_wgt);
+		glBindBuffer(GL_ARRAY_BUFFER, boneWeightBufID);
+		glVertexAttribPointer(h_wgt, MAX_GPU_INFLUENCES, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	}
 	
+	// This frame's region of the streaming buffer, if there is one
+	bool streamed = !gpu && streamPos;
+	size_t posOffset = streamed ? stream->getOffset() : 0;
+	size_t norOffset = streamed ? posOffset + posBuf.size()*sizeof(float) : 0;
+
 	int h_pos = prog->getAttribute("aPos");
 	glEnableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	glBindBuffer(GL_ARRAY_BUFFER, gpu ? restPosBufID : (streamed ? stream->getID() : posBufID));
+	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)posOffset);
 
 	int h_nor = prog->getAttribute("aNor");
 	glEnableVertexAttribArray(h_nor);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	glBindBuffer(GL_ARRAY_BUFFER, gpu ? restNorBufID : (streamed ? stream->getID() : norBufID));
+	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)norOffset);
 
 	int h_tex = prog->getAttribute("aTex");
 	glEnableVertexAttribArray(h_tex);
@@ -297,9 +746,17 @@ void ShapeSkin::draw(int k) const
 	// Draw
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elemBufID);
 	glDrawElements(GL_TRIANGLES, (int)elemBuf.size(), GL_UNSIGNED_INT, (const void *)0);
+	if (streamed){
+		// The region can be rewritten once this draw is done
+		stream->release();
+	}
 	
 	glDisableVertexAttribArray(h_nor);
 	glDisableVertexAttribArray(h_pos);
+	if (gpu){
+		glDisableVertexAttribArray(h_wgt);
+		glDisableVertexAttribArray(h_ind);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
@@ -7,9 +7,15 @@
 #define GLEW_STATIC
 #include <GL/glew.h>
 
+#include "SkinKernel.h"
+#include "BinaryCache.h"
+
 class MatrixStack;
 class Program;
 class TextureMatrix;
+class JobPool;
+class StreamBuffer;
+struct Pose;
 
 struct Bone{
 	glm::mat4 quatMat;
@@ -40,14 +46,76 @@ extern std::vector<Frame> allFrames;
 class ShapeSkin
 {
 public:
+	enum SkinMode
+	{
+		CPU_SKINNING, // Skin here, re-upload positions and normals every frame
+		GPU_SKINNING  // Static influences as attributes, palette as a uniform array
+	};
+	enum SkinMethod
+	{
+		LINEAR_BLEND,   // Blend the bone matrices
+		DUAL_QUATERNION // Blend the bones as dual quaternions: no candy-wrapper collapse on twists
+	};
+	// Must match MAX_BONES in skin_gpu_vert.glsl and skin_dq_gpu_vert.glsl
+	static const int MAX_GPU_BONES = 64;
+	static const int MAX_GPU_INFLUENCES = 4;
+
 	ShapeSkin();
 	virtual ~ShapeSkin();
 	void setTextureMatrixType(const std::string &meshName);
 	void loadMesh(const std::string &meshName);
 	void loadAttachment(const std::string &filename); // THIS IS THE FUNCTION TO WORK ON
+	// loadMesh + loadAttachment through the binary cache: maps the bundle if it
+	// is fresh, otherwise parses the text files and cooks a new bundle
+	void load(const std::string &meshName, const std::string &attachmentName);
+	// Reads the bind pose, texcoords, triangles and influences in place from
+	// the open bundle, which the shape then keeps mapped
+	bool loadBinary(std::shared_ptr<BinaryCache> cache);
+	bool writeBinary(const std::string &path, const std::vector<std::string> &sources) const;
+	// Whether loadAttachment reorders the triangles for the vertex cache and
+	// the vertices (influences included) for fetch order. On by default;
+	// cooked bundles keep the order they were cooked with.
+	void setOptimizeOrder(bool b) { optimizeOrder = b; }
 	void setProgram(std::shared_ptr<Program> p) { prog = p; }
 	void init();
-	void update(int k);
+	void buildPalette(const Frame &pose); // Fills the per-bone skinning matrices for the given pose
+	void buildPalette(const Pose &pose); // Same, from rotations and translations
+	// Palette entry for bone j given its current transform
+	void setPaletteEntry(size_t j, const glm::mat4 &boneMatrix);
+	void setPaletteEntry(size_t j, const glm::quat &rot, const glm::vec3 &pos);
+	void skin(); // CPU skinning of the vertices whose bones moved (all of them if not incremental)
+	void skinRange(size_t begin, size_t end); // Same as skin(), for kernel slots [begin, end) (see SkinKernel::getSlotCount)
+	// Persistent-mapped triple buffering for the CPU-skinned positions and
+	// normals (GL thread only, after init()). Returns false, and keeps the
+	// glBufferData path, if GL_ARB_buffer_storage is missing.
+	bool setStreaming(bool on);
+	bool isStreaming() const { return stream != NULL; }
+	// Points this frame's skinning at the next region of the ring, waiting
+	// for the GPU if it is still reading it (GL thread, before skin()/skinAll)
+	void map();
+	double getStreamWaitMs() const; // Spent waiting in the last map()
+	void upload(); // Sends the re-skinned positions and normals to the GPU (GL thread only)
+	// The vertex ranges upload() sends, merged across small gaps; clears the
+	// pending vertices and returns the bytes. upload() calls it.
+	size_t collectUploadRanges();
+	const std::vector< std::pair<size_t, size_t> > &getUploadRanges() const { return uploadRanges; }
+	void skinReference(); // Straightforward per-vertex glm version of skin(), for validation
+	void setSkinMode(SkinMode m);
+	SkinMode getSkinMode() const { return skinMode; }
+	// Per mesh. Takes effect from the next setPaletteEntry/buildPalette.
+	void setSkinMethod(SkinMethod m) { skinMethod = m; markAllDirty(); }
+	SkinMethod getSkinMethod() const { return skinMethod; }
+	// Dirty-bone tracking: a bone is dirty when its palette entry changes.
+	// When incremental, skin() only redoes the vertices of dirty bones and
+	// upload() only sends the vertex ranges that were redone.
+	void setIncremental(bool b) { incremental = b; markAllDirty(); }
+	bool getIncremental() const { return incremental; }
+	void markAllDirty() { allDirty = true; }
+	size_t getSkinnedVertCount() const { return skinnedVerts; } // By the last skin()/skinAll()
+	size_t getUploadedBytes() const { return uploadedBytes; } // By the last upload()
+	bool canSkinOnGPU() const { return boneCount <= MAX_GPU_BONES; }
+	void setSkinISA(SkinKernel::ISA isa) { kernel.setISA(isa); }
+	SkinKernel::ISA getSkinISA() const { return kernel.getISA(); }
 	void draw(int k) const;
 	void setTextureFilename(const std::string &f) { textureFilename = f; }
 	std::string getTextureFilename() const { return textureFilename; }
@@ -60,31 +128,93 @@ public:
 	void updatePos(int vertInd, glm::vec3 newPos);
 	void updateNor(int vertInd, glm::vec3 newNor);
 
+	// Skins every shape with its current palette, splitting the vertices of all
+	// of them into chunks for the pool's threads. Runs serially if pool is null.
+	static void skinAll(const std::vector< std::shared_ptr<ShapeSkin> > &shapes, JobPool *pool);
+
+	size_t getVertCount() const { return vertCount; }
+	size_t getBoneCount() const { return boneCount; }
+	size_t getMaxInfluences() const { return maxInfluences; }
+	size_t getInfluenceCount() const { return influenceBone.size(); }
+	const SkinKernel &getKernel() const { return kernel; }
+	const std::vector<glm::mat4> &getPalette() const { return palette; }
+	const std::vector<float> &getPaletteDQ() const { return paletteDQ; }
+	const std::vector<float> &getPosBuf() const { return posBuf; }
+	const std::vector<float> &getNorBuf() const { return norBuf; }
+	const SectionArray<unsigned int> &getElemBuf() const { return elemBuf; }
+
 private:
+	void ownArrays(); // After the text loaders: read the arrays they filled
+	void finishAttachment(); // Derived data shared by the text and binary loaders
+	void optimizeVertexOrder(const std::string &name); // See setOptimizeOrder
+	void collectDirty(); // Dirty bones -> kernel slot ranges to skin, vertices to upload
+
 	std::shared_ptr<Program> prog;
-	std::vector<unsigned int> elemBuf;
+	SectionArray<unsigned int> elemBuf;
 	std::vector<float> posBuf;
 	std::vector<float> norBuf;
-	std::vector<float> texBuf;
+	SectionArray<float> texBuf;
 
 	// new attributes
 	size_t maxInfluences = 0;
 	size_t vertCount = 0;
     size_t boneCount = 0;
 
-	std::vector<float> initialPosBuf;
-	std::vector<float> initialNorBuf;
-	std::vector<unsigned int> boneIndBuf;
-	std::vector<float> weightBuf;
+	// The arrays that never change after loading are owned after a text load,
+	// and borrowed from the bundle, kept mapped here, after a binary one
+	std::shared_ptr<BinaryCache> bundle;
+	SectionArray<float> initialPosBuf;
+	SectionArray<float> initialNorBuf;
+	// Influences in CSR form: vertex i's are [influenceStart[i], influenceStart[i + 1])
+	SectionArray<unsigned int> influenceStart;
+	SectionArray<unsigned int> influenceBone;
+	SectionArray<float> influenceWeight;
 	
-	std::shared_ptr< std::vector<std::vector<glm::mat4> > > boneMatrices = nullptr;
-	std::vector<glm::mat4> initialBoneMatrices;
-
+	// inverse(bindPose) for each bone, computed once when the attachment is loaded
+	std::vector<glm::mat4> inverseBindPose;
+	// Skinning palette: M_j(k) * inverse(M_j(0)) for each bone j, rebuilt once per frame
+	std::vector<glm::mat4> palette;
+	// Same palette as 3x4 row-major floats, the layout the SIMD kernel gathers from
+	std::vector<float> paletteRows;
+	// Same palette as dual quaternions (real xyzw, dual xyzw), in 12-float slots
+	// so it shares the kernel's bone offsets and is a mat3x4 array in GLSL
+	std::vector<float> paletteDQ;
+	SkinKernel kernel;
+
+	// Dirty tracking. Kernel slots are grouped in blocks of 8 (one SIMD step);
+	// boneBlocks[boneBlockStart[j] .. boneBlockStart[j + 1]) are the blocks
+	// holding a vertex that bone j influences.
+	bool incremental = true;
+	bool optimizeOrder = true;
+	bool allDirty = true;
+	std::vector<unsigned char> boneDirty;
+	std::vector<unsigned int> boneBlockStart;
+	std::vector<unsigned int> boneBlocks;
+	std::vector<unsigned char> blockDirty;
+	std::vector<unsigned char> vertDirty; // skinned but not uploaded yet
+	std::vector< std::pair<size_t, size_t> > skinRanges; // this frame's slots
+	std::vector< std::pair<size_t, size_t> > uploadRanges; // this frame's vertices
+	size_t skinnedVerts = 0;
+	size_t uploadedBytes = 0;
+
+	// Streaming: where skinning writes this frame, NULL for posBuf/norBuf
+	std::shared_ptr<StreamBuffer> stream;
+	float *streamPos = NULL;
+	float *streamNor = NULL;
+
+	SkinMode skinMode;
+	SkinMethod skinMethod;
 
 	GLuint elemBufID;
 	GLuint posBufID;
 	GLuint norBufID;
 	GLuint texBufID;
+	// GPU skinning: bind-pose vertices and the (at most 4) largest influences
+	// per vertex, uploaded once in init()
+	GLuint restPosBufID;
+	GLuint restNorBufID;
+	GLuint boneIndBufID;
+	GLuint boneWeightBufID;
 	std::string textureFilename;
 	std::shared_ptr<TextureMatrix> T;
 };
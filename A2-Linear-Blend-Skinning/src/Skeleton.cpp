@@ -0,0 +1,264 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "Skeleton.h"
+
+using namespace std;
+
+Skeleton::Skeleton()
+{
+}
+
+Skeleton::~Skeleton()
+{
+}
+
+// Reads the next non-empty, non-comment line
+static bool nextDataLine(ifstream &in, string &line)
+{
+	while(getline(in, line)) {
+		if(!line.empty() && line.at(0) != '#') {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Skeleton::loadHierarchy(const string &filename)
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		cout << "Cannot read " << filename << endl;
+		return false;
+	}
+	string line;
+	size_t boneCount = 0;
+	if(nextDataLine(in, line)) {
+		stringstream(line) >> boneCount;
+	}
+	vector<int> fileParent(boneCount, -1);
+	vector<string> fileName(boneCount);
+	vector<RotationOrder> fileOrder(boneCount, XYZ);
+	for(size_t n = 0; n < boneCount && nextDataLine(in, line); n++) {
+		stringstream ss(line);
+		int j, p;
+		string order, name;
+		ss >> j >> p >> order >> name;
+		if(j < 0 || j >= (int)boneCount || p >= (int)boneCount) {
+			cout << filename << ": bad joint line " << line << endl;
+			return false;
+		}
+		static const char *orders[] = {"EULER_XYZ", "EULER_XZY", "EULER_YXZ", "EULER_YZX", "EULER_ZXY", "EULER_ZYX"};
+		for(int o = 0; o < 6; o++) {
+			if(order == orders[o]) {
+				fileOrder[j] = (RotationOrder)o;
+			}
+		}
+		fileParent[j] = p;
+		fileName[j] = name;
+	}
+
+	// Evaluation order: the file order if it already lists parents first,
+	// otherwise joints sorted by depth
+	vector<int> depth(boneCount, 0);
+	bool parentsFirst = true;
+	for(size_t j = 0; j < boneCount; j++) {
+		int d = 0;
+		for(int p = fileParent[j]; p >= 0 && d <= (int)boneCount; p = fileParent[p]) {
+			d++;
+		}
+		if(d > (int)boneCount) {
+			cout << filename << ": cycle at joint " << j << endl;
+			return false;
+		}
+		depth[j] = d;
+		parentsFirst = parentsFirst && fileParent[j] < (int)j;
+	}
+	jointIndex.resize(boneCount);
+	for(size_t j = 0; j < boneCount; j++) {
+		jointIndex[j] = (int)j;
+	}
+	if(!parentsFirst) {
+		stable_sort(jointIndex.begin(), jointIndex.end(), [&](int a, int b) { return depth[a] < depth[b]; });
+	}
+	evalIndex.resize(boneCount);
+	for(size_t i = 0; i < boneCount; i++) {
+		evalIndex[jointIndex[i]] = (int)i;
+	}
+
+	parent.resize(boneCount);
+	names.resize(boneCount);
+	rotationOrder.resize(boneCount);
+	for(size_t i = 0; i < boneCount; i++) {
+		int j = jointIndex[i];
+		parent[i] = fileParent[j] < 0 ? -1 : evalIndex[fileParent[j]];
+		names[i] = fileName[j];
+		rotationOrder[i] = fileOrder[j];
+	}
+	translation.assign(boneCount, glm::vec3(0.0f));
+	pre.assign(boneCount, glm::mat4(1.0f));
+	post.assign(boneCount, glm::mat4(1.0f));
+	return true;
+}
+
+bool Skeleton::loadStaticTransforms(const string &filename)
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		cout << "Cannot read " << filename << endl;
+		return false;
+	}
+	string line;
+	size_t boneCount = 0;
+	if(nextDataLine(in, line)) {
+		stringstream(line) >> boneCount;
+	}
+	if(boneCount != getBoneCount()) {
+		cout << filename << ": " << boneCount << " joints, hierarchy has " << getBoneCount() << endl;
+		return false;
+	}
+	enum { T, ROFF, RP, RPRE, RPOST, SOFF, SP, S, MATRIX_COUNT };
+	for(size_t j = 0; j < boneCount; j++) {
+		if(!nextDataLine(in, line)) {
+			cout << filename << ": missing joint " << j << endl;
+			return false;
+		}
+		// Each matrix is a quaternion (x, y, z, w) and a position
+		stringstream ss(line);
+		glm::mat4 M[MATRIX_COUNT];
+		glm::vec3 p[MATRIX_COUNT];
+		for(int m = 0; m < MATRIX_COUNT; m++) {
+			glm::quat q;
+			ss >> q.x >> q.y >> q.z >> q.w >> p[m].x >> p[m].y >> p[m].z;
+			M[m] = glm::mat4_cast(q);
+			M[m][3] = glm::vec4(p[m], 1.0f);
+		}
+		int i = evalIndex[j];
+		translation[i] = p[T];
+		pre[i] = M[ROFF] * M[RP] * M[RPRE];
+		post[i] = glm::inverse(M[RPOST]) * glm::inverse(M[RP]) * M[SOFF] * M[SP] * M[S] * glm::inverse(M[SP]);
+	}
+	return true;
+}
+
+bool Skeleton::loadClip(const string &filename, vector<Pose> &frames, bool degrees) const
+{
+	ifstream in(filename);
+	if(!in.good()) {
+		cout << "Cannot read " << filename << endl;
+		return false;
+	}
+	string line;
+	size_t frameCount = 0, boneCount = 0;
+	if(nextDataLine(in, line)) {
+		stringstream(line) >> frameCount >> boneCount;
+	}
+	if(boneCount != getBoneCount()) {
+		cout << filename << ": " << boneCount << " joints, hierarchy has " << getBoneCount() << endl;
+		return false;
+	}
+	cout << "Loading local clip from " << filename << endl;
+	// The header frame count is not reliable (binding pose files repeat the
+	// clip's), so read lines until the end
+	while(nextDataLine(in, line)) {
+		const char *s = line.c_str();
+		char *end;
+		Pose pose;
+		pose.resize(boneCount);
+		for(size_t j = 0; j < boneCount; j++) {
+			glm::vec3 angles;
+			for(int c = 0; c < 3; c++) {
+				angles[c] = strtof(s, &end);
+				s = end;
+			}
+			if(degrees) {
+				angles = glm::radians(angles);
+			}
+			int i = evalIndex[j];
+			pose.rot[i] = eulerToQuat(angles, rotationOrder[i]);
+			pose.pos[i] = translation[i];
+			if(j == 0) {
+				// The root carries its translation after its angles
+				for(int c = 0; c < 3; c++) {
+					pose.pos[i][c] = strtof(s, &end);
+					s = end;
+				}
+			}
+		}
+		frames.push_back(pose);
+	}
+	return true;
+}
+
+bool Skeleton::load(const string &prefix, vector<Pose> &frames, Pose &bind)
+{
+	vector<Pose> bindFrames;
+	if(!loadHierarchy(prefix + "_hierarchy.txt") ||
+		!loadStaticTransforms(prefix + "_static_transforms.txt") ||
+		!loadClip(prefix + "_skel_local.txt", frames) ||
+		!loadClip(prefix + "_binding_pose_local.txt", bindFrames, true) ||
+		bindFrames.empty()) {
+		return false;
+	}
+	bind = bindFrames[0];
+	return true;
+}
+
+int Skeleton::findJoint(const string &name) const
+{
+	auto it = find(names.begin(), names.end(), name);
+	return it == names.end() ? -1 : (int)(it - names.begin());
+}
+
+void Skeleton::getSubtreeMask(int i, vector<float> &mask) const
+{
+	// Parents come first, so one pass marks the whole subtree
+	mask.assign(getBoneCount(), 0.0f);
+	for(size_t k = i; k < getBoneCount(); k++) {
+		if((int)k == i || (parent[k] >= 0 && mask[parent[k]] > 0.0f)) {
+			mask[k] = 1.0f;
+		}
+	}
+}
+
+glm::quat Skeleton::eulerToQuat(const glm::vec3 &angles, RotationOrder order)
+{
+	// FBX EULER_XYZ applies X first, so R = Rz * Ry * Rx
+	const glm::vec3 &r = angles;
+	glm::quat qx = glm::angleAxis(r.x, glm::vec3(1.0f, 0.0f, 0.0f));
+	glm::quat qy = glm::angleAxis(r.y, glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::quat qz = glm::angleAxis(r.z, glm::vec3(0.0f, 0.0f, 1.0f));
+	switch(order) {
+		case XZY: return qy * qz * qx;
+		case YXZ: return qz * qx * qy;
+		case YZX: return qx * qz * qy;
+		case ZXY: return qy * qx * qz;
+		case ZYX: return qx * qy * qz;
+		default: return qz * qy * qx;
+	}
+}
+
+void Skeleton::computeWorld(const Pose &local, glm::mat4 *world) const
+{
+	size_t boneCount = getBoneCount();
+	for(size_t i = 0; i < boneCount; i++) {
+		glm::mat4 M = pre[i] * glm::mat4_cast(local.rot[i]) * post[i];
+		M[3] += glm::vec4(local.pos[i], 0.0f);
+		world[i] = parent[i] < 0 ? M : world[parent[i]] * M;
+	}
+}
+
+void Skeleton::computeWorld(const Pose &local, Frame &frame) const
+{
+	// Written in place, so no scratch array; parents are still done first
+	size_t boneCount = getBoneCount();
+	frame.bonePlacements.resize(boneCount);
+	Bone *world = frame.bonePlacements.data();
+	for(size_t i = 0; i < boneCount; i++) {
+		glm::mat4 M = pre[i] * glm::mat4_cast(local.rot[i]) * post[i];
+		M[3] += glm::vec4(local.pos[i], 0.0f);
+		world[jointIndex[i]].quatMat = parent[i] < 0 ? M : world[jointIndex[parent[i]]].quatMat * M;
+	}
+}
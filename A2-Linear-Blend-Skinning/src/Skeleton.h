@@ -0,0 +1,79 @@
+#pragma once
+#ifndef SKELETON_H
+#define SKELETON_H
+
+#include <string>
+#include <vector>
+
+#include "Pose.h"
+#include "ShapeSkin.h"
+
+/**
+ * Joint hierarchy with the static FBX transforms, for local-space clips.
+ *
+ * For each joint,
+ *   World = ParentWorld * T * Roff * Rp * Rpre * R * Rpost^-1 * Rp^-1 * Soff * Sp * S * Sp^-1
+ * where only T (root only) and R vary over time. Everything left of R
+ * except T is folded into one 'pre' matrix and everything right of R into
+ * one 'post' matrix when the static transforms are loaded.
+ *
+ * Joints are stored in parent-before-child order, so computeWorld() is a
+ * single forward pass over flat arrays: every parent's world matrix is
+ * ready by the time its children read it. Local poses use that order too.
+ * A local Pose holds R in rot and T in pos; for non-root joints pos is
+ * the static T from the file.
+ */
+class Skeleton
+{
+public:
+	Skeleton();
+	virtual ~Skeleton();
+
+	// _hierarchy.txt: <JOINT INDEX> <PARENT INDEX> <ROTATION ORDER> <JOINT NAME>
+	bool loadHierarchy(const std::string &filename);
+	// _static_transforms.txt: T Roff Rp Rpre Rpost Soff Sp S per joint
+	bool loadStaticTransforms(const std::string &filename);
+	// _skel_local.txt or _binding_pose_local.txt: Euler angles per joint,
+	// plus the root position. Appends one local pose per line. The clip
+	// files are in radians, the binding pose files in degrees.
+	bool loadClip(const std::string &filename, std::vector<Pose> &frames, bool degrees = false) const;
+
+	// All four files of a data set: <prefix>_hierarchy.txt,
+	// _static_transforms.txt, _skel_local.txt and _binding_pose_local.txt
+	bool load(const std::string &prefix, std::vector<Pose> &frames, Pose &bind);
+
+	size_t getBoneCount() const { return parent.size(); }
+	// Parent of joint i (in evaluation order), -1 for roots
+	int getParent(size_t i) const { return parent[i]; }
+	// Index in the data files (and skin weights) of joint i
+	int getJointIndex(size_t i) const { return jointIndex[i]; }
+	const std::string &getName(size_t i) const { return names[i]; }
+	// Evaluation index of the named joint, -1 if there is none
+	int findJoint(const std::string &name) const;
+	// 1 for joint i and everything below it, 0 elsewhere (a BlendTree mask)
+	void getSubtreeMask(int i, std::vector<float> &mask) const;
+
+	// World matrices in evaluation order. world must hold getBoneCount().
+	void computeWorld(const Pose &local, glm::mat4 *world) const;
+	// Same, as bone placements indexed like the data files (and like
+	// ShapeSkin::buildPalette expects). Does not allocate once sized.
+	void computeWorld(const Pose &local, Frame &frame) const;
+
+	const glm::mat4 &getPre(size_t i) const { return pre[i]; }
+	const glm::mat4 &getPost(size_t i) const { return post[i]; }
+
+private:
+	enum RotationOrder { XYZ, XZY, YXZ, YZX, ZXY, ZYX };
+	static glm::quat eulerToQuat(const glm::vec3 &angles, RotationOrder order);
+
+	std::vector<int> parent;
+	std::vector<int> jointIndex;
+	std::vector<int> evalIndex; // inverse of jointIndex
+	std::vector<std::string> names;
+	std::vector<RotationOrder> rotationOrder;
+	std::vector<glm::vec3> translation; // static T
+	std::vector<glm::mat4> pre;  // Roff * Rp * Rpre
+	std::vector<glm::mat4> post; // Rpost^-1 * Rp^-1 * Soff * Sp * S * Sp^-1
+};
+
+#endif
@@ -0,0 +1,563 @@
+#include <algorithm>
+#include <cmath>
+
+#include "SkinKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SKIN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SKIN_TARGET_AVX2
+#else
+#define SKIN_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+using namespace std;
+
+SkinKernel::SkinKernel() :
+	vertCount(0),
+	slotCount(0)
+{
+	isa = detectISA();
+}
+
+SkinKernel::~SkinKernel()
+{
+}
+
+SkinKernel::ISA SkinKernel::detectISA()
+{
+#ifdef SKIN_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] >= 7) {
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if(avx2 && fma && osxsave && (_xgetbv(0) & 6) == 6) {
+			return AVX2;
+		}
+	}
+	return SSE;
+#else
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return AVX2;
+	}
+	// SSE2 is part of x86-64
+	return SSE;
+#endif
+#else
+	return SCALAR;
+#endif
+}
+
+const char *SkinKernel::getISAName(ISA isa)
+{
+	switch(isa) {
+		case SSE: return "SSE";
+		case AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
+
+void SkinKernel::setISA(ISA isa)
+{
+	// Never go above what the CPU supports
+	this->isa = min(isa, detectISA());
+}
+
+void SkinKernel::setup(const float *pos, const float *nor, const unsigned int *start, const unsigned int *bones, const float *weights, size_t vertCount)
+{
+	this->vertCount = vertCount;
+
+	// Bucket the vertices by influence count, keeping their order within a bucket
+	vector< vector<unsigned int> > byCount;
+	for(size_t i = 0; i < vertCount; i++) {
+		size_t n = start[i + 1] - start[i];
+		if(n >= byCount.size()) {
+			byCount.resize(n + 1);
+		}
+		byCount[n].push_back((unsigned int)i);
+	}
+	buckets.clear();
+	slotCount = 0;
+	size_t influenceCount = 0;
+	for(size_t n = 0; n < byCount.size(); n++) {
+		if(byCount[n].empty()) {
+			continue;
+		}
+		Bucket b;
+		b.influences = n;
+		b.begin = slotCount;
+		b.end = slotCount + byCount[n].size();
+		b.paddedCount = (byCount[n].size() + 7) & ~(size_t)7;
+		b.influenceBase = influenceCount;
+		buckets.push_back(b);
+		slotCount += b.paddedCount;
+		influenceCount += n * b.paddedCount;
+	}
+
+	px.assign(slotCount, 0.0f);
+	py.assign(slotCount, 0.0f);
+	pz.assign(slotCount, 0.0f);
+	nx.assign(slotCount, 0.0f);
+	ny.assign(slotCount, 0.0f);
+	nz.assign(slotCount, 0.0f);
+	vertexIndex.assign(slotCount, (unsigned int)vertCount);
+	boneOffset.assign(influenceCount, 0);
+	weight.assign(influenceCount, 0.0f);
+
+	for(const Bucket &b : buckets) {
+		const vector<unsigned int> &verts = byCount[b.influences];
+		for(size_t k = 0; k < verts.size(); k++) {
+			size_t slot = b.begin + k;
+			unsigned int i = verts[k];
+			vertexIndex[slot] = i;
+			px[slot] = pos[3*i];
+			py[slot] = pos[3*i + 1];
+			pz[slot] = pos[3*i + 2];
+			nx[slot] = nor[3*i];
+			ny[slot] = nor[3*i + 1];
+			nz[slot] = nor[3*i + 2];
+			for(size_t s = 0; s < b.influences; s++) {
+				size_t e = b.influenceBase + s * b.paddedCount + k;
+				boneOffset[e] = (int)bones[start[i] + s] * 12;
+				weight[e] = weights[start[i] + s];
+			}
+		}
+	}
+}
+
+size_t SkinKernel::getInfluenceBytes() const
+{
+	return boneOffset.size() * sizeof(int) + weight.size() * sizeof(float) + vertexIndex.size() * sizeof(unsigned int);
+}
+
+void SkinKernel::skin(const float *palette, float *outPos, float *outNor) const
+{
+	skinBuckets(palette, outPos, outNor, 0, slotCount, false);
+}
+
+void SkinKernel::skinRange(const float *palette, float *outPos, float *outNor, size_t begin, size_t end) const
+{
+	skinBuckets(palette, outPos, outNor, begin, end, false);
+}
+
+void SkinKernel::skinDQ(const float *dqPalette, float *outPos, float *outNor) const
+{
+	skinBuckets(dqPalette, outPos, outNor, 0, slotCount, true);
+}
+
+void SkinKernel::skinRangeDQ(const float *dqPalette, float *outPos, float *outNor, size_t begin, size_t end) const
+{
+	skinBuckets(dqPalette, outPos, outNor, begin, end, true);
+}
+
+void SkinKernel::skinBuckets(const float *palette, float *outPos, float *outNor, size_t begin, size_t end, bool dq) const
+{
+	for(const Bucket &b : buckets) {
+		// The part of [begin, end) holding this bucket's vertices
+		size_t s = max(begin, b.begin);
+		size_t e = min(end, b.end);
+		if(s < e) {
+			(this->*getBucketFn(b.influences, dq))(palette, outPos, outNor, b, s, e);
+		}
+	}
+}
+
+template <int N>
+void SkinKernel::skinScalar(const float *palette, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	for(size_t i = begin; i < end; i++) {
+		size_t v = vertexIndex[i];
+		// Blend the 3x4 matrices, then transform once
+		float m[12] = {0.0f};
+		for(size_t s = 0; s < count; s++) {
+			float w = weight[base + s * bucket.paddedCount + i];
+			const float *b = palette + boneOffset[base + s * bucket.paddedCount + i];
+			for(int c = 0; c < 12; c++) {
+				m[c] += w * b[c];
+			}
+		}
+		float x = px[i], y = py[i], z = pz[i];
+		outPos[3*v]     = m[0]*x + m[1]*y + m[2]*z  + m[3];
+		outPos[3*v + 1] = m[4]*x + m[5]*y + m[6]*z  + m[7];
+		outPos[3*v + 2] = m[8]*x + m[9]*y + m[10]*z + m[11];
+		x = nx[i]; y = ny[i]; z = nz[i];
+		outNor[3*v]     = m[0]*x + m[1]*y + m[2]*z;
+		outNor[3*v + 1] = m[4]*x + m[5]*y + m[6]*z;
+		outNor[3*v + 2] = m[8]*x + m[9]*y + m[10]*z;
+	}
+}
+
+template <int N>
+void SkinKernel::skinDQScalar(const float *dq, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	for(size_t i = begin; i < end; i++) {
+		size_t v = vertexIndex[i];
+		const float *first = count > 0 ? dq + boneOffset[base + i] : dq;
+		float b[8] = {0.0f};
+		for(size_t s = 0; s < count; s++) {
+			float w = weight[base + s * bucket.paddedCount + i];
+			const float *q = dq + boneOffset[base + s * bucket.paddedCount + i];
+			// Shortest path: keep every rotation on the first one's side
+			if(q[0]*first[0] + q[1]*first[1] + q[2]*first[2] + q[3]*first[3] < 0.0f) {
+				w = -w;
+			}
+			for(int c = 0; c < 8; c++) {
+				b[c] += w * q[c];
+			}
+		}
+		float len = sqrt(b[0]*b[0] + b[1]*b[1] + b[2]*b[2] + b[3]*b[3]);
+		float inv = 1.0f / max(len, 1e-12f);
+		float rx = b[0]*inv, ry = b[1]*inv, rz = b[2]*inv, rw = b[3]*inv;
+		float dx = b[4]*inv, dy = b[5]*inv, dz = b[6]*inv, dw = b[7]*inv;
+		// Translation 2 * (rw * d - dw * r + r x d)
+		float tx = 2.0f * (rw*dx - dw*rx + ry*dz - rz*dy);
+		float ty = 2.0f * (rw*dy - dw*ry + rz*dx - rx*dz);
+		float tz = 2.0f * (rw*dz - dw*rz + rx*dy - ry*dx);
+		// Rotation v + 2 r x (r x v + rw v)
+		for(int k = 0; k < 2; k++) {
+			float x = k ? nx[i] : px[i];
+			float y = k ? ny[i] : py[i];
+			float z = k ? nz[i] : pz[i];
+			float cx = ry*z - rz*y + rw*x;
+			float cy = rz*x - rx*z + rw*y;
+			float cz = rx*y - ry*x + rw*z;
+			float *out = k ? outNor : outPos;
+			float t = k ? 0.0f : 1.0f;
+			out[3*v]     = x + 2.0f * (ry*cz - rz*cy) + t * tx;
+			out[3*v + 1] = y + 2.0f * (rz*cx - rx*cz) + t * ty;
+			out[3*v + 2] = z + 2.0f * (rx*cy - ry*cx) + t * tz;
+		}
+	}
+}
+
+#ifdef SKIN_X86
+
+template <int N>
+void SkinKernel::skinSSE(const float *palette, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	alignas(16) float res[6][4];
+	for(size_t i = begin; i < end; i += 4) {
+		__m128 m[12];
+		for(int c = 0; c < 12; c++) {
+			m[c] = _mm_setzero_ps();
+		}
+		for(size_t s = 0; s < count; s++) {
+			const int *o = &boneOffset[base + s * bucket.paddedCount + i];
+			__m128 w = _mm_load_ps(&weight[base + s * bucket.paddedCount + i]);
+			const float *b0 = palette + o[0];
+			const float *b1 = palette + o[1];
+			const float *b2 = palette + o[2];
+			const float *b3 = palette + o[3];
+			// SSE has no gather: load each lane's matrix element by hand
+			for(int c = 0; c < 12; c++) {
+				__m128 e = _mm_setr_ps(b0[c], b1[c], b2[c], b3[c]);
+				m[c] = _mm_add_ps(m[c], _mm_mul_ps(w, e));
+			}
+		}
+		__m128 x = _mm_load_ps(&px[i]);
+		__m128 y = _mm_load_ps(&py[i]);
+		__m128 z = _mm_load_ps(&pz[i]);
+		for(int r = 0; r < 3; r++) {
+			__m128 v = _mm_add_ps(_mm_mul_ps(m[4*r], x), _mm_mul_ps(m[4*r + 1], y));
+			v = _mm_add_ps(v, _mm_mul_ps(m[4*r + 2], z));
+			_mm_store_ps(res[r], _mm_add_ps(v, m[4*r + 3]));
+		}
+		x = _mm_load_ps(&nx[i]);
+		y = _mm_load_ps(&ny[i]);
+		z = _mm_load_ps(&nz[i]);
+		for(int r = 0; r < 3; r++) {
+			__m128 v = _mm_add_ps(_mm_mul_ps(m[4*r], x), _mm_mul_ps(m[4*r + 1], y));
+			_mm_store_ps(res[3 + r], _mm_add_ps(v, _mm_mul_ps(m[4*r + 2], z)));
+		}
+		size_t n = min((size_t)4, end - i);
+		for(size_t l = 0; l < n; l++) {
+			outPos[3*vertexIndex[i + l]]     = res[0][l];
+			outPos[3*vertexIndex[i + l] + 1] = res[1][l];
+			outPos[3*vertexIndex[i + l] + 2] = res[2][l];
+			outNor[3*vertexIndex[i + l]]     = res[3][l];
+			outNor[3*vertexIndex[i + l] + 1] = res[4][l];
+			outNor[3*vertexIndex[i + l] + 2] = res[5][l];
+		}
+	}
+}
+
+template <int N>
+SKIN_TARGET_AVX2
+void SkinKernel::skinAVX2(const float *palette, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	alignas(32) float res[6][8];
+	for(size_t i = begin; i < end; i += 8) {
+		__m256 m[12];
+		for(int c = 0; c < 12; c++) {
+			m[c] = _mm256_setzero_ps();
+		}
+		for(size_t s = 0; s < count; s++) {
+			__m256i o = _mm256_load_si256((const __m256i *)&boneOffset[base + s * bucket.paddedCount + i]);
+			__m256 w = _mm256_load_ps(&weight[base + s * bucket.paddedCount + i]);
+			for(int c = 0; c < 12; c++) {
+				__m256 e = _mm256_i32gather_ps(palette + c, o, 4);
+				m[c] = _mm256_fmadd_ps(w, e, m[c]);
+			}
+		}
+		__m256 x = _mm256_load_ps(&px[i]);
+		__m256 y = _mm256_load_ps(&py[i]);
+		__m256 z = _mm256_load_ps(&pz[i]);
+		for(int r = 0; r < 3; r++) {
+			__m256 v = _mm256_fmadd_ps(m[4*r], x, m[4*r + 3]);
+			v = _mm256_fmadd_ps(m[4*r + 1], y, v);
+			_mm256_store_ps(res[r], _mm256_fmadd_ps(m[4*r + 2], z, v));
+		}
+		x = _mm256_load_ps(&nx[i]);
+		y = _mm256_load_ps(&ny[i]);
+		z = _mm256_load_ps(&nz[i]);
+		for(int r = 0; r < 3; r++) {
+			__m256 v = _mm256_mul_ps(m[4*r], x);
+			v = _mm256_fmadd_ps(m[4*r + 1], y, v);
+			_mm256_store_ps(res[3 + r], _mm256_fmadd_ps(m[4*r + 2], z, v));
+		}
+		size_t n = min((size_t)8, end - i);
+		for(size_t l = 0; l < n; l++) {
+			outPos[3*vertexIndex[i + l]]     = res[0][l];
+			outPos[3*vertexIndex[i + l] + 1] = res[1][l];
+			outPos[3*vertexIndex[i + l] + 2] = res[2][l];
+			outNor[3*vertexIndex[i + l]]     = res[3][l];
+			outNor[3*vertexIndex[i + l] + 1] = res[4][l];
+			outNor[3*vertexIndex[i + l] + 2] = res[5][l];
+		}
+	}
+}
+
+template <int N>
+void SkinKernel::skinDQSSE(const float *dq, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	alignas(16) float res[6][4];
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 signBit = _mm_set1_ps(-0.0f);
+	for(size_t i = begin; i < end; i += 4) {
+		__m128 b[8];
+		for(int c = 0; c < 8; c++) {
+			b[c] = _mm_setzero_ps();
+		}
+		__m128 f[4];
+		for(size_t s = 0; s < count; s++) {
+			const int *o = &boneOffset[base + s * bucket.paddedCount + i];
+			__m128 w = _mm_load_ps(&weight[base + s * bucket.paddedCount + i]);
+			const float *q0 = dq + o[0];
+			const float *q1 = dq + o[1];
+			const float *q2 = dq + o[2];
+			const float *q3 = dq + o[3];
+			__m128 e[8];
+			for(int c = 0; c < 8; c++) {
+				e[c] = _mm_setr_ps(q0[c], q1[c], q2[c], q3[c]);
+			}
+			if(s == 0) {
+				for(int c = 0; c < 4; c++) {
+					f[c] = e[c];
+				}
+			}
+			// Flip the weight where the rotation is in the other hemisphere
+			__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e[0], f[0]), _mm_mul_ps(e[1], f[1])),
+				_mm_add_ps(_mm_mul_ps(e[2], f[2]), _mm_mul_ps(e[3], f[3])));
+			w = _mm_xor_ps(w, _mm_and_ps(d, signBit));
+			for(int c = 0; c < 8; c++) {
+				b[c] = _mm_add_ps(b[c], _mm_mul_ps(w, e[c]));
+			}
+		}
+		__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b[0], b[0]), _mm_mul_ps(b[1], b[1])),
+			_mm_add_ps(_mm_mul_ps(b[2], b[2]), _mm_mul_ps(b[3], b[3])));
+		__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(len2, _mm_set1_ps(1e-24f))));
+		__m128 rx = _mm_mul_ps(b[0], inv), ry = _mm_mul_ps(b[1], inv), rz = _mm_mul_ps(b[2], inv), rw = _mm_mul_ps(b[3], inv);
+		__m128 dx = _mm_mul_ps(b[4], inv), dy = _mm_mul_ps(b[5], inv), dz = _mm_mul_ps(b[6], inv), dw = _mm_mul_ps(b[7], inv);
+		__m128 t[3];
+		t[0] = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dx), _mm_mul_ps(dw, rx)), _mm_sub_ps(_mm_mul_ps(ry, dz), _mm_mul_ps(rz, dy))));
+		t[1] = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dy), _mm_mul_ps(dw, ry)), _mm_sub_ps(_mm_mul_ps(rz, dx), _mm_mul_ps(rx, dz))));
+		t[2] = _mm_mul_ps(two, _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rw, dz), _mm_mul_ps(dw, rz)), _mm_sub_ps(_mm_mul_ps(rx, dy), _mm_mul_ps(ry, dx))));
+		for(int k = 0; k < 2; k++) {
+			__m128 x = _mm_load_ps(k ? &nx[i] : &px[i]);
+			__m128 y = _mm_load_ps(k ? &ny[i] : &py[i]);
+			__m128 z = _mm_load_ps(k ? &nz[i] : &pz[i]);
+			__m128 cx = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ry, z), _mm_mul_ps(rz, y)), _mm_mul_ps(rw, x));
+			__m128 cy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rz, x), _mm_mul_ps(rx, z)), _mm_mul_ps(rw, y));
+			__m128 cz = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(rx, y), _mm_mul_ps(ry, x)), _mm_mul_ps(rw, z));
+			__m128 ox = _mm_add_ps(x, _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(ry, cz), _mm_mul_ps(rz, cy))));
+			__m128 oy = _mm_add_ps(y, _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(rz, cx), _mm_mul_ps(rx, cz))));
+			__m128 oz = _mm_add_ps(z, _mm_mul_ps(two, _mm_sub_ps(_mm_mul_ps(rx, cy), _mm_mul_ps(ry, cx))));
+			if(k == 0) {
+				ox = _mm_add_ps(ox, t[0]);
+				oy = _mm_add_ps(oy, t[1]);
+				oz = _mm_add_ps(oz, t[2]);
+			}
+			_mm_store_ps(res[3*k], ox);
+			_mm_store_ps(res[3*k + 1], oy);
+			_mm_store_ps(res[3*k + 2], oz);
+		}
+		size_t n = min((size_t)4, end - i);
+		for(size_t l = 0; l < n; l++) {
+			outPos[3*vertexIndex[i + l]]     = res[0][l];
+			outPos[3*vertexIndex[i + l] + 1] = res[1][l];
+			outPos[3*vertexIndex[i + l] + 2] = res[2][l];
+			outNor[3*vertexIndex[i + l]]     = res[3][l];
+			outNor[3*vertexIndex[i + l] + 1] = res[4][l];
+			outNor[3*vertexIndex[i + l] + 2] = res[5][l];
+		}
+	}
+}
+
+template <int N>
+SKIN_TARGET_AVX2
+void SkinKernel::skinDQAVX2(const float *dq, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	const size_t count = N > 0 ? N : bucket.influences;
+	const size_t base = bucket.influenceBase - bucket.begin;
+	alignas(32) float res[6][8];
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 signBit = _mm256_set1_ps(-0.0f);
+	for(size_t i = begin; i < end; i += 8) {
+		__m256 b[8];
+		for(int c = 0; c < 8; c++) {
+			b[c] = _mm256_setzero_ps();
+		}
+		__m256 f[4];
+		for(size_t s = 0; s < count; s++) {
+			__m256i o = _mm256_load_si256((const __m256i *)&boneOffset[base + s * bucket.paddedCount + i]);
+			__m256 w = _mm256_load_ps(&weight[base + s * bucket.paddedCount + i]);
+			__m256 e[8];
+			for(int c = 0; c < 8; c++) {
+				e[c] = _mm256_i32gather_ps(dq + c, o, 4);
+			}
+			if(s == 0) {
+				for(int c = 0; c < 4; c++) {
+					f[c] = e[c];
+				}
+			}
+			// Flip the weight where the rotation is in the other hemisphere
+			__m256 d = _mm256_mul_ps(e[0], f[0]);
+			d = _mm256_fmadd_ps(e[1], f[1], d);
+			d = _mm256_fmadd_ps(e[2], f[2], d);
+			d = _mm256_fmadd_ps(e[3], f[3], d);
+			w = _mm256_xor_ps(w, _mm256_and_ps(d, signBit));
+			for(int c = 0; c < 8; c++) {
+				b[c] = _mm256_fmadd_ps(w, e[c], b[c]);
+			}
+		}
+		__m256 len2 = _mm256_mul_ps(b[0], b[0]);
+		len2 = _mm256_fmadd_ps(b[1], b[1], len2);
+		len2 = _mm256_fmadd_ps(b[2], b[2], len2);
+		len2 = _mm256_fmadd_ps(b[3], b[3], len2);
+		__m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_sqrt_ps(_mm256_max_ps(len2, _mm256_set1_ps(1e-24f))));
+		__m256 rx = _mm256_mul_ps(b[0], inv), ry = _mm256_mul_ps(b[1], inv), rz = _mm256_mul_ps(b[2], inv), rw = _mm256_mul_ps(b[3], inv);
+		__m256 dx = _mm256_mul_ps(b[4], inv), dy = _mm256_mul_ps(b[5], inv), dz = _mm256_mul_ps(b[6], inv), dw = _mm256_mul_ps(b[7], inv);
+		__m256 t[3];
+		t[0] = _mm256_mul_ps(two, _mm256_fmsub_ps(rw, dx, _mm256_fmsub_ps(dw, rx, _mm256_fmsub_ps(ry, dz, _mm256_mul_ps(rz, dy)))));
+		t[1] = _mm256_mul_ps(two, _mm256_fmsub_ps(rw, dy, _mm256_fmsub_ps(dw, ry, _mm256_fmsub_ps(rz, dx, _mm256_mul_ps(rx, dz)))));
+		t[2] = _mm256_mul_ps(two, _mm256_fmsub_ps(rw, dz, _mm256_fmsub_ps(dw, rz, _mm256_fmsub_ps(rx, dy, _mm256_mul_ps(ry, dx)))));
+		for(int k = 0; k < 2; k++) {
+			__m256 x = _mm256_load_ps(k ? &nx[i] : &px[i]);
+			__m256 y = _mm256_load_ps(k ? &ny[i] : &py[i]);
+			__m256 z = _mm256_load_ps(k ? &nz[i] : &pz[i]);
+			__m256 cx = _mm256_fmadd_ps(rw, x, _mm256_fmsub_ps(ry, z, _mm256_mul_ps(rz, y)));
+			__m256 cy = _mm256_fmadd_ps(rw, y, _mm256_fmsub_ps(rz, x, _mm256_mul_ps(rx, z)));
+			__m256 cz = _mm256_fmadd_ps(rw, z, _mm256_fmsub_ps(rx, y, _mm256_mul_ps(ry, x)));
+			__m256 ox = _mm256_fmadd_ps(two, _mm256_fmsub_ps(ry, cz, _mm256_mul_ps(rz, cy)), x);
+			__m256 oy = _mm256_fmadd_ps(two, _mm256_fmsub_ps(rz, cx, _mm256_mul_ps(rx, cz)), y);
+			__m256 oz = _mm256_fmadd_ps(two, _mm256_fmsub_ps(rx, cy, _mm256_mul_ps(ry, cx)), z);
+			if(k == 0) {
+				ox = _mm256_add_ps(ox, t[0]);
+				oy = _mm256_add_ps(oy, t[1]);
+				oz = _mm256_add_ps(oz, t[2]);
+			}
+			_mm256_store_ps(res[3*k], ox);
+			_mm256_store_ps(res[3*k + 1], oy);
+			_mm256_store_ps(res[3*k + 2], oz);
+		}
+		size_t n = min((size_t)8, end - i);
+		for(size_t l = 0; l < n; l++) {
+			outPos[3*vertexIndex[i + l]]     = res[0][l];
+			outPos[3*vertexIndex[i + l] + 1] = res[1][l];
+			outPos[3*vertexIndex[i + l] + 2] = res[2][l];
+			outNor[3*vertexIndex[i + l]]     = res[3][l];
+			outNor[3*vertexIndex[i + l] + 1] = res[4][l];
+			outNor[3*vertexIndex[i + l] + 2] = res[5][l];
+		}
+	}
+}
+
+#else
+
+template <int N>
+void SkinKernel::skinSSE(const float *palette, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	skinScalar<N>(palette, outPos, outNor, bucket, begin, end);
+}
+
+template <int N>
+void SkinKernel::skinAVX2(const float *palette, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	skinScalar<N>(palette, outPos, outNor, bucket, begin, end);
+}
+
+template <int N>
+void SkinKernel::skinDQSSE(const float *dq, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	skinDQScalar<N>(dq, outPos, outNor, bucket, begin, end);
+}
+
+template <int N>
+void SkinKernel::skinDQAVX2(const float *dq, float *outPos, float *outNor, const Bucket &bucket, size_t begin, size_t end) const
+{
+	skinDQScalar<N>(dq, outPos, outNor, bucket, begin, end);
+}
+
+#endif
+
+// One instantiation per common influence count, the generic one otherwise.
+// This comes after the kernels: taking their address before the definitions
+// are seen would instantiate them without the target attribute.
+#define SKIN_PICK(fn) \
+	switch(influences) { \
+		case 1: return &SkinKernel::fn<1>; \
+		case 2: return &SkinKernel::fn<2>; \
+		case 3: return &SkinKernel::fn<3>; \
+		case 4: return &SkinKernel::fn<4>; \
+		default: return &SkinKernel::fn<0>; \
+	}
+
+SkinKernel::BucketFn SkinKernel::getBucketFn(size_t influences, bool dq) const
+{
+	switch(isa) {
+		case AVX2:
+			if(dq) {
+				SKIN_PICK(skinDQAVX2)
+			}
+			SKIN_PICK(skinAVX2)
+		case SSE:
+			if(dq) {
+				SKIN_PICK(skinDQSSE)
+			}
+			SKIN_PICK(skinSSE)
+		default:
+			if(dq) {
+				SKIN_PICK(skinDQScalar)
+			}
+			SKIN_PICK(skinScalar)
+	}
+}
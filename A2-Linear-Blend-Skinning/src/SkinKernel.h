@@ -0,0 +1,153 @@
+#pragma once
+#ifndef SKINKERNEL_H
+#define SKINKERNEL_H
+
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Minimal allocator so std::vector storage starts on a SIMD boundary
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+	template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n)
+	{
+		size_t bytes = ((n * sizeof(T) + Alignment - 1) / Alignment) * Alignment;
+#ifdef _MSC_VER
+		void *p = _aligned_malloc(bytes, Alignment);
+#else
+		void *p = std::aligned_alloc(Alignment, bytes);
+#endif
+		if(!p) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T *>(p);
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+	template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float, 32> > AlignedFloats;
+typedef std::vector<int, AlignedAllocator<int, 32> > AlignedInts;
+
+/**
+ * Linear blend skinning over structure-of-arrays vertex data.
+ *
+ * Vertices are sorted into buckets by influence count. Within a bucket,
+ * positions, normals, bone indices and weights are kept in separate 32-byte
+ * aligned arrays padded to a multiple of 8 vertices, with exactly as many
+ * influence slots as the bucket's count. Each bucket runs a kernel
+ * specialized for that count (1 to 4; larger counts share a generic one),
+ * so there are no zero-weight slots to multiply through and no per-slot
+ * branches. Results are scattered back to the original vertex order.
+ *
+ * For each vertex the weighted palette matrices are summed into one 3x4
+ * matrix, which is then applied to the position and normal. The SSE path
+ * does 4 vertices per iteration, the AVX2 path 8. The instruction set is
+ * picked at runtime; the scalar path works everywhere.
+ *
+ * The palette is 12 floats per bone: the top three rows of the 4x4 skinning
+ * matrix, row-major. Output is written interleaved (xyz) so it can go
+ * straight into the GL vertex buffers. skin() does not allocate.
+ *
+ * skinDQ() does dual quaternion skinning over the same arrays. Its palette
+ * keeps the 12-float stride (so the same bone offsets address it) but only
+ * the first 8 floats of each bone are read: the real part (x, y, z, w) and
+ * the dual part (x, y, z, w). Each vertex blends 8 floats per influence,
+ * flipping quaternions that are not in the same hemisphere as its first
+ * influence, normalizes, and applies the rigid transform.
+ */
+class SkinKernel
+{
+public:
+	enum ISA
+	{
+		SCALAR,
+		SSE,
+		AVX2
+	};
+
+	SkinKernel();
+	virtual ~SkinKernel();
+
+	// Interleaved xyz positions/normals. Influences in CSR form: vertex i's
+	// bones and weights are [start[i], start[i + 1]).
+	void setup(const float *pos, const float *nor, const unsigned int *start, const unsigned int *bones, const float *weights, size_t vertCount);
+	void skin(const float *palette, float *outPos, float *outNor) const;
+	// Skins slots [begin, end) of the bucketed order (see getSlotCount()).
+	// begin must be a multiple of 8 so that ranges can be handed to
+	// different threads.
+	void skinRange(const float *palette, float *outPos, float *outNor, size_t begin, size_t end) const;
+	void skinDQ(const float *dqPalette, float *outPos, float *outNor) const;
+	void skinRangeDQ(const float *dqPalette, float *outPos, float *outNor, size_t begin, size_t end) const;
+
+	void setISA(ISA isa);
+	ISA getISA() const { return isa; }
+	size_t getVertCount() const { return vertCount; }
+	// Vertices plus the padding that keeps each bucket a multiple of 8
+	size_t getSlotCount() const { return slotCount; }
+	size_t getBucketCount() const { return buckets.size(); }
+	// Vertex whose results slot i holds, getVertCount() for padding
+	unsigned int getSlotVertex(size_t i) const { return vertexIndex[i]; }
+	// Bytes held for bone offsets, weights and the vertex order
+	size_t getInfluenceBytes() const;
+
+	static ISA detectISA();
+	static const char *getISAName(ISA isa);
+
+private:
+	// Vertices with the same influence count, in slots [begin, end)
+	struct Bucket
+	{
+		size_t influences;
+		size_t begin;
+		size_t end;
+		size_t paddedCount;
+		// Influence s of slot i is at [influenceBase + s * paddedCount + i - begin]
+		size_t influenceBase;
+	};
+	typedef void (SkinKernel::*BucketFn)(const float *, float *, float *, const Bucket &, size_t, size_t) const;
+
+	void skinBuckets(const float *palette, float *outPos, float *outNor, size_t begin, size_t end, bool dq) const;
+	BucketFn getBucketFn(size_t influences, bool dq) const;
+
+	// N is the influence count, or 0 to read it from the bucket
+	template <int N> void skinScalar(const float *palette, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+	template <int N> void skinSSE(const float *palette, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+	template <int N> void skinAVX2(const float *palette, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+	template <int N> void skinDQScalar(const float *dq, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+	template <int N> void skinDQSSE(const float *dq, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+	template <int N> void skinDQAVX2(const float *dq, float *outPos, float *outNor, const Bucket &b, size_t begin, size_t end) const;
+
+	ISA isa;
+	size_t vertCount;
+	size_t slotCount;
+	std::vector<Bucket> buckets;
+
+	// Per slot, in bucketed order
+	AlignedFloats px, py, pz;
+	AlignedFloats nx, ny, nz;
+	std::vector<unsigned int> vertexIndex; // where the slot's results go, vertCount for padding
+	// Indices are pre-multiplied by 12 so they address the palette directly
+	AlignedInts boneOffset;
+	AlignedFloats weight;
+};
+
+#endif
@@ -0,0 +1,51 @@
+#pragma once
+#ifndef STREAMBUFFER_H
+#define STREAMBUFFER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <cstddef>
+
+/**
+ * Ring of REGIONS equal regions in one persistently mapped buffer
+ * (GL_ARB_buffer_storage), for vertex data rewritten every frame.
+ *
+ * Each frame, acquire() moves to the next region and returns where to
+ * write; the CPU writes straight into it (the mapping is coherent, so no
+ * flush is needed) and the draws read it at getOffset(). release() puts a
+ * fence after those draws. acquire() only waits when it comes back around
+ * to a region the GPU may still be reading, REGIONS frames later.
+ *
+ * The storage is never reallocated, unlike glBufferData every frame.
+ * Callers fall back to glBufferData when isSupported() is false.
+ */
+class StreamBuffer
+{
+public:
+	static const int REGIONS = 3;
+
+	StreamBuffer();
+	virtual ~StreamBuffer();
+
+	static bool isSupported();
+	// GL thread only, like everything below
+	bool init(size_t regionBytes);
+	void *acquire();
+	void release();
+
+	GLuint getID() const { return bufID; }
+	size_t getOffset() const { return current * regionBytes; }
+	// Time the last acquire() spent waiting on its region's fence
+	double getWaitMs() const { return waitMs; }
+
+private:
+	GLuint bufID;
+	char *mapped;
+	size_t regionBytes;
+	int current;
+	GLsync fences[REGIONS];
+	double waitMs;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <vector>
 #include <memory>
+#include <chrono>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -20,6 +21,15 @@
 #include "ShapeSkin.h"
 #include "Texture.h"
 #include "TextureMatrix.h"
+#include "Bench.h"
+#include "JobPool.h"
+#include "ClipStream.h"
+#include "CompressedClip.h"
+#include "PoseSampler.h"
+#include "Skeleton.h"
+#include "BlendTree.h"
+#include "Headless.h"
+#include "Profiler.h"
 
 #include "Parsers.hpp"
 
@@ -32,11 +42,18 @@ public:
 	vector<string> textureData;
 	vector< vector<string> > meshData;
 	string skeletonData;
+	bool streamSkeleton = false; // SKELETON_STREAM: decode frames on demand
+	float compressRotTol = 0.0f; // COMPRESS_CLIP <degrees> <units>: play from a CompressedClip
+	float compressPosTol = 0.0f;
+	string skeletonLocal; // SKELETON_LOCAL <prefix>: play the local-space clip
+	vector<string> clipData; // CLIP <local clip>: more clips to crossfade to
+	vector< vector<string> > layerData; // LAYER <local clip> <weight> <OVERRIDE|ADDITIVE> [joint]
 };
 
 DataInput dataInput;
 
 GLFWwindow *window; // Main application window
+shared_ptr<Headless> headless = NULL; // Offscreen context and framebuffer for --headless and --compare
 string RESOURCE_DIR = ""; // Where the shaders are loaded from
 string DATA_DIR = ""; // where the data are loaded from
 bool keyToggles[256] = {false};
@@ -46,7 +63,27 @@ vector< shared_ptr<ShapeSkin> > shapes;
 map< string, shared_ptr<Texture> > textureMap;
 shared_ptr<Program> progSimple = NULL;
 shared_ptr<Program> progSkin = NULL;
+shared_ptr<Program> progSkinGPU = NULL; // same shading, skinning in the vertex shader
+shared_ptr<Program> progSkinDQGPU = NULL; // same, dual quaternion skinning
+shared_ptr<JobPool> jobPool = NULL; // CPU skinning threads
+shared_ptr<ClipStream> clipStream = NULL; // Set instead of allFrames for SKELETON_STREAM
+shared_ptr<CompressedClip> compressedClip = NULL; // Set instead of allFrames for COMPRESS_CLIP
+CompressedClip::Cursor clipCursor; // Where decoding compressedClip got to
+Pose clipPose; // Decoded from compressedClip
+Pose nextPose; // The frame after clipPose, for sub-frame playback of compressedClip or clipStream
+Frame clipFrame(0); // clipPose as matrices
+PoseSampler sampler; // allFrames as rotations and translations, for sub-frame playback
+shared_ptr<Skeleton> skeleton = NULL; // Set for SKELETON_LOCAL; sampler then holds local poses
+shared_ptr<BlendTree> blendTree = NULL; // The character's clips and layers, with skeleton
+vector<int> baseClips; // blendTree clips that 'n' cycles the base layer through
+size_t baseClip = 0;
+double tBlend = 0.0; // t at the last blendTree update
+PoseSampler::Mode sampleMode = PoseSampler::NLERP;
 double t, t0;
+// Stage timings ('t'); readback and write are only timed by --headless
+shared_ptr<Profiler> profiler = NULL;
+int stageWait, stageSkin, stageUpload, stageDraw, stageReadback, stageWrite;
+string csvFile = "profile.csv"; // Written while the profiler is on
 
 bool drawWireframe = false;
 
@@ -74,6 +111,49 @@ static void char_callback(GLFWwindow *window, unsigned int key)
 {
 	keyToggles[key] = !keyToggles[key];
 	switch(key) {
+		case 'i':
+			// Cycle step / nlerp / slerp playback
+			sampleMode = (PoseSampler::Mode)((sampleMode + 1) % 3);
+			cout << "Sampling: " << PoseSampler::getModeName(sampleMode) << endl;
+			break;
+		case 'q':
+			// Swap linear blend and dual quaternion skinning on every mesh
+			for(const auto &shape : shapes) {
+				bool dq = shape->getSkinMethod() == ShapeSkin::DUAL_QUATERNION;
+				shape->setSkinMethod(dq ? ShapeSkin::LINEAR_BLEND : ShapeSkin::DUAL_QUATERNION);
+			}
+			break;
+		case 'd':
+			// Dirty-bone tracking on/off, to compare against full re-skinning
+			for(const auto &shape : shapes) {
+				shape->setIncremental(!shape->getIncremental());
+			}
+			cout << "Incremental skinning: " << (shapes.empty() || shapes[0]->getIncremental() ? "on" : "off") << endl;
+			break;
+		case 'p':
+			// Persistent-mapped streaming on/off (glBufferData when off)
+			for(const auto &shape : shapes) {
+				shape->setStreaming(!shape->isStreaming());
+			}
+			cout << "Vertex streaming: " << (!shapes.empty() && shapes[0]->isStreaming() ? "persistent mapped" : "glBufferData") << endl;
+			break;
+		case 't':
+			// Stage timings, unthrottled while they are on
+			glfwSwapInterval(keyToggles[key] ? 0 : 1);
+			profiler->setEnabled(keyToggles[key]);
+			if(keyToggles[key]) {
+				profiler->openCSV(csvFile);
+			} else {
+				profiler->closeCSV();
+			}
+			break;
+		case 'n':
+			// Crossfade to the next clip
+			if(blendTree && baseClips.size() > 1) {
+				baseClip = (baseClip + 1) % baseClips.size();
+				blendTree->crossfade(0, baseClips[baseClip], 0.5f);
+			}
+			break;
 	}
 
 	for(const auto &shape : shapes) {
@@ -110,15 +190,27 @@ void init()
 	keyToggles[(unsigned)'c'] = true;
 	
 	camera = make_shared<Camera>();
+	jobPool = make_shared<JobPool>();
+	profiler = make_shared<Profiler>();
+	stageWait = profiler->addStage("wait");
+	stageSkin = profiler->addStage("skin");
+	stageUpload = profiler->addStage("upload", true);
+	stageDraw = profiler->addStage("draw", true);
+	stageReadback = profiler->addStage("readback");
+	stageWrite = profiler->addStage("write");
+	profiler->setGPUTiming(true);
 	
 	// Create shapes
 	for(const auto &mesh : dataInput.meshData) {
 		auto shape = make_shared<ShapeSkin>();
 		shapes.push_back(shape);
 		shape->setTextureMatrixType(mesh[0]);
-		shape->loadMesh(DATA_DIR + mesh[0]);
-		shape->loadAttachment(DATA_DIR + mesh[1]);
+		shape->load(DATA_DIR + mesh[0], DATA_DIR + mesh[1]);
 		shape->setTextureFilename(mesh[2]);
+		if(mesh.size() > 3 && mesh[3] == "DQS") {
+			shape->setSkinMethod(ShapeSkin::DUAL_QUATERNION);
+		}
+		cout << "CPU skinning path: " << SkinKernel::getISAName(shape->getSkinISA()) << endl;
 	}
 	
 	// For drawing the grid, etc.
@@ -130,6 +222,12 @@ void init()
 	progSkin = make_shared<Program>();
 	progSkin->setShaderNames(RESOURCE_DIR + "skin_vert.glsl", RESOURCE_DIR + "skin_frag.glsl");
 	progSkin->setVerbose(true);
+	progSkinGPU = make_shared<Program>();
+	progSkinGPU->setShaderNames(RESOURCE_DIR + "skin_gpu_vert.glsl", RESOURCE_DIR + "skin_frag.glsl");
+	progSkinGPU->setVerbose(true);
+	progSkinDQGPU = make_shared<Program>();
+	progSkinDQGPU->setShaderNames(RESOURCE_DIR + "skin_dq_gpu_vert.glsl", RESOURCE_DIR + "skin_frag.glsl");
+	progSkinDQGPU->setVerbose(true);
 	
 	// Set background color
 	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
@@ -141,29 +239,42 @@ void init()
 	
 	for(auto shape : shapes) {
 		shape->init();
+		if(!shape->setStreaming(true)) {
+			cout << "No GL_ARB_buffer_storage, streaming vertices with glBufferData" << endl;
+		}
 	}
 	
 	progSimple->init();
 	progSimple->addUniform("P");
 	progSimple->addUniform("MV");
 	
-	progSkin->init();
-	progSkin->addAttribute("aPos");
-	progSkin->addAttribute("aNor");
-	progSkin->addAttribute("aTex");
-	progSkin->addUniform("P");
-	progSkin->addUniform("MV");
-	progSkin->addUniform("ka");
-	progSkin->addUniform("ks");
-	progSkin->addUniform("s");
-	progSkin->addUniform("kdTex");
-	progSkin->addUniform("T");
+	for(auto prog : {progSkin, progSkinGPU, progSkinDQGPU}) {
+		prog->init();
+		prog->addAttribute("aPos");
+		prog->addAttribute("aNor");
+		prog->addAttribute("aTex");
+		prog->addUniform("P");
+		prog->addUniform("MV");
+		prog->addUniform("ka");
+		prog->addUniform("ks");
+		prog->addUniform("s");
+		prog->addUniform("kdTex");
+		prog->addUniform("T");
+	}
+	progSkinGPU->addAttribute("aBoneInd");
+	progSkinGPU->addAttribute("aWeight");
+	progSkinGPU->addUniform("bones");
+	progSkinDQGPU->addAttribute("aBoneInd");
+	progSkinDQGPU->addAttribute("aWeight");
+	progSkinDQGPU->addUniform("bonesDQ");
 	
 	// Bind the texture to unit 1.
 	int unit = 1;
-	progSkin->bind();
-	glUniform1i(progSkin->getUniform("kdTex"), unit);
-	progSkin->unbind();
+	for(auto prog : {progSkin, progSkinGPU, progSkinDQGPU}) {
+		prog->bind();
+		glUniform1i(prog->getUniform("kdTex"), unit);
+		prog->unbind();
+	}
 	
 	for(const auto &filename : dataInput.textureData) {
 		auto textureKd = make_shared<Texture>();
@@ -174,16 +285,112 @@ void init()
 		textureKd->setWrapModes(GL_REPEAT, GL_REPEAT);
 	}
 	
-	// Initialize time.
-	glfwSetTime(0.0);
+	// Initialize time. Headless runs set t for each frame themselves.
+	if(!headless) {
+		glfwSetTime(0.0);
+	}
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+int getFrameCount()
+{
+	if(skeleton) {
+		return sampler.getFrameCount();
+	} else if(clipStream) {
+		return clipStream->getFrameCount();
+	} else if(compressedClip) {
+		return compressedClip->getFrameCount();
+	}
+	return allFrames.size();
+}
+
+// Bone matrices for frame k from whichever clip storage is in use
+const Frame &getPose(int k)
+{
+	if(skeleton) {
+		sampler.sample((float)k, PoseSampler::STEP, clipPose);
+		skeleton->computeWorld(clipPose, clipFrame);
+		return clipFrame;
+	} else if(clipStream) {
+		return clipStream->getFrame(k);
+	} else if(compressedClip) {
+		compressedClip->decode((float)k, clipPose, clipCursor);
+		clipFrame.bonePlacements.resize(clipPose.size());
+		for(size_t j = 0; j < clipPose.size(); j++) {
+			clipFrame.bonePlacements[j] = Bone(clipPose.rot[j], clipPose.pos[j]);
+		}
+		return clipFrame;
+	}
+	return allFrames.at(k);
+}
+
+static void toPose(const Frame &frame, Pose &pose)
+{
+	pose.resize(frame.bonePlacements.size());
+	for(size_t j = 0; j < pose.size(); j++) {
+		const glm::mat4 &M = frame.bonePlacements[j].quatMat;
+		pose.rot[j] = glm::normalize(glm::quat_cast(glm::mat3(M)));
+		pose.pos[j] = glm::vec3(M[3]);
+	}
+}
+
+// Pose at a fractional frame from compressedClip or clipStream, which the
+// sampler does not hold. Blends the two frames around it like PoseSampler,
+// wrapping from the last frame into the first. Between two of its own keys
+// the compressed clip always nlerps, whatever the mode.
+static void sampleClip(float frame, PoseSampler::Mode mode, Pose &pose)
+{
+	int n = getFrameCount();
+	float f = fmod(frame, (float)n);
+	if(f < 0.0f) {
+		f += n;
+	}
+	int a = min((int)f, n - 1);
+	int b = (a + 1) % n;
+	float alpha = (mode == PoseSampler::STEP) ? 0.0f : f - a;
+	if(compressedClip) {
+		if(alpha == 0.0f || b != 0) {
+			compressedClip->decode(a + alpha, pose, clipCursor);
+			return;
+		}
+		compressedClip->decode((float)a, pose, clipCursor);
+		compressedClip->decode(0.0f, nextPose, clipCursor);
+	} else {
+		// getFrame's result only lasts until the next call
+		toPose(clipStream->getFrame(a), pose);
+		if(alpha == 0.0f) {
+			return;
+		}
+		toPose(clipStream->getFrame(b), nextPose);
+	}
+	for(size_t j = 0; j < pose.size(); j++) {
+		pose.rot[j] = (mode == PoseSampler::SLERP) ? glm::slerp(pose.rot[j], nextPose.rot[j], alpha) : nlerp(pose.rot[j], nextPose.rot[j], alpha);
+		pose.pos[j] = glm::mix(pose.pos[j], nextPose.pos[j], alpha);
+	}
+}
+
+// Seconds, from GLFW unless there is no window
+static double getTime()
+{
+	if(headless) {
+		return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+	}
+	return glfwGetTime();
+}
+
+// Averages over the last Profiler::HISTORY frames
+static void printStageTimes()
+{
+	bool streaming = !shapes.empty() && shapes[0]->isStreaming();
+	cout << (streaming ? "persistent mapped" : "glBufferData") << ": ";
+	profiler->print(cout);
+}
+
 void render()
 {
 	// Update time.
-	double t1 = glfwGetTime();
+	double t1 = getTime();
 	float dt = (t1 - t0);
 	if(keyToggles[(unsigned)' ']) {
 		t += dt;
@@ -192,11 +399,18 @@ void render()
 
 	// Get current frame buffer size.
 	int width, height;
-	glfwGetFramebufferSize(window, &width, &height);
+	if(headless) {
+		width = headless->getWidth();
+		height = headless->getHeight();
+	} else {
+		glfwGetFramebufferSize(window, &width, &height);
+	}
 	glViewport(0, 0, width, height);
 	
 	// Use the window size for camera.
-	glfwGetWindowSize(window, &width, &height);
+	if(!headless) {
+		glfwGetWindowSize(window, &width, &height);
+	}
 	camera->setAspect((float)width/(float)height);
 	
 	// Clear buffers
@@ -251,11 +465,54 @@ void render()
 
 	// t = glfwGetTime();
 
-	int frameCount = allFrames.size(); // TODO: This number needs to be modified
+	int frameCount = getFrameCount();
 	int frame = ((int)floor(t*fps)) % frameCount;
+	if(skeleton) {
+		// Blend in local space, then one pass down the hierarchy
+		blendTree->update((float)(t - tBlend));
+		tBlend = t;
+		blendTree->evaluate(sampleMode, clipPose);
+		skeleton->computeWorld(clipPose, clipFrame);
+	} else if(compressedClip || clipStream) {
+		sampleClip((float)(t*fps), sampleMode, clipPose);
+		clipFrame.bonePlacements.resize(clipPose.size());
+		for(size_t j = 0; j < clipPose.size(); j++) {
+			clipFrame.bonePlacements[j] = Bone(clipPose.rot[j], clipPose.pos[j]);
+		}
+	}
+	bool sampled = skeleton || compressedClip || clipStream;
+	const Frame &pose = sampled ? clipFrame : getPose(frame);
 
 	//cout << "Frame count = " << frameCount << " | Current frame: " << frame << endl;
 
+	// Skin every character at once on the job pool. The GL uploads happen
+	// below, on this thread. With 'g' toggled, skinning runs in the vertex
+	// shader instead and only the palette is sent.
+	bool gpuSkinning = keyToggles[(unsigned)'g'];
+	// The palette blends the two frames around t, so playback is not tied
+	// to the 30 Hz data
+	for(const auto &shape : shapes) {
+		bool gpu = gpuSkinning && shape->canSkinOnGPU();
+		shape->setSkinMode(gpu ? ShapeSkin::GPU_SKINNING : ShapeSkin::CPU_SKINNING);
+		// Skinning writes into this frame's region of the streaming buffer
+		{
+			ProfileScope scope(profiler.get(), stageWait);
+			shape->map();
+		}
+		ProfileScope scope(profiler.get(), stageSkin);
+		if(sampler.getFrameCount() > 0 && !skeleton) {
+			sampler.sample((float)(t*fps), sampleMode, *shape);
+		} else if(compressedClip || clipStream) {
+			shape->buildPalette(clipPose);
+		} else {
+			shape->buildPalette(pose);
+		}
+	}
+	{
+		ProfileScope scope(profiler.get(), stageSkin);
+		ShapeSkin::skinAll(shapes, jobPool.get());
+	}
+
 	for(const auto &shape : shapes) {
 		MV->pushMatrix();
 
@@ -273,10 +530,10 @@ void render()
 			glLoadMatrixf(glm::value_ptr(MV->topMatrix()));
 			for (int i = 0; i < bindPose.bonePlacements.size(); i++){
 				// Draw frame
-				glm::vec3 origin = allFrames.at(frame).bonePlacements.at(i).quatMat[3];
-				glm::vec3 xDir = glm::vec3(allFrames.at(frame).bonePlacements.at(i).quatMat[0])*5.0f + origin;
-				glm::vec3 yDir = glm::vec3(allFrames.at(frame).bonePlacements.at(i).quatMat[1])*5.0f + origin;
-				glm::vec3 zDir = glm::vec3(allFrames.at(frame).bonePlacements.at(i).quatMat[2])*5.0f + origin;
+				glm::vec3 origin = pose.bonePlacements.at(i).quatMat[3];
+				glm::vec3 xDir = glm::vec3(pose.bonePlacements.at(i).quatMat[0])*5.0f + origin;
+				glm::vec3 yDir = glm::vec3(pose.bonePlacements.at(i).quatMat[1])*5.0f + origin;
+				glm::vec3 zDir = glm::vec3(pose.bonePlacements.at(i).quatMat[2])*5.0f + origin;
 
 				glLineWidth(2);
 				glBegin(GL_LINES);
@@ -308,29 +565,157 @@ void render()
 		}
 		
 		// Draw skin
-		progSkin->bind();
-		textureMap[shape->getTextureFilename()]->bind(progSkin->getUniform("kdTex"));
+		auto prog = progSkin;
+		if(shape->getSkinMode() == ShapeSkin::GPU_SKINNING) {
+			prog = (shape->getSkinMethod() == ShapeSkin::DUAL_QUATERNION) ? progSkinDQGPU : progSkinGPU;
+		}
+		prog->bind();
+		textureMap[shape->getTextureFilename()]->bind(prog->getUniform("kdTex"));
 		glLineWidth(1.0f); // for wireframe
-		glUniformMatrix4fv(progSkin->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
-		glUniformMatrix4fv(progSkin->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
-		glUniform3f(progSkin->getUniform("ka"), 0.1f, 0.1f, 0.1f);
-		glUniform3f(progSkin->getUniform("ks"), 0.1f, 0.1f, 0.1f);
-		glUniform1f(progSkin->getUniform("s"), 200.0f);
-		shape->setProgram(progSkin);
-		shape->update(frame);
-		shape->draw(frame);
-		progSkin->unbind();
+		glUniformMatrix4fv(prog->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
+		glUniformMatrix4fv(prog->getUniform("MV"), 1, GL_FALSE, glm::value_ptr(MV->topMatrix()));
+		glUniform3f(prog->getUniform("ka"), 0.1f, 0.1f, 0.1f);
+		glUniform3f(prog->getUniform("ks"), 0.1f, 0.1f, 0.1f);
+		glUniform1f(prog->getUniform("s"), 200.0f);
+		shape->setProgram(prog);
+		{
+			ProfileScope scope(profiler.get(), stageUpload);
+			shape->upload();
+		}
+		{
+			ProfileScope scope(profiler.get(), stageDraw);
+			shape->draw(frame);
+		}
+		prog->unbind();
 		
 		MV->popMatrix();
 	}
 
+	if(keyToggles[(unsigned)'u']) {
+		// What dirty-bone tracking saved this frame
+		size_t skinned = 0, verts = 0, bytes = 0;
+		for(const auto &shape : shapes) {
+			skinned += shape->getSkinnedVertCount();
+			verts += shape->getVertCount();
+			bytes += shape->getUploadedBytes();
+		}
+		cout << "frame " << frame << ": skinned " << skinned << " of " << verts << " vertices, uploaded " << bytes << " bytes" << endl;
+	}
+
 	// Pop matrix stacks.
 	MV->popMatrix();
 	P->popMatrix();
 
+	// Kept out of the --headless frames
+	if(!headless) {
+		profiler->draw(width, height);
+	}
+
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+// Renders a few frames with CPU and then GPU skinning into the headless
+// framebuffer and compares them. Pixels whose channels differ by more than
+// 'tolerance' (0-255) count as mismatches; a small fraction is allowed for
+// edge pixels that land differently due to float rounding.
+bool compareSkinningPaths(int tolerance)
+{
+	const double maxMismatch = 0.005;
+	int width = headless->getWidth();
+	int height = headless->getHeight();
+	vector<unsigned char> cpuPixels;
+	vector<unsigned char> gpuPixels;
+
+	bool ok = true;
+	int frameCount = getFrameCount();
+	for(int frame = 0; frame < frameCount; frame += max(1, frameCount / 4)) {
+		t = (frame + 0.5) / 30.0;
+		keyToggles[(unsigned)'g'] = false;
+		render();
+		headless->readPixels(cpuPixels);
+		keyToggles[(unsigned)'g'] = true;
+		render();
+		headless->readPixels(gpuPixels);
+
+		int mismatched = 0;
+		int maxDiff = 0;
+		for(int i = 0; i < width * height; i++) {
+			int d = 0;
+			for(int c = 0; c < 4; c++) {
+				d = max(d, abs((int)cpuPixels[4*i + c] - (int)gpuPixels[4*i + c]));
+			}
+			maxDiff = max(maxDiff, d);
+			if(d > tolerance) {
+				mismatched++;
+			}
+		}
+		double fraction = mismatched / (double)(width * height);
+		bool pass = fraction <= maxMismatch;
+		ok = ok && pass;
+		cout << "frame " << frame << ": " << mismatched << " mismatched pixels (" << 100.0 * fraction << "%), max diff " << maxDiff << (pass ? " ok" : " FAILED") << endl;
+	}
+	keyToggles[(unsigned)'g'] = false;
+	return ok;
+}
+
+// Renders frames 0..frameCount-1 of the clip at 30 Hz steps as fast as
+// possible and writes each one to outDir (which must exist) as
+// frame_00000.ppm (or .raw), then prints the average time per stage. With
+// csvFile set, each frame's stage times go there too.
+bool runHeadless(int frameCount, const string &outDir, Headless::Format format)
+{
+	const double fps = 30.0;
+	vector<unsigned char> pixels;
+	profiler->setEnabled(true);
+	if(!csvFile.empty()) {
+		profiler->openCSV(csvFile);
+	}
+	double tStart = getTime();
+	for(int k = 0; k < frameCount; k++) {
+		t = k / fps;
+		render();
+		{
+			// Reading back waits for the GPU, so this includes its time
+			ProfileScope scope(profiler.get(), stageReadback);
+			headless->readPixels(pixels);
+		}
+		if(!outDir.empty()) {
+			ProfileScope scope(profiler.get(), stageWrite);
+			char name[32];
+			snprintf(name, sizeof(name), "frame_%05d", k);
+			if(!headless->writeFrame(outDir + "/" + name + Headless::getExtension(format), format, pixels)) {
+				return false;
+			}
+		}
+		profiler->endFrame();
+	}
+	double seconds = getTime() - tStart;
+	cout << frameCount << " frames at " << headless->getWidth() << "x" << headless->getHeight() << " in " << seconds << " s (" << frameCount / seconds << " fps)" << endl;
+	printStageTimes();
+	profiler->closeCSV();
+	return true;
+}
+
+// The offscreen context and framebuffer, with the scene initialized in it
+static bool initHeadless(int width, int height)
+{
+	headless = make_shared<Headless>();
+	if(!headless->createContext()) {
+		cerr << "No offscreen OpenGL context" << endl;
+		return false;
+	}
+	glewExperimental = true;
+	// glewInit() also wants a GLX display, which an EGL context lacks
+	if((headless->isEGL() ? glewContextInit() : glewInit()) != GLEW_OK) {
+		cerr << "Failed to initialize GLEW" << endl;
+		return false;
+	}
+	glGetError();
+	cout << "OpenGL renderer: " << glGetString(GL_RENDERER) << ", version " << glGetString(GL_VERSION) << endl;
+	init();
+	return headless->createFramebuffer(width, height);
+}
+
 void loadDataInputFile()
 {
 	string filename = DATA_DIR + "input.txt";
@@ -371,10 +756,31 @@ void loadDataInputFile()
 			mesh.push_back(value); // skin
 			ss >> value;
 			mesh.push_back(value); // texture
+			if(ss >> value) {
+				mesh.push_back(value); // LBS or DQS
+			}
 			dataInput.meshData.push_back(mesh);
 		} else if(key.compare("SKELETON") == 0) {
 			ss >> value;
 			dataInput.skeletonData = value;
+		} else if(key.compare("SKELETON_STREAM") == 0) {
+			ss >> value;
+			dataInput.skeletonData = value;
+			dataInput.streamSkeleton = true;
+		} else if(key.compare("SKELETON_LOCAL") == 0) {
+			ss >> dataInput.skeletonLocal;
+		} else if(key.compare("CLIP") == 0) {
+			ss >> value;
+			dataInput.clipData.push_back(value);
+		} else if(key.compare("LAYER") == 0) {
+			vector<string> layer;
+			while(ss >> value) {
+				layer.push_back(value);
+			}
+			dataInput.layerData.push_back(layer);
+		} else if(key.compare("COMPRESS_CLIP") == 0) {
+			ss >> dataInput.compressRotTol;
+			ss >> dataInput.compressPosTol;
 		} else {
 			cout << "Unkown key word: " << key << endl;
 		}
@@ -382,17 +788,159 @@ void loadDataInputFile()
 	in.close();
 }
 
+// The SKELETON_LOCAL clip is the base layer; CLIP lines add clips it can
+// crossfade to and LAYER lines add layers on top
+bool loadBlendTree(const vector<Pose> &localFrames)
+{
+	blendTree = make_shared<BlendTree>();
+	baseClips.push_back(blendTree->addClip(localFrames));
+	for(const auto &file : dataInput.clipData) {
+		vector<Pose> frames;
+		if(!skeleton->loadClip(DATA_DIR + file, frames)) {
+			return false;
+		}
+		int clip = blendTree->addClip(frames);
+		if(clip < 0) {
+			cout << file << " does not match the skeleton" << endl;
+			return false;
+		}
+		baseClips.push_back(clip);
+	}
+	blendTree->addLayer(baseClips[0], BlendTree::OVERRIDE);
+	for(const auto &layer : dataInput.layerData) {
+		vector<Pose> frames;
+		if(layer.size() < 3 || !skeleton->loadClip(DATA_DIR + layer[0], frames)) {
+			cout << "Bad LAYER line" << endl;
+			return false;
+		}
+		bool additive = layer[2] == "ADDITIVE";
+		int mask = -1;
+		if(layer.size() > 3) {
+			int joint = skeleton->findJoint(layer[3]);
+			if(joint < 0) {
+				cout << "No joint " << layer[3] << endl;
+				return false;
+			}
+			vector<float> weights;
+			skeleton->getSubtreeMask(joint, weights);
+			mask = blendTree->addMask(weights);
+		}
+		int clip = blendTree->addClip(frames, additive);
+		if(blendTree->addLayer(clip, additive ? BlendTree::ADDITIVE : BlendTree::OVERRIDE, (float)atof(layer[1].c_str()), mask) < 0) {
+			cout << layer[0] << " does not match the skeleton" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
 int main(int argc, char **argv)
 {
 	if(argc < 3) {
-		cout << "Usage: A2 <SHADER DIR> <DATA DIR>" << endl;
+		cout << "Usage: A2 <SHADER DIR> <DATA DIR> [--bench <name> [args...] | --compare [tolerance] | --cook |" << endl;
+		cout << "       --headless [--frames N] [--out dir] [--format ppm|raw] [--size WxH] [--csv file]]" << endl;
 		return 0;
 	}
 	RESOURCE_DIR = argv[1] + string("/");
 	DATA_DIR = argv[2] + string("/");
 	loadDataInputFile();
 
-	loadBoneAnimation(dataInput.skeletonData);
+	// Rebuild every binary bundle from the text files, then exit
+	if(argc >= 4 && string(argv[3]) == "--cook") {
+		remove(BinaryCache::getPath(DATA_DIR + dataInput.skeletonData).c_str());
+		loadBoneAnimationCached(dataInput.skeletonData);
+		for(const auto &mesh : dataInput.meshData) {
+			remove(BinaryCache::getPath(DATA_DIR + mesh[0]).c_str());
+			ShapeSkin().load(DATA_DIR + mesh[0], DATA_DIR + mesh[1]);
+		}
+		return 0;
+	}
+
+	if(!dataInput.skeletonLocal.empty()) {
+		skeleton = make_shared<Skeleton>();
+		vector<Pose> localFrames;
+		Pose localBind;
+		if(!skeleton->load(DATA_DIR + dataInput.skeletonLocal, localFrames, localBind)) {
+			return -1;
+		}
+		skeleton->computeWorld(localBind, bindPose);
+		sampler.setClip(localFrames);
+		if(!loadBlendTree(localFrames)) {
+			return -1;
+		}
+	} else if(dataInput.streamSkeleton) {
+		clipStream = make_shared<ClipStream>();
+		if(!clipStream->open(DATA_DIR + dataInput.skeletonData)) {
+			return -1;
+		}
+		bindPose = clipStream->getBindPose();
+	} else {
+		loadBoneAnimationCached(dataInput.skeletonData);
+	}
+
+	// Headless benchmarks: no window needed
+	if(argc >= 5 && string(argv[3]) == "--bench") {
+		vector<string> args(argv + 5, argv + argc);
+		return runBenchmark(argv[4], args, dataInput.meshData, dataInput.skeletonData) ? 0 : -1;
+	}
+
+	// Keep only the compressed clip
+	if(dataInput.compressRotTol > 0.0f && !allFrames.empty()) {
+		compressedClip = make_shared<CompressedClip>();
+		compressedClip->compress(allFrames, glm::radians(dataInput.compressRotTol), dataInput.compressPosTol);
+		cout << "Compressed clip: " << allFrames.size() * bindPose.bonePlacements.size() * sizeof(Bone) / 1024 << " KB -> " << compressedClip->getByteSize() / 1024 << " KB" << endl;
+		vector<Frame>().swap(allFrames);
+	}
+	if(!skeleton) {
+		sampler.setClip(allFrames);
+	}
+	
+	// CPU vs. GPU skinning pixel comparison, offscreen like --headless, so it
+	// needs no display. Under Mesa, LIBGL_ALWAYS_SOFTWARE=1 gives llvmpipe.
+	if(argc >= 4 && string(argv[3]) == "--compare") {
+		int tolerance = (argc >= 5) ? atoi(argv[4]) : 8;
+		bool ok = initHeadless(640, 480) && compareSkinningPaths(tolerance);
+		// Shapes and programs go before the context
+		shapes.clear();
+		profiler.reset();
+		headless.reset();
+		return ok ? 0 : -1;
+	}
+
+	// Offscreen batch rendering: no window, no vsync, no input
+	if(argc >= 4 && string(argv[3]) == "--headless") {
+		int frameCount = getFrameCount();
+		int width = 640, height = 480;
+		string outDir;
+		csvFile = "";
+		Headless::Format format = Headless::PPM;
+		for(int i = 4; i + 1 < argc; i += 2) {
+			string opt = argv[i], val = argv[i + 1];
+			if(opt == "--frames") {
+				frameCount = atoi(val.c_str());
+			} else if(opt == "--out") {
+				outDir = val;
+			} else if(opt == "--format") {
+				format = (val == "raw") ? Headless::RAW : Headless::PPM;
+			} else if(opt == "--size") {
+				sscanf(val.c_str(), "%dx%d", &width, &height);
+			} else if(opt == "--csv") {
+				csvFile = val;
+			} else {
+				cout << "Unknown option " << opt << endl;
+				return -1;
+			}
+		}
+		if(!initHeadless(width, height)) {
+			return -1;
+		}
+		bool ok = runHeadless(frameCount, outDir, format);
+		// Shapes and programs go before the context
+		shapes.clear();
+		profiler.reset();
+		headless.reset();
+		return ok ? 0 : -1;
+	}
 	
 	// Set error callback.
 	glfwSetErrorCallback(error_callback);
@@ -436,6 +984,11 @@ int main(int argc, char **argv)
 			render();
 			// Swap front and back buffers.
 			glfwSwapBuffers(window);
+			// The frame time includes the swap
+			profiler->endFrame();
+			if(profiler->isEnabled() && profiler->getFrameCount() > 0 && profiler->getFrameCount() % Profiler::HISTORY == 0) {
+				printStageTimes();
+			}
 		}
 		// Poll for and process events.
 		glfwPollEvents();
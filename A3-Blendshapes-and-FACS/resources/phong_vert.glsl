@@ -1,35 +1,54 @@
 #version 120
 
+// Blendshapes: every target's position and normal deltas are packed in
+// bsTex, two texels per vertex per target (see Shape::initBlendShapes()).
+// Only the targets with a non-zero weight are listed, so the others cost
+// nothing. A 16-bit bsTex holds each target's deltas divided by its
+// ranges, which are folded into bsWeight (positions) and bsNorWeight.
+const int MAX_TARGETS = 64;
+
 attribute vec4 aPos;
 attribute vec3 aNor;
 attribute vec2 aTex;
-
-// Blendshape position and normal vectors:
-attribute vec3 blendshape1Pos;
-attribute vec3 blendshape1Nor;
-
-attribute vec3 blendshape2Pos;
-attribute vec3 blendshape2Nor;
-
-attribute vec3 blendshape3Pos;
-attribute vec3 blendshape3Nor;
+attribute float aVert; // vertex index, to find its texels
 
 uniform mat4 P;
 uniform mat4 MV;
 
-// Weights for each of the aforementioned blendshapes
-uniform float wA;
-uniform float wB;
-uniform float wC;
+uniform sampler2D bsTex;
+uniform vec2 bsTexSize;
+uniform float bsVertCount;
+uniform int bsCount;
+uniform float bsTarget[MAX_TARGETS];
+uniform float bsWeight[MAX_TARGETS];
+uniform float bsNorWeight[MAX_TARGETS];
 
 varying vec3 vPos;
 varying vec3 vNor;
 varying vec2 vTex;
 
+vec3 fetchDelta(float texel)
+{
+	// Exact: integers below 2^24, and the width is a power of 2
+	float y = floor(texel / bsTexSize.x);
+	float x = texel - y * bsTexSize.x;
+	return texture2DLod(bsTex, (vec2(x, y) + 0.5) / bsTexSize, 0.0).xyz;
+}
+
 void main()
-{	
-	vec4 posCam = MV * vec4(aPos.xyz + blendshape1Pos * wA + blendshape2Pos * wB + blendshape3Pos * wC, 1.0);
-	vec3 norCam = (MV * vec4(normalize(aNor + blendshape1Nor * wA + blendshape2Nor * wB + blendshape3Nor * wC), 0.0)).xyz;
+{
+	vec3 pos = aPos.xyz;
+	vec3 nor = aNor;
+	for(int i = 0; i < MAX_TARGETS; i++) {
+		if(i >= bsCount) {
+			break;
+		}
+		float texel = 2.0 * (bsTarget[i] * bsVertCount + aVert);
+		pos += fetchDelta(texel) * bsWeight[i];
+		nor += fetchDelta(texel + 1.0) * bsNorWeight[i];
+	}
+	vec4 posCam = MV * vec4(pos, 1.0);
+	vec3 norCam = (MV * vec4(normalize(nor), 0.0)).xyz;
 	gl_Position = P * posCam;
 	
 	vPos = posCam.xyz; 
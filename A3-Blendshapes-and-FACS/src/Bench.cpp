@@ -0,0 +1,569 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+#define GLM_FORCE_RADIANS
+#include <glm/glm.hpp>
+
+#include "Bench.h"
+#include "ObjParser.h"
+#include "Shape.h"
+#include "BlendKernel.h"
+#include "ThreadPool.h"
+#include "FacsClip.h"
+#include "FacsAnimator.h"
+
+using namespace std;
+
+typedef chrono::high_resolution_clock Clock;
+
+static double elapsedMs(Clock::time_point t0)
+{
+	return chrono::duration<double, milli>(Clock::now() - t0).count();
+}
+
+// What the loaders took from tinyobj::LoadObj: the attributes and every
+// shape's corners, in order
+static bool loadTinyObj(const string &filename, ObjData &obj)
+{
+	tinyobj::attrib_t attrib;
+	vector<tinyobj::shape_t> shapes;
+	vector<tinyobj::material_t> materials;
+	string warn, err;
+	if(!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str())) {
+		cerr << err << endl;
+		return false;
+	}
+	obj.vertices = attrib.vertices;
+	obj.normals = attrib.normals;
+	obj.texcoords = attrib.texcoords;
+	obj.indices.clear();
+	for(const auto &shape : shapes) {
+		obj.indices.insert(obj.indices.end(), shape.mesh.indices.begin(), shape.mesh.indices.end());
+	}
+	return true;
+}
+
+static bool sameObj(const ObjData &a, const ObjData &b)
+{
+	if(a.vertices != b.vertices || a.normals != b.normals || a.texcoords != b.texcoords || a.indices.size() != b.indices.size()) {
+		return false;
+	}
+	for(size_t i = 0; i < a.indices.size(); i++) {
+		if(a.indices[i].vertex_index != b.indices[i].vertex_index ||
+			a.indices[i].normal_index != b.indices[i].normal_index ||
+			a.indices[i].texcoord_index != b.indices[i].texcoord_index) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Startup OBJ parsing: every file once, one after another as init() reads
+// them, with tinyobj::LoadObj and with parseObj on 1 to N threads. Checks
+// that parseObj matches LoadObj exactly. Arguments: N (default: every
+// hardware thread), repetitions.
+static bool benchParse(const vector<string> &args, const vector<string> &objFiles)
+{
+	int maxThreads = args.empty() ? max(1, (int)thread::hardware_concurrency()) : stoi(args[0]);
+	int reps = (args.size() > 1) ? stoi(args[1]) : 3;
+
+	bool ok = true;
+	double totalBytes = 0.0;
+	for(const auto &file : objFiles) {
+		ObjData ref, obj;
+		bool loaded = loadTinyObj(file, ref) && parseObj(file, obj, maxThreads);
+		bool same = loaded && sameObj(ref, obj);
+		ok = ok && same;
+		ifstream in(file, ios::binary | ios::ate);
+		double kb = in.tellg() / 1024.0;
+		totalBytes += kb * 1024.0;
+		cout << file << ": " << kb << " KB, " << obj.vertices.size() / 3 << " v, " << obj.indices.size() / 3 << " triangles, "
+			<< (same ? "same as tinyobj" : "DIFFERENT from tinyobj") << endl;
+	}
+
+	auto t0 = Clock::now();
+	for(int r = 0; r < reps; r++) {
+		for(const auto &file : objFiles) {
+			ObjData obj;
+			loadTinyObj(file, obj);
+		}
+	}
+	double tinyMs = elapsedMs(t0) / reps;
+	cout << objFiles.size() << " files, " << totalBytes / (1024.0 * 1024.0) << " MB" << endl;
+	cout << "tinyobj      : " << tinyMs << " ms, " << totalBytes / (1024.0 * 1024.0) / (tinyMs * 1e-3) << " MB/s" << endl;
+
+	vector<int> threadCounts;
+	for(int n = 1; n < maxThreads; n *= 2) {
+		threadCounts.push_back(n);
+	}
+	threadCounts.push_back(maxThreads);
+	for(int n : threadCounts) {
+		t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			for(const auto &file : objFiles) {
+				ObjData obj;
+				parseObj(file, obj, n);
+			}
+		}
+		double ms = elapsedMs(t0) / reps;
+		cout << "parseObj x" << n << (n < 10 ? " " : "") << " : " << ms << " ms, " << totalBytes / (1024.0 * 1024.0) / (ms * 1e-3) << " MB/s, "
+			<< tinyMs / ms << "x" << endl;
+	}
+	cout << (ok ? "all files match" : "MISMATCH") << endl;
+	return ok;
+}
+
+// Every mesh with DELTA lines, with all of its targets (not only the
+// emotion's)
+static vector< shared_ptr<Shape> > loadBlendShapes(const vector<string> &meshFiles, const vector< pair<string, string> > &deltaFiles, float epsilon, bool quantize = false)
+{
+	vector< shared_ptr<Shape> > shapes;
+	for(const auto &mesh : meshFiles) {
+		shared_ptr<Shape> shape;
+		for(const auto &delta : deltaFiles) {
+			if(delta.first != mesh) {
+				continue;
+			}
+			if(!shape) {
+				shape = make_shared<Shape>();
+				shape->setDeltaEpsilon(epsilon);
+				shape->setDeltaQuantization(quantize);
+				shape->loadMesh(mesh);
+			}
+			vector<float> pos, nor;
+			loadBlendShapeObj(delta.second, pos, nor);
+			shape->addBlendShape(delta.second, pos, nor, 0);
+		}
+		if(shape) {
+			shapes.push_back(shape);
+		}
+	}
+	return shapes;
+}
+
+// A shape's sparse deltas scattered back out to one dense array per target
+static void scatterDense(const Shape &shape, vector< vector<float> > &densePos, vector< vector<float> > &denseNor)
+{
+	size_t targetCount = shape.blendshapes.size();
+	densePos.assign(targetCount, vector<float>(shape.posBuf.size(), 0.0f));
+	denseNor.assign(targetCount, vector<float>(shape.norBuf.size(), 0.0f));
+	for(size_t t = 0; t < targetCount; t++) {
+		const BlendShape &bs = *shape.blendshapes[t];
+		for(size_t e = 0; e < bs.bsVerts.size(); e++) {
+			for(int k = 0; k < 3; k++) {
+				densePos[t][3 * bs.bsVerts[e] + k] = bs.getPosDelta(3 * e + k);
+				if(bs.hasNormals()) {
+					denseNor[t][3 * bs.bsVerts[e] + k] = bs.getNorDelta(3 * e + k);
+				}
+			}
+		}
+	}
+}
+
+// The naive loop: every target over every vertex, then every normal
+// renormalized
+static void blendDense(const Shape &shape, const vector< vector<float> > &densePos, const vector< vector<float> > &denseNor, const vector<float> &weights, vector<float> &pos, vector<float> &nor)
+{
+	pos = shape.posBuf;
+	nor = shape.norBuf;
+	for(size_t t = 0; t < densePos.size(); t++) {
+		float w = weights[t];
+		for(size_t i = 0; i < pos.size(); i++) {
+			pos[i] += w * densePos[t][i];
+		}
+		for(size_t i = 0; i < nor.size(); i++) {
+			nor[i] += w * denseNor[t][i];
+		}
+	}
+	for(size_t i = 0; i < nor.size(); i += 3) {
+		glm::vec3 n = glm::normalize(glm::vec3(nor[i], nor[i + 1], nor[i + 2]));
+		nor[i] = n.x;
+		nor[i + 1] = n.y;
+		nor[i + 2] = n.z;
+	}
+}
+
+static float maxDifference(const vector<float> &a, const vector<float> &b)
+{
+	float err = 0.0f;
+	for(size_t i = 0; i < a.size() && i < b.size(); i++) {
+		err = max(err, abs(a[i] - b[i]));
+	}
+	return err;
+}
+
+// Sparse blendshape deltas: per-target sparsity and bytes against dense
+// deltas, and the CPU blend with every target at weight 0.5, sparse against
+// the dense loop it replaced. Arguments: epsilon, repetitions.
+static bool benchDeltas(const vector<string> &args, const vector<string> &meshFiles, const vector< pair<string, string> > &deltaFiles)
+{
+	float epsilon = args.empty() ? 1e-4f : stof(args[0]);
+	int reps = (args.size() > 1) ? stoi(args[1]) : 200;
+	cout << "Epsilon " << epsilon << endl;
+	auto shapes = loadBlendShapes(meshFiles, deltaFiles, epsilon);
+
+	bool ok = true;
+	size_t denseBytes = 0, sparseBytes = 0;
+	for(const auto &shape : shapes) {
+		size_t vertCount = shape->posBuf.size() / 3;
+		size_t targetCount = shape->blendshapes.size();
+		size_t entries = 0;
+		for(const auto &bs : shape->blendshapes) {
+			denseBytes += bs->denseBytes;
+			sparseBytes += bs->getBytes();
+			entries += bs->bsVerts.size();
+		}
+		cout << shape->getMeshFilename() << ": " << targetCount << " targets, " << 100.0 * entries / (targetCount * vertCount)
+			<< "% of the vertex deltas kept" << endl;
+
+		// The old dense loop, over the same deltas scattered back out
+		vector< vector<float> > densePos, denseNor;
+		scatterDense(*shape, densePos, denseNor);
+		for(float &weight : shape->blendWeights) {
+			weight = 0.5f;
+		}
+		vector<float> pos, nor;
+		auto t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			blendDense(*shape, densePos, denseNor, shape->blendWeights, pos, nor);
+		}
+		double denseMs = elapsedMs(t0) / reps;
+
+		t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			shape->blendReference();
+		}
+		double sparseMs = elapsedMs(t0) / reps;
+
+		// Same positions; normals the dense loop renormalized may differ in
+		// the last bits
+		float posErr = maxDifference(pos, shape->getBlendPos());
+		float norErr = maxDifference(nor, shape->getBlendNor());
+		bool same = posErr == 0.0f && norErr < 1e-5f;
+		ok = ok && same;
+		cout << "CPU blend, dense : " << denseMs << " ms" << endl;
+		cout << "CPU blend, sparse: " << sparseMs << " ms, " << denseMs / sparseMs << "x, max difference " << posErr << " (positions) "
+			<< norErr << " (normals)" << (same ? "" : " MISMATCH") << endl;
+	}
+	cout << "Total: " << sparseBytes / 1024 << " KB sparse instead of " << denseBytes / 1024 << " KB dense, "
+		<< (denseBytes - sparseBytes) / 1024 << " KB (" << 100.0 * (denseBytes - sparseBytes) / max<size_t>(denseBytes, 1) << "%) saved" << endl;
+	return ok;
+}
+
+// CPU blending with every target weighted: the naive dense loop, the sparse
+// scalar loop, the block kernel on one thread for each instruction set, and
+// on 1 to N threads. The kernel has to match the sparse loop. Arguments: N
+// (default: every hardware thread), repetitions.
+static bool benchBlend(const vector<string> &args, const vector<string> &meshFiles, const vector< pair<string, string> > &deltaFiles)
+{
+	int maxThreads = args.empty() ? max(1, (int)thread::hardware_concurrency()) : stoi(args[0]);
+	int reps = (args.size() > 1) ? stoi(args[1]) : 200;
+	auto shapes = loadBlendShapes(meshFiles, deltaFiles, 1e-4f);
+
+	bool ok = true;
+	for(const auto &shape : shapes) {
+		size_t targetCount = shape->blendshapes.size();
+		for(size_t t = 0; t < targetCount; t++) {
+			shape->blendWeights[t] = 0.5f + 0.4f * sin((float)t);
+		}
+		const BlendKernel &kernel = shape->getKernel();
+		cout << shape->getMeshFilename() << ": " << shape->posBuf.size() / 3 << " vertices, " << targetCount << " targets, "
+			<< kernel.getBlockCount() << " blocks of " << BlendKernel::BLOCK << ", " << kernel.getEntryCount() << " block deltas, "
+			<< kernel.getBytes() / 1024 << " KB" << endl;
+
+		vector< vector<float> > densePos, denseNor;
+		scatterDense(*shape, densePos, denseNor);
+		vector<float> pos, nor;
+		auto t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			blendDense(*shape, densePos, denseNor, shape->blendWeights, pos, nor);
+		}
+		double denseMs = elapsedMs(t0) / reps;
+		cout << "dense scalar     : " << denseMs << " ms" << endl;
+
+		t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			shape->blendReference();
+		}
+		double ms = elapsedMs(t0) / reps;
+		vector<float> refPos = shape->getBlendPos();
+		vector<float> refNor = shape->getBlendNor();
+		cout << "sparse scalar    : " << ms << " ms, " << denseMs / ms << "x" << endl;
+
+		// FMA and a different normalization change the last bits
+		auto check = [&](const char *label, double ms) {
+			float posErr = maxDifference(refPos, shape->getBlendPos());
+			float norErr = maxDifference(refNor, shape->getBlendNor());
+			bool same = posErr < 1e-4f && norErr < 1e-4f;
+			ok = ok && same;
+			cout << label << ms << " ms, " << denseMs / ms << "x, max difference " << posErr << " (positions) " << norErr << " (normals)"
+				<< (same ? "" : " MISMATCH") << endl;
+		};
+		BlendKernel::ISA best = BlendKernel::detectISA();
+		for(int isa = BlendKernel::SCALAR; isa <= best; isa++) {
+			shape->setBlendISA((BlendKernel::ISA)isa);
+			t0 = Clock::now();
+			for(int r = 0; r < reps; r++) {
+				shape->blendCPU();
+			}
+			string label = string("kernel ") + BlendKernel::getISAName((BlendKernel::ISA)isa);
+			label.resize(17, ' ');
+			check((label + ": ").c_str(), elapsedMs(t0) / reps);
+		}
+
+		vector<int> threadCounts;
+		for(int n = 1; n < maxThreads; n *= 2) {
+			threadCounts.push_back(n);
+		}
+		threadCounts.push_back(maxThreads);
+		for(int n : threadCounts) {
+			ThreadPool pool(n);
+			t0 = Clock::now();
+			for(int r = 0; r < reps; r++) {
+				shape->blendCPU(&pool);
+			}
+			string label = string("kernel ") + BlendKernel::getISAName(best) + " x" + to_string(n);
+			label.resize(17, ' ');
+			check((label + ": ").c_str(), elapsedMs(t0) / reps);
+		}
+
+		// What a streamed frame costs: every vertex written, as into a
+		// freshly acquired region of the mapped buffer
+		vector<float> outPos(shape->posBuf.size()), outNor(shape->norBuf.size());
+		t0 = Clock::now();
+		for(int r = 0; r < reps; r++) {
+			kernel.blend(shape->blendWeights.data(), outPos.data(), outNor.empty() ? NULL : outNor.data(), true);
+		}
+		ms = elapsedMs(t0) / reps;
+		cout << "kernel, all verts: " << ms << " ms, " << denseMs / ms << "x" << endl;
+	}
+	cout << (ok ? "kernel matches" : "MISMATCH") << endl;
+	return ok;
+}
+
+// FACS playback for a crowd: a clip with N keyed action units (8 random
+// keys each over 10 s) and crossfades between 3 emotions of 4 of them, on
+// M faces with their own time offsets and speeds, for F frames at 60 Hz.
+// FacsAnimator against the clip's curves searched face by face, which it
+// has to match. Arguments: M, N, F.
+static bool benchFacs(const vector<string> &args)
+{
+	int faceCount = args.empty() ? 1000 : stoi(args[0]);
+	int auCount = (args.size() > 1) ? stoi(args[1]) : 50;
+	int frames = (args.size() > 2) ? stoi(args[2]) : 600;
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> unit(0.0f, 1.0f);
+	FacsClip clip;
+	clip.setLength(10.0f);
+	for(int a = 1; a <= auCount; a++) {
+		for(int k = 0; k < 8; k++) {
+			clip.addKey(a, 10.0f * unit(rng), unit(rng));
+		}
+	}
+	vector<Emotion> emotions(3);
+	for(int e = 0; e < 3; e++) {
+		emotions[e].emotionName = "emotion " + to_string(e);
+		for(int a = 0; a < 4; a++) {
+			emotions[e].actionNumbers.push_back(1 + (4 * e + a) % auCount);
+		}
+	}
+	clip.addFade(0.0f, 1.0f, emotions[0]);
+	clip.addFade(3.0f, 1.5f, emotions[1]);
+	clip.addFade(6.0f, 1.0f, emotions[2]);
+	clip.addFade(9.0f, 1.0f, emotions[0]);
+
+	FacsAnimator animator;
+	int c = animator.addClip(clip);
+	vector<float> offsets(faceCount), speeds(faceCount);
+	for(int f = 0; f < faceCount; f++) {
+		offsets[f] = 10.0f * unit(rng);
+		speeds[f] = 0.8f + 0.4f * unit(rng);
+		animator.addFace(c, offsets[f], speeds[f]);
+	}
+	size_t slotCount = animator.getSlotCount();
+	cout << faceCount << " faces, " << slotCount << " action units, " << animator.getCurveCount() << " curves, "
+		<< animator.getKeyCount() << " keys" << endl;
+
+	// Face by face, each curve searched from scratch
+	vector<FacsClip::Curve> curves = clip.getCurves();
+	vector< vector<int> > curveSlots;
+	for(const auto &curve : curves) {
+		vector<int> slots;
+		for(int a : curve.actionNumbers) {
+			slots.push_back(animator.getSlot(a));
+		}
+		curveSlots.push_back(slots);
+	}
+	vector<float> ref(faceCount * slotCount);
+	auto evaluateRef = [&](double t) {
+		for(int f = 0; f < faceCount; f++) {
+			double local = fmod(offsets[f] + speeds[f] * t, (double)clip.getLength());
+			float lt = (float)(local < 0.0 ? local + clip.getLength() : local);
+			float *w = &ref[f * slotCount];
+			fill(w, w + slotCount, 0.0f);
+			for(size_t k = 0; k < curves.size(); k++) {
+				const auto &times = curves[k].times;
+				const auto &values = curves[k].values;
+				size_t i = upper_bound(times.begin(), times.end(), lt) - times.begin();
+				float v;
+				if(times.empty()) {
+					v = 0.0f;
+				} else if(i == 0 || lt <= times.front()) {
+					v = values.front();
+				} else if(i == times.size()) {
+					v = values.back();
+				} else {
+					float a = (lt - times[i - 1]) / (times[i] - times[i - 1]);
+					v = values[i - 1] + a * (values[i] - values[i - 1]);
+				}
+				for(int slot : curveSlots[k]) {
+					w[slot] += v;
+				}
+			}
+			for(size_t s = 0; s < slotCount; s++) {
+				w[s] = min(max(w[s], 0.0f), 1.0f);
+			}
+		}
+	};
+
+	auto t0 = Clock::now();
+	for(int r = 0; r < frames; r++) {
+		evaluateRef(r / 60.0);
+	}
+	double refMs = elapsedMs(t0) / frames;
+	t0 = Clock::now();
+	for(int r = 0; r < frames; r++) {
+		animator.evaluate(r / 60.0);
+	}
+	double ms = elapsedMs(t0) / frames;
+
+	// Same weights, frame by frame
+	float err = 0.0f;
+	for(int r = 0; r < frames; r += 7) {
+		evaluateRef(r / 60.0);
+		animator.evaluate(r / 60.0);
+		for(int f = 0; f < faceCount; f++) {
+			for(size_t s = 0; s < slotCount; s++) {
+				err = max(err, abs(ref[f * slotCount + s] - animator.getWeights(f)[s]));
+			}
+		}
+	}
+	double perWeight = 1e6 * ms / (faceCount * slotCount);
+	cout << "searched per face: " << refMs << " ms/frame" << endl;
+	cout << "FacsAnimator     : " << ms << " ms/frame, " << perWeight << " ns per weight, " << refMs / ms << "x, max difference " << err << endl;
+	return err < 1e-5f;
+}
+
+// 16-bit blendshape deltas against float ones: bytes of the sparse deltas,
+// the kernel's blocks and the GPU delta texture, each target's quantization
+// error, how far the blended shape moves, and the kernel's time. The kernel
+// has to match the reference loop over the same 16-bit deltas, and the
+// blended positions have to stay within the sum of w * each target's
+// largest error. Arguments: repetitions.
+static bool benchQuantize(const vector<string> &args, const vector<string> &meshFiles, const vector< pair<string, string> > &deltaFiles)
+{
+	int reps = args.empty() ? 200 : stoi(args[0]);
+	auto floatShapes = loadBlendShapes(meshFiles, deltaFiles, 1e-4f);
+	auto quantShapes = loadBlendShapes(meshFiles, deltaFiles, 1e-4f, true);
+
+	bool ok = true;
+	for(size_t s = 0; s < floatShapes.size() && s < quantShapes.size(); s++) {
+		Shape &fs = *floatShapes[s];
+		Shape &qs = *quantShapes[s];
+		size_t vertCount = fs.posBuf.size() / 3;
+		size_t targetCount = fs.blendshapes.size();
+		cout << fs.getMeshFilename() << ": " << vertCount << " vertices, " << targetCount << " targets" << endl;
+
+		size_t floatBytes = 0, quantBytes = 0;
+		float posBound = 0.0f;
+		for(size_t t = 0; t < targetCount; t++) {
+			const BlendShape &bs = *qs.blendshapes[t];
+			floatBytes += fs.blendshapes[t]->getBytes();
+			quantBytes += bs.getBytes();
+			float w = 0.5f + 0.4f * sin((float)t);
+			fs.blendWeights[t] = qs.blendWeights[t] = w;
+			posBound += w * bs.quantError.posMax;
+			cout << "  " << bs.bsName << ": range " << bs.posRange << " / " << bs.norRange << ", error max " << bs.quantError.posMax
+				<< " rms " << bs.quantError.posRms << " (positions), max " << bs.quantError.norMax << " rms " << bs.quantError.norRms
+				<< " (normals)" << endl;
+		}
+		// Two texels per vertex per target, RGB32F or RGB16_SNORM
+		size_t texels = 2 * targetCount * vertCount;
+		cout << "sparse deltas: " << floatBytes / 1024 << " KB float, " << quantBytes / 1024 << " KB 16-bit, "
+			<< (double)floatBytes / quantBytes << "x" << endl;
+		cout << "kernel blocks: " << fs.getKernel().getBytes() / 1024 << " KB float, " << qs.getKernel().getBytes() / 1024
+			<< " KB 16-bit, " << (double)fs.getKernel().getBytes() / qs.getKernel().getBytes() << "x" << endl;
+		cout << "GPU texture  : " << texels * 12 / 1024 << " KB float, " << texels * 6 / 1024 << " KB 16-bit, 2x" << endl;
+
+		// What quantizing does to the blended shape
+		fs.blendReference();
+		qs.blendReference();
+		vector<float> refPos = qs.getBlendPos();
+		vector<float> refNor = qs.getBlendNor();
+		float posErr = maxDifference(fs.getBlendPos(), refPos);
+		float norErr = maxDifference(fs.getBlendNor(), refNor);
+		bool bounded = posErr <= posBound + 1e-5f;
+		ok = ok && bounded;
+		cout << "blended shape: max difference " << posErr << " (positions, bound " << posBound << ") " << norErr << " (normals)"
+			<< (bounded ? "" : " OVER BOUND") << endl;
+
+		BlendKernel::ISA best = BlendKernel::detectISA();
+		for(int isa = BlendKernel::SCALAR; isa <= best; isa++) {
+			fs.setBlendISA((BlendKernel::ISA)isa);
+			qs.setBlendISA((BlendKernel::ISA)isa);
+			auto t0 = Clock::now();
+			for(int r = 0; r < reps; r++) {
+				fs.blendCPU();
+			}
+			double floatMs = elapsedMs(t0) / reps;
+			t0 = Clock::now();
+			for(int r = 0; r < reps; r++) {
+				qs.blendCPU();
+			}
+			double quantMs = elapsedMs(t0) / reps;
+			float kernelErr = max(maxDifference(refPos, qs.getBlendPos()), maxDifference(refNor, qs.getBlendNor()));
+			bool same = kernelErr < 1e-4f;
+			ok = ok && same;
+			string label = string("kernel ") + BlendKernel::getISAName((BlendKernel::ISA)isa);
+			label.resize(13, ' ');
+			cout << label << ": " << floatMs << " ms float, " << quantMs << " ms 16-bit, max difference " << kernelErr
+				<< (same ? "" : " MISMATCH") << endl;
+		}
+	}
+	cout << (ok ? "16-bit deltas within bounds" : "MISMATCH") << endl;
+	return ok;
+}
+
+bool runBenchmark(const string &name, const vector<string> &args, const vector<string> &meshFiles, const vector< pair<string, string> > &deltaFiles)
+{
+	if(name == "parse") {
+		vector<string> objFiles = meshFiles;
+		for(const auto &delta : deltaFiles) {
+			objFiles.push_back(delta.second);
+		}
+		return benchParse(args, objFiles);
+	}
+	if(name == "deltas") {
+		return benchDeltas(args, meshFiles, deltaFiles);
+	}
+	if(name == "blend") {
+		return benchBlend(args, meshFiles, deltaFiles);
+	}
+	if(name == "facs") {
+		return benchFacs(args);
+	}
+	if(name == "quantize") {
+		return benchQuantize(args, meshFiles, deltaFiles);
+	}
+	cout << "Unknown benchmark: " << name << endl;
+	cout << "Available: parse [threads] [reps], deltas [epsilon] [reps], blend [threads] [reps], facs [faces] [action units] [frames], quantize [reps]" << endl;
+	return false;
+}
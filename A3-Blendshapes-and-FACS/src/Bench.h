@@ -0,0 +1,17 @@
+#pragma once
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Headless benchmarks. These only touch CPU-side data, so they run without
+// a window or GL context:
+//   A3 <SHADER DIR> <DATA DIR> --bench <name> [args...]
+// meshFiles are the MESH OBJs from input.txt and deltaFiles the DELTA lines
+// as (base mesh, target) pairs, all with DATA_DIR.
+// Returns false if the benchmark name is unknown or a check failed.
+bool runBenchmark(const std::string &name, const std::vector<std::string> &args, const std::vector<std::string> &meshFiles, const std::vector< std::pair<std::string, std::string> > &deltaFiles);
+
+#endif
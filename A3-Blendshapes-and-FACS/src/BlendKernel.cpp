@@ -0,0 +1,394 @@
+#include <algorithm>
+#include <cmath>
+
+#include "BlendKernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BLEND_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BLEND_TARGET_AVX2
+#else
+#define BLEND_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+using namespace std;
+
+// Floats per block: 8 lanes of px, py, pz, nx, ny, nz
+static const size_t BLOCK_FLOATS = 6 * BlendKernel::BLOCK;
+
+BlendKernel::BlendKernel() :
+	vertCount(0),
+	hasNormals(false),
+	quantized(false)
+{
+	isa = detectISA();
+}
+
+BlendKernel::~BlendKernel()
+{
+}
+
+BlendKernel::ISA BlendKernel::detectISA()
+{
+#ifdef BLEND_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if(info[0] >= 7) {
+		__cpuidex(info, 7, 0);
+		bool avx2 = (info[1] & (1 << 5)) != 0;
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		if(avx2 && fma && osxsave && (_xgetbv(0) & 6) == 6) {
+			return AVX2;
+		}
+	}
+	return SSE;
+#else
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+		return AVX2;
+	}
+	// SSE2 is part of x86-64
+	return SSE;
+#endif
+#else
+	return SCALAR;
+#endif
+}
+
+const char *BlendKernel::getISAName(ISA isa)
+{
+	switch(isa) {
+		case SSE: return "SSE";
+		case AVX2: return "AVX2";
+		default: return "scalar";
+	}
+}
+
+void BlendKernel::setISA(ISA isa)
+{
+	// Never go above what the CPU supports
+	this->isa = min(isa, detectISA());
+}
+
+void BlendKernel::setup(const float *pos, const float *nor, size_t vertCount, const vector<Target> &targets)
+{
+	this->vertCount = vertCount;
+	hasNormals = (nor != NULL);
+	size_t blockCount = (vertCount + BLOCK - 1) / BLOCK;
+
+	base.assign(blockCount * BLOCK_FLOATS, 0.0f);
+	for(size_t v = 0; v < vertCount; v++) {
+		float *b = &base[(v / BLOCK) * BLOCK_FLOATS + v % BLOCK];
+		for(int k = 0; k < 3; k++) {
+			b[k * BLOCK] = pos[3*v + k];
+			b[(3 + k) * BLOCK] = nor ? nor[3*v + k] : 0.0f;
+		}
+	}
+
+	// Entries per block. A target's vertices are sorted, so the ones in the
+	// same block are next to each other.
+	blockStart.assign(blockCount + 1, 0);
+	for(const Target &t : targets) {
+		size_t last = blockCount;
+		for(size_t i = 0; i < t.count; i++) {
+			size_t b = t.verts[i] / BLOCK;
+			if(b != last) {
+				blockStart[b + 1]++;
+				last = b;
+			}
+		}
+	}
+	for(size_t b = 0; b < blockCount; b++) {
+		blockStart[b + 1] += blockStart[b];
+	}
+
+	// 16-bit entries only if every target has them; otherwise quantized
+	// targets are widened here
+	quantized = !targets.empty();
+	targetScale.clear();
+	for(const Target &t : targets) {
+		quantized = quantized && t.posQ;
+		targetScale.push_back(t.posScale);
+		targetScale.push_back(t.norScale);
+	}
+	if(!quantized) {
+		targetScale.clear();
+	}
+
+	// Fill them target by target, so a block sums its targets in order
+	size_t entryCount = blockStart[blockCount];
+	entryTarget.assign(entryCount, 0);
+	entryDelta.assign(quantized ? 0 : entryCount * BLOCK_FLOATS, 0.0f);
+	entryDelta16.assign(quantized ? entryCount * BLOCK_FLOATS : 0, 0);
+	vector<unsigned int> next(blockStart.begin(), blockStart.end() - 1);
+	for(size_t t = 0; t < targets.size(); t++) {
+		const Target &target = targets[t];
+		size_t last = blockCount;
+		size_t e = 0;
+		for(size_t i = 0; i < target.count; i++) {
+			unsigned int v = target.verts[i];
+			size_t b = v / BLOCK;
+			if(b != last) {
+				e = next[b]++;
+				entryTarget[e] = (unsigned int)t;
+				last = b;
+			}
+			size_t d = e * BLOCK_FLOATS + v % BLOCK;
+			for(int k = 0; k < 3; k++) {
+				if(quantized) {
+					entryDelta16[d + k * BLOCK] = target.posQ[3*i + k];
+					entryDelta16[d + (3 + k) * BLOCK] = target.norQ ? target.norQ[3*i + k] : 0;
+				} else if(target.posQ) {
+					entryDelta[d + k * BLOCK] = target.posQ[3*i + k] * target.posScale;
+					entryDelta[d + (3 + k) * BLOCK] = target.norQ ? target.norQ[3*i + k] * target.norScale : 0.0f;
+				} else {
+					entryDelta[d + k * BLOCK] = target.pos[3*i + k];
+					entryDelta[d + (3 + k) * BLOCK] = target.nor ? target.nor[3*i + k] : 0.0f;
+				}
+			}
+		}
+	}
+}
+
+size_t BlendKernel::getBytes() const
+{
+	return (base.size() + entryDelta.size() + targetScale.size()) * sizeof(float) + entryDelta16.size() * sizeof(short)
+		+ (blockStart.size() + entryTarget.size()) * sizeof(unsigned int);
+}
+
+void BlendKernel::blend(const float *weights, float *outPos, float *outNor, bool writeUntouched) const
+{
+	(this->*getBlocksFn())(weights, outPos, outNor, 0, getBlockCount(), writeUntouched);
+}
+
+void BlendKernel::blendRange(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	(this->*getBlocksFn())(weights, outPos, outNor, begin, min(end, getBlockCount()), writeUntouched);
+}
+
+void BlendKernel::writeBlock(const float *res, float *outPos, float *outNor, size_t block) const
+{
+	size_t v0 = block * BLOCK;
+	size_t n = min((size_t)BLOCK, vertCount - v0);
+	float *p = outPos + 3 * v0;
+	for(size_t l = 0; l < n; l++) {
+		p[3*l]     = res[l];
+		p[3*l + 1] = res[BLOCK + l];
+		p[3*l + 2] = res[2 * BLOCK + l];
+	}
+	if(!outNor) {
+		return;
+	}
+	float *q = outNor + 3 * v0;
+	for(size_t l = 0; l < n; l++) {
+		q[3*l]     = res[3 * BLOCK + l];
+		q[3*l + 1] = res[4 * BLOCK + l];
+		q[3*l + 2] = res[5 * BLOCK + l];
+	}
+}
+
+template <bool Q>
+void BlendKernel::blendScalar(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	float res[BLOCK_FLOATS];
+	for(size_t b = begin; b < end; b++) {
+		if(blockStart[b] == blockStart[b + 1]) {
+			if(writeUntouched) {
+				writeBlock(&base[b * BLOCK_FLOATS], outPos, outNor, b);
+			}
+			continue;
+		}
+		const float *bp = &base[b * BLOCK_FLOATS];
+		for(size_t c = 0; c < BLOCK_FLOATS; c++) {
+			res[c] = bp[c];
+		}
+		for(unsigned int e = blockStart[b]; e < blockStart[b + 1]; e++) {
+			unsigned int t = entryTarget[e];
+			float w = weights[t];
+			if(w == 0.0f) {
+				continue;
+			}
+			if(Q) {
+				float wp = w * targetScale[2*t], wn = w * targetScale[2*t + 1];
+				const short *d = &entryDelta16[e * BLOCK_FLOATS];
+				for(size_t c = 0; c < BLOCK_FLOATS / 2; c++) {
+					res[c] += wp * d[c];
+				}
+				for(size_t c = BLOCK_FLOATS / 2; c < BLOCK_FLOATS; c++) {
+					res[c] += wn * d[c];
+				}
+			} else {
+				const float *d = &entryDelta[e * BLOCK_FLOATS];
+				for(size_t c = 0; c < BLOCK_FLOATS; c++) {
+					res[c] += w * d[c];
+				}
+			}
+		}
+		for(int l = 0; l < BLOCK && hasNormals; l++) {
+			float x = res[3 * BLOCK + l], y = res[4 * BLOCK + l], z = res[5 * BLOCK + l];
+			// Padding lanes are zero; keep them finite
+			float inv = 1.0f / sqrt(max(x*x + y*y + z*z, 1e-24f));
+			res[3 * BLOCK + l] = x * inv;
+			res[4 * BLOCK + l] = y * inv;
+			res[5 * BLOCK + l] = z * inv;
+		}
+		writeBlock(res, outPos, outNor, b);
+	}
+}
+
+#ifdef BLEND_X86
+
+template <bool Q>
+void BlendKernel::blendSSE(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	alignas(16) float res[BLOCK_FLOATS];
+	const __m128 tiny = _mm_set1_ps(1e-24f);
+	const __m128 one = _mm_set1_ps(1.0f);
+	for(size_t b = begin; b < end; b++) {
+		if(blockStart[b] == blockStart[b + 1]) {
+			if(writeUntouched) {
+				writeBlock(&base[b * BLOCK_FLOATS], outPos, outNor, b);
+			}
+			continue;
+		}
+		const float *bp = &base[b * BLOCK_FLOATS];
+		__m128 a[12];
+		for(int c = 0; c < 12; c++) {
+			a[c] = _mm_load_ps(bp + 4*c);
+		}
+		for(unsigned int e = blockStart[b]; e < blockStart[b + 1]; e++) {
+			unsigned int t = entryTarget[e];
+			float w = weights[t];
+			if(w == 0.0f) {
+				continue;
+			}
+			if(Q) {
+				// 8 shorts per load; sign-extend each half by unpacking
+				// into the high 16 bits and shifting back
+				__m128 wp = _mm_set1_ps(w * targetScale[2*t]);
+				__m128 wn = _mm_set1_ps(w * targetScale[2*t + 1]);
+				const __m128i *d = (const __m128i *)&entryDelta16[e * BLOCK_FLOATS];
+				for(int c = 0; c < 6; c++) {
+					__m128i x = _mm_load_si128(d + c);
+					__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+					__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+					__m128 wv = c < 3 ? wp : wn;
+					a[2*c] = _mm_add_ps(a[2*c], _mm_mul_ps(wv, lo));
+					a[2*c + 1] = _mm_add_ps(a[2*c + 1], _mm_mul_ps(wv, hi));
+				}
+			} else {
+				__m128 wv = _mm_set1_ps(w);
+				const float *d = &entryDelta[e * BLOCK_FLOATS];
+				for(int c = 0; c < 12; c++) {
+					a[c] = _mm_add_ps(a[c], _mm_mul_ps(wv, _mm_load_ps(d + 4*c)));
+				}
+			}
+		}
+		if(hasNormals) {
+			// Normals are a[6..11]: x in 6-7, y in 8-9, z in 10-11
+			for(int h = 0; h < 2; h++) {
+				__m128 x = a[6 + h], y = a[8 + h], z = a[10 + h];
+				__m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+				__m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(len2, tiny)));
+				a[6 + h] = _mm_mul_ps(x, inv);
+				a[8 + h] = _mm_mul_ps(y, inv);
+				a[10 + h] = _mm_mul_ps(z, inv);
+			}
+		}
+		for(int c = 0; c < 12; c++) {
+			_mm_store_ps(res + 4*c, a[c]);
+		}
+		writeBlock(res, outPos, outNor, b);
+	}
+}
+
+template <bool Q>
+BLEND_TARGET_AVX2
+void BlendKernel::blendAVX2(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	alignas(32) float res[BLOCK_FLOATS];
+	const __m256 tiny = _mm256_set1_ps(1e-24f);
+	const __m256 one = _mm256_set1_ps(1.0f);
+	for(size_t b = begin; b < end; b++) {
+		if(blockStart[b] == blockStart[b + 1]) {
+			if(writeUntouched) {
+				writeBlock(&base[b * BLOCK_FLOATS], outPos, outNor, b);
+			}
+			continue;
+		}
+		const float *bp = &base[b * BLOCK_FLOATS];
+		__m256 a[6];
+		for(int c = 0; c < 6; c++) {
+			a[c] = _mm256_load_ps(bp + 8*c);
+		}
+		for(unsigned int e = blockStart[b]; e < blockStart[b + 1]; e++) {
+			unsigned int t = entryTarget[e];
+			float w = weights[t];
+			if(w == 0.0f) {
+				continue;
+			}
+			if(Q) {
+				__m256 wp = _mm256_set1_ps(w * targetScale[2*t]);
+				__m256 wn = _mm256_set1_ps(w * targetScale[2*t + 1]);
+				const __m128i *d = (const __m128i *)&entryDelta16[e * BLOCK_FLOATS];
+				for(int c = 0; c < 6; c++) {
+					__m256 x = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_load_si128(d + c)));
+					a[c] = _mm256_fmadd_ps(c < 3 ? wp : wn, x, a[c]);
+				}
+			} else {
+				__m256 wv = _mm256_set1_ps(w);
+				const float *d = &entryDelta[e * BLOCK_FLOATS];
+				for(int c = 0; c < 6; c++) {
+					a[c] = _mm256_fmadd_ps(wv, _mm256_load_ps(d + 8*c), a[c]);
+				}
+			}
+		}
+		if(hasNormals) {
+			__m256 len2 = _mm256_mul_ps(a[3], a[3]);
+			len2 = _mm256_fmadd_ps(a[4], a[4], len2);
+			len2 = _mm256_fmadd_ps(a[5], a[5], len2);
+			__m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(len2, tiny)));
+			for(int c = 3; c < 6; c++) {
+				a[c] = _mm256_mul_ps(a[c], inv);
+			}
+		}
+		for(int c = 0; c < 6; c++) {
+			_mm256_store_ps(res + 8*c, a[c]);
+		}
+		// writeBlock() is SSE code; running it with the upper halves of the
+		// registers dirty costs a state transition on every block
+		_mm256_zeroupper();
+		writeBlock(res, outPos, outNor, b);
+	}
+}
+
+#else
+
+template <bool Q>
+void BlendKernel::blendSSE(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	blendScalar<Q>(weights, outPos, outNor, begin, end, writeUntouched);
+}
+
+template <bool Q>
+void BlendKernel::blendAVX2(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const
+{
+	blendScalar<Q>(weights, outPos, outNor, begin, end, writeUntouched);
+}
+
+#endif
+
+BlendKernel::BlocksFn BlendKernel::getBlocksFn() const
+{
+	switch(isa) {
+		case AVX2: return quantized ? &BlendKernel::blendAVX2<true> : &BlendKernel::blendAVX2<false>;
+		case SSE: return quantized ? &BlendKernel::blendSSE<true> : &BlendKernel::blendSSE<false>;
+		default: return quantized ? &BlendKernel::blendScalar<true> : &BlendKernel::blendScalar<false>;
+	}
+}
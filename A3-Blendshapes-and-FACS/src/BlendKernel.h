@@ -0,0 +1,147 @@
+#pragma once
+#ifndef BLENDKERNEL_H
+#define BLENDKERNEL_H
+
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Minimal allocator so std::vector storage starts on a SIMD boundary
+template <typename T, size_t Alignment>
+struct AlignedAllocator
+{
+	typedef T value_type;
+	template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+
+	T *allocate(size_t n)
+	{
+		size_t bytes = ((n * sizeof(T) + Alignment - 1) / Alignment) * Alignment;
+#ifdef _MSC_VER
+		void *p = _aligned_malloc(bytes, Alignment);
+#else
+		void *p = std::aligned_alloc(Alignment, bytes);
+#endif
+		if(!p) {
+			throw std::bad_alloc();
+		}
+		return static_cast<T *>(p);
+	}
+
+	void deallocate(T *p, size_t)
+	{
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	template <typename U> bool operator==(const AlignedAllocator<U, Alignment> &) const { return true; }
+	template <typename U> bool operator!=(const AlignedAllocator<U, Alignment> &) const { return false; }
+};
+
+typedef std::vector<float, AlignedAllocator<float, 32> > AlignedFloats;
+typedef std::vector<short, AlignedAllocator<short, 32> > AlignedShorts;
+
+/**
+ * Blendshapes on the CPU: base + sum of w * delta for positions and
+ * normals, with the normals renormalized.
+ *
+ * Vertices are grouped in blocks of BLOCK (8). Each block keeps its base
+ * positions and normals as structure-of-arrays (px[8] py[8] pz[8] nx[8]
+ * ny[8] nz[8], 48 floats) and a list of entries, one per target that moves
+ * any of its vertices, each with the target's 48 deltas in the same layout
+ * (zero for the vertices it leaves alone). A block is then a handful of
+ * vector multiply-adds per target with a non-zero weight, with no gathers
+ * or per-vertex indices; blocks no target touches are skipped or copied.
+ *
+ * The SSE path does a block as 12 4-wide vectors, the AVX2 path as 6
+ * 8-wide ones with FMA. The instruction set is picked at runtime; the
+ * scalar path works everywhere. Output is written interleaved (xyz) so it
+ * can go straight into a mapped vertex buffer. Block ranges can be blended
+ * on different threads. blend() does not allocate.
+ *
+ * When every target comes quantized (16-bit deltas with a scale per
+ * target for positions and one for normals), the entries stay 16-bit:
+ * half the delta bytes to stream per block. The kernels widen them to
+ * floats as they load them and fold the scales into the weights.
+ */
+class BlendKernel
+{
+public:
+	enum ISA
+	{
+		SCALAR,
+		SSE,
+		AVX2
+	};
+	static const int BLOCK = 8;
+
+	// One blendshape's sparse deltas: count vertices in increasing order,
+	// 3 floats each in pos and nor (nor may be NULL). Quantized targets
+	// have posQ/norQ instead, delta = q * posScale (norScale).
+	struct Target
+	{
+		const unsigned int *verts;
+		const float *pos;
+		const float *nor;
+		size_t count;
+		const short *posQ;
+		const short *norQ;
+		float posScale;
+		float norScale;
+	};
+
+	BlendKernel();
+	virtual ~BlendKernel();
+
+	// Interleaved xyz base positions/normals (nor may be NULL)
+	void setup(const float *pos, const float *nor, size_t vertCount, const std::vector<Target> &targets);
+	// weights has one entry per target. outNor may be NULL.
+	void blend(const float *weights, float *outPos, float *outNor, bool writeUntouched) const;
+	// Blocks [begin, end) only. With writeUntouched, blocks no target moves
+	// get the base shape, otherwise they are left as they are.
+	void blendRange(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const;
+
+	void setISA(ISA isa);
+	ISA getISA() const { return isa; }
+	size_t getVertCount() const { return vertCount; }
+	size_t getBlockCount() const { return blockStart.empty() ? 0 : blockStart.size() - 1; }
+	size_t getEntryCount() const { return entryTarget.size(); }
+	bool isQuantized() const { return quantized; }
+	// Bytes held for the base shape and the block deltas
+	size_t getBytes() const;
+
+	static ISA detectISA();
+	static const char *getISAName(ISA isa);
+
+private:
+	typedef void (BlendKernel::*BlocksFn)(const float *, float *, float *, size_t, size_t, bool) const;
+
+	BlocksFn getBlocksFn() const;
+	// Scatters a block's 48 structure-of-arrays results to interleaved xyz
+	void writeBlock(const float *res, float *outPos, float *outNor, size_t block) const;
+
+	// Q: the entries are entryDelta16
+	template <bool Q> void blendScalar(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const;
+	template <bool Q> void blendSSE(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const;
+	template <bool Q> void blendAVX2(const float *weights, float *outPos, float *outNor, size_t begin, size_t end, bool writeUntouched) const;
+
+	ISA isa;
+	size_t vertCount;
+	bool hasNormals;
+	bool quantized;
+	AlignedFloats base; // 48 per block
+	// Block b's entries are [blockStart[b], blockStart[b + 1])
+	std::vector<unsigned int> blockStart;
+	std::vector<unsigned int> entryTarget;
+	AlignedFloats entryDelta; // 48 per entry
+	AlignedShorts entryDelta16; // 48 per entry instead when quantized
+	std::vector<float> targetScale; // position and normal scale per target, when quantized
+};
+
+#endif
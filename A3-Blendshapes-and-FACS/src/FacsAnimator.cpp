@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+#include "FacsAnimator.h"
+#include "FacsClip.h"
+
+using namespace std;
+
+FacsAnimator::FacsAnimator() :
+	keyStart(1, 0),
+	outStart(1, 0)
+{
+}
+
+FacsAnimator::~FacsAnimator()
+{
+}
+
+int FacsAnimator::addClip(const FacsClip &clip)
+{
+	Clip c;
+	c.curveBegin = getCurveCount();
+	c.length = clip.getLength();
+	for(const FacsClip::Curve &curve : clip.getCurves()) {
+		// A flat key before the first and a sentinel after the last, so
+		// sampling needs no end cases
+		size_t n = curve.times.size();
+		keyTime.push_back(-FLT_MAX);
+		keyValue.push_back(n > 0 ? curve.values[0] : 0.0f);
+		keySlope.push_back(0.0f);
+		for(size_t k = 0; k < n; k++) {
+			float dt = (k + 1 < n) ? curve.times[k + 1] - curve.times[k] : 0.0f;
+			keyTime.push_back(curve.times[k]);
+			keyValue.push_back(curve.values[k]);
+			keySlope.push_back(dt > 0.0f ? (curve.values[k + 1] - curve.values[k]) / dt : 0.0f);
+		}
+		keyTime.push_back(FLT_MAX);
+		keyValue.push_back(0.0f);
+		keySlope.push_back(0.0f);
+		keyStart.push_back((unsigned int)keyTime.size());
+		for(int a : curve.actionNumbers) {
+			int slot = getSlot(a);
+			if(slot < 0) {
+				slot = (int)actionNumbers.size();
+				actionNumbers.push_back(a);
+			}
+			outSlot.push_back((unsigned int)slot);
+		}
+		outStart.push_back((unsigned int)outSlot.size());
+	}
+	c.curveEnd = getCurveCount();
+	clips.push_back(c);
+	// New action units widen every face's weights
+	weights.assign(faces.size() * actionNumbers.size(), 0.0f);
+	return (int)clips.size() - 1;
+}
+
+int FacsAnimator::addFace(int clip, float timeOffset, float speed)
+{
+	Face f;
+	f.clip = clip;
+	f.timeOffset = timeOffset;
+	f.speed = speed;
+	f.cursorBase = cursors.size();
+	faces.push_back(f);
+	cursors.resize(cursors.size() + clips[clip].curveEnd - clips[clip].curveBegin, 0);
+	weights.resize(faces.size() * actionNumbers.size(), 0.0f);
+	return (int)faces.size() - 1;
+}
+
+int FacsAnimator::getSlot(int actionNo) const
+{
+	auto it = find(actionNumbers.begin(), actionNumbers.end(), actionNo);
+	return it == actionNumbers.end() ? -1 : (int)(it - actionNumbers.begin());
+}
+
+void FacsAnimator::evaluate(double t)
+{
+	size_t slotCount = actionNumbers.size();
+	for(size_t f = 0; f < faces.size(); f++) {
+		const Face &face = faces[f];
+		const Clip &clip = clips[face.clip];
+		double local = face.timeOffset + face.speed * t;
+		if(clip.length > 0.0f) {
+			local = fmod(local, (double)clip.length);
+			if(local < 0.0) {
+				local += clip.length;
+			}
+		}
+		float *w = &weights[f * slotCount];
+		fill(w, w + slotCount, 0.0f);
+		unsigned int *cursor = &cursors[face.cursorBase];
+		float lt = (float)local;
+		for(size_t c = clip.curveBegin; c < clip.curveEnd; c++, cursor++) {
+			// The key at or before lt: where it was last frame or a few
+			// keys on, unless time went back
+			const float *times = &keyTime[keyStart[c]];
+			unsigned int k = *cursor;
+			if(times[k] > lt) {
+				k = 0;
+			}
+			while(times[k + 1] <= lt) {
+				k++;
+			}
+			*cursor = k;
+			size_t key = keyStart[c] + k;
+			float v = keyValue[key] + (lt - keyTime[key]) * keySlope[key];
+			for(unsigned int o = outStart[c]; o < outStart[c + 1]; o++) {
+				w[outSlot[o]] += v;
+			}
+		}
+		for(size_t s = 0; s < slotCount; s++) {
+			w[s] = min(max(w[s], 0.0f), 1.0f);
+		}
+	}
+}
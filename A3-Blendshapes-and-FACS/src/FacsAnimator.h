@@ -0,0 +1,81 @@
+#pragma once
+#ifndef FACSANIMATOR_H
+#define FACSANIMATOR_H
+
+#include <vector>
+#include <cstddef>
+
+class FacsClip;
+
+/**
+ * Plays FACS clips on any number of faces, evaluating every face's action
+ * unit weights in one pass per frame.
+ *
+ * addClip() flattens a clip's curves into keys shared by every face (all
+ * clips' key times and values in two arrays), each curve listing the
+ * weight slots it adds to. A face is a clip, a time offset and a speed.
+ * evaluate() walks each face's curves and keeps a key cursor per face and
+ * curve, so playing forward finds the keys around t without searching; it
+ * only scans a curve from the start when time jumps back, as when a clip
+ * loops.
+ *
+ * The result is a dense weight vector per face, one slot per action unit
+ * any clip drives (see getSlot()), clamped to [0, 1]. Everything is sized
+ * by addClip() and addFace(), so evaluate() does not allocate.
+ */
+class FacsAnimator
+{
+public:
+	FacsAnimator();
+	virtual ~FacsAnimator();
+
+	// Returns the clip index
+	int addClip(const FacsClip &clip);
+	// Returns the face index. Clips loop.
+	int addFace(int clip, float timeOffset = 0.0f, float speed = 1.0f);
+	// Every face at time t in seconds
+	void evaluate(double t);
+	// Face f's weights, getSlotCount() of them
+	const float *getWeights(int face) const { return weights.data() + face * actionNumbers.size(); }
+	// Which weight slot an action unit is in, -1 if no clip drives it
+	int getSlot(int actionNo) const;
+	int getSlotCount() const { return (int)actionNumbers.size(); }
+	int getFaceCount() const { return (int)faces.size(); }
+	size_t getCurveCount() const { return keyStart.size() - 1; }
+	// Including the two padding keys per curve
+	size_t getKeyCount() const { return keyTime.size(); }
+
+private:
+	struct Clip
+	{
+		size_t curveBegin;
+		size_t curveEnd;
+		float length;
+	};
+
+	struct Face
+	{
+		int clip;
+		float timeOffset;
+		float speed;
+		size_t cursorBase; // cursors of the clip's curves start here
+	};
+
+	std::vector<Clip> clips;
+	std::vector<Face> faces;
+	// Curve c's keys are [keyStart[c], keyStart[c + 1]): a flat one at
+	// -FLT_MAX, the clip's, and FLT_MAX. It adds to the slots
+	// [outStart[c], outStart[c + 1]).
+	std::vector<unsigned int> keyStart;
+	std::vector<float> keyTime;
+	std::vector<float> keyValue;
+	std::vector<float> keySlope; // to the next key, so sampling does not divide
+	std::vector<unsigned int> outStart;
+	std::vector<unsigned int> outSlot;
+	std::vector<int> actionNumbers; // per slot
+	// Per face: key index at or before the face's time, per curve
+	std::vector<unsigned int> cursors;
+	std::vector<float> weights; // getSlotCount() per face
+};
+
+#endif
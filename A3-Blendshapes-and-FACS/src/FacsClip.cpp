@@ -0,0 +1,171 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "FacsClip.h"
+
+using namespace std;
+
+// Linear between keys, held outside them; 0 without keys
+static float sampleCurve(const FacsClip::Curve &c, float t)
+{
+	if(c.times.empty()) {
+		return 0.0f;
+	}
+	size_t i = upper_bound(c.times.begin(), c.times.end(), t) - c.times.begin();
+	if(i == 0) {
+		return c.values.front();
+	}
+	if(i == c.times.size()) {
+		return c.values.back();
+	}
+	float a = (t - c.times[i - 1]) / (c.times[i] - c.times[i - 1]);
+	return c.values[i - 1] + a * (c.values[i] - c.values[i - 1]);
+}
+
+FacsClip::FacsClip() :
+	length(0.0f)
+{
+}
+
+FacsClip::~FacsClip()
+{
+}
+
+bool FacsClip::load(const string &filename, const vector<Emotion> &emotions)
+{
+	ifstream in;
+	in.open(filename);
+	if(!in.good()) {
+		cout << "Cannot read " << filename << endl;
+		return false;
+	}
+	cout << "Loading " << filename << endl;
+
+	string line;
+	while(getline(in, line)) {
+		if(line.empty() || line.at(0) == '#') {
+			continue;
+		}
+		string key;
+		stringstream ss(line);
+		ss >> key;
+		if(key == "LENGTH") {
+			ss >> length;
+		} else if(key == "AU") {
+			int actionNo;
+			float time, weight;
+			ss >> actionNo;
+			while(ss >> time >> weight) {
+				addKey(actionNo, time, weight);
+			}
+		} else if(key == "FADE") {
+			float time, seconds;
+			string name;
+			ss >> time >> seconds >> name;
+			auto it = find_if(emotions.begin(), emotions.end(), [&name](const Emotion &e) { return e.emotionName == name; });
+			if(it == emotions.end()) {
+				cout << filename << ": no EMOTION " << name << " in input.txt" << endl;
+				continue;
+			}
+			addFade(time, seconds, *it);
+		} else if(!key.empty()) {
+			cout << "Unknown key word: " << key << endl;
+		}
+	}
+	in.close();
+	cout << filename << ": " << auCurves.size() << " action unit curves, " << fades.size() << " fades, " << getLength() << " s" << endl;
+	return true;
+}
+
+void FacsClip::addKey(int actionNo, float time, float weight)
+{
+	auto curve = find_if(auCurves.begin(), auCurves.end(), [actionNo](const Curve &c) { return c.actionNumbers[0] == actionNo; });
+	if(curve == auCurves.end()) {
+		Curve c;
+		c.actionNumbers.push_back(actionNo);
+		auCurves.push_back(c);
+		curve = auCurves.end() - 1;
+	}
+	size_t i = lower_bound(curve->times.begin(), curve->times.end(), time) - curve->times.begin();
+	if(i < curve->times.size() && curve->times[i] == time) {
+		curve->values[i] = weight;
+		return;
+	}
+	curve->times.insert(curve->times.begin() + i, time);
+	curve->values.insert(curve->values.begin() + i, weight);
+}
+
+void FacsClip::addFade(float time, float seconds, const Emotion &emotion)
+{
+	Fade fade = {time, max(seconds, 0.0f), emotion};
+	fades.push_back(fade);
+}
+
+float FacsClip::getLength() const
+{
+	if(length > 0.0f) {
+		return length;
+	}
+	float end = 0.0f;
+	for(const Curve &c : auCurves) {
+		if(!c.times.empty()) {
+			end = max(end, c.times.back());
+		}
+	}
+	for(const Fade &fade : fades) {
+		end = max(end, fade.time + fade.seconds);
+	}
+	return end;
+}
+
+vector<FacsClip::Curve> FacsClip::getCurves() const
+{
+	vector<Fade> sorted = fades;
+	stable_sort(sorted.begin(), sorted.end(), [](const Fade &a, const Fade &b) { return a.time < b.time; });
+
+	// One curve per emotion, in the order they are first faded to. A fade
+	// takes every emotion from where it is to 0, the new one to 1.
+	vector<Curve> emotionCurves;
+	vector<string> names;
+	for(const Fade &fade : sorted) {
+		size_t target = find(names.begin(), names.end(), fade.emotion.emotionName) - names.begin();
+		if(target == names.size()) {
+			Curve c;
+			c.actionNumbers = fade.emotion.actionNumbers;
+			emotionCurves.push_back(c);
+			names.push_back(fade.emotion.emotionName);
+		}
+		for(size_t e = 0; e < emotionCurves.size(); e++) {
+			Curve &c = emotionCurves[e];
+			float from = sampleCurve(c, fade.time);
+			// A fade that starts before the last one ended cuts it short
+			while(!c.times.empty() && c.times.back() > fade.time) {
+				c.times.pop_back();
+				c.values.pop_back();
+			}
+			c.times.push_back(fade.time);
+			c.values.push_back(from);
+			c.times.push_back(fade.time + fade.seconds);
+			c.values.push_back(e == target ? 1.0f : 0.0f);
+		}
+	}
+
+	vector<Curve> curves = auCurves;
+	curves.insert(curves.end(), emotionCurves.begin(), emotionCurves.end());
+	return curves;
+}
+
+vector<int> FacsClip::getActionNumbers() const
+{
+	vector<int> actionNumbers;
+	for(const Curve &c : getCurves()) {
+		for(int a : c.actionNumbers) {
+			if(find(actionNumbers.begin(), actionNumbers.end(), a) == actionNumbers.end()) {
+				actionNumbers.push_back(a);
+			}
+		}
+	}
+	return actionNumbers;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef FACSCLIP_H
+#define FACSCLIP_H
+
+#include <string>
+#include <vector>
+
+#include "Shape.h"
+
+/**
+ * A FACS animation: keyed weight curves for action units, and crossfades
+ * between emotions. Played back by a FacsAnimator.
+ *
+ * Timeline files have one keyword per line, like input.txt:
+ *   LENGTH <seconds>
+ *     Loop length. Default: the last key or the end of the last fade.
+ *   AU <action#> <time> <weight> [<time> <weight> ...]
+ *     Keys for one action unit's weight, linearly interpolated and held
+ *     before the first and after the last key. Repeated lines add keys.
+ *   FADE <time> <seconds> <emotion>
+ *     From <time>, crossfade over <seconds> from whatever the emotions
+ *     were at to <emotion> (an EMOTION line in input.txt) at full weight.
+ * An action unit's weight is its own curve plus the weights of the
+ * emotions containing it, clamped to [0, 1].
+ */
+class FacsClip
+{
+public:
+	// Keys, sorted by time, and the action units they drive
+	struct Curve
+	{
+		std::vector<float> times;
+		std::vector<float> values;
+		std::vector<int> actionNumbers;
+	};
+
+	FacsClip();
+	virtual ~FacsClip();
+
+	bool load(const std::string &filename, const std::vector<Emotion> &emotions);
+	// A key at an existing time replaces it
+	void addKey(int actionNo, float time, float weight);
+	void addFade(float time, float seconds, const Emotion &emotion);
+	void setLength(float length) { this->length = length; }
+	float getLength() const;
+	// One curve per keyed action unit, then one per emotion that is faded
+	// to; builds the emotion curves from the fades
+	std::vector<Curve> getCurves() const;
+	// Every action unit some curve drives, in the order they appear
+	std::vector<int> getActionNumbers() const;
+
+private:
+	struct Fade
+	{
+		float time;
+		float seconds;
+		Emotion emotion;
+	};
+
+	float length; // <= 0 until set
+	std::vector<Curve> auCurves;
+	std::vector<Fade> fades;
+};
+
+#endif
@@ -0,0 +1,122 @@
+#include "LoadTimeline.h"
+
+#include <algorithm>
+#include <iomanip>
+
+using namespace std;
+
+// Characters in the bar drawn for each step
+static const int BAR_WIDTH = 40;
+
+LoadTimeline::LoadTimeline() :
+	t0(Clock::now())
+{
+	threads[this_thread::get_id()] = 0;
+}
+
+LoadTimeline::~LoadTimeline()
+{
+}
+
+double LoadTimeline::now() const
+{
+	return chrono::duration<double, milli>(Clock::now() - t0).count();
+}
+
+int LoadTimeline::threadIndex()
+{
+	auto it = threads.find(this_thread::get_id());
+	if(it != threads.end()) {
+		return it->second;
+	}
+	int index = (int)threads.size();
+	threads[this_thread::get_id()] = index;
+	return index;
+}
+
+int LoadTimeline::add(const string &name, const vector<int> &deps)
+{
+	lock_guard<std::mutex> lock(mutex);
+	Step step = {name, deps, -1.0, -1.0, -1};
+	steps.push_back(step);
+	return (int)steps.size() - 1;
+}
+
+void LoadTimeline::begin(int step)
+{
+	double t = now();
+	lock_guard<std::mutex> lock(mutex);
+	steps[step].start = t;
+	steps[step].thread = threadIndex();
+}
+
+void LoadTimeline::end(int step)
+{
+	double t = now();
+	lock_guard<std::mutex> lock(mutex);
+	steps[step].end = t;
+}
+
+void LoadTimeline::print(ostream &out, int last) const
+{
+	lock_guard<std::mutex> lock(mutex);
+	// Critical path, walked back from last
+	vector<int> path;
+	for(int s = last; s >= 0; ) {
+		path.push_back(s);
+		int next = -1;
+		for(int d : steps[s].deps) {
+			if(next < 0 || steps[d].end > steps[next].end) {
+				next = d;
+			}
+		}
+		s = next;
+	}
+	reverse(path.begin(), path.end());
+
+	double total = 0.0;
+	for(const Step &step : steps) {
+		total = max(total, step.end);
+	}
+	vector<int> order;
+	for(int s = 0; s < (int)steps.size(); s++) {
+		if(steps[s].start >= 0.0) {
+			order.push_back(s);
+		}
+	}
+	stable_sort(order.begin(), order.end(), [this](int a, int b) { return steps[a].start < steps[b].start; });
+
+	ios::fmtflags flags = out.flags();
+	streamsize precision = out.precision();
+	out << fixed << setprecision(1);
+	out << "Load timeline (ms, * on the critical path):" << endl;
+	for(int s : order) {
+		const Step &step = steps[s];
+		double end = step.end >= 0.0 ? step.end : total;
+		int a = total > 0.0 ? (int)(BAR_WIDTH * step.start / total) : 0;
+		int b = total > 0.0 ? (int)(BAR_WIDTH * end / total) : 0;
+		string bar(BAR_WIDTH, ' ');
+		for(int i = a; i <= min(b, BAR_WIDTH - 1); i++) {
+			bar[i] = '#';
+		}
+		string thread = step.thread == 0 ? "main" : "pool " + to_string(step.thread);
+		bool critical = find(path.begin(), path.end(), s) != path.end();
+		out << (critical ? " * " : "   ") << "|" << bar << "| "
+			<< setw(7) << step.start << " " << setw(7) << end << "  "
+			<< left << setw(7) << thread << right << " " << step.name << endl;
+	}
+	if(last >= 0 && steps[last].end >= 0.0) {
+		out << "Critical path to " << steps[last].name << ": " << steps[last].end << " ms" << endl;
+		double ready = 0.0;
+		for(int s : path) {
+			const Step &step = steps[s];
+			if(step.start - ready > 0.05) {
+				out << "  " << setw(7) << step.start - ready << "  waiting to start" << endl;
+			}
+			out << "  " << setw(7) << step.end - step.start << "  " << step.name << endl;
+			ready = step.end;
+		}
+	}
+	out.flags(flags);
+	out.precision(precision);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#ifndef LOADTIMELINE_H
+#define LOADTIMELINE_H
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * When each loading step ran, and on which thread, for finding what holds
+ * up the first frame.
+ *
+ * Steps are registered with add(), naming the steps whose output they
+ * need, and timed with begin()/end() (or a LoadScope) by whichever thread
+ * runs them. print() lists them on a shared time axis and then follows the
+ * critical path back from one step: at each step, the dependency that
+ * finished last. Time between a step's dependencies ending and its own
+ * start was spent queued or waiting for a thread. Thread safe.
+ */
+class LoadTimeline
+{
+public:
+	// Time 0 is now; this thread is "main"
+	LoadTimeline();
+	virtual ~LoadTimeline();
+
+	// Returns the step index
+	int add(const std::string &name, const std::vector<int> &deps = std::vector<int>());
+	void begin(int step);
+	void end(int step);
+	// Milliseconds since construction
+	double now() const;
+	// Every step, then the critical path ending at last
+	void print(std::ostream &out, int last) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Step
+	{
+		std::string name;
+		std::vector<int> deps;
+		double start; // ms, -1 until begun
+		double end;   // ms, -1 until ended
+		int thread;
+	};
+
+	int threadIndex(); // needs mutex held
+
+	Clock::time_point t0;
+	mutable std::mutex mutex;
+	std::vector<Step> steps;
+	std::map<std::thread::id, int> threads; // main is 0
+};
+
+/**
+ * Times the enclosing scope as one step.
+ */
+class LoadScope
+{
+public:
+	LoadScope(LoadTimeline *timeline, int step) :
+		timeline(timeline),
+		step(step)
+	{
+		timeline->begin(step);
+	}
+	~LoadScope()
+	{
+		timeline->end(step);
+	}
+
+private:
+	LoadTimeline *timeline;
+	int step;
+};
+
+#endif
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Load-time reordering of indexed triangle lists for the GPU.
+ *
+ * optimizeVertexCache() reorders the triangles with Tipsify (Sander, Nehab
+ * and Barczak 2007) so each vertex is reused while it is still in the
+ * post-transform cache. Tipsify works in fans and only jumps when it runs
+ * into a dead end; optimizeOverdraw() sorts the runs between jumps so those
+ * facing away from the mesh center draw first and occlude the rest.
+ * optimizeVertexFetch() then numbers the vertices in the order the
+ * triangles first use them, so attribute reads, and CPU loops over the
+ * vertices, walk memory front to back. Triangles keep their winding.
+ */
+
+// Under a FIFO cache of cacheSize entries
+struct VertexCacheStats
+{
+	float acmr; // vertices transformed per triangle: 0.5 ideal, 3 worst
+	float atvr; // vertices transformed per vertex used: 1 ideal
+};
+
+VertexCacheStats analyzeVertexCache(const std::vector<unsigned int> &indices, size_t vertCount, int cacheSize = 16);
+// clusters, if given, gets the first triangle of each run between jumps
+void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertCount, int cacheSize = 16, std::vector<unsigned int> *clusters = nullptr);
+// pos has 3 floats per vertex
+void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<float> &pos, const std::vector<unsigned int> &clusters);
+// Renumbers the indices, remap[old] = new; unused vertices go last
+void optimizeVertexFetch(std::vector<unsigned int> &indices, size_t vertCount, std::vector<unsigned int> &remap);
+// The passes in order, printing the cache stats before and after. Apply
+// remap to every per-vertex array with remapVertices(). The overdraw pass
+// costs a little cache efficiency and scatters the fetch order across the
+// mesh, so it is only worth it for static meshes.
+void optimizeMesh(const std::string &name, std::vector<unsigned int> &indices, const std::vector<float> &pos, std::vector<unsigned int> &remap, bool overdraw = true);
+
+// Moves each vertex's components to its new index. Arrays that are not
+// per vertex (e.g. empty) are left alone.
+template <typename T>
+void remapVertices(std::vector<T> &v, const std::vector<unsigned int> &remap, size_t components)
+{
+	if(v.size() != remap.size() * components) {
+		return;
+	}
+	std::vector<T> out(v.size());
+	for(size_t i = 0; i < remap.size(); i++) {
+		for(size_t c = 0; c < components; c++) {
+			out[remap[i] * components + c] = v[i * components + c];
+		}
+	}
+	v.swap(out);
+}
+
+#endif
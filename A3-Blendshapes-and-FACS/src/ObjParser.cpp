@@ -0,0 +1,457 @@
+#include <iostream>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <algorithm>
+
+#include "ObjParser.h"
+
+using namespace std;
+
+// Below this many bytes per chunk, the threads cost more than they save
+static const size_t MIN_CHUNK_BYTES = 128 * 1024;
+
+// One chunk's lines and what they hold
+struct ObjChunk
+{
+	const char *begin;
+	const char *end;
+	std::vector<float> vertices;
+	std::vector<float> normals;
+	std::vector<float> texcoords;
+	std::vector<tinyobj::index_t> corners; // of every face, in order
+	std::vector<unsigned int> faceSizes;
+	// Corners with relative indices, resolved against this chunk's counts
+	// only, and which of them: 1 vertex, 2 texcoord, 4 normal
+	std::vector< std::pair<size_t, int> > relative;
+	size_t vertexBase = 0, normalBase = 0, texcoordBase = 0; // counts before the chunk
+	std::vector<tinyobj::index_t> triangles;
+	const char *error = NULL; // line that failed to parse
+};
+
+static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static inline bool isSpace(char c) { return c == ' ' || c == '\t'; }
+// The file is one buffer, so a line also ends at '\n'
+static inline bool isNewLine(char c) { return c == '\r' || c == '\n' || c == '\0'; }
+
+// tinyobj's tryParseDouble on [s, end), one pass and the same arithmetic,
+// so the values are bit-identical to LoadObj's
+static bool parseDouble(const char *s, const char *end, double &result)
+{
+	static const double powLut[] = {1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001};
+	if(s >= end) {
+		return false;
+	}
+	double mantissa = 0.0;
+	int exponent = 0;
+	bool negative = false;
+	bool leadingDot = false;
+	const char *p = s;
+	if(*p == '+' || *p == '-') {
+		negative = (*p == '-');
+		p++;
+		leadingDot = (p != end && *p == '.');
+	} else if(*p == '.') {
+		leadingDot = true;
+	} else if(!isDigit(*p)) {
+		return false;
+	}
+	if(!leadingDot) {
+		const char *digits = p;
+		while(p < end && isDigit(*p)) {
+			mantissa *= 10;
+			mantissa += (int)(*p - '0');
+			p++;
+		}
+		if(p == digits) {
+			return false;
+		}
+	}
+	if(p < end && *p == '.') {
+		p++;
+		for(int read = 1; p < end && isDigit(*p); read++, p++) {
+			mantissa += (int)(*p - '0') * (read < 8 ? powLut[read] : pow(10.0, -read));
+		}
+	}
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		p++;
+		bool negativeExp = false;
+		if(p < end && (*p == '+' || *p == '-')) {
+			negativeExp = (*p == '-');
+			p++;
+		} else if(!(p < end && isDigit(*p))) {
+			return false;
+		}
+		const char *digits = p;
+		while(p < end && isDigit(*p)) {
+			exponent *= 10;
+			exponent += (int)(*p - '0');
+			p++;
+		}
+		if(p == digits) {
+			return false;
+		}
+		exponent *= negativeExp ? -1 : 1;
+	}
+	result = (negative ? -1 : 1) * (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+	return true;
+}
+
+// The next blank-separated number on the line, 0 if it is not one
+static float parseFloat(const char *&p)
+{
+	while(isSpace(*p)) {
+		p++;
+	}
+	const char *end = p;
+	while(!isSpace(*end) && !isNewLine(*end)) {
+		end++;
+	}
+	double v = 0.0;
+	parseDouble(p, end, v);
+	p = end;
+	return (float)v;
+}
+
+// atoi, then on to the next '/', blank or line end
+static int parseInt(const char *&p)
+{
+	while(isSpace(*p)) {
+		p++;
+	}
+	bool negative = false;
+	if(*p == '+' || *p == '-') {
+		negative = (*p == '-');
+		p++;
+	}
+	int i = 0;
+	while(isDigit(*p)) {
+		i = i * 10 + (*p - '0');
+		p++;
+	}
+	while(*p != '/' && !isSpace(*p) && !isNewLine(*p)) {
+		p++;
+	}
+	return negative ? -i : i;
+}
+
+// OBJ indices are 1-based, negative ones count back from the last element
+static bool fixIndex(int idx, size_t count, int &out, int &relative, int which)
+{
+	if(idx > 0) {
+		out = idx - 1;
+	} else if(idx < 0) {
+		out = (int)count + idx;
+		relative |= which;
+	}
+	return idx != 0;
+}
+
+static void parseChunk(ObjChunk &c)
+{
+	const char *p = c.begin;
+	while(p < c.end) {
+		const char *line = p;
+		const char *next = (const char *)memchr(p, '\n', c.end - p);
+		next = next ? next + 1 : c.end;
+		while(isSpace(*p)) {
+			p++;
+		}
+		if(p[0] == 'v' && isSpace(p[1])) {
+			p += 2;
+			for(int k = 0; k < 3; k++) {
+				c.vertices.push_back(parseFloat(p));
+			}
+		} else if(p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+			p += 3;
+			for(int k = 0; k < 3; k++) {
+				c.normals.push_back(parseFloat(p));
+			}
+		} else if(p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+			p += 3;
+			for(int k = 0; k < 2; k++) {
+				c.texcoords.push_back(parseFloat(p));
+			}
+		} else if(p[0] == 'f' && isSpace(p[1])) {
+			p += 2;
+			while(isSpace(*p)) {
+				p++;
+			}
+			unsigned int size = 0;
+			while(!isNewLine(*p)) {
+				// v, v/vt, v//vn or v/vt/vn
+				tinyobj::index_t idx;
+				idx.vertex_index = idx.normal_index = idx.texcoord_index = -1;
+				int relative = 0;
+				bool ok = fixIndex(parseInt(p), c.vertices.size() / 3, idx.vertex_index, relative, 1);
+				if(ok && *p == '/') {
+					p++;
+					if(*p == '/') {
+						p++;
+						ok = fixIndex(parseInt(p), c.normals.size() / 3, idx.normal_index, relative, 4);
+					} else {
+						ok = fixIndex(parseInt(p), c.texcoords.size() / 2, idx.texcoord_index, relative, 2);
+						if(ok && *p == '/') {
+							p++;
+							ok = fixIndex(parseInt(p), c.normals.size() / 3, idx.normal_index, relative, 4);
+						}
+					}
+				}
+				if(!ok) {
+					c.error = line;
+					return;
+				}
+				if(relative) {
+					c.relative.push_back(make_pair(c.corners.size(), relative));
+				}
+				c.corners.push_back(idx);
+				size++;
+				while(isSpace(*p) || *p == '\r') {
+					p++;
+				}
+			}
+			c.faceSizes.push_back(size);
+		}
+		p = next;
+	}
+}
+
+// tinyobj's point in polygon test
+static bool pnpoly(int nvert, const float *vertx, const float *verty, float testx, float testy)
+{
+	bool c = false;
+	for(int i = 0, j = nvert - 1; i < nvert; j = i++) {
+		if(((verty[i] > testy) != (verty[j] > testy)) &&
+			(testx < (vertx[j] - vertx[i]) * (testy - verty[i]) / (verty[j] - verty[i]) + vertx[i])) {
+			c = !c;
+		}
+	}
+	return c;
+}
+
+// tinyobj's ear clipping, step for step, so polygons split the same way.
+// remaining is scratch space.
+static void triangulate(const tinyobj::index_t *face, size_t n, const vector<float> &v, vector<tinyobj::index_t> &remaining, vector<tinyobj::index_t> &out)
+{
+	// Project on the two axes the first proper corner spans most
+	size_t axes[2] = {1, 2};
+	for(size_t k = 0; k < n; k++) {
+		size_t vi0 = (size_t)face[k % n].vertex_index;
+		size_t vi1 = (size_t)face[(k + 1) % n].vertex_index;
+		size_t vi2 = (size_t)face[(k + 2) % n].vertex_index;
+		if(3 * vi0 + 2 >= v.size() || 3 * vi1 + 2 >= v.size() || 3 * vi2 + 2 >= v.size()) {
+			continue;
+		}
+		float e0x = v[vi1 * 3 + 0] - v[vi0 * 3 + 0];
+		float e0y = v[vi1 * 3 + 1] - v[vi0 * 3 + 1];
+		float e0z = v[vi1 * 3 + 2] - v[vi0 * 3 + 2];
+		float e1x = v[vi2 * 3 + 0] - v[vi1 * 3 + 0];
+		float e1y = v[vi2 * 3 + 1] - v[vi1 * 3 + 1];
+		float e1z = v[vi2 * 3 + 2] - v[vi1 * 3 + 2];
+		float cx = fabs(e0y * e1z - e0z * e1y);
+		float cy = fabs(e0z * e1x - e0x * e1z);
+		float cz = fabs(e0x * e1y - e0y * e1x);
+		const float epsilon = numeric_limits<float>::epsilon();
+		if(cx > epsilon || cy > epsilon || cz > epsilon) {
+			if(!(cx > cy && cx > cz)) {
+				axes[0] = 0;
+				if(cz > cx && cz > cy) {
+					axes[1] = 1;
+				}
+			}
+			break;
+		}
+	}
+	float area = 0;
+	for(size_t k = 0; k < n; k++) {
+		size_t vi0 = (size_t)face[k % n].vertex_index;
+		size_t vi1 = (size_t)face[(k + 1) % n].vertex_index;
+		if(vi0 * 3 + axes[0] >= v.size() || vi0 * 3 + axes[1] >= v.size() ||
+			vi1 * 3 + axes[0] >= v.size() || vi1 * 3 + axes[1] >= v.size()) {
+			continue;
+		}
+		area += (v[vi0 * 3 + axes[0]] * v[vi1 * 3 + axes[1]] - v[vi0 * 3 + axes[1]] * v[vi1 * 3 + axes[0]]) * 0.5f;
+	}
+
+	// Cut off ears until a triangle is left, giving up after a full lap
+	// without one
+	remaining.assign(face, face + n);
+	size_t guess = 0;
+	size_t iterationsLeft = n;
+	size_t previousSize = n;
+	tinyobj::index_t ind[3];
+	float vx[3], vy[3];
+	while(remaining.size() > 3 && iterationsLeft > 0) {
+		size_t size = remaining.size();
+		if(guess >= size) {
+			guess -= size;
+		}
+		if(previousSize != size) {
+			previousSize = size;
+			iterationsLeft = size;
+		} else {
+			iterationsLeft--;
+		}
+		for(int k = 0; k < 3; k++) {
+			ind[k] = remaining[(guess + k) % size];
+			size_t vi = (size_t)ind[k].vertex_index;
+			if(vi * 3 + axes[0] >= v.size() || vi * 3 + axes[1] >= v.size()) {
+				vx[k] = 0.0f;
+				vy[k] = 0.0f;
+			} else {
+				vx[k] = v[vi * 3 + axes[0]];
+				vy[k] = v[vi * 3 + axes[1]];
+			}
+		}
+		float e0x = vx[1] - vx[0];
+		float e0y = vy[1] - vy[0];
+		float e1x = vx[2] - vx[1];
+		float e1y = vy[2] - vy[1];
+		float cross = e0x * e1y - e0y * e1x;
+		// Reflex corner
+		if(cross * area < 0.0f) {
+			guess++;
+			continue;
+		}
+		// Another corner inside the ear
+		bool overlap = false;
+		for(size_t other = 3; other < size && !overlap; other++) {
+			size_t ovi = (size_t)remaining[(guess + other) % size].vertex_index;
+			if(ovi * 3 + axes[0] >= v.size() || ovi * 3 + axes[1] >= v.size()) {
+				continue;
+			}
+			overlap = pnpoly(3, vx, vy, v[ovi * 3 + axes[0]], v[ovi * 3 + axes[1]]);
+		}
+		if(overlap) {
+			guess++;
+			continue;
+		}
+		out.insert(out.end(), ind, ind + 3);
+		remaining.erase(remaining.begin() + (guess + 1) % size);
+	}
+	if(remaining.size() == 3) {
+		out.insert(out.end(), remaining.begin(), remaining.end());
+	}
+}
+
+static void triangulateChunk(ObjChunk &c, const vector<float> &vertices)
+{
+	for(const auto &r : c.relative) {
+		tinyobj::index_t &idx = c.corners[r.first];
+		if(r.second & 1) {
+			idx.vertex_index += (int)c.vertexBase;
+		}
+		if(r.second & 2) {
+			idx.texcoord_index += (int)c.texcoordBase;
+		}
+		if(r.second & 4) {
+			idx.normal_index += (int)c.normalBase;
+		}
+	}
+	c.triangles.reserve(c.corners.size() * 3 / 2);
+	vector<tinyobj::index_t> scratch;
+	size_t first = 0;
+	for(unsigned int n : c.faceSizes) {
+		const tinyobj::index_t *face = &c.corners[first];
+		first += n;
+		if(n == 3) {
+			c.triangles.insert(c.triangles.end(), face, face + 3);
+		} else if(n > 3) {
+			triangulate(face, n, vertices, scratch, c.triangles);
+		}
+	}
+}
+
+// Runs f on every chunk, one thread each, the first on this thread
+template <typename F>
+static void forEachChunk(vector<ObjChunk> &chunks, F f)
+{
+	vector<thread> threads;
+	for(size_t i = 1; i < chunks.size(); i++) {
+		threads.emplace_back([&f, &chunks, i]() { f(chunks[i]); });
+	}
+	if(!chunks.empty()) {
+		f(chunks[0]);
+	}
+	for(auto &t : threads) {
+		t.join();
+	}
+}
+
+template <typename T>
+static void append(vector<T> &dst, const vector<T> &src)
+{
+	dst.insert(dst.end(), src.begin(), src.end());
+}
+
+bool parseObj(const string &filename, ObjData &obj, int threadCount)
+{
+	obj = ObjData();
+	ifstream in(filename, ios::binary | ios::ate);
+	if(!in.good()) {
+		cerr << "Cannot read " << filename << endl;
+		return false;
+	}
+	// '\0'-terminated, so a last line without '\n' still ends
+	size_t size = (size_t)in.tellg();
+	vector<char> text(size + 1, '\0');
+	in.seekg(0);
+	in.read(text.data(), size);
+
+	if(threadCount <= 0) {
+		threadCount = max(1, (int)thread::hardware_concurrency());
+	}
+	size_t chunkCount = min((size_t)threadCount, size / MIN_CHUNK_BYTES + 1);
+	vector<ObjChunk> chunks(chunkCount);
+	const char *p = text.data();
+	const char *end = p + size;
+	for(size_t i = 0; i < chunkCount; i++) {
+		// Up to the first line break past an even split
+		const char *split = max(p, (const char *)text.data() + size * (i + 1) / chunkCount);
+		const char *lineBreak = (const char *)memchr(split, '\n', end - split);
+		chunks[i].begin = p;
+		p = lineBreak ? lineBreak + 1 : end;
+		chunks[i].end = p;
+	}
+
+	forEachChunk(chunks, parseChunk);
+	for(const auto &c : chunks) {
+		if(c.error) {
+			cerr << filename << ":" << 1 + count((const char *)text.data(), c.error, '\n') << ": bad face index (0 or missing)" << endl;
+			return false;
+		}
+	}
+
+	// Each chunk's vertices follow the previous chunks'
+	size_t vertexCount = 0, normalCount = 0, texcoordCount = 0;
+	for(auto &c : chunks) {
+		c.vertexBase = vertexCount / 3;
+		c.normalBase = normalCount / 3;
+		c.texcoordBase = texcoordCount / 2;
+		vertexCount += c.vertices.size();
+		normalCount += c.normals.size();
+		texcoordCount += c.texcoords.size();
+	}
+	obj.vertices.reserve(vertexCount);
+	obj.normals.reserve(normalCount);
+	obj.texcoords.reserve(texcoordCount);
+	for(const auto &c : chunks) {
+		append(obj.vertices, c.vertices);
+		append(obj.normals, c.normals);
+		append(obj.texcoords, c.texcoords);
+	}
+
+	// Triangulating needs the positions, so it waits for all of them
+	forEachChunk(chunks, [&obj](ObjChunk &c) { triangulateChunk(c, obj.vertices); });
+	size_t indexCount = 0;
+	for(const auto &c : chunks) {
+		indexCount += c.triangles.size();
+	}
+	obj.indices.reserve(indexCount);
+	for(const auto &c : chunks) {
+		append(obj.indices, c.triangles);
+	}
+	return true;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <string>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+
+/**
+ * The parts of an OBJ file the loaders use: the v/vn/vt arrays and the
+ * faces, triangulated, as 3 corners per triangle in file order.
+ */
+struct ObjData
+{
+	std::vector<float> vertices;  // 3 per 'v'
+	std::vector<float> normals;   // 3 per 'vn'
+	std::vector<float> texcoords; // 2 per 'vt'
+	std::vector<tinyobj::index_t> indices;
+};
+
+/**
+ * Reads the whole file, splits it into chunks on line boundaries and parses
+ * the chunks on threadCount threads (<= 0 for every hardware thread; small
+ * files get fewer chunks). Each chunk fills its own arrays, which are then
+ * concatenated; relative indices are fixed up once the counts before each
+ * chunk are known, and polygons are triangulated, again per chunk, once all
+ * vertices are in.
+ *
+ * Numbers go through the same arithmetic as tinyobj::LoadObj, and polygons
+ * through the same ear clipping, so the result matches what LoadObj gives
+ * with its shapes concatenated. Materials, groups, lines and points are
+ * skipped. Prints the error and returns false if the file cannot be read or
+ * a face index is 0.
+ */
+bool parseObj(const std::string &filename, ObjData &obj, int threadCount = 0);
+
+#endif
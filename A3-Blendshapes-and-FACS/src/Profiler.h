@@ -0,0 +1,133 @@
+#pragma once
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#define GLEW_STATIC
+#include <GL/glew.h>
+
+#include <chrono>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * Per-frame stage timings: CPU time from scoped timers, GPU time from
+ * GL_TIME_ELAPSED queries, averaged over the last HISTORY frames.
+ *
+ * Stages are registered once with addStage() and then timed by index,
+ * usually with a ProfileScope around the code. Times of a stage entered
+ * several times in a frame add up. endFrame() closes the frame; GPU
+ * results are read LATENCY frames later so the CPU never waits on the
+ * GPU, and a frame's CSV row is written once its queries are in.
+ *
+ * While disabled a ProfileScope is one branch on a member flag, and
+ * endFrame() returns immediately, so the instrumentation stays compiled in.
+ * GL timer queries cannot nest, so at most one GPU stage may be open at a
+ * time; CPU stages nest freely.
+ */
+class Profiler
+{
+public:
+	static const int HISTORY = 120; // frames in the rolling averages
+	static const int LATENCY = 3;   // frames before GPU results are read
+
+	Profiler();
+	virtual ~Profiler();
+
+	// Returns the stage index. With gpu set, the stage is also timed on the
+	// GPU once GL timing is on.
+	int addStage(const std::string &name, bool gpu = false);
+	// Needs a current context with GL 3.3 or ARB_timer_query; returns false
+	// (CPU timing only) otherwise
+	bool setGPUTiming(bool on);
+	void setEnabled(bool on);
+	bool isEnabled() const { return enabled; }
+
+	void begin(int stage);
+	void end(int stage);
+	void endFrame();
+
+	// Writes a row per frame (CPU and GPU ms per stage) while enabled.
+	// closeCSV() waits for the frames still in flight.
+	bool openCSV(const std::string &filename);
+	void closeCSV();
+
+	// Rolling averages in ms, 0 before the first resolved frame
+	double getCPUMs(int stage) const;
+	double getGPUMs(int stage) const;
+	double getFrameMs() const;
+	int getFrameCount() const { return resolved; }
+	void print(std::ostream &out) const;
+	// Bars of the averages (CPU dark, GPU light) against budgetMs, and a
+	// strip chart of the recent frame times, in the lower left corner.
+	// Uses the fixed-function pipeline, so unbind any program first.
+	void draw(int width, int height, double budgetMs = 1000.0 / 60.0) const;
+
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	struct Stage
+	{
+		std::string name;
+		bool gpu;
+		Clock::time_point start;
+		double sum[2]; // CPU, GPU over the history window
+	};
+	// One in-flight frame
+	struct Slot
+	{
+		int frame;
+		double frameMs;
+		std::vector<double> cpuMs;
+		std::vector<std::pair<int, GLuint> > queries; // stage, query
+	};
+
+	void reset();
+	void resolve(Slot &slot);
+
+	bool enabled;
+	bool gpuTiming;
+	std::vector<Stage> stages;
+	std::vector<GLuint> queryPool; // free query objects
+	bool queryOpen;
+	Slot slots[LATENCY + 1];
+	int frame;
+	int resolved;
+	Clock::time_point frameStart;
+	// [(frame % HISTORY) * stride + stage * 2 + CPU/GPU], stride = 2 * stages
+	std::vector<double> history;
+	std::vector<double> frameHistory;
+	double frameSum;
+	std::ofstream csv;
+};
+
+/**
+ * Times the enclosing scope as one stage. Costs a pointer and flag test
+ * when the profiler is null or disabled.
+ */
+class ProfileScope
+{
+public:
+	ProfileScope(Profiler *profiler, int stage) :
+		profiler(profiler && profiler->isEnabled() ? profiler : nullptr),
+		stage(stage)
+	{
+		if(this->profiler) {
+			this->profiler->begin(stage);
+		}
+	}
+	~ProfileScope()
+	{
+		if(profiler) {
+			profiler->end(stage);
+		}
+	}
+
+private:
+	Profiler *profiler;
+	int stage;
+};
+
+#endif
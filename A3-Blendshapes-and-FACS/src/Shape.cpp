@@ -1,25 +1,57 @@
 #include <iostream>
 #include <fstream>
+#include <unordered_map>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
 
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+// Before the implementation below, which has no include guard
+#include "ObjParser.h"
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
 #include "Shape.h"
 #include "GLSL.h"
 #include "Program.h"
+#include "MeshOptimizer.h"
+#include "ThreadPool.h"
+#include "StreamBuffer.h"
 
 using namespace std;
 using namespace glm;
 
+// Texture unit of the delta texture; kdTex is on 1
+static const GLint DELTA_UNIT = 2;
+// Texels per row of the delta texture. 1024 is the smallest maximum size
+// GL 3 allows, and a power of 2 so the shader's divisions are exact.
+static const int DELTA_TEX_WIDTH = 1024;
+// Kernel blocks per CPU blending job: 1024 vertices, enough that the job
+// overhead stays negligible while a head still splits over the threads
+static const size_t BLEND_CHUNK = 128;
+
 Shape::Shape() :
 	prog(NULL),
 	posBufID(0),
 	norBufID(0),
-	texBufID(0)
+	texBufID(0),
+	eleBufID(0),
+	eleType(GL_UNSIGNED_INT),
+	blendMode(GPU_BLENDING),
+	deltaEpsilon(1e-4f),
+	quantizeDeltas(false),
+	deltaTexID(0),
+	deltaTexWidth(0),
+	deltaTexHeight(0),
+	deltaTexQuantized(false),
+	vertBufID(0),
+	blendPosBufID(0),
+	blendNorBufID(0),
+	kernelDirty(false)
 {
 }
 
@@ -27,57 +59,83 @@ Shape::~Shape()
 {
 }
 
-void Shape::loadObj(const string &filename, vector<float> &pos, vector<float> &nor, vector<float> &tex, bool loadNor, bool loadTex)
+// One vertex per distinct (position, normal, texcoord) index triple. Keys
+// are compared whole, so no index range is too large to weld.
+struct WeldKey
 {
-	
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn;
-	std::string err;
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str());
-	if(!warn.empty()) {
-		//std::cout << warn << std::endl;
-	}
-	if(!err.empty()) {
-		std::cerr << err << std::endl;
-	}
-	if(!ret) {
+	int v, n, t;
+	bool operator==(const WeldKey &o) const { return v == o.v && n == o.n && t == o.t; }
+};
+
+struct WeldKeyHash
+{
+	size_t operator()(const WeldKey &k) const
+	{
+		uint64_t h = (uint32_t)k.v * 0x9E3779B97F4A7C15ull;
+		h ^= (uint32_t)k.n + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+		h ^= (uint32_t)k.t + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2);
+		return (size_t)h;
+	}
+};
+
+void Shape::loadObj(const string &filename, vector<float> &pos, vector<float> &nor, vector<float> &tex, vector<unsigned int> &ele, bool loadNor, bool loadTex, int parseThreads)
+{
+	ObjData obj;
+	if(!parseObj(filename, obj, parseThreads)) {
 		return;
 	}
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) {
-		// Loop over faces(polygon)
-		size_t index_offset = 0;
-		for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-			int fv = shapes[s].mesh.num_face_vertices[f];
-			// Loop over vertices in the face.
-			for(size_t v = 0; v < fv; v++) {
-				// access to vertex
-				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-				pos.push_back(attrib.vertices[3*idx.vertex_index+0]);
-				pos.push_back(attrib.vertices[3*idx.vertex_index+1]);
-				pos.push_back(attrib.vertices[3*idx.vertex_index+2]);
-				if(!attrib.normals.empty() && loadNor) {
-					nor.push_back(attrib.normals[3*idx.normal_index+0]);
-					nor.push_back(attrib.normals[3*idx.normal_index+1]);
-					nor.push_back(attrib.normals[3*idx.normal_index+2]);
-				}
-				if(!attrib.texcoords.empty() && loadTex) {
-					tex.push_back(attrib.texcoords[2*idx.texcoord_index+0]);
-					tex.push_back(attrib.texcoords[2*idx.texcoord_index+1]);
-				}
-			}
-			index_offset += fv;
+	// Each distinct (position, normal, texcoord) index triple becomes one
+	// vertex, so corners shared by several faces are stored once. Blendshape
+	// OBJs share the base mesh's face list, so ele also maps their corners.
+	unordered_map<WeldKey, unsigned int, WeldKeyHash> welded;
+	size_t corners = obj.indices.size();
+	welded.reserve(corners);
+	ele.reserve(ele.size() + corners);
+	// Faces are triangulated by the parser, so every 3 corners are a triangle
+	for(const tinyobj::index_t &idx : obj.indices) {
+		WeldKey key = {idx.vertex_index, idx.normal_index, idx.texcoord_index};
+		auto it = welded.find(key);
+		if(it != welded.end()) {
+			ele.push_back(it->second);
+			continue;
+		}
+		unsigned int v = (unsigned int)(pos.size() / 3);
+		welded[key] = v;
+		ele.push_back(v);
+		pos.push_back(obj.vertices[3*idx.vertex_index+0]);
+		pos.push_back(obj.vertices[3*idx.vertex_index+1]);
+		pos.push_back(obj.vertices[3*idx.vertex_index+2]);
+		if(!obj.normals.empty() && loadNor) {
+			nor.push_back(obj.normals[3*idx.normal_index+0]);
+			nor.push_back(obj.normals[3*idx.normal_index+1]);
+			nor.push_back(obj.normals[3*idx.normal_index+2]);
+		}
+		if(!obj.texcoords.empty() && loadTex) {
+			tex.push_back(obj.texcoords[2*idx.texcoord_index+0]);
+			tex.push_back(obj.texcoords[2*idx.texcoord_index+1]);
 		}
 	}
+	cout << filename << ": " << corners << " corners welded to " << pos.size() / 3 << " vertices" << endl;
 }
 
-void Shape::loadMesh(const string &meshName)
+void Shape::loadMesh(const string &meshName, int parseThreads)
 {
 	// Load geometry
 	meshFilename = meshName;
-	loadObj(meshFilename, posBuf, norBuf, texBuf);
+	loadObj(meshFilename, posBuf, norBuf, texBuf, eleBuf, true, true, parseThreads);
+
+	// Triangles in vertex cache order, vertices in the order they are first
+	// drawn. The blendshapes still come in OBJ corner order, so keep that
+	// mapping, renumbered, before eleBuf is shuffled.
+	cornerBuf = eleBuf;
+	vector<unsigned int> remap;
+	optimizeMesh(meshFilename, eleBuf, posBuf, remap);
+	remapVertices(posBuf, remap, 3);
+	remapVertices(norBuf, remap, 3);
+	remapVertices(texBuf, remap, 2);
+	for (unsigned int &v : cornerBuf){
+		v = remap[v];
+	}
 }
 
 void Shape::init()
@@ -105,22 +163,293 @@ void Shape::init()
 	glBindBuffer(GL_ARRAY_BUFFER, texBufID);
 	glBufferData(GL_ARRAY_BUFFER, texBuf.size()*sizeof(float), &texBuf[0], GL_STATIC_DRAW);
 	
-	// Send each of the blendshape delta arrays to the GPU
-	for (int i = 0; i < this->blendshapes.size(); i++){
-		shared_ptr<BlendShape> currBs = blendshapes.at(i);
-		
-		glGenBuffers(1, &(currBs->bsPosDeltasID));
-		glBindBuffer(GL_ARRAY_BUFFER, currBs->bsPosDeltasID);
-		glBufferData(GL_ARRAY_BUFFER, currBs->bsPosDeltas.size()*sizeof(float), &(currBs->bsPosDeltas[0]), GL_STATIC_DRAW);
+	// Send the index array to the GPU, in 16 bits if every index fits
+	glGenBuffers(1, &eleBufID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	if(posBuf.size() / 3 <= 0xFFFF) {
+		vector<unsigned short> ele16(eleBuf.begin(), eleBuf.end());
+		eleType = GL_UNSIGNED_SHORT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, ele16.size()*sizeof(unsigned short), ele16.data(), GL_STATIC_DRAW);
+	} else {
+		eleType = GL_UNSIGNED_INT;
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, eleBuf.size()*sizeof(unsigned int), eleBuf.data(), GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	
+	if (!this->blendshapes.empty()){
+		initBlendShapes();
+	}
+	
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+void Shape::initBlendShapes()
+{
+	size_t vertCount = posBuf.size() / 3;
 
-		glGenBuffers(1, &(currBs->bsNorDeltasID));
-		glBindBuffer(GL_ARRAY_BUFFER, currBs->bsNorDeltasID);
-		glBufferData(GL_ARRAY_BUFFER, currBs->bsNorDeltas.size()*sizeof(float), &(currBs->bsNorDeltas[0]), GL_STATIC_DRAW);
+	// Buffers for CPU blending; only the moved vertices change after this
+	glGenBuffers(1, &blendPosBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, blendPosBufID);
+	glBufferData(GL_ARRAY_BUFFER, blendPos.size()*sizeof(float), blendPos.data(), GL_DYNAMIC_DRAW);
+	glGenBuffers(1, &blendNorBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, blendNorBufID);
+	glBufferData(GL_ARRAY_BUFFER, blendNor.size()*sizeof(float), blendNor.data(), GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// GPU blending reads float textures in the vertex shader
+	GLint vertexUnits = 0;
+	glGetIntegerv(GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS, &vertexUnits);
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	size_t texels = 2 * blendshapes.size() * vertCount;
+	int width = DELTA_TEX_WIDTH;
+	int height = (int)((texels + width - 1) / width);
+	if (!(GLEW_VERSION_3_0 || GLEW_ARB_texture_float) || vertexUnits < 1 || height > maxSize){
+		std::cout << meshFilename << ": blending on the CPU only" << std::endl;
+		return;
+	}
+
+	// Quantized targets go up as they are, in a 16-bit signed normalized
+	// texture (GL 3.1); the shader reads q / QUANT_MAX and draw() folds each
+	// target's range into its weight
+	bool quantized = GLEW_VERSION_3_1 != 0;
+	for (const auto &bs : blendshapes){
+		quantized = quantized && bs->quantized;
+	}
+
+	// Pack every target: position delta, normal delta, per vertex. The
+	// shader reads the vertex's texels for every listed target, so the
+	// vertices a target does not move are zeros here.
+	deltaTexWidth = width;
+	deltaTexHeight = height;
+	deltaTexQuantized = quantized;
+	glGenTextures(1, &deltaTexID);
+	glBindTexture(GL_TEXTURE_2D, deltaTexID);
+	if (quantized){
+		std::vector<short> texData(3 * (size_t)width * height, 0);
+		for (size_t t = 0; t < blendshapes.size(); t++){
+			const BlendShape &bs = *blendshapes[t];
+			for (size_t e = 0; e < bs.bsVerts.size(); e++){
+				short *texel = &texData[3 * 2 * (t * vertCount + bs.bsVerts[e])];
+				for (int k = 0; k < 3; k++){
+					texel[k] = bs.bsPosQuant[3*e + k];
+					texel[3 + k] = bs.bsNorQuant.empty() ? 0 : bs.bsNorQuant[3*e + k];
+				}
+			}
+		}
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16_SNORM, width, height, 0, GL_RGB, GL_SHORT, texData.data());
+	} else {
+		std::vector<float> texData(3 * (size_t)width * height, 0.0f);
+		for (size_t t = 0; t < blendshapes.size(); t++){
+			const BlendShape &bs = *blendshapes[t];
+			for (size_t e = 0; e < bs.bsVerts.size(); e++){
+				float *texel = &texData[3 * 2 * (t * vertCount + bs.bsVerts[e])];
+				for (int k = 0; k < 3; k++){
+					texel[k] = bs.getPosDelta(3*e + k);
+					texel[3 + k] = bs.hasNormals() ? bs.getNorDelta(3*e + k) : 0.0f;
+				}
+			}
+		}
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, width, height, 0, GL_RGB, GL_FLOAT, texData.data());
 	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
-	// Unbind the arrays
+	// Vertex indices as floats, exact up to 2^24
+	std::vector<float> vert(vertCount);
+	for (size_t v = 0; v < vertCount; v++){
+		vert[v] = (float)v;
+	}
+	glGenBuffers(1, &vertBufID);
+	glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+	glBufferData(GL_ARRAY_BUFFER, vert.size()*sizeof(float), vert.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	std::cout << meshFilename << ": " << blendshapes.size() << " blendshapes in a " << width << "x" << height
+		<< (quantized ? " 16-bit" : " float") << " delta texture" << std::endl;
+	GLSL::checkError(GET_FILE_LINE);
+}
+
+bool Shape::canBlendOnGPU() const
+{
+	if (blendshapes.empty()){
+		return true;
+	}
+	if (deltaTexID == 0){
+		return false;
+	}
+	int active = 0;
+	for (float w : blendWeights){
+		active += (w != 0.0f);
+	}
+	return active <= MAX_GPU_TARGETS;
+}
+
+void Shape::blendReference()
+{
+	// Back to the base shape, then base + sum of w * delta over the
+	// non-zero weights
+	for (unsigned int v : blendVerts){
+		for (int k = 0; k < 3; k++){
+			blendPos[3*v + k] = posBuf[3*v + k];
+		}
+		for (int k = 0; k < 3 && !norBuf.empty(); k++){
+			blendNor[3*v + k] = norBuf[3*v + k];
+		}
+	}
+	for (size_t t = 0; t < blendshapes.size(); t++){
+		float w = blendWeights[t];
+		if (w == 0.0f){
+			continue;
+		}
+		const BlendShape &bs = *blendshapes[t];
+		for (size_t e = 0; e < bs.bsVerts.size(); e++){
+			unsigned int v = bs.bsVerts[e];
+			for (int k = 0; k < 3; k++){
+				blendPos[3*v + k] += w * bs.getPosDelta(3*e + k);
+			}
+		}
+		for (size_t e = 0; e < bs.bsVerts.size() && bs.hasNormals(); e++){
+			unsigned int v = bs.bsVerts[e];
+			for (int k = 0; k < 3; k++){
+				blendNor[3*v + k] += w * bs.getNorDelta(3*e + k);
+			}
+		}
+	}
+	for (size_t i = 0; i < blendVerts.size() && !norBuf.empty(); i++){
+		unsigned int v = blendVerts[i];
+		vec3 n = normalize(vec3(blendNor[3*v], blendNor[3*v + 1], blendNor[3*v + 2]));
+		blendNor[3*v] = n.x;
+		blendNor[3*v + 1] = n.y;
+		blendNor[3*v + 2] = n.z;
+	}
+}
+
+const BlendKernel &Shape::getKernel()
+{
+	if (kernelDirty){
+		std::vector<BlendKernel::Target> targets;
+		for (const auto &bs : blendshapes){
+			BlendKernel::Target target = {};
+			target.verts = bs->bsVerts.data();
+			target.count = bs->bsVerts.size();
+			if (bs->quantized){
+				target.posQ = bs->bsPosQuant.data();
+				target.norQ = bs->bsNorQuant.empty() ? NULL : bs->bsNorQuant.data();
+				target.posScale = bs->posRange / BlendShape::QUANT_MAX;
+				target.norScale = bs->norRange / BlendShape::QUANT_MAX;
+			} else {
+				target.pos = bs->bsPosDeltas.data();
+				target.nor = bs->bsNorDeltas.empty() ? NULL : bs->bsNorDeltas.data();
+			}
+			targets.push_back(target);
+		}
+		kernel.setup(posBuf.data(), norBuf.empty() ? NULL : norBuf.data(), posBuf.size() / 3, targets);
+		kernelDirty = false;
+	}
+	return kernel;
+}
+
+void Shape::blendRange(size_t begin, size_t end)
+{
+	// A streamed region still holds the frame from REGIONS frames ago, so
+	// it gets every vertex; blendPos already has the base shape wherever no
+	// target reaches
+	bool streamed = (streamPos != NULL);
+	float *pos = streamed ? streamPos : blendPos.data();
+	float *nor = streamed ? streamNor : (blendNor.empty() ? NULL : blendNor.data());
+	kernel.blendRange(blendWeights.data(), pos, nor, begin, end, streamed);
+}
+
+void Shape::submitBlend(ThreadPool *pool, std::vector< std::future<void> > &jobs)
+{
+	getKernel();
+	size_t blockCount = kernel.getBlockCount();
+	if (!pool){
+		blendRange(0, blockCount);
+		return;
+	}
+	for (size_t begin = 0; begin < blockCount; begin += BLEND_CHUNK){
+		size_t end = std::min(begin + BLEND_CHUNK, blockCount);
+		jobs.push_back(pool->submit([this, begin, end] { blendRange(begin, end); }, true));
+	}
+}
+
+void Shape::blendCPU(ThreadPool *pool)
+{
+	std::vector< std::future<void> > jobs;
+	submitBlend(pool, jobs);
+	for (auto &job : jobs){
+		job.get();
+	}
+}
+
+void Shape::updateBlends(const std::vector< std::shared_ptr<Shape> > &shapes, ThreadPool *pool)
+{
+	// Every shape's jobs go in before the wait, so the threads are shared
+	// across all of them
+	std::vector< std::future<void> > jobs;
+	for (const auto &shape : shapes){
+		shape->streamPos = shape->streamNor = NULL;
+		if (shape->blendMode == CPU_BLENDING && !shape->blendshapes.empty()){
+			shape->map();
+			shape->submitBlend(pool, jobs);
+		}
+	}
+	for (auto &job : jobs){
+		job.get();
+	}
+	for (const auto &shape : shapes){
+		if (shape->blendMode == CPU_BLENDING && !shape->blendshapes.empty()){
+			shape->uploadBlend();
+		}
+	}
+}
+
+bool Shape::setStreaming(bool on)
+{
+	stream.reset();
+	streamPos = streamNor = NULL;
+	// Only shapes with blendshapes rewrite their vertices
+	if (on && StreamBuffer::isSupported() && !blendshapes.empty()){
+		stream = std::make_shared<StreamBuffer>();
+		if (!stream->init(posBuf.size()*sizeof(float) + norBuf.size()*sizeof(float))){
+			stream.reset();
+		}
+	}
+	return stream != NULL;
+}
+
+void Shape::map()
+{
+	streamPos = streamNor = NULL;
+	if (!stream){
+		return;
+	}
+	streamPos = (float *)stream->acquire();
+	streamNor = norBuf.empty() ? NULL : streamPos + posBuf.size();
+}
+
+void Shape::uploadBlend()
+{
+	// Streamed vertices were written straight into the mapped buffer
+	if (streamPos || blendVerts.empty()){
+		return;
+	}
+
+	// Only the span of vertices that can have changed
+	size_t first = 3 * blendVerts.front();
+	size_t count = 3 * (blendVerts.back() + 1) - first;
+	glBindBuffer(GL_ARRAY_BUFFER, blendPosBufID);
+	glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(float), count*sizeof(float), &blendPos[first]);
+	if (!blendNor.empty()){
+		glBindBuffer(GL_ARRAY_BUFFER, blendNorBufID);
+		glBufferSubData(GL_ARRAY_BUFFER, first*sizeof(float), count*sizeof(float), &blendNor[first]);
+	}
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	
 	GLSL::checkError(GET_FILE_LINE);
 }
 
@@ -128,33 +457,56 @@ void Shape::draw() const
 {
 	assert(prog);
 
-	if (!(this->blendshapes.empty())){
-		for (int i = 0; i < blendshapes.size(); i++){
-			shared_ptr<BlendShape> curr = blendshapes.at(i);
-			int bs_pos = prog->getAttribute("blendshape" + std::to_string(i + 1) + "Pos");
-			
-			glEnableVertexAttribArray(bs_pos);
-			glBindBuffer(GL_ARRAY_BUFFER, curr->bsPosDeltasID);
-			glVertexAttribPointer(bs_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-
-			int bs_nor = prog->getAttribute("blendshape" + std::to_string(i + 1) + "Nor");
-			glEnableVertexAttribArray(bs_nor);
-			glBindBuffer(GL_ARRAY_BUFFER, curr->bsNorDeltasID);
-			glVertexAttribPointer(bs_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
-
-			GLSL::checkError(GET_FILE_LINE);
+	// The targets with non-zero weight, for the vertex shader
+	GLfloat targets[MAX_GPU_TARGETS];
+	GLfloat weights[MAX_GPU_TARGETS];
+	GLfloat norWeights[MAX_GPU_TARGETS];
+	int targetCount = 0;
+	if (blendMode == GPU_BLENDING && deltaTexID != 0){
+		for (size_t t = 0; t < blendWeights.size() && targetCount < MAX_GPU_TARGETS; t++){
+			if (blendWeights[t] != 0.0f){
+				// A 16-bit texture holds the deltas divided by their range
+				const BlendShape &bs = *blendshapes[t];
+				targets[targetCount] = (float)t;
+				weights[targetCount] = blendWeights[t] * (deltaTexQuantized ? bs.posRange : 1.0f);
+				norWeights[targetCount] = blendWeights[t] * (deltaTexQuantized ? bs.norRange : 1.0f);
+				targetCount++;
+			}
 		}
 	}
+	glUniform1i(prog->getUniform("bsCount"), targetCount);
+	int h_vert = prog->getAttribute("aVert");
+	if (targetCount > 0){
+		glUniform1fv(prog->getUniform("bsTarget"), targetCount, targets);
+		glUniform1fv(prog->getUniform("bsWeight"), targetCount, weights);
+		glUniform1fv(prog->getUniform("bsNorWeight"), targetCount, norWeights);
+		glUniform2f(prog->getUniform("bsTexSize"), (float)deltaTexWidth, (float)deltaTexHeight);
+		glUniform1f(prog->getUniform("bsVertCount"), (float)(posBuf.size() / 3));
+		glActiveTexture(GL_TEXTURE0 + DELTA_UNIT);
+		glBindTexture(GL_TEXTURE_2D, deltaTexID);
+		glUniform1i(prog->getUniform("bsTex"), DELTA_UNIT);
+
+		glEnableVertexAttribArray(h_vert);
+		glBindBuffer(GL_ARRAY_BUFFER, vertBufID);
+		glVertexAttribPointer(h_vert, 1, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	}
+
+	// Already blended with CPU blending, maybe into this frame's region of
+	// the streaming buffer
+	bool cpu = (blendMode == CPU_BLENDING && !blendshapes.empty());
+	bool streamed = cpu && streamPos;
+	size_t posOffset = streamed ? stream->getOffset() : 0;
+	size_t norOffset = streamed ? posOffset + posBuf.size()*sizeof(float) : 0;
 
 	int h_pos = prog->getAttribute("aPos");
 	glEnableVertexAttribArray(h_pos);
-	glBindBuffer(GL_ARRAY_BUFFER, posBufID);
-	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	glBindBuffer(GL_ARRAY_BUFFER, streamed ? stream->getID() : (cpu ? blendPosBufID : posBufID));
+	glVertexAttribPointer(h_pos, 3, GL_FLOAT, GL_FALSE, 0, (const void *)posOffset);
 
 	int h_nor = prog->getAttribute("aNor");
 	glEnableVertexAttribArray(h_nor);
-	glBindBuffer(GL_ARRAY_BUFFER, norBufID);
-	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)0);
+	glBindBuffer(GL_ARRAY_BUFFER, streamed ? stream->getID() : (cpu ? blendNorBufID : norBufID));
+	glVertexAttribPointer(h_nor, 3, GL_FLOAT, GL_FALSE, 0, (const void *)norOffset);
 
 	int h_tex = prog->getAttribute("aTex");
 	glEnableVertexAttribArray(h_tex);
@@ -162,12 +514,21 @@ void Shape::draw() const
 	glVertexAttribPointer(h_tex, 2, GL_FLOAT, GL_FALSE, 0, (const void *)0);
 
 	// Draw
-	int count = (int)posBuf.size()/3; // number of indices to be rendered
-	glDrawArrays(GL_TRIANGLES, 0, count);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, eleBufID);
+	glDrawElements(GL_TRIANGLES, (GLsizei)eleBuf.size(), eleType, (const void *)0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	if (streamed){
+		// The region can be rewritten once these draws are done
+		stream->release();
+	}
 	
 	glDisableVertexAttribArray(h_tex);
 	glDisableVertexAttribArray(h_nor);
 	glDisableVertexAttribArray(h_pos);
+	if (targetCount > 0){
+		glDisableVertexAttribArray(h_vert);
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
 
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
@@ -176,85 +537,141 @@ void Shape::draw() const
 
 // new functions: 
 void Shape::addBlendShape(std::string filename, std::vector<float>& objPos, std::vector<float>& objNor, int actionNo){
-	if (objPos.size() != this->posBuf.size()){
-		std::cout << "The # of the blendshape's positions and the mesh's vertices does not match. " << objPos.size() << " != " << this->posBuf.size() << std::endl;
+	// objPos and objNor have a value per face corner; cornerBuf gives each
+	// corner's welded vertex
+	if (objPos.size() != 3 * this->cornerBuf.size()){
+		std::cout << "The # of the blendshape's positions and the mesh's face corners does not match. " << objPos.size() / 3 << " != " << this->cornerBuf.size() << std::endl;
+		return;
 	}
 
-	if (objNor.size() != this->norBuf.size()){
-		std::cout << "The # of the blendshape's normals and the mesh's normals does not match. " << objPos.size() << " != " << this->posBuf.size() << std::endl;
+	if (objNor.size() != 3 * this->cornerBuf.size() && !this->norBuf.empty()){
+		std::cout << "The # of the blendshape's normals and the mesh's face corners does not match. " << objNor.size() / 3 << " != " << this->cornerBuf.size() << std::endl;
+		return;
 	}
 
 	// Assuming the topology is the same, we can go ahead and create the delta vectors:
 	std::shared_ptr<BlendShape> bs = std::make_shared<BlendShape>();
 	bs->bsName = filename;
 	bs->actionNo = actionNo;
-	bs->bsNorDeltas.clear();
-	bs->bsPosDeltas.clear();
+	std::vector<float> posDeltas(this->posBuf.size(), 0.0f);
+	std::vector<float> norDeltas(this->norBuf.size(), 0.0f);
 
-	// Create the delta positions:
-	for (int i = 0; i < objPos.size(); i = (i + 3)){
-		float deltaX = objPos.at(i) - this->posBuf.at(i);
-		float deltaY = objPos.at(i + 1) - this->posBuf.at(i + 1);
-		float deltaZ = objPos.at(i + 2) - this->posBuf.at(i + 2);
+	// Create the delta positions and normals. Corners welded into one
+	// vertex carry the same values, so writing them repeatedly is harmless.
+	for (size_t c = 0; c < this->cornerBuf.size(); c++){
+		size_t v = this->cornerBuf[c];
+		for (int k = 0; k < 3; k++){
+			posDeltas[3*v + k] = objPos[3*c + k] - this->posBuf[3*v + k];
+		}
+		for (int k = 0; k < 3 && !this->norBuf.empty(); k++){
+			norDeltas[3*v + k] = objNor[3*c + k] - this->norBuf[3*v + k];
+		}
+	}
 
-		bs->bsPosDeltas.push_back(deltaX);
-		bs->bsPosDeltas.push_back(deltaY);
-		bs->bsPosDeltas.push_back(deltaZ);
+	// Keep the vertices that move by more than the epsilon
+	size_t vertCount = this->posBuf.size() / 3;
+	for (size_t v = 0; v < vertCount; v++){
+		bool moved = false;
+		for (int k = 0; k < 3; k++){
+			moved = moved || std::abs(posDeltas[3*v + k]) > this->deltaEpsilon;
+			moved = moved || (!norDeltas.empty() && std::abs(norDeltas[3*v + k]) > this->deltaEpsilon);
+		}
+		if (!moved){
+			continue;
+		}
+		bs->bsVerts.push_back((unsigned int)v);
+		bs->bsPosDeltas.insert(bs->bsPosDeltas.end(), &posDeltas[3*v], &posDeltas[3*v] + 3);
+		if (!norDeltas.empty()){
+			bs->bsNorDeltas.insert(bs->bsNorDeltas.end(), &norDeltas[3*v], &norDeltas[3*v] + 3);
+		}
+	}
+	bs->denseBytes = (posDeltas.size() + norDeltas.size()) * sizeof(float);
+	if (this->quantizeDeltas){
+		bs->quantize();
+	}
+	std::cout << filename << ": " << bs->bsVerts.size() << " of " << vertCount << " vertices moved ("
+		<< 100.0 * bs->bsVerts.size() / std::max<size_t>(vertCount, 1) << "%), "
+		<< bs->getBytes() / 1024 << " KB instead of " << bs->denseBytes / 1024 << " KB" << std::endl;
+	if (bs->quantized){
+		std::cout << filename << ": 16-bit deltas, max error " << bs->quantError.posMax << " (position), "
+			<< bs->quantError.norMax << " (normal)" << std::endl;
 	}
 
-	// Create the delta normals:
-	for (int i = 0; i < objNor.size(); i = (i + 3)){
-		float deltaX = objPos.at(i) - this->posBuf.at(i);
-		float deltaY = objPos.at(i + 1) - this->posBuf.at(i + 1);
-		float deltaZ = objPos.at(i + 2) - this->posBuf.at(i + 2);
+	this->blendshapes.push_back(bs);
+	this->blendWeights.resize(this->blendshapes.size(), 0.0f);
 
-		bs->bsNorDeltas.push_back(deltaX);
-		bs->bsNorDeltas.push_back(deltaY);
-		bs->bsNorDeltas.push_back(deltaZ);
+	// CPU blending starts from the base shape and redoes the vertices any
+	// target moves
+	if (this->blendPos.empty()){
+		this->blendPos = this->posBuf;
+		this->blendNor = this->norBuf;
 	}
+	std::vector<unsigned int> verts;
+	std::set_union(this->blendVerts.begin(), this->blendVerts.end(), bs->bsVerts.begin(), bs->bsVerts.end(), std::back_inserter(verts));
+	this->blendVerts.swap(verts);
+	this->kernelDirty = true;
+}
 
-	this->blendshapes.push_back(bs);
+void BlendShape::quantize()
+{
+	if (quantized){
+		return;
+	}
+	// The largest component maps to QUANT_MAX, so the step is range / QUANT_MAX
+	// and no value is off by more than half of that
+	auto range = [](const vector<float> &d){
+		float r = 0.0f;
+		for (float x : d){
+			r = max(r, std::abs(x));
+		}
+		return r > 0.0f ? r : 1.0f;
+	};
+	auto toShorts = [](const vector<float> &d, float r, vector<short> &q, float &maxErr, float &rmsErr){
+		q.resize(d.size());
+		double sum = 0.0;
+		maxErr = 0.0f;
+		for (size_t i = 0; i < d.size(); i++){
+			float x = d[i] / r * QUANT_MAX;
+			q[i] = (short)std::lround(std::min(std::max(x, (float)-QUANT_MAX), (float)QUANT_MAX));
+			float err = std::abs(q[i] * (r / QUANT_MAX) - d[i]);
+			maxErr = max(maxErr, err);
+			sum += (double)err * err;
+		}
+		rmsErr = d.empty() ? 0.0f : (float)sqrt(sum / d.size());
+	};
+	posRange = range(bsPosDeltas);
+	norRange = range(bsNorDeltas);
+	toShorts(bsPosDeltas, posRange, bsPosQuant, quantError.posMax, quantError.posRms);
+	toShorts(bsNorDeltas, norRange, bsNorQuant, quantError.norMax, quantError.norRms);
+	vector<float>().swap(bsPosDeltas);
+	vector<float>().swap(bsNorDeltas);
+	quantized = true;
+}
+
+size_t BlendShape::getBytes() const
+{
+	return bsVerts.size() * sizeof(unsigned int) + (bsPosDeltas.size() + bsNorDeltas.size()) * sizeof(float)
+		+ (bsPosQuant.size() + bsNorQuant.size()) * sizeof(short);
 }
 
 // A function that will load blendshape obj files. WILL NOT CREATE DELTAS, that is done when added to a Shape object
-void loadBlendShapeObj(const string &filename, vector<float> &pos, vector<float> &nor)
+void loadBlendShapeObj(const string &filename, vector<float> &pos, vector<float> &nor, int parseThreads)
 {
-	tinyobj::attrib_t attrib;
-	std::vector<tinyobj::shape_t> shapes;
-	std::vector<tinyobj::material_t> materials;
-	std::string warn;
-	std::string err;
 	std::cout << "Loading blendshape: " << filename << std::endl;
-	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str());
-	if(!warn.empty()) {
-		//std::cout << warn << std::endl;
-	}
-	if(!err.empty()) {
-		std::cerr << err << std::endl;
-	}
-	if(!ret) {
+	ObjData obj;
+	if(!parseObj(filename, obj, parseThreads)) {
 		return;
 	}
-	// Loop over shapes
-	for (size_t s = 0; s < shapes.size(); s++) {
-		// Loop over faces(polygon)
-		size_t index_offset = 0;
-		for(size_t f = 0; f < shapes[s].mesh.num_face_vertices.size(); f++) {
-			int fv = shapes[s].mesh.num_face_vertices[f];
-			// Loop over vertices in the face.
-			for(size_t v = 0; v < fv; v++) {
-				// access to vertex
-				tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
-				pos.push_back(attrib.vertices[3*idx.vertex_index+0]);
-				pos.push_back(attrib.vertices[3*idx.vertex_index+1]);
-				pos.push_back(attrib.vertices[3*idx.vertex_index+2]);
-				if(!attrib.normals.empty()) {
-					nor.push_back(attrib.normals[3*idx.normal_index+0]);
-					nor.push_back(attrib.normals[3*idx.normal_index+1]);
-					nor.push_back(attrib.normals[3*idx.normal_index+2]);
-				}
-			}
-			index_offset += fv;
+	// One position and normal per face corner
+	pos.reserve(pos.size() + 3 * obj.indices.size());
+	for(const tinyobj::index_t &idx : obj.indices) {
+		pos.push_back(obj.vertices[3*idx.vertex_index+0]);
+		pos.push_back(obj.vertices[3*idx.vertex_index+1]);
+		pos.push_back(obj.vertices[3*idx.vertex_index+2]);
+		if(!obj.normals.empty()) {
+			nor.push_back(obj.normals[3*idx.normal_index+0]);
+			nor.push_back(obj.normals[3*idx.normal_index+1]);
+			nor.push_back(obj.normals[3*idx.normal_index+2]);
 		}
 	}
 }
\ No newline at end of file
@@ -2,14 +2,19 @@
 #ifndef SHAPE_H
 #define SHAPE_H
 
+#include <future>
 #include <memory>
 #include <vector>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
 
+#include "BlendKernel.h"
+
 class MatrixStack;
 class Program;
+class ThreadPool;
+class StreamBuffer;
 
 struct Emotion{
 	std::string emotionName;
@@ -20,20 +25,59 @@ struct BlendShape{
 	std::string bsName;
 	int actionNo;
 
-	GLuint bsPosDeltasID = 0;
-	GLuint bsNorDeltasID = 0;
-
-	std::vector<float> bsPosDeltas; // Blend shape position deltas
-	std::vector<float> bsNorDeltas; // Blend shape normal deltas
+	// Sparse: only the vertices the target moves, in increasing order, with
+	// 3 values per entry in each delta array
+	std::vector<unsigned int> bsVerts;
+	std::vector<float> bsPosDeltas; // Blend shape position deltas, empty once quantized
+	std::vector<float> bsNorDeltas; // Blend shape normal deltas, empty without normals
+	size_t denseBytes = 0; // what dense deltas for every vertex would take
+
+	// Quantized (see quantize()): delta = q / QUANT_MAX * range, with one
+	// range per target for positions and one for normals
+	static const int QUANT_MAX = 32767;
+	bool quantized = false;
+	std::vector<short> bsPosQuant;
+	std::vector<short> bsNorQuant;
+	float posRange = 1.0f;
+	float norRange = 1.0f;
+	// How far the quantized deltas are from the float ones, per component
+	struct QuantizationError
+	{
+		float posMax = 0.0f;
+		float posRms = 0.0f;
+		float norMax = 0.0f;
+		float norRms = 0.0f;
+	};
+	QuantizationError quantError;
+
+	// Replaces the float deltas with 16-bit ones
+	void quantize();
+	// Component i of the position/normal deltas, whichever way they are stored
+	float getPosDelta(size_t i) const { return quantized ? bsPosQuant[i] * (posRange / QUANT_MAX) : bsPosDeltas[i]; }
+	float getNorDelta(size_t i) const { return quantized ? bsNorQuant[i] * (norRange / QUANT_MAX) : bsNorDeltas[i]; }
+	bool hasNormals() const { return quantized ? !bsNorQuant.empty() : !bsNorDeltas.empty(); }
+	size_t getBytes() const;
 };
 
 class Shape
 {
 public:
+	enum BlendMode
+	{
+		CPU_BLENDING, // Blend here, re-upload positions and normals every frame
+		GPU_BLENDING  // Every target's deltas in one texture, blended in the vertex shader
+	};
+	// Must match MAX_TARGETS in phong_vert.glsl
+	static const int MAX_GPU_TARGETS = 64;
+
 	Shape();
 	virtual ~Shape();
-	void loadObj(const std::string &filename, std::vector<float> &pos, std::vector<float> &nor, std::vector<float> &tex, bool loadNor = true, bool loadTex = true);
-	void loadMesh(const std::string &meshName);
+	// Welds face corners with the same position, normal and texcoord indices
+	// into one vertex; ele gets 3 vertex indices per triangle. parseThreads
+	// goes to parseObj(); pass 1 when already on a loader thread.
+	void loadObj(const std::string &filename, std::vector<float> &pos, std::vector<float> &nor, std::vector<float> &tex, std::vector<unsigned int> &ele, bool loadNor = true, bool loadTex = true, int parseThreads = 0);
+	// Loads and optimizes the mesh; no GL calls until init()
+	void loadMesh(const std::string &meshName, int parseThreads = 0);
 	void setProgram(std::shared_ptr<Program> p) { prog = p; }
 	virtual void init();
 	virtual void draw() const;
@@ -42,15 +86,38 @@ public:
 
 	std::vector<std::shared_ptr<BlendShape>> blendshapes; // A vector containing the deltas for all blendshapes affecting this shape
 	void addBlendShape(std::string filename, std::vector<float>& objPos, std::vector<float>& objNor, int actionNo);
-	
-	void saveBufs(){ // Saves the position buffer to a temp variable
-		this->originalPos = this->posBuf;
-		this->originalNor = this->norBuf;
-	} 
-	void restoreBufs(){ // restores the position buffer from the saved variable
-		this->posBuf = this->originalPos;
-		this->norBuf = this->originalNor;
-	}
+	// A vertex goes into a target if a component of its position or normal
+	// delta is over this; set before adding the blendshapes
+	void setDeltaEpsilon(float e) { deltaEpsilon = e; }
+	// Stores the deltas as 16-bit integers with a scale per target, in
+	// memory and in the GPU delta texture; set before adding the blendshapes
+	void setDeltaQuantization(bool on) { quantizeDeltas = on; }
+	// One per blendshape; targets with weight 0 cost nothing in either mode
+	std::vector<float> blendWeights;
+	void setBlendMode(BlendMode m) { blendMode = m; }
+	BlendMode getBlendMode() const { return blendMode; }
+	// Needs vertex shader texture reads of float textures, and no more than
+	// MAX_GPU_TARGETS non-zero weights
+	bool canBlendOnGPU() const;
+	// Blends every CPU_BLENDING shape with its current weights, splitting
+	// the vertex blocks over pool's threads (or on this thread without a
+	// pool), and uploads the results; call before draw()
+	static void updateBlends(const std::vector< std::shared_ptr<Shape> > &shapes, ThreadPool *pool);
+	// The CPU blend without the upload, into getBlendPos()/getBlendNor().
+	// Only rewrites the blocks of vertices some target moves.
+	void blendCPU(ThreadPool *pool = NULL);
+	// The same one vertex at a time, for checking blendCPU()
+	void blendReference();
+	const std::vector<float> &getBlendPos() const { return blendPos; }
+	const std::vector<float> &getBlendNor() const { return blendNor; }
+	// CPU blending into a persistently mapped ring (see StreamBuffer)
+	// instead of glBufferSubData. GL thread only; false if unsupported.
+	bool setStreaming(bool on);
+	bool isStreaming() const { return stream != NULL; }
+	void setBlendISA(BlendKernel::ISA isa) { kernel.setISA(isa); }
+	BlendKernel::ISA getBlendISA() const { return kernel.getISA(); }
+	// Sets up the kernel if blendshapes were added since
+	const BlendKernel &getKernel();
 
 	std::vector<float> posBuf;
 	std::vector<float> norBuf;
@@ -64,20 +131,52 @@ public:
 	std::string getMeshFilename(){ return this-> meshFilename; }
 
 protected:
+	void initBlendShapes();
+	void map(); // This frame's streaming region, if CPU blending is streamed
+	void blendRange(size_t begin, size_t end); // Kernel blocks [begin, end)
+	// Every block, as urgent jobs on pool if there is one, added to jobs
+	void submitBlend(ThreadPool *pool, std::vector< std::future<void> > &jobs);
+	void uploadBlend();
+
 	std::string meshFilename;
 	std::string textureFilename;
 	std::shared_ptr<Program> prog;
 	std::vector<float> texBuf;
-
-	std::vector<float> originalPos; // used to save the posBuf for CPU rendering
-	std::vector<float> originalNor; // used to save the norBuf for CPU rendering
+	std::vector<unsigned int> eleBuf; // 3 indices per triangle, in vertex cache order
+	std::vector<unsigned int> cornerBuf; // OBJ face corner -> vertex, for the blendshapes
 
 	GLuint posBufID;
 	GLuint norBufID;
 	GLuint texBufID;
+	GLuint eleBufID;
+	GLenum eleType; // GL_UNSIGNED_SHORT when every index fits, else GL_UNSIGNED_INT
+
+	BlendMode blendMode;
+	float deltaEpsilon;
+	bool quantizeDeltas;
+	// Every vertex some target moves, in increasing order
+	std::vector<unsigned int> blendVerts;
+	// Texel 2 * (target * vertex count + vertex) holds the position delta,
+	// the next one the normal delta
+	GLuint deltaTexID;
+	int deltaTexWidth;
+	int deltaTexHeight;
+	bool deltaTexQuantized; // GL_RGB16_SNORM holding the 16-bit deltas, else GL_RGB32F
+	GLuint vertBufID; // aVert: each vertex's index, to find its texels
+	// CPU blending results
+	std::vector<float> blendPos;
+	std::vector<float> blendNor;
+	GLuint blendPosBufID;
+	GLuint blendNorBufID;
+	BlendKernel kernel;
+	bool kernelDirty; // blendshapes added since the kernel was set up
+	// Streaming: where blending writes this frame, NULL for blendPos/blendNor
+	std::shared_ptr<StreamBuffer> stream;
+	float *streamPos = NULL;
+	float *streamNor = NULL;
 };
 
-void loadBlendShapeObj(const std::string &filename, std::vector<float> &pos, std::vector<float> &nor);
+void loadBlendShapeObj(const std::string &filename, std::vector<float> &pos, std::vector<float> &nor, int parseThreads = 0);
 
 
 #endif
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <chrono>
+
+#include "StreamBuffer.h"
+#include "GLSL.h"
+
+using namespace std;
+
+StreamBuffer::StreamBuffer() :
+	bufID(0),
+	mapped(NULL),
+	regionBytes(0),
+	current(0),
+	waitMs(0.0)
+{
+	for(int i = 0; i < REGIONS; i++) {
+		fences[i] = 0;
+	}
+}
+
+StreamBuffer::~StreamBuffer()
+{
+	for(int i = 0; i < REGIONS; i++) {
+		if(fences[i]) {
+			glDeleteSync(fences[i]);
+		}
+	}
+	if(bufID) {
+		glBindBuffer(GL_ARRAY_BUFFER, bufID);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDeleteBuffers(1, &bufID);
+	}
+}
+
+bool StreamBuffer::isSupported()
+{
+	return GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+}
+
+bool StreamBuffer::init(size_t regionBytes)
+{
+	if(!isSupported()) {
+		return false;
+	}
+	// Keep every region on its own cache lines
+	this->regionBytes = (regionBytes + 255) & ~(size_t)255;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &bufID);
+	glBindBuffer(GL_ARRAY_BUFFER, bufID);
+	glBufferStorage(GL_ARRAY_BUFFER, REGIONS * this->regionBytes, NULL, flags);
+	mapped = (char *)glMapBufferRange(GL_ARRAY_BUFFER, 0, REGIONS * this->regionBytes, flags);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	if(!mapped) {
+		cerr << "Could not map streaming buffer" << endl;
+		glDeleteBuffers(1, &bufID);
+		bufID = 0;
+		return false;
+	}
+	current = REGIONS - 1;
+	GLSL::checkError(GET_FILE_LINE);
+	return true;
+}
+
+void *StreamBuffer::acquire()
+{
+	current = (current + 1) % REGIONS;
+	waitMs = 0.0;
+	if(fences[current]) {
+		auto t0 = chrono::high_resolution_clock::now();
+		// The first wait flushes, so the fence is sure to be reached
+		GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+		for(;;) {
+			GLenum r = glClientWaitSync(fences[current], flags, 1000000);
+			if(r == GL_ALREADY_SIGNALED || r == GL_CONDITION_SATISFIED || r == GL_WAIT_FAILED) {
+				break;
+			}
+			flags = 0;
+		}
+		waitMs = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - t0).count();
+		glDeleteSync(fences[current]);
+		fences[current] = 0;
+	}
+	return mapped + getOffset();
+}
+
+void StreamBuffer::release()
+{
+	if(fences[current]) {
+		glDeleteSync(fences[current]);
+	}
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <iostream>
+#include <mutex>
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -11,6 +12,9 @@ using namespace std;
 
 Texture::Texture() :
 	filename(""),
+	width(0),
+	height(0),
+	ncomps(0),
 	tid(0)
 {
 	
@@ -23,14 +27,23 @@ Texture::~Texture()
 
 void Texture::init()
 {
+	decode();
+	upload();
+}
+
+void Texture::decode()
+{
+	// The flag is global in stb_image, so set it once rather than per thread
+	static once_flag flip;
+	call_once(flip, []() { stbi_set_flip_vertically_on_load(true); });
 	// Load texture
-	int w, h, ncomps;
-	stbi_set_flip_vertically_on_load(true);
-	unsigned char *data = stbi_load(filename.c_str(), &w, &h, &ncomps, 0);
+	int w, h, n;
+	unsigned char *data = stbi_load(filename.c_str(), &w, &h, &n, 0);
 	if(!data) {
 		cerr << filename << " not found" << endl;
+		w = h = n = 0;
 	}
-	if(ncomps != 3 && ncomps != 4) {
+	if(n != 3 && n != 4) {
 		cerr << filename << " must have 3 or 4 components (RGB/RGBA)" << endl;
 	}
 	if((w & (w - 1)) != 0 || (h & (h - 1)) != 0) {
@@ -38,7 +51,25 @@ void Texture::init()
 	}
 	width = w;
 	height = h;
-	
+	ncomps = n;
+	if(data) {
+		pixels.assign(data, data + (size_t)w * h * n);
+		// Free image, since the data is now in pixels
+		stbi_image_free(data);
+	}
+}
+
+void Texture::initColor(unsigned char r, unsigned char g, unsigned char b)
+{
+	width = 1;
+	height = 1;
+	ncomps = 3;
+	pixels = {r, g, b};
+	upload();
+}
+
+void Texture::upload()
+{
 	// Generate a texture buffer object
 	glGenTextures(1, &tid);
 	// Bind the current texture to be the newly generated texture object
@@ -49,7 +80,10 @@ void Texture::init()
 	if(ncomps == 4) {
 		format = GL_RGBA;
 	}
-	glTexImage2D(GL_TEXTURE_2D, 0, ncomps, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+	// Rows of 3 bytes are not 4-aligned for odd widths
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glTexImage2D(GL_TEXTURE_2D, 0, ncomps, width, height, 0, format, GL_UNSIGNED_BYTE, pixels.empty() ? NULL : pixels.data());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 	// Generate image pyramid
 	glGenerateMipmap(GL_TEXTURE_2D);
 	// Set texture wrap modes for the S and T directions
@@ -60,8 +94,8 @@ void Texture::init()
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	// Unbind
 	glBindTexture(GL_TEXTURE_2D, 0);
-	// Free image, since the data is now on the GPU
-	stbi_image_free(data);
+	// Free the pixels, since the data is now on the GPU
+	vector<unsigned char>().swap(pixels);
 	
 	GLSL::checkError(GET_FILE_LINE);
 }
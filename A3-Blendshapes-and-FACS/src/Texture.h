@@ -6,6 +6,7 @@
 #include <GL/glew.h>
 
 #include <string>
+#include <vector>
 
 class Texture
 {
@@ -13,7 +14,15 @@ public:
 	Texture();
 	virtual ~Texture();
 	void setFilename(const std::string &f) { filename = f; }
-	void init();
+	const std::string &getFilename() const { return filename; }
+	void init(); // decode() then upload()
+	// decode() reads the file into memory and makes no GL calls, so it can
+	// run on a loader thread; upload() then needs the context thread
+	void decode();
+	void upload();
+	// A 1x1 texture, e.g. to draw with until the file is in
+	void initColor(unsigned char r, unsigned char g, unsigned char b);
+	bool isUploaded() const { return tid != 0; }
 	void setUnit(GLint u) { unit = u; }
 	GLint getUnit() const { return unit; }
 	void bind(GLint handle);
@@ -24,6 +33,8 @@ private:
 	std::string filename;
 	int width;
 	int height;
+	int ncomps;
+	std::vector<unsigned char> pixels; // between decode() and upload()
 	GLuint tid;
 	GLint unit;
 	
@@ -0,0 +1,56 @@
+#include "ThreadPool.h"
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threadCount) :
+	quit(false)
+{
+	if(threadCount <= 0) {
+		threadCount = max(1, (int)thread::hardware_concurrency());
+	}
+	for(int i = 0; i < threadCount; i++) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this));
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for(auto &w : workers) {
+		w.join();
+	}
+}
+
+void ThreadPool::push(function<void()> job, bool urgent)
+{
+	{
+		lock_guard<std::mutex> lock(mutex);
+		if(urgent) {
+			jobs.push_front(move(job));
+		} else {
+			jobs.push_back(move(job));
+		}
+	}
+	wake.notify_one();
+}
+
+void ThreadPool::workerLoop()
+{
+	while(true) {
+		function<void()> job;
+		{
+			unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [this] { return quit || !jobs.empty(); });
+			if(jobs.empty()) {
+				return;
+			}
+			job = move(jobs.front());
+			jobs.pop_front();
+		}
+		job();
+	}
+}
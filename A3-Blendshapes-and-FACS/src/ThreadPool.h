@@ -0,0 +1,60 @@
+#pragma once
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+
+/**
+ * Worker threads taking jobs from one FIFO queue: asset loading in the
+ * background and the per-frame CPU blending. submit() returns a future for
+ * the job's result (or the exception it threw); normal jobs start in the
+ * order they were submitted, so whatever gates the first frame should be
+ * submitted first. Urgent jobs, which a frame is waiting on, go ahead of
+ * everything queued. The caller never runs jobs itself, so it is free for
+ * GL work while they run.
+ *
+ * A normal job may block on the future of a normal job submitted before it:
+ * that job has already been taken by a worker by then, so it cannot be stuck
+ * behind it. Urgent jobs must not wait on any future, since the job they
+ * wait for may still be queued behind them while they hold every worker.
+ */
+class ThreadPool
+{
+public:
+	// threadCount <= 0 uses every hardware thread
+	ThreadPool(int threadCount = 0);
+	// Finishes the jobs already queued, then joins the workers
+	virtual ~ThreadPool();
+
+	template <typename F>
+	std::future<typename std::invoke_result<F>::type> submit(F f, bool urgent = false)
+	{
+		typedef typename std::invoke_result<F>::type R;
+		// packaged_task is move-only and std::function needs a copyable target
+		auto task = std::make_shared< std::packaged_task<R()> >(std::move(f));
+		std::future<R> result = task->get_future();
+		push([task]() { (*task)(); }, urgent);
+		return result;
+	}
+	int getThreadCount() const { return (int)workers.size(); }
+
+private:
+	void push(std::function<void()> job, bool urgent);
+	void workerLoop();
+
+	std::vector<std::thread> workers;
+	std::deque< std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool quit;
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <fstream>
 #include <vector>
 #include <memory>
+#include <future>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
@@ -19,6 +20,13 @@
 #include "MatrixStack.h"
 #include "Shape.h"
 #include "Texture.h"
+#include "Profiler.h"
+#include "Bench.h"
+#include "ThreadPool.h"
+#include "LoadTimeline.h"
+#include "StreamBuffer.h"
+#include "FacsClip.h"
+#include "FacsAnimator.h"
 
 using namespace std;
 
@@ -39,7 +47,9 @@ public:
 	vector<string> textureData;
 	vector< vector<string> > meshData;
 	
-	Emotion e;
+	vector<Emotion> emotions;
+	string timelineFile; // TIMELINE, empty without one
+	bool quantizeDeltas = false; // QUANTIZE
 
 	vector<shared_ptr<blendShapeObjInfo>> bsObjInfo;
 };
@@ -56,6 +66,39 @@ vector< shared_ptr<Shape> > shapes;
 map< string, shared_ptr<Texture> > textureMap;
 shared_ptr<Program> prog = NULL;
 double t, t0;
+// Stage timings ('t'), written to profile.csv while on
+shared_ptr<Profiler> profiler = NULL;
+int stageBlend, stageDraw;
+shared_ptr<ThreadPool> threadPool = NULL; // asset loading, then CPU blending
+
+// FACS playback. With a TIMELINE, every shape with blendshapes is a face of
+// the animator; without one, the EMOTION's action units follow abs(sin t).
+struct FacsFace
+{
+	shared_ptr<Shape> shape;
+	int face;
+	vector<int> slots; // animator weight slot per blendshape, -1 if not animated
+};
+vector<int> facsActions; // the action units whose blendshapes are loaded
+shared_ptr<FacsAnimator> facsAnimator = NULL;
+vector<FacsFace> facsFaces;
+
+// Asset loading. Files are read and decoded on the pool, GL uploads happen
+// on this thread. Geometry is in before the first frame; textures show up
+// as they finish, drawn with a placeholder until then.
+struct PendingTexture
+{
+	shared_ptr<Texture> texture;
+	future<void> decoded;
+	int step;
+};
+shared_ptr<LoadTimeline> loadTimeline = NULL;
+vector<PendingTexture> pendingTextures;
+shared_ptr<Texture> placeholderTexture = NULL;
+vector<int> firstFrameDeps; // the steps the first frame needs
+int firstFrameStep = -1;
+bool firstFrameDone = false; // the first frame's step has ended
+const int TEXTURE_UNIT = 1; // kdTex
 
 static void error_callback(int error, const char *description)
 {
@@ -73,6 +116,29 @@ static void char_callback(GLFWwindow *window, unsigned int key)
 {
 	keyToggles[key] = !keyToggles[key];
 	switch(key) {
+		case 't':
+			// Unthrottled while timing
+			glfwSwapInterval(keyToggles[key] ? 0 : 1);
+			profiler->setEnabled(keyToggles[key]);
+			if(keyToggles[key]) {
+				profiler->openCSV("profile.csv");
+			} else {
+				profiler->closeCSV();
+			}
+			break;
+		case 'g':
+			cout << "Blendshapes: " << (keyToggles[key] ? "GPU" : "CPU") << endl;
+			break;
+		case 'p': {
+			// Persistent-mapped streaming of CPU blending on/off
+			// (glBufferSubData when off)
+			bool streaming = false;
+			for(const auto &shape : shapes) {
+				streaming = shape->setStreaming(!shape->isStreaming()) || streaming;
+			}
+			cout << "Vertex streaming: " << (streaming ? "persistent mapped" : "glBufferSubData") << endl;
+			break;
+		}
 	}
 }
 
@@ -100,86 +166,185 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	}
 }
 
+// Which blendshapes to load: the timeline's action units, or the EMOTION's
+static void initFacs()
+{
+	if(!dataInput.timelineFile.empty()) {
+		FacsClip clip;
+		if(!clip.load(DATA_DIR + dataInput.timelineFile, dataInput.emotions)) {
+			exit(1);
+		}
+		facsAnimator = make_shared<FacsAnimator>();
+		facsAnimator->addClip(clip);
+		facsActions = clip.getActionNumbers();
+		return;
+	}
+	// Without a timeline there is nothing to say when each emotion shows
+	if(dataInput.emotions.size() > 1) {
+		std::cout << "There is more than 1 EMOTION line and no TIMELINE in " << DATA_DIR << "input.txt" << std::endl;
+		exit(1);
+	}
+	if(!dataInput.emotions.empty()) {
+		facsActions = dataInput.emotions[0].actionNumbers;
+	}
+}
+
 void init()
 {
 	keyToggles[(unsigned)'c'] = true;
+	keyToggles[(unsigned)'g'] = true;
 	
 	camera = make_shared<Camera>();
+	profiler = make_shared<Profiler>();
+	stageBlend = profiler->addStage("blendshapes");
+	stageDraw = profiler->addStage("draw", true);
+	profiler->setGPUTiming(true);
+	threadPool = make_shared<ThreadPool>();
+	initFacs();
 	
-	// Create shapes
+	loadTimeline = make_shared<LoadTimeline>();
+	LoadTimeline *timeline = loadTimeline.get();
+	cout << "Loading on " << threadPool->getThreadCount() << " threads" << endl;
+
+	// Queue the jobs, geometry first since the first frame waits for it,
+	// each mesh followed by its blendshapes since it is uploaded with them.
+	// Each file is one job, so parse it on one thread.
+	vector< future< shared_ptr<Shape> > > meshJobs;
+	vector<int> meshSteps;
+	vector< future<void> > bsJobs(dataInput.bsObjInfo.size());
+	vector<int> bsSteps(dataInput.bsObjInfo.size(), -1);
 	for(const auto &mesh : dataInput.meshData) {
-		auto shape = make_shared<Shape>();
-		shapes.push_back(shape);
-		shape->loadMesh(DATA_DIR + mesh[0]);
-		shape->setTextureFilename(mesh[1]);
-
-		// Add the blendshape if the base file name matches:
-		for (int i = 0; i < dataInput.bsObjInfo.size(); i++){
+		int step = timeline->add("load " + mesh[0]);
+		meshSteps.push_back(step);
+		meshJobs.push_back(threadPool->submit([mesh, step, timeline]() {
+			LoadScope scope(timeline, step);
+			auto shape = make_shared<Shape>();
+			shape->loadMesh(DATA_DIR + mesh[0], 1);
+			shape->setTextureFilename(mesh[1]);
+			return shape;
+		}));
+
+		for (size_t i = 0; i < dataInput.bsObjInfo.size(); i++){
 			shared_ptr<blendShapeObjInfo> curr = dataInput.bsObjInfo.at(i);
 
-			// Check if the current blendshape's action number is present in the selected emotion
-			if (std::find(dataInput.e.actionNumbers.begin(), dataInput.e.actionNumbers.end(), curr->actionNo) == dataInput.e.actionNumbers.end()){
-				// If it is not found in the emotion's actionNo vector, then continue
+			// Check if the current blendshape's action number is animated
+			if (std::find(facsActions.begin(), facsActions.end(), curr->actionNo) == facsActions.end()){
+				// If it is not found in the animated action numbers, then continue
 				continue;
 			}
 
 			if ((DATA_DIR + mesh[0]) == curr->baseShapefileName){
-				loadBlendShapeObj(curr->blendShapefileName, curr->objPos, curr->objNor);
-				shape->addBlendShape(curr->blendShapefileName, curr->objPos, curr->objNor, curr->actionNo);
+				int bsStep = timeline->add("load " + curr->blendShapefileName.substr(DATA_DIR.size()));
+				bsSteps[i] = bsStep;
+				bsJobs[i] = threadPool->submit([curr, bsStep, timeline]() {
+					LoadScope scope(timeline, bsStep);
+					loadBlendShapeObj(curr->blendShapefileName, curr->objPos, curr->objNor, 1);
+				});
 			}
 		}
 	}
-	
-	// GLSL programs
-	prog = make_shared<Program>();
-	prog->setShaderNames(RESOURCE_DIR + "phong_vert.glsl", RESOURCE_DIR + "phong_frag.glsl");
-	prog->setVerbose(true);
-	
-	// Set background color
-	glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
-	// Enable z-buffer test
-	glEnable(GL_DEPTH_TEST);
-	// Enable alpha blending
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	
-	for(auto shape : shapes) {
-		shape->init();
-	}
-	
-	prog->init();
-	prog->addAttribute("aPos");
-	prog->addAttribute("aNor");
-	prog->addAttribute("aTex");
-	prog->addUniform("P");
-	prog->addUniform("MV");
-	prog->addUniform("ka");
-	prog->addUniform("ks");
-	prog->addUniform("s");
-	prog->addUniform("kdTex");
-
-
-	string currWeightStr = "wA";
-	for (int i = 0; i < 3; i++){
-		prog->addAttribute("blendshape" + std::to_string(i + 1) + "Pos");
-		prog->addAttribute("blendshape" + std::to_string(i + 1) + "Nor");
-		prog->addUniform(currWeightStr);
-		currWeightStr.at(1) = currWeightStr.at(1) + 1;
-	}
-	
-	// Bind the texture to unit 1.
-	int unit = 1;
-	prog->bind();
-	glUniform1i(prog->getUniform("kdTex"), unit);
-	prog->unbind();
-	
 	for(const auto &filename : dataInput.textureData) {
 		auto textureKd = make_shared<Texture>();
 		textureMap[filename] = textureKd;
 		textureKd->setFilename(DATA_DIR + filename);
-		textureKd->init();
-		textureKd->setUnit(unit); // Bind to unit 1
-		textureKd->setWrapModes(GL_REPEAT, GL_REPEAT);
+		int step = timeline->add("decode " + filename);
+		PendingTexture pending;
+		pending.texture = textureKd;
+		pending.step = step;
+		pending.decoded = threadPool->submit([textureKd, step, timeline]() {
+			LoadScope scope(timeline, step);
+			textureKd->decode();
+		});
+		pendingTextures.push_back(move(pending));
+	}
+
+	// Meanwhile, the shaders and GL state on this thread
+	int shaderStep = timeline->add("compile shaders");
+	firstFrameDeps.push_back(shaderStep);
+	{
+		LoadScope scope(timeline, shaderStep);
+		// GLSL programs
+		prog = make_shared<Program>();
+		prog->setShaderNames(RESOURCE_DIR + "phong_vert.glsl", RESOURCE_DIR + "phong_frag.glsl");
+		prog->setVerbose(true);
+		
+		// Set background color
+		glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+		// Enable z-buffer test
+		glEnable(GL_DEPTH_TEST);
+		// Enable alpha blending
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		
+		prog->init();
+		prog->addAttribute("aPos");
+		prog->addAttribute("aNor");
+		prog->addAttribute("aTex");
+		prog->addUniform("P");
+		prog->addUniform("MV");
+		prog->addUniform("ka");
+		prog->addUniform("ks");
+		prog->addUniform("s");
+		prog->addUniform("kdTex");
+
+		// Blendshapes
+		prog->addAttribute("aVert");
+		prog->addUniform("bsTex");
+		prog->addUniform("bsTexSize");
+		prog->addUniform("bsVertCount");
+		prog->addUniform("bsCount");
+		prog->addUniform("bsTarget");
+		prog->addUniform("bsWeight");
+		prog->addUniform("bsNorWeight");
+		
+		// Bind the texture to unit 1.
+		prog->bind();
+		glUniform1i(prog->getUniform("kdTex"), TEXTURE_UNIT);
+		prog->unbind();
+
+		placeholderTexture = make_shared<Texture>();
+		placeholderTexture->initColor(128, 128, 128);
+		placeholderTexture->setUnit(TEXTURE_UNIT);
+	}
+
+	// Create shapes, in input order, as their files come in
+	for(size_t m = 0; m < meshJobs.size(); m++) {
+		auto shape = meshJobs[m].get();
+		vector<int> deps(1, meshSteps[m]);
+		for (size_t i = 0; i < dataInput.bsObjInfo.size(); i++){
+			if (bsSteps[i] >= 0 && shape->getMeshFilename() == dataInput.bsObjInfo.at(i)->baseShapefileName){
+				bsJobs[i].wait();
+				deps.push_back(bsSteps[i]);
+			}
+		}
+		int step = timeline->add("upload " + dataInput.meshData[m][0], deps);
+		firstFrameDeps.push_back(step);
+		LoadScope scope(timeline, step);
+
+		// Add the blendshape if the base file name matches:
+		shape->setDeltaQuantization(dataInput.quantizeDeltas);
+		for (size_t i = 0; i < dataInput.bsObjInfo.size(); i++){
+			shared_ptr<blendShapeObjInfo> curr = dataInput.bsObjInfo.at(i);
+			if (bsSteps[i] >= 0 && shape->getMeshFilename() == curr->baseShapefileName){
+				shape->addBlendShape(curr->blendShapefileName, curr->objPos, curr->objNor, curr->actionNo);
+			}
+		}
+		shape->init();
+		shape->setStreaming(true);
+		shapes.push_back(shape);
+
+		if (facsAnimator && !shape->blendshapes.empty()){
+			FacsFace f;
+			f.shape = shape;
+			f.face = facsAnimator->addFace(0);
+			for (const auto &bs : shape->blendshapes){
+				f.slots.push_back(facsAnimator->getSlot(bs->actionNo));
+			}
+			facsFaces.push_back(f);
+		}
+	}
+	if(!StreamBuffer::isSupported()) {
+		cout << "No GL_ARB_buffer_storage, CPU blending uploads with glBufferSubData" << endl;
 	}
 	
 	// Initialize time.
@@ -188,8 +353,42 @@ void init()
 	GLSL::checkError(GET_FILE_LINE);
 }
 
+// Once the first frame is up and every texture is in
+static void finishLoading()
+{
+	if(!loadTimeline || !pendingTextures.empty() || !firstFrameDone) {
+		return;
+	}
+	loadTimeline->print(cout, firstFrameStep);
+	cout << "Textures done at " << loadTimeline->now() << " ms" << endl;
+	loadTimeline = NULL;
+}
+
+// Uploads the textures decoded so far
+static void uploadTextures()
+{
+	for(auto it = pendingTextures.begin(); it != pendingTextures.end(); ) {
+		if(it->decoded.wait_for(chrono::seconds(0)) != future_status::ready) {
+			++it;
+			continue;
+		}
+		int step = loadTimeline->add("upload " + it->texture->getFilename().substr(DATA_DIR.size()), vector<int>(1, it->step));
+		{
+			LoadScope scope(loadTimeline.get(), step);
+			it->decoded.get();
+			it->texture->upload();
+			it->texture->setUnit(TEXTURE_UNIT); // Bind to unit 1
+			it->texture->setWrapModes(GL_REPEAT, GL_REPEAT);
+		}
+		it = pendingTextures.erase(it);
+		finishLoading();
+	}
+}
+
 void render()
 {
+	uploadTextures();
+
 	// Update time.
 	double t1 = glfwGetTime();
 	float dt = (t1 - t0);
@@ -233,12 +432,44 @@ void render()
 	MV->pushMatrix();
 	MV->translate(0.0, -18.5, 0.0);
 	
+	// Blendshapes: in the vertex shader unless 'g' is off or too many
+	// weights are set, else on the CPU threads, all shapes at once
+	{
+		ProfileScope scope(profiler.get(), stageBlend);
+		if(facsAnimator) {
+			// Every face's weights at once, then each blendshape's action unit
+			facsAnimator->evaluate(t);
+			for(const auto &f : facsFaces) {
+				const float *weights = facsAnimator->getWeights(f.face);
+				for (size_t i = 0; i < f.slots.size(); i++){
+					f.shape->blendWeights[i] = f.slots[i] >= 0 ? weights[f.slots[i]] : 0.0f;
+				}
+			}
+		} else {
+			float currWeight = abs(sin(t));
+			for(const auto &shape : shapes) {
+				for (float &w : shape->blendWeights){
+					w = currWeight;
+				}
+			}
+		}
+		for(const auto &shape : shapes) {
+			bool gpu = keyToggles[(unsigned)'g'] && shape->canBlendOnGPU();
+			shape->setBlendMode(gpu ? Shape::GPU_BLENDING : Shape::CPU_BLENDING);
+		}
+		Shape::updateBlends(shapes, threadPool.get());
+	}
+
 	// Draw shapes
 	prog->bind();
 
 	for(const auto &shape : shapes) {
 		MV->pushMatrix();
-		textureMap[shape->getTextureFilename()]->bind(prog->getUniform("kdTex"));
+		auto texture = textureMap[shape->getTextureFilename()];
+		if(!texture->isUploaded()) {
+			texture = placeholderTexture;
+		}
+		texture->bind(prog->getUniform("kdTex"));
 		glLineWidth(1.0f); // for wireframe
 
 		// The following translation points were computed by finding the midpoint of the bounding box of the vertices making up the eye
@@ -260,27 +491,12 @@ void render()
 		glUniform3f(prog->getUniform("ks"), 0.1f, 0.1f, 0.1f);
 		glUniform1f(prog->getUniform("s"), 200.0f);
 
-		if (!shape->blendshapes.empty()){
-			string currWeightStr = "wA";
-			for (int i = 0; i < shape->blendshapes.size(); i++){
-				GLint currWeightID = prog->getUniform(currWeightStr);
-
-				float currWeight = abs(sin(t));
-				glUniform1f(currWeightID, currWeight);
-
-				currWeightStr.at(1) = currWeightStr.at(1) + 1;
-			}
-		}else{
-			string currWeightStr = "wA";
-			for (int i = 0; i < 3; i++){
-				glUniform1f(prog->getUniform(currWeightStr), 0.0);
-				currWeightStr.at(1) = currWeightStr.at(1) + 1;
-			}
-		}
-		
 		shape->setProgram(prog);
 
-		shape->draw();
+		{
+			ProfileScope scope(profiler.get(), stageDraw);
+			shape->draw();
+		}
 
 		MV->popMatrix();
 	}
@@ -293,6 +509,8 @@ void render()
 	MV->popMatrix();
 	P->popMatrix();
 
+	profiler->draw(width, height);
+
 	GLSL::checkError(GET_FILE_LINE);
 }
 
@@ -349,22 +567,24 @@ void loadDataInputFile()
 			dataInput.bsObjInfo.push_back(o);
 		
 		}else if(key.compare("EMOTION") == 0){
-			
-			// Check if there has already been an emotion loaded:
-			if (!dataInput.e.emotionName.empty()){
-				std::cout << "There is more than 1 EMOTION line in " << filename << std::endl;
-				in.close();
-				exit(1);
-			}
-
 			// The format for this line is EMOTION NAME ACTION#_1 ... ACTION#_N
-			ss >> dataInput.e.emotionName;
+			Emotion e;
+			ss >> e.emotionName;
 
 			while (!ss.eof()){
 				ss >> value;
 				// value contains the ACTION#
-				dataInput.e.actionNumbers.push_back(std::stoi(value));
+				e.actionNumbers.push_back(std::stoi(value));
 			}
+			dataInput.emotions.push_back(e);
+
+		}else if(key.compare("TIMELINE") == 0){
+			// TIMELINE FILE: keyed action unit curves and emotion fades (see FacsClip.h)
+			ss >> dataInput.timelineFile;
+
+		}else if(key.compare("QUANTIZE") == 0){
+			// QUANTIZE: 16-bit blendshape deltas
+			dataInput.quantizeDeltas = true;
 
 		}else {
 			cout << "Unkown key word: " << key << endl;
@@ -377,12 +597,26 @@ void loadDataInputFile()
 int main(int argc, char **argv)
 {
 	if(argc < 3) {
-		cout << "Usage: A3 <SHADER DIR> <DATA DIR>" << endl;
+		cout << "Usage: A3 <SHADER DIR> <DATA DIR> [--bench <name> [args...]]" << endl;
 		return 0;
 	}
 	RESOURCE_DIR = argv[1] + string("/");
 	DATA_DIR = argv[2] + string("/");
 	loadDataInputFile();
+
+	// Headless benchmarks: no window needed
+	if(argc >= 5 && string(argv[3]) == "--bench") {
+		vector<string> meshFiles;
+		for(const auto &mesh : dataInput.meshData) {
+			meshFiles.push_back(DATA_DIR + mesh[0]);
+		}
+		vector< pair<string, string> > deltaFiles;
+		for(const auto &bs : dataInput.bsObjInfo) {
+			deltaFiles.push_back(make_pair(bs->baseShapefileName, bs->blendShapefileName));
+		}
+		vector<string> args(argv + 5, argv + argc);
+		return runBenchmark(argv[4], args, meshFiles, deltaFiles) ? 0 : -1;
+	}
 	
 	// Set error callback.
 	glfwSetErrorCallback(error_callback);
@@ -422,10 +656,24 @@ int main(int argc, char **argv)
 	// Loop until the user closes the window.
 	while(!glfwWindowShouldClose(window)) {
 		if(!glfwGetWindowAttrib(window, GLFW_ICONIFIED)) {
+			bool firstFrame = loadTimeline && firstFrameStep < 0;
+			if(firstFrame) {
+				firstFrameStep = loadTimeline->add("first frame", firstFrameDeps);
+				loadTimeline->begin(firstFrameStep);
+			}
 			// Render scene.
 			render();
 			// Swap front and back buffers.
 			glfwSwapBuffers(window);
+			if(firstFrame) {
+				loadTimeline->end(firstFrameStep);
+				firstFrameDone = true;
+				finishLoading();
+			}
+			profiler->endFrame();
+			if(profiler->isEnabled() && profiler->getFrameCount() > 0 && profiler->getFrameCount() % Profiler::HISTORY == 0) {
+				profiler->print(cout);
+			}
 		}
 		// Poll for and process events.
 		glfwPollEvents();
@@ -23,6 +23,7 @@
 #include "Shape.h"
 #include "Texture.h"
 #include "Link.h"
+#include "Profiler.h"
 
 #include "ObjectiveRosenbrock.h"
 #include "ObjectiveLink.h"
@@ -49,6 +50,11 @@ shared_ptr<Texture> texture;
 
 vector<shared_ptr<Link> > links;
 
+// Stage timings ('t'), written to profile.csv while on. Only created with a
+// window; the scopes do nothing without it.
+shared_ptr<Profiler> profiler;
+int stageIK, stageDraw;
+
 class IK
 {
 public:
@@ -215,6 +221,8 @@ static string runIK()
 	// const Vector3d &weights = ik.weights;
 	const Vector2d &target = ik.target;
 	
+	ProfileScope scope(profiler.get(), stageIK);
+
 	// Extract angles
 	VectorXd x(n);
 	for(int i = 0; i < n; ++i) {
@@ -389,6 +397,16 @@ static void char_callback(GLFWwindow *window, unsigned int key)
 				}
 			}
 			break;
+		case 't':
+			// Unthrottled while timing
+			glfwSwapInterval(keyToggles[key] ? 0 : 1);
+			profiler->setEnabled(keyToggles[key]);
+			if(keyToggles[key]) {
+				profiler->openCSV("profile.csv");
+			} else {
+				profiler->closeCSV();
+			}
+			break;
 	}
 }
 
@@ -458,6 +476,11 @@ static void init()
 	shape->setProgram(progTex);
 	shape->init();
 	
+	profiler = make_shared<Profiler>();
+	stageIK = profiler->addStage("ik");
+	stageDraw = profiler->addStage("draw", true);
+	profiler->setGPUTiming(true);
+	
 	// Initialize time.
 	glfwSetTime(0.0);
 	
@@ -536,6 +559,7 @@ void render()
 	glUniformMatrix4fv(progTex->getUniform("P"), 1, GL_FALSE, glm::value_ptr(P->topMatrix()));
 	MV->pushMatrix();
 	if(!links.empty()) {
+		ProfileScope scope(profiler.get(), stageDraw);
 		links.front()->draw(progTex, MV, shape);
 	}
 	MV->popMatrix();
@@ -546,6 +570,8 @@ void render()
 	MV->popMatrix();
 	P->popMatrix();
 	
+	profiler->draw(width, height);
+	
 	GLSL::checkError(GET_FILE_LINE);
 }
 
@@ -620,6 +646,10 @@ int main(int argc, char **argv)
 				render();
 				// Swap front and back buffers.
 				glfwSwapBuffers(window);
+				profiler->endFrame();
+				if(profiler->isEnabled() && profiler->getFrameCount() > 0 && profiler->getFrameCount() % Profiler::HISTORY == 0) {
+					profiler->print(cout);
+				}
 			}
 			// Poll for and process events.
 			glfwPollEvents();